@@ -16,6 +16,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <sys/param.h>
 
 #include "esp_log.h"
 
@@ -42,6 +43,16 @@
                                         } while(0);
 #endif
 
+// Initial number of buckets of the loop base_index and id_index, doubles as nodes are added
+#define EVENT_INDEX_MIN_SIZE            8
+
+// Lists of handlers matching an event are executed in the order of the position of their loop or base node.
+// Within a base node, base level handlers are executed before the event level handlers.
+#define HANDLERS_KEY(position, level)   (((int64_t) (position) << 2) | (level))
+#define HANDLERS_LEVEL_LOOP             0
+#define HANDLERS_LEVEL_BASE             1
+#define HANDLERS_LEVEL_ID               2
+
 /* ------------------------- Static Variables ------------------------------- */
 
 static const char* TAG = "event";
@@ -104,6 +115,119 @@ static int esp_event_dump_prepare(void)
 }
 #endif
 
+static inline size_t event_index_hash(esp_event_base_t base, int32_t id, size_t index_size)
+{
+    uint32_t hash = ((uint32_t) (uintptr_t) base ^ ((uint32_t) id * 0x9E3779B1)) * 0x85EBCA6B;
+    return (hash ^ (hash >> 15)) & (index_size - 1);
+}
+
+static void base_index_add(esp_event_loop_instance_t* loop, esp_event_base_node_t* base_node)
+{
+    if (loop->base_count >= loop->base_index_size) {
+        size_t size = loop->base_index_size * 2;
+        esp_event_base_nodes_t* index = calloc(size, sizeof(*index));
+        // If there is no memory, keep the current index, it only gets slower
+        if (index) {
+            for (size_t i = 0; i < loop->base_index_size; i++) {
+                while (!SLIST_EMPTY(&(loop->base_index[i]))) {
+                    esp_event_base_node_t* it = SLIST_FIRST(&(loop->base_index[i]));
+                    SLIST_REMOVE_HEAD(&(loop->base_index[i]), index_next);
+                    SLIST_INSERT_HEAD(&(index[event_index_hash(it->base, ESP_EVENT_ANY_ID, size)]), it, index_next);
+                }
+            }
+            free(loop->base_index);
+            loop->base_index = index;
+            loop->base_index_size = size;
+        }
+    }
+    size_t bucket = event_index_hash(base_node->base, ESP_EVENT_ANY_ID, loop->base_index_size);
+    SLIST_INSERT_HEAD(&(loop->base_index[bucket]), base_node, index_next);
+    loop->base_count++;
+}
+
+static void base_index_remove(esp_event_loop_instance_t* loop, esp_event_base_node_t* base_node)
+{
+    size_t bucket = event_index_hash(base_node->base, ESP_EVENT_ANY_ID, loop->base_index_size);
+    SLIST_REMOVE(&(loop->base_index[bucket]), base_node, esp_event_base_node, index_next);
+    loop->base_count--;
+}
+
+static void id_index_add(esp_event_loop_instance_t* loop, esp_event_id_node_t* id_node)
+{
+    if (loop->id_count >= loop->id_index_size) {
+        size_t size = loop->id_index_size * 2;
+        esp_event_id_nodes_t* index = calloc(size, sizeof(*index));
+        // If there is no memory, keep the current index, it only gets slower
+        if (index) {
+            for (size_t i = 0; i < loop->id_index_size; i++) {
+                while (!SLIST_EMPTY(&(loop->id_index[i]))) {
+                    esp_event_id_node_t* it = SLIST_FIRST(&(loop->id_index[i]));
+                    SLIST_REMOVE_HEAD(&(loop->id_index[i]), index_next);
+                    SLIST_INSERT_HEAD(&(index[event_index_hash(it->base_node->base, it->id, size)]), it, index_next);
+                }
+            }
+            free(loop->id_index);
+            loop->id_index = index;
+            loop->id_index_size = size;
+        }
+    }
+    size_t bucket = event_index_hash(id_node->base_node->base, id_node->id, loop->id_index_size);
+    SLIST_INSERT_HEAD(&(loop->id_index[bucket]), id_node, index_next);
+    loop->id_count++;
+}
+
+static void id_index_remove(esp_event_loop_instance_t* loop, esp_event_id_node_t* id_node)
+{
+    size_t bucket = event_index_hash(id_node->base_node->base, id_node->id, loop->id_index_size);
+    SLIST_REMOVE(&(loop->id_index[bucket]), id_node, esp_event_id_node, index_next);
+    loop->id_count--;
+}
+
+/* Finds the next list of handlers to execute for an event, the one with the smallest key after *key.
+ * Only nodes with a key below 'end' are considered. Returns NULL if there are no more handlers.
+ * As handlers may unregister other handlers, this is done again after executing each list.
+ */
+static esp_event_handler_nodes_t* find_next_handlers(esp_event_loop_instance_t* loop, esp_event_base_t base,
+        int32_t id, int64_t* key, int64_t end)
+{
+    esp_event_handler_nodes_t* result = NULL;
+    int64_t result_key = end;
+
+    esp_event_loop_node_t* loop_node;
+    SLIST_FOREACH(loop_node, &(loop->loop_nodes), next) {
+        int64_t it_key = HANDLERS_KEY(loop_node->position, HANDLERS_LEVEL_LOOP);
+        if (it_key > *key && !SLIST_EMPTY(&(loop_node->handlers))) {
+            // loop nodes are sorted by position
+            if (it_key < result_key) {
+                result = &(loop_node->handlers);
+                result_key = it_key;
+            }
+            break;
+        }
+    }
+
+    esp_event_base_node_t* base_node;
+    SLIST_FOREACH(base_node, &(loop->base_index[event_index_hash(base, ESP_EVENT_ANY_ID, loop->base_index_size)]), index_next) {
+        int64_t it_key = HANDLERS_KEY(base_node->position, HANDLERS_LEVEL_BASE);
+        if (base_node->base == base && it_key > *key && it_key < result_key && !SLIST_EMPTY(&(base_node->handlers))) {
+            result = &(base_node->handlers);
+            result_key = it_key;
+        }
+    }
+
+    esp_event_id_node_t* id_node;
+    SLIST_FOREACH(id_node, &(loop->id_index[event_index_hash(base, id, loop->id_index_size)]), index_next) {
+        int64_t it_key = HANDLERS_KEY(id_node->base_node->position, HANDLERS_LEVEL_ID);
+        if (id_node->id == id && id_node->base_node->base == base && it_key > *key && it_key < result_key) {
+            result = &(id_node->handlers);
+            result_key = it_key;
+        }
+    }
+
+    *key = result_key;
+    return result;
+}
+
 static void esp_event_loop_run_task(void* args)
 {
     esp_err_t err;
@@ -131,7 +255,6 @@ static void handler_execute(esp_event_loop_instance_t* loop, esp_event_handler_n
     start = esp_timer_get_time();
 #endif
     // Execute the handler
-#if CONFIG_ESP_EVENT_POST_FROM_ISR
     void* data_ptr = NULL;
 
     if (post.data_set) {
@@ -143,9 +266,6 @@ static void handler_execute(esp_event_loop_instance_t* loop, esp_event_handler_n
     }
 
     (*(handler->handler_ctx->handler))(handler->handler_ctx->arg, post.base, post.id, data_ptr);
-#else
-    (*(handler->handler_ctx->handler))(handler->handler_ctx->arg, post.base, post.id, post.data);
-#endif
 
 #ifdef CONFIG_ESP_EVENT_LOOP_PROFILING
     diff = esp_timer_get_time() - start;
@@ -207,7 +327,8 @@ static esp_err_t handler_instances_add(esp_event_handler_nodes_t* handlers, esp_
     return ESP_OK;
 }
 
-static esp_err_t base_node_add_handler(esp_event_base_node_t* base_node,
+static esp_err_t base_node_add_handler(esp_event_loop_instance_t* loop,
+        esp_event_base_node_t* base_node,
         int32_t id,
         esp_event_handler_t event_handler,
         void *event_handler_arg,
@@ -237,6 +358,7 @@ static esp_err_t base_node_add_handler(esp_event_base_node_t* base_node,
             }
 
             id_node->id = id;
+            id_node->base_node = base_node;
 
             SLIST_INIT(&(id_node->handlers));
 
@@ -249,6 +371,7 @@ static esp_err_t base_node_add_handler(esp_event_base_node_t* base_node,
                 else {
                     SLIST_INSERT_AFTER(last_id_node, id_node, next);
                 }
+                id_index_add(loop, id_node);
             } else {
                 free(id_node);
             }
@@ -261,7 +384,8 @@ static esp_err_t base_node_add_handler(esp_event_base_node_t* base_node,
     }
 }
 
-static esp_err_t loop_node_add_handler(esp_event_loop_node_t* loop_node,
+static esp_err_t loop_node_add_handler(esp_event_loop_instance_t* loop,
+        esp_event_loop_node_t* loop_node,
         esp_event_base_t base,
         int32_t id,
         esp_event_handler_t event_handler,
@@ -295,11 +419,12 @@ static esp_err_t loop_node_add_handler(esp_event_loop_node_t* loop_node,
             }
 
             base_node->base = base;
+            base_node->position = loop->next_position++;
 
             SLIST_INIT(&(base_node->handlers));
             SLIST_INIT(&(base_node->id_nodes));
 
-            err = base_node_add_handler(base_node, id, event_handler, event_handler_arg, handler_ctx, legacy);
+            err = base_node_add_handler(loop, base_node, id, event_handler, event_handler_arg, handler_ctx, legacy);
 
             if (err == ESP_OK) {
                 if (!last_base_node) {
@@ -308,13 +433,14 @@ static esp_err_t loop_node_add_handler(esp_event_loop_node_t* loop_node,
                 else {
                     SLIST_INSERT_AFTER(last_base_node, base_node, next);
                 }
+                base_index_add(loop, base_node);
             } else {
                 free(base_node);
             }
 
             return err;
         } else {
-            return base_node_add_handler(base_node, id, event_handler, event_handler_arg, handler_ctx, legacy);
+            return base_node_add_handler(loop, base_node, id, event_handler, event_handler_arg, handler_ctx, legacy);
         }
     }
 }
@@ -345,7 +471,7 @@ static esp_err_t handler_instances_remove(esp_event_handler_nodes_t* handlers, e
 }
 
 
-static esp_err_t base_node_remove_handler(esp_event_base_node_t* base_node, int32_t id, esp_event_handler_instance_context_t* handler_ctx, bool legacy)
+static esp_err_t base_node_remove_handler(esp_event_loop_instance_t* loop, esp_event_base_node_t* base_node, int32_t id, esp_event_handler_instance_context_t* handler_ctx, bool legacy)
 {
     if (id == ESP_EVENT_ANY_ID) {
         return handler_instances_remove(&(base_node->handlers), handler_ctx, legacy);
@@ -359,6 +485,7 @@ static esp_err_t base_node_remove_handler(esp_event_base_node_t* base_node, int3
                 if (res == ESP_OK) {
                     if (SLIST_EMPTY(&(it->handlers))) {
                         SLIST_REMOVE(&(base_node->id_nodes), it, esp_event_id_node, next);
+                        id_index_remove(loop, it);
                         free(it);
                         return ESP_OK;
                     }
@@ -370,7 +497,7 @@ static esp_err_t base_node_remove_handler(esp_event_base_node_t* base_node, int3
     return ESP_ERR_NOT_FOUND;
 }
 
-static esp_err_t loop_node_remove_handler(esp_event_loop_node_t* loop_node, esp_event_base_t base, int32_t id, esp_event_handler_instance_context_t* handler_ctx, bool legacy)
+static esp_err_t loop_node_remove_handler(esp_event_loop_instance_t* loop, esp_event_loop_node_t* loop_node, esp_event_base_t base, int32_t id, esp_event_handler_instance_context_t* handler_ctx, bool legacy)
 {
     if (base == esp_event_any_base && id == ESP_EVENT_ANY_ID) {
         return handler_instances_remove(&(loop_node->handlers), handler_ctx, legacy);
@@ -379,11 +506,12 @@ static esp_err_t loop_node_remove_handler(esp_event_loop_node_t* loop_node, esp_
         esp_event_base_node_t *it, *temp;
         SLIST_FOREACH_SAFE(it, &(loop_node->base_nodes), next, temp) {
             if (it->base == base) {
-                esp_err_t res = base_node_remove_handler(it, id, handler_ctx, legacy);
+                esp_err_t res = base_node_remove_handler(loop, it, id, handler_ctx, legacy);
 
                 if (res == ESP_OK) {
                     if (SLIST_EMPTY(&(it->handlers)) && SLIST_EMPTY(&(it->id_nodes))) {
                         SLIST_REMOVE(&(loop_node->base_nodes), it, esp_event_base_node, next);
+                        base_index_remove(loop, it);
                         free(it);
                         return ESP_OK;
                     }
@@ -429,17 +557,41 @@ static void loop_node_remove_all_handler(esp_event_loop_node_t* loop_node)
     }
 }
 
-static void inline __attribute__((always_inline)) post_instance_delete(esp_event_post_instance_t* post)
+static void* data_pool_alloc(esp_event_loop_instance_t* loop)
 {
-#if CONFIG_ESP_EVENT_POST_FROM_ISR
-    if (post->data_allocated && post->data.ptr) {
-        free(post->data.ptr);
+    portENTER_CRITICAL(&(loop->data_pool_lock));
+    void* buffer = loop->data_pool_free;
+    if (buffer) {
+        loop->data_pool_free = *((void**) buffer);
     }
-#else
-    if (post->data) {
-        free(post->data);
+    portEXIT_CRITICAL(&(loop->data_pool_lock));
+    return buffer;
+}
+
+static inline bool data_pool_contains(esp_event_loop_instance_t* loop, void* buffer)
+{
+    return (uint8_t*) buffer >= loop->data_pool &&
+            (uint8_t*) buffer < loop->data_pool + loop->data_pool_size * loop->data_pool_buffer_size;
+}
+
+static void data_pool_release(esp_event_loop_instance_t* loop, void* buffer)
+{
+    portENTER_CRITICAL(&(loop->data_pool_lock));
+    *((void**) buffer) = loop->data_pool_free;
+    loop->data_pool_free = buffer;
+    portEXIT_CRITICAL(&(loop->data_pool_lock));
+}
+
+static void inline __attribute__((always_inline)) post_instance_delete(esp_event_loop_instance_t* loop,
+        esp_event_post_instance_t* post)
+{
+    if (post->data_allocated && post->data.ptr) {
+        if (data_pool_contains(loop, post->data.ptr)) {
+            data_pool_release(loop, post->data.ptr);
+        } else {
+            free(post->data.ptr);
+        }
     }
-#endif
     memset(post, 0, sizeof(*post));
 }
 
@@ -480,6 +632,32 @@ esp_err_t esp_event_loop_create(const esp_event_loop_args_t* event_loop_args, es
 
     SLIST_INIT(&(loop->loop_nodes));
 
+    loop->base_index = calloc(EVENT_INDEX_MIN_SIZE, sizeof(*(loop->base_index)));
+    loop->id_index = calloc(EVENT_INDEX_MIN_SIZE, sizeof(*(loop->id_index)));
+    if (loop->base_index == NULL || loop->id_index == NULL) {
+        ESP_LOGE(TAG, "alloc for event loop index failed");
+        goto on_err;
+    }
+    loop->base_index_size = EVENT_INDEX_MIN_SIZE;
+    loop->id_index_size = EVENT_INDEX_MIN_SIZE;
+
+    vPortCPUInitializeMutex(&(loop->data_pool_lock));
+    if (event_loop_args->data_pool_size > 0 && event_loop_args->data_pool_buffer_size > 0) {
+        // Free buffers store the pointer to the next one, this also keeps the buffers aligned
+        size_t buffer_size = (MAX(event_loop_args->data_pool_buffer_size, sizeof(void*)) + sizeof(void*) - 1) &
+                ~(sizeof(void*) - 1);
+        loop->data_pool = malloc(event_loop_args->data_pool_size * buffer_size);
+        if (loop->data_pool == NULL) {
+            ESP_LOGE(TAG, "alloc for event data pool failed");
+            goto on_err;
+        }
+        loop->data_pool_size = event_loop_args->data_pool_size;
+        loop->data_pool_buffer_size = buffer_size;
+        for (size_t i = loop->data_pool_size; i > 0; i--) {
+            data_pool_release(loop, loop->data_pool + (i - 1) * buffer_size);
+        }
+    }
+
     // Create the loop task if requested
     if (event_loop_args->task_name != NULL) {
         BaseType_t task_created = xTaskCreatePinnedToCore(esp_event_loop_run_task, event_loop_args->task_name,
@@ -529,17 +707,18 @@ on_err:
     }
 #endif
 
+    free(loop->base_index);
+    free(loop->id_index);
+    free(loop->data_pool);
     free(loop);
 
     return err;
 }
 
-// On event lookup performance: The library implements the event list as a linked list, which results to O(n)
-// lookup time. The test comparing this implementation to the O(lg n) performance of rbtrees
-// (https://github.com/freebsd/freebsd/blob/master/sys/sys/tree.h)
-// indicate that the difference is not that substantial, especially considering the additional
-// pointers per node of rbtrees. Code for the rbtree implementation of the event loop library is archived
-// in feature/esp_event_loop_library_rbtrees if needed.
+// On event lookup performance: The handlers are stored in linked lists of loop, base and event nodes, which
+// keep the order in which they are executed. Base and event nodes are also kept in hash tables by base and
+// by base and id, so that the handlers of an event are found without walking the lists of all the other
+// events registered to the loop.
 esp_err_t esp_event_loop_run(esp_event_loop_handle_t event_loop, TickType_t ticks_to_run)
 {
     assert(event_loop);
@@ -564,44 +743,23 @@ esp_err_t esp_event_loop_run(esp_event_loop_handle_t event_loop, TickType_t tick
         bool exec = false;
 
         esp_event_handler_node_t *handler, *temp_handler;
-        esp_event_loop_node_t *loop_node, *temp_node;
-        esp_event_base_node_t *base_node, *temp_base;
-        esp_event_id_node_t *id_node, *temp_id_node;
+        esp_event_handler_nodes_t *handlers;
+
+        // Execute loop, base and id level handlers, skipping nodes created by the handlers
+        int64_t key = -1;
+        int64_t end_key = HANDLERS_KEY(loop->next_position, HANDLERS_LEVEL_LOOP);
 
-        SLIST_FOREACH_SAFE(loop_node, &(loop->loop_nodes), next, temp_node) {
-            // Execute loop level handlers
-            SLIST_FOREACH_SAFE(handler, &(loop_node->handlers), next, temp_handler) {
+        while ((handlers = find_next_handlers(loop, post.base, post.id, &key, end_key)) != NULL) {
+            SLIST_FOREACH_SAFE(handler, handlers, next, temp_handler) {
                 handler_execute(loop, handler, post);
                 exec |= true;
             }
-
-            SLIST_FOREACH_SAFE(base_node, &(loop_node->base_nodes), next, temp_base) {
-                if (base_node->base == post.base) {
-                    // Execute base level handlers
-                    SLIST_FOREACH_SAFE(handler, &(base_node->handlers), next, temp_handler) {
-                        handler_execute(loop, handler, post);
-                        exec |= true;
-                    }
-
-                    SLIST_FOREACH_SAFE(id_node, &(base_node->id_nodes), next, temp_id_node) {
-                        if (id_node->id == post.id) {
-                            // Execute id level handlers
-                            SLIST_FOREACH_SAFE(handler, &(id_node->handlers), next, temp_handler) {
-                                handler_execute(loop, handler, post);
-                                exec |= true;
-                            }
-                            // Skip to next base node
-                            break;
-                        }
-                    }
-                }
-            }
         }
 
         esp_event_base_t base = post.base;
         int32_t id = post.id;
 
-        post_instance_delete(&post);
+        post_instance_delete(loop, &post);
 
         if (ticks_to_run != portMAX_DELAY) {
             end = xTaskGetTickCount();
@@ -663,11 +821,14 @@ esp_err_t esp_event_loop_delete(esp_event_loop_handle_t event_loop)
     // Drop existing posts on the queue
     esp_event_post_instance_t post;
     while(xQueueReceive(loop->queue, &post, 0) == pdTRUE) {
-        post_instance_delete(&post);
+        post_instance_delete(loop, &post);
     }
 
     // Cleanup loop
     vQueueDelete(loop->queue);
+    free(loop->base_index);
+    free(loop->id_index);
+    free(loop->data_pool);
     free(loop);
     // Free loop mutex before deleting
     xSemaphoreGiveRecursive(loop_mutex);
@@ -724,8 +885,9 @@ esp_err_t esp_event_handler_register_with_internal(esp_event_loop_handle_t event
 
         SLIST_INIT(&(loop_node->handlers));
         SLIST_INIT(&(loop_node->base_nodes));
+        loop_node->position = loop->next_position++;
 
-        err = loop_node_add_handler(loop_node, event_base, event_id, event_handler, event_handler_arg, handler_ctx_arg, legacy);
+        err = loop_node_add_handler(loop, loop_node, event_base, event_id, event_handler, event_handler_arg, handler_ctx_arg, legacy);
 
         if (err == ESP_OK) {
             if (!last_loop_node) {
@@ -739,7 +901,7 @@ esp_err_t esp_event_handler_register_with_internal(esp_event_loop_handle_t event
         }
     }
     else {
-        err = loop_node_add_handler(last_loop_node, event_base, event_id, event_handler, event_handler_arg, handler_ctx_arg, legacy);
+        err = loop_node_add_handler(loop, last_loop_node, event_base, event_id, event_handler, event_handler_arg, handler_ctx_arg, legacy);
     }
 
 on_err:
@@ -782,7 +944,7 @@ esp_err_t esp_event_handler_unregister_with_internal(esp_event_loop_handle_t eve
     esp_event_loop_node_t *it, *temp;
 
     SLIST_FOREACH_SAFE(it, &(loop->loop_nodes), next, temp) {
-        esp_err_t res = loop_node_remove_handler(it, event_base, event_id, handler_ctx, legacy);
+        esp_err_t res = loop_node_remove_handler(loop, it, event_base, event_id, handler_ctx, legacy);
 
         if (res == ESP_OK && SLIST_EMPTY(&(it->base_nodes)) && SLIST_EMPTY(&(it->handlers))) {
             SLIST_REMOVE(&(loop->loop_nodes), it, esp_event_loop_node, next);
@@ -829,21 +991,31 @@ esp_err_t esp_event_post_to(esp_event_loop_handle_t event_loop, esp_event_base_t
     memset((void*)(&post), 0, sizeof(post));
 
     if (event_data != NULL && event_data_size != 0) {
-        // Make persistent copy of event data on heap.
-        void* event_data_copy = calloc(1, event_data_size);
+        if (event_data_size <= sizeof(post.data.val)) {
+            // Small data is copied into the post itself
+            memcpy((void*)(&(post.data.val)), event_data, event_data_size);
+            post.data_allocated = false;
+        } else {
+            // Make persistent copy of event data, in the loop data pool if possible, otherwise on heap.
+            void* event_data_copy = NULL;
 
-        if (event_data_copy == NULL) {
-            return ESP_ERR_NO_MEM;
-        }
+            if (event_data_size <= loop->data_pool_buffer_size) {
+                event_data_copy = data_pool_alloc(loop);
+            }
 
-        memcpy(event_data_copy, event_data, event_data_size);
-#if CONFIG_ESP_EVENT_POST_FROM_ISR
-        post.data.ptr = event_data_copy;
-        post.data_allocated = true;
+            if (event_data_copy == NULL) {
+                event_data_copy = malloc(event_data_size);
+            }
+
+            if (event_data_copy == NULL) {
+                return ESP_ERR_NO_MEM;
+            }
+
+            memcpy(event_data_copy, event_data, event_data_size);
+            post.data.ptr = event_data_copy;
+            post.data_allocated = true;
+        }
         post.data_set = true;
-#else
-        post.data = event_data_copy;
-#endif
     }
     post.base = event_base;
     post.id = event_id;
@@ -875,7 +1047,7 @@ esp_err_t esp_event_post_to(esp_event_loop_handle_t event_loop, esp_event_base_t
     }
 
     if (result != pdTRUE) {
-        post_instance_delete(&post);
+        post_instance_delete(loop, &post);
 
 #ifdef CONFIG_ESP_EVENT_LOOP_PROFILING
         atomic_fetch_add(&loop->events_dropped, 1);
@@ -923,7 +1095,7 @@ esp_err_t esp_event_isr_post_to(esp_event_loop_handle_t event_loop, esp_event_ba
     result = xQueueSendToBackFromISR(loop->queue, &post, task_unblocked);
 
     if (result != pdTRUE) {
-        post_instance_delete(&post);
+        post_instance_delete(loop, &post);
 
 #ifdef CONFIG_ESP_EVENT_LOOP_PROFILING
         atomic_fetch_add(&loop->events_dropped, 1);
@@ -38,6 +38,12 @@ typedef struct {
     uint32_t task_stack_size;                   /**< stack size of the event loop task, ignored if task name is NULL */
     BaseType_t task_core_id;                    /**< core to which the event loop task is pinned to,
                                                         ignored if task name is NULL */
+    size_t data_pool_size;                      /**< number of buffers preallocated for the data of posted events,
+                                                        0 to allocate all event data from heap */
+    size_t data_pool_buffer_size;               /**< size of each preallocated buffer. Event data which doesn't
+                                                        fit, or is posted when all the buffers are in use, is
+                                                        allocated from heap. Data of up to 4 bytes is always stored
+                                                        in the queue itself. */
 } esp_event_loop_args_t;
 
 /**
@@ -46,7 +46,10 @@ typedef struct esp_event_id_node {
     int32_t id;                                                     /**< id number of the event */
     esp_event_handler_nodes_t handlers;                             /**< list of handlers to be executed when
                                                                             this event is raised */
+    struct esp_event_base_node* base_node;                          /**< base node this event belongs to */
     SLIST_ENTRY(esp_event_id_node) next;                            /**< pointer to the next event node on the linked list */
+    SLIST_ENTRY(esp_event_id_node) index_next;                      /**< pointer to the next event node in the same
+                                                                            bucket of the loop id_index */
 } esp_event_id_node_t;
 
 typedef SLIST_HEAD(esp_event_id_nodes, esp_event_id_node) esp_event_id_nodes_t;
@@ -56,7 +59,11 @@ typedef struct esp_event_base_node {
     esp_event_handler_nodes_t handlers;                             /**< event base level handlers, handlers for
                                                                             all events with this base */
     esp_event_id_nodes_t id_nodes;                                  /**< list of event ids with this base */
+    uint32_t position;                                              /**< order of the node in the loop, see
+                                                                            esp_event_loop_instance_t::next_position */
     SLIST_ENTRY(esp_event_base_node) next;                          /**< pointer to the next base node on the linked list */
+    SLIST_ENTRY(esp_event_base_node) index_next;                    /**< pointer to the next base node in the same
+                                                                            bucket of the loop base_index */
 } esp_event_base_node_t;
 
 typedef SLIST_HEAD(esp_event_base_nodes, esp_event_base_node) esp_event_base_nodes_t;
@@ -64,6 +71,8 @@ typedef SLIST_HEAD(esp_event_base_nodes, esp_event_base_node) esp_event_base_nod
 typedef struct esp_event_loop_node {
     esp_event_handler_nodes_t handlers;                             /** event loop level handlers */
     esp_event_base_nodes_t base_nodes;                              /** list of event bases registered to the loop */
+    uint32_t position;                                              /** order of the node in the loop, see
+                                                                            esp_event_loop_instance_t::next_position */
     SLIST_ENTRY(esp_event_loop_node) next;                          /** pointer to the next loop node containing
                                                                             event loop level handlers and the rest of
                                                                             event bases registered to the loop */
@@ -81,6 +90,25 @@ typedef struct esp_event_loop_instance {
     SemaphoreHandle_t mutex;                                        /**< mutex for updating the events linked list */
     esp_event_loop_nodes_t loop_nodes;                              /**< set of linked lists containing the
                                                                             registered handlers for the loop */
+    esp_event_base_nodes_t* base_index;                             /**< hash table of the base nodes of all
+                                                                            loop nodes, by base */
+    size_t base_index_size;                                         /**< number of buckets in base_index */
+    size_t base_count;                                              /**< number of base nodes in base_index */
+    esp_event_id_nodes_t* id_index;                                 /**< hash table of the event nodes of all
+                                                                            base nodes, by base and id */
+    size_t id_index_size;                                           /**< number of buckets in id_index */
+    size_t id_count;                                                /**< number of event nodes in id_index */
+    uint32_t next_position;                                         /**< position of the next loop or base node.
+                                                                            Nodes are only ever added after all the
+                                                                            existing ones, so handlers are executed
+                                                                            in the order of the node positions */
+    uint8_t* data_pool;                                             /**< buffers for the data of posted events, see
+                                                                            esp_event_loop_args_t::data_pool_size */
+    size_t data_pool_size;                                          /**< number of buffers in data_pool */
+    size_t data_pool_buffer_size;                                   /**< size of each buffer in data_pool */
+    void* data_pool_free;                                           /**< first free buffer of data_pool, a free buffer
+                                                                            starts with a pointer to the next one */
+    portMUX_TYPE data_pool_lock;                                    /**< spinlock for data_pool_free */
 #ifdef CONFIG_ESP_EVENT_LOOP_PROFILING
     atomic_uint_least32_t events_recieved;                          /**< number of events successfully posted to the loop */
     atomic_uint_least32_t events_dropped;                           /**< number of events dropped due to queue being full */
@@ -89,21 +117,16 @@ typedef struct esp_event_loop_instance {
 #endif
 } esp_event_loop_instance_t;
 
-#if CONFIG_ESP_EVENT_POST_FROM_ISR
 typedef union esp_event_post_data {
-    uint32_t val;
-    void *ptr;
+    uint32_t val;                                                    /**< data which fits into the post itself */
+    void *ptr;                                                       /**< data copied to the loop data pool or to the heap */
 } esp_event_post_data_t;
-#else
-typedef void* esp_event_post_data_t;
-#endif
 
 /// Event posted to the event queue
 typedef struct esp_event_post_instance {
-#if CONFIG_ESP_EVENT_POST_FROM_ISR
-    bool data_allocated;                                             /**< indicates whether data is allocated from heap */
+    bool data_allocated;                                             /**< indicates whether data is allocated from the
+                                                                            loop data pool or from heap */
     bool data_set;                                                   /**< indicates if data is null */
-#endif
     esp_event_base_t base;                                           /**< the event base */
     int32_t id;                                                      /**< the event id */
     esp_event_post_data_t data;                                      /**< data associated with the event */
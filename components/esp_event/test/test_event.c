@@ -1931,6 +1931,54 @@ TEST_CASE("events are dispatched in the order they are registered", "[event]")
     TEST_TEARDOWN();
 }
 
+TEST_CASE("event data is copied to the loop data pool", "[event]")
+{
+    TEST_SETUP();
+
+    esp_event_loop_handle_t loop;
+    esp_event_loop_args_t loop_args = test_event_get_default_loop_args();
+
+    loop_args.task_name = NULL;
+    loop_args.data_pool_size = 2;
+    loop_args.data_pool_buffer_size = 16;
+    TEST_ESP_OK(esp_event_loop_create(&loop_args, &loop));
+
+    esp_event_post_instance_t post;
+    esp_event_loop_instance_t* loop_def = (esp_event_loop_instance_t*) loop;
+    uint8_t data[20] = { 0 };
+
+    // Up to 4 bytes are stored in the post
+    TEST_ESP_OK(esp_event_post_to(loop, s_test_base1, TEST_EVENT_BASE1_EV1, data, 4, portMAX_DELAY));
+    TEST_ASSERT_EQUAL(pdTRUE, xQueueReceive(loop_def->queue, &post, portMAX_DELAY));
+    TEST_ASSERT_EQUAL(true, post.data_set);
+    TEST_ASSERT_EQUAL(false, post.data_allocated);
+
+    // Two buffers of the pool are used, then data is allocated from heap
+    esp_event_post_instance_t posts[3];
+    for (int i = 0; i < 3; i++) {
+        TEST_ESP_OK(esp_event_post_to(loop, s_test_base1, TEST_EVENT_BASE1_EV1, data, 16, portMAX_DELAY));
+        TEST_ASSERT_EQUAL(pdTRUE, xQueueReceive(loop_def->queue, &posts[i], portMAX_DELAY));
+        TEST_ASSERT_EQUAL(true, posts[i].data_set);
+        TEST_ASSERT_EQUAL(true, posts[i].data_allocated);
+    }
+    TEST_ASSERT_TRUE((uint8_t*) posts[0].data.ptr >= loop_def->data_pool);
+    TEST_ASSERT_TRUE((uint8_t*) posts[1].data.ptr >= loop_def->data_pool);
+    TEST_ASSERT_TRUE((uint8_t*) posts[0].data.ptr < loop_def->data_pool + 2 * loop_def->data_pool_buffer_size);
+    TEST_ASSERT_TRUE((uint8_t*) posts[1].data.ptr < loop_def->data_pool + 2 * loop_def->data_pool_buffer_size);
+    TEST_ASSERT_NULL(loop_def->data_pool_free);
+    TEST_ASSERT_TRUE((uint8_t*) posts[2].data.ptr < loop_def->data_pool ||
+            (uint8_t*) posts[2].data.ptr >= loop_def->data_pool + 2 * loop_def->data_pool_buffer_size);
+
+    // Put the posts back, the loop frees their data when it is deleted
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(pdTRUE, xQueueSendToBack(loop_def->queue, &posts[i], portMAX_DELAY));
+    }
+
+    TEST_ESP_OK(esp_event_loop_delete(loop));
+
+    TEST_TEARDOWN();
+}
+
 #if CONFIG_ESP_EVENT_POST_FROM_ISR
 TEST_CASE("can properly prepare event data posted to loop", "[event]")
 {
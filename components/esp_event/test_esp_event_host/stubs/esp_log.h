@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdio.h>
+
+#define ESP_LOG_DISCARD(tag, format, ...) do { if (0) { printf("%s" format, tag, ##__VA_ARGS__); } } while(0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_DISCARD(tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_DISCARD(tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_DISCARD(tag, format, ##__VA_ARGS__)
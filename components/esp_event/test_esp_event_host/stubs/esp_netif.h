@@ -0,0 +1,15 @@
+#pragma once
+
+/* Only the types used by esp_event_legacy.h */
+
+typedef struct {
+    int unused;
+} ip_event_ap_staipassigned_t;
+
+typedef struct {
+    int unused;
+} ip_event_got_ip_t;
+
+typedef struct {
+    int unused;
+} ip_event_got_ip6_t;
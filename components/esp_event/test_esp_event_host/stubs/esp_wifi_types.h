@@ -0,0 +1,43 @@
+#pragma once
+
+/* Only the types used by esp_event_legacy.h */
+
+typedef struct {
+    int unused;
+} wifi_event_sta_wps_fail_reason_t;
+
+typedef struct {
+    int unused;
+} wifi_event_sta_scan_done_t;
+
+typedef struct {
+    int unused;
+} wifi_event_sta_connected_t;
+
+typedef struct {
+    int unused;
+} wifi_event_sta_disconnected_t;
+
+typedef struct {
+    int unused;
+} wifi_event_sta_authmode_change_t;
+
+typedef struct {
+    int unused;
+} wifi_event_sta_wps_er_pin_t;
+
+typedef struct {
+    int unused;
+} wifi_event_sta_wps_er_success_t;
+
+typedef struct {
+    int unused;
+} wifi_event_ap_staconnected_t;
+
+typedef struct {
+    int unused;
+} wifi_event_ap_stadisconnected_t;
+
+typedef struct {
+    int unused;
+} wifi_event_ap_probe_req_rx_t;
@@ -0,0 +1,3 @@
+#pragma once
+
+#define CONFIG_LOG_DEFAULT_LEVEL 3
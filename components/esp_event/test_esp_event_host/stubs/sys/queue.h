@@ -0,0 +1,18 @@
+#pragma once
+
+/* The host C library's queue.h, with the macros from the BSD one used by esp_event.c */
+#include_next <sys/queue.h>
+
+#ifndef SLIST_FOREACH_SAFE
+#define SLIST_FOREACH_SAFE(var, head, field, tvar)                      \
+    for ((var) = SLIST_FIRST((head));                                   \
+        (var) && ((tvar) = SLIST_NEXT((var), field), 1);                \
+        (var) = (tvar))
+#endif
+
+#ifndef SLIST_REMOVE_AFTER
+#define SLIST_REMOVE_AFTER(elm, field) do {                             \
+    SLIST_NEXT(elm, field) =                                            \
+        SLIST_NEXT(SLIST_NEXT(elm, field), field);                      \
+} while (0)
+#endif
@@ -0,0 +1,310 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "catch.hpp"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "esp_event.h"
+#include "esp_event_internal.h"
+
+using namespace std;
+
+static const char *s_bases[] = { "BASE0", "BASE1", "BASE2", "BASE3", "BASE4", "BASE5" };
+static const int NUM_BASES = sizeof(s_bases) / sizeof(s_bases[0]);
+static const int NUM_IDS = 10;
+
+static vector<int> s_executed;
+
+static void record_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    s_executed.push_back((int)(intptr_t) arg);
+}
+
+/* Loops are created without a task. The test runs them with esp_event_loop_run() for 0 ticks, which dispatches one
+   posted event, as running a loop for longer would also wait for more events. */
+static esp_event_loop_handle_t create_loop(size_t data_pool_size = 0, size_t data_pool_buffer_size = 0)
+{
+    esp_event_loop_args_t args = {};
+    args.queue_size = 32;
+    args.task_name = NULL;
+    args.data_pool_size = data_pool_size;
+    args.data_pool_buffer_size = data_pool_buffer_size;
+    esp_event_loop_handle_t loop;
+    REQUIRE(esp_event_loop_create(&args, &loop) == ESP_OK);
+    return loop;
+}
+
+static void post_and_run(esp_event_loop_handle_t loop, esp_event_base_t base, int32_t id)
+{
+    REQUIRE(esp_event_post_to(loop, base, id, NULL, 0, portMAX_DELAY) == ESP_OK);
+    REQUIRE(esp_event_loop_run(loop, 0) == ESP_OK);
+}
+
+/* The handlers which should be executed for an event, found by walking all the nodes of the loop */
+static vector<int> expected_handlers(esp_event_loop_handle_t event_loop, esp_event_base_t base, int32_t id)
+{
+    esp_event_loop_instance_t *loop = (esp_event_loop_instance_t *) event_loop;
+    vector<int> result;
+    esp_event_loop_node_t *loop_node;
+    esp_event_base_node_t *base_node;
+    esp_event_id_node_t *id_node;
+    esp_event_handler_node_t *handler;
+
+    SLIST_FOREACH(loop_node, &(loop->loop_nodes), next) {
+        SLIST_FOREACH(handler, &(loop_node->handlers), next) {
+            result.push_back((int)(intptr_t) handler->handler_ctx->arg);
+        }
+        SLIST_FOREACH(base_node, &(loop_node->base_nodes), next) {
+            if (base_node->base != base) {
+                continue;
+            }
+            SLIST_FOREACH(handler, &(base_node->handlers), next) {
+                result.push_back((int)(intptr_t) handler->handler_ctx->arg);
+            }
+            SLIST_FOREACH(id_node, &(base_node->id_nodes), next) {
+                if (id_node->id == id) {
+                    SLIST_FOREACH(handler, &(id_node->handlers), next) {
+                        result.push_back((int)(intptr_t) handler->handler_ctx->arg);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+TEST_CASE("handlers are executed in the order they are registered", "[event]")
+{
+    esp_event_loop_handle_t loop = create_loop();
+    const char *base1 = s_bases[0];
+    const char *base2 = s_bases[1];
+
+    REQUIRE(esp_event_handler_register_with(loop, base2, 1, record_handler, (void *) 0) == ESP_OK);
+    REQUIRE(esp_event_handler_register_with(loop, ESP_EVENT_ANY_BASE, ESP_EVENT_ANY_ID, record_handler, (void *) 1) == ESP_OK);
+    REQUIRE(esp_event_handler_register_with(loop, base1, ESP_EVENT_ANY_ID, record_handler, (void *) 2) == ESP_OK);
+    REQUIRE(esp_event_handler_register_with(loop, base2, 2, record_handler, (void *) 3) == ESP_OK);
+    REQUIRE(esp_event_handler_register_with(loop, base1, 1, record_handler, (void *) 4) == ESP_OK);
+    REQUIRE(esp_event_handler_register_with(loop, base2, ESP_EVENT_ANY_ID, record_handler, (void *) 5) == ESP_OK);
+    REQUIRE(esp_event_handler_register_with(loop, base1, 2, record_handler, (void *) 6) == ESP_OK);
+
+    s_executed.clear();
+    post_and_run(loop, base2, 2);
+    post_and_run(loop, base1, 1);
+    post_and_run(loop, base1, 2);
+    post_and_run(loop, base2, 1);
+    CHECK(s_executed == vector<int>({1, 3, 5, 1, 2, 4, 1, 2, 6, 0, 1, 5}));
+
+    REQUIRE(esp_event_loop_delete(loop) == ESP_OK);
+}
+
+struct registration {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_instance_t instance;
+};
+
+static esp_event_loop_handle_t s_unregister_loop;
+static registration s_to_unregister;
+
+static void unregister_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    s_executed.push_back((int)(intptr_t) arg);
+    CHECK(esp_event_handler_instance_unregister_with(s_unregister_loop, s_to_unregister.base, s_to_unregister.id,
+            s_to_unregister.instance) == ESP_OK);
+}
+
+TEST_CASE("handler can unregister handlers which are not executed yet", "[event]")
+{
+    esp_event_loop_handle_t loop = create_loop();
+    s_unregister_loop = loop;
+    const char *base = s_bases[0];
+    esp_event_handler_instance_t instance;
+
+    REQUIRE(esp_event_handler_instance_register_with(loop, base, ESP_EVENT_ANY_ID, unregister_handler, (void *) 0,
+            &instance) == ESP_OK);
+    REQUIRE(esp_event_handler_instance_register_with(loop, base, 1, record_handler, (void *) 1,
+            &s_to_unregister.instance) == ESP_OK);
+    s_to_unregister.base = base;
+    s_to_unregister.id = 1;
+    REQUIRE(esp_event_handler_instance_register_with(loop, s_bases[1], 1, record_handler, (void *) 2,
+            &instance) == ESP_OK);
+
+    s_executed.clear();
+    post_and_run(loop, base, 1);
+    CHECK(s_executed == vector<int>({0}));
+    post_and_run(loop, s_bases[1], 1);
+    CHECK(s_executed == vector<int>({0, 2}));
+
+    REQUIRE(esp_event_loop_delete(loop) == ESP_OK);
+}
+
+TEST_CASE("handlers are executed in the same order as walking all the nodes", "[event]")
+{
+    esp_event_loop_handle_t loop = create_loop();
+    vector<registration> registrations;
+    uint32_t seed = 1;
+    auto next_random = [&seed](uint32_t range) {
+        seed = seed * 1103515245 + 12345;
+        return ((seed >> 8) & 0xffffff) % range;
+    };
+
+    for (int step = 0; step < 3000; step++) {
+        if (registrations.empty() || next_random(10) < 6) {
+            registration r;
+            uint32_t kind = next_random(20);
+            if (kind == 0) {
+                r.base = ESP_EVENT_ANY_BASE;
+                r.id = ESP_EVENT_ANY_ID;
+            } else {
+                r.base = s_bases[next_random(NUM_BASES)];
+                r.id = (kind < 5) ? ESP_EVENT_ANY_ID : (int32_t) next_random(NUM_IDS);
+            }
+            REQUIRE(esp_event_handler_instance_register_with(loop, r.base, r.id, record_handler, (void *)(intptr_t) step,
+                    &r.instance) == ESP_OK);
+            registrations.push_back(r);
+        } else {
+            size_t i = next_random(registrations.size());
+            registration r = registrations[i];
+            REQUIRE(esp_event_handler_instance_unregister_with(loop, r.base, r.id, r.instance) == ESP_OK);
+            registrations.erase(registrations.begin() + i);
+        }
+
+        if (step % 100 == 99) {
+            for (int b = 0; b < NUM_BASES; b++) {
+                for (int id = 0; id < NUM_IDS; id++) {
+                    vector<int> expected = expected_handlers(loop, s_bases[b], id);
+                    s_executed.clear();
+                    post_and_run(loop, s_bases[b], id);
+                    CHECK(s_executed == expected);
+                }
+            }
+        }
+    }
+
+    REQUIRE(esp_event_loop_delete(loop) == ESP_OK);
+}
+
+static vector<vector<uint8_t>> s_received;
+
+static void data_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+    const uint8_t *bytes = (const uint8_t *) data;
+    s_received.push_back(vector<uint8_t>(bytes, bytes + (size_t) id));
+}
+
+static size_t free_pool_buffers(esp_event_loop_handle_t event_loop)
+{
+    esp_event_loop_instance_t *loop = (esp_event_loop_instance_t *) event_loop;
+    size_t count = 0;
+    for (void *it = loop->data_pool_free; it != NULL; it = *(void **) it) {
+        count++;
+    }
+    return count;
+}
+
+TEST_CASE("event data is copied to the post, the data pool or the heap", "[event]")
+{
+    const size_t POOL_SIZE = 4;
+    esp_event_loop_handle_t loop = create_loop(POOL_SIZE, 30);
+    esp_event_loop_instance_t *loop_instance = (esp_event_loop_instance_t *) loop;
+    REQUIRE(loop_instance->data_pool_buffer_size >= 30);
+    REQUIRE(free_pool_buffers(loop) == POOL_SIZE);
+    REQUIRE(esp_event_handler_register_with(loop, s_bases[0], ESP_EVENT_ANY_ID, data_handler, NULL) == ESP_OK);
+
+    /* the event id is the size of the data */
+    const size_t sizes[] = { 1, 4, 5, 30, 31, 200, 17, 17, 17, 17 };
+    vector<vector<uint8_t>> sent;
+    for (size_t size : sizes) {
+        vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; i++) {
+            data[i] = (uint8_t)(sent.size() * 16 + i);
+        }
+        REQUIRE(esp_event_post_to(loop, s_bases[0], size, data.data(), size, portMAX_DELAY) == ESP_OK);
+        sent.push_back(data);
+    }
+    /* 5 and 30 bytes, and the first two 17 byte events are in the pool, the other ones on the heap */
+    CHECK(free_pool_buffers(loop) == 0);
+
+    s_received.clear();
+    for (size_t i = 0; i < sent.size(); i++) {
+        REQUIRE(esp_event_loop_run(loop, 0) == ESP_OK);
+    }
+    CHECK(s_received == sent);
+    CHECK(free_pool_buffers(loop) == POOL_SIZE);
+
+    /* Posts which are still in the queue are freed with the loop */
+    REQUIRE(esp_event_post_to(loop, s_bases[0], 20, sent[5].data(), 20, portMAX_DELAY) == ESP_OK);
+    REQUIRE(esp_event_post_to(loop, s_bases[0], 200, sent[5].data(), 200, portMAX_DELAY) == ESP_OK);
+    REQUIRE(esp_event_loop_delete(loop) == ESP_OK);
+}
+
+static void empty_handler(void *arg, esp_event_base_t base, int32_t id, void *data)
+{
+}
+
+/* Time to post and dispatch one event, with handlers registered for many events of many bases */
+TEST_CASE("esp_event dispatch benchmark", "[event][benchmark]")
+{
+    const int ITERATIONS = 20000;
+    const int counts[][2] = { { 1, 10 }, { 4, 25 }, { 10, 50 }, { 20, 100 } };
+    typedef std::chrono::steady_clock clock;
+    static char bases[20][12];
+
+    for (auto count : counts) {
+        int num_bases = count[0];
+        int num_ids = count[1];
+        esp_event_loop_handle_t loop = create_loop();
+        for (int b = 0; b < num_bases; b++) {
+            snprintf(bases[b], sizeof(bases[b]), "B%d", b);
+            REQUIRE(esp_event_handler_register_with(loop, bases[b], ESP_EVENT_ANY_ID, empty_handler, NULL) == ESP_OK);
+            for (int id = 0; id < num_ids; id++) {
+                REQUIRE(esp_event_handler_register_with(loop, bases[b], id, empty_handler, NULL) == ESP_OK);
+            }
+        }
+
+        uint32_t seed = 1;
+        auto start = clock::now();
+        for (int i = 0; i < ITERATIONS; i++) {
+            seed = seed * 1103515245 + 12345;
+            uint32_t r = (seed >> 8) & 0xffffff;
+            esp_event_post_to(loop, bases[r % num_bases], (r / num_bases) % num_ids, NULL, 0, portMAX_DELAY);
+            esp_event_loop_run(loop, 0);
+        }
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+        printf("%2d bases x %3d ids: post and run %u ns\n", num_bases, num_ids, (unsigned)(ns / ITERATIONS));
+        REQUIRE(esp_event_loop_delete(loop) == ESP_OK);
+    }
+}
+
+/* Time to post and dispatch one event with 16 bytes of data */
+TEST_CASE("esp_event data benchmark", "[event][benchmark]")
+{
+    const int ITERATIONS = 20000;
+    typedef std::chrono::steady_clock clock;
+    uint8_t data[16] = { 0 };
+
+    for (size_t pool_size : { 0, 8 }) {
+        esp_event_loop_handle_t loop = create_loop(pool_size, sizeof(data));
+        REQUIRE(esp_event_handler_register_with(loop, s_bases[0], 1, empty_handler, NULL) == ESP_OK);
+        auto start = clock::now();
+        for (int i = 0; i < ITERATIONS; i++) {
+            esp_event_post_to(loop, s_bases[0], 1, data, sizeof(data), portMAX_DELAY);
+            esp_event_loop_run(loop, 0);
+        }
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+        printf("data pool of %d buffers: post and run %u ns\n", (int) pool_size, (unsigned)(ns / ITERATIONS));
+        REQUIRE(esp_event_loop_delete(loop) == ESP_OK);
+    }
+}
@@ -22,6 +22,7 @@
 #include <http_parser.h>
 #include <sdkconfig.h>
 #include <esp_err.h>
+#include <esp_partition.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -50,7 +51,9 @@ initializer that should be kept in sync
         .global_transport_ctx_free_fn = NULL,           \
         .open_fn = NULL,                                \
         .close_fn = NULL,                               \
-        .uri_match_fn = NULL                            \
+        .uri_match_fn = NULL,                           \
+        .uri_trie_enable = false,                       \
+        .worker_count = 0                               \
 }
 
 #define ESP_ERR_HTTPD_BASE              (0xb000)                    /*!< Starting number of HTTPD error codes */
@@ -239,6 +242,36 @@ typedef struct httpd_config {
      * of the `httpd_uri_match_func_t` function prototype)
      */
     httpd_uri_match_func_t uri_match_fn;
+
+    /**
+     * Look up URI handlers in a trie of the registered URIs.
+     *
+     * Without the trie, each request tests the registered URI handlers one
+     * after another, which takes time in proportion to the number of handlers.
+     * The trie is rebuilt whenever a URI handler is registered or unregistered,
+     * and finds the handler of a request in time depending only on the length
+     * of its URI. Handlers are matched with the same precedence as without it.
+     *
+     * This is used only if uri_match_fn is NULL or `httpd_uri_match_wildcard()`.
+     * Other matching functions are tested against each handler as before.
+     */
+    bool uri_trie_enable;
+
+    /**
+     * Number of worker tasks processing requests.
+     *
+     * When 0, requests are received and processed one at a time by the server
+     * task, so a slow URI handler delays the requests of all other clients.
+     *
+     * Otherwise the server task only accepts connections and waits for incoming
+     * data, and hands each session with a pending request over to one of this
+     * many worker tasks, which are created with the same stack size, priority
+     * and core affinity as the server task. A session is handed to only one
+     * worker at a time, so the requests of a client are still processed in the
+     * order they are received. URI handlers of different sessions may run
+     * concurrently and must protect any data they share.
+     */
+    uint16_t worker_count;
 } httpd_config_t;
 
 /**
@@ -1077,13 +1110,94 @@ static inline esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *r, const char *str
     return httpd_resp_send_chunk(r, str, (str == NULL) ? 0 : HTTPD_RESP_USE_STRLEN);
 }
 
+/**
+ * @brief   API to send the contents of a file as HTTP response.
+ *
+ * The file is read from its beginning in blocks of
+ * CONFIG_HTTPD_SEND_FILE_BUF_LEN bytes, and each block is sent as it is
+ * read, instead of being copied again into HTTP chunks as with
+ * httpd_resp_send_chunk(). When the size of the file is known from
+ * fstat(), it is sent as Content-Length, and a request with a Range
+ * header of a single byte range is answered with '206 Partial Content'
+ * and only that range of the file, or with '416 Range Not Satisfiable'
+ * if the range lies beyond the end of the file. Otherwise, the file is
+ * read until its end and sent with chunked encoding.
+ *
+ * As with httpd_resp_send(), the status code, content type and any
+ * additional headers may be set before calling this API. A Range header
+ * is only served if the status code is left as '200 OK'.
+ *
+ * @note
+ *  - This API is supposed to be called only from the context of
+ *    a URI handler where httpd_req_t* request pointer is valid.
+ *  - Once this API is called, the request has been responded to.
+ *  - Once this API is called, all request headers are purged, so
+ *    request headers need be copied into separate buffers if
+ *    they are required later.
+ *  - The file descriptor is not closed by this API.
+ *
+ * @param[in] r     The request being responded to
+ * @param[in] fd    File descriptor of the file to be sent, opened for reading
+ *
+ * @return
+ *  - ESP_OK : On successfully sending the response packet
+ *  - ESP_ERR_INVALID_ARG : Null request pointer or invalid file descriptor
+ *  - ESP_ERR_NO_MEM            : Failed to allocate the buffer for reading the file
+ *  - ESP_FAIL                  : Error in seeking in or reading the file
+ *  - ESP_ERR_HTTPD_RESP_HDR    : Essential headers are too large for internal buffer
+ *  - ESP_ERR_HTTPD_RESP_SEND   : Error in raw send
+ *  - ESP_ERR_HTTPD_INVALID_REQ : Invalid request
+ */
+esp_err_t httpd_resp_send_file(httpd_req_t *r, int fd);
+
+/**
+ * @brief   API to send a region of a flash partition as HTTP response.
+ *
+ * The region is mapped into data memory with esp_partition_mmap(), a
+ * few MMU pages at a time, and sent directly from the mapped memory.
+ * This suits static content such as a web UI bundle written to a data
+ * partition. Its length is sent as Content-Length. A request with a
+ * Range header of a single byte range is answered with '206 Partial
+ * Content' and only that range of the region, or with '416 Range Not
+ * Satisfiable' if the range lies beyond the end of the region.
+ *
+ * As with httpd_resp_send(), the status code, content type and any
+ * additional headers may be set before calling this API. A Range header
+ * is only served if the status code is left as '200 OK'.
+ *
+ * @note
+ *  - This API is supposed to be called only from the context of
+ *    a URI handler where httpd_req_t* request pointer is valid.
+ *  - Once this API is called, the request has been responded to.
+ *  - Once this API is called, all request headers are purged, so
+ *    request headers need be copied into separate buffers if
+ *    they are required later.
+ *
+ * @param[in] r         The request being responded to
+ * @param[in] partition Partition holding the content
+ * @param[in] offset    Offset of the content from the beginning of the partition
+ * @param[in] len       Length of the content
+ *
+ * @return
+ *  - ESP_OK : On successfully sending the response packet
+ *  - ESP_ERR_INVALID_ARG : Null arguments, or region beyond the end of the partition
+ *  - ESP_ERR_HTTPD_RESP_HDR    : Essential headers are too large for internal buffer
+ *  - ESP_ERR_HTTPD_RESP_SEND   : Error in raw send
+ *  - ESP_ERR_HTTPD_INVALID_REQ : Invalid request
+ *  - Other errors from esp_partition_mmap()
+ */
+esp_err_t httpd_resp_send_partition(httpd_req_t *r, const esp_partition_t *partition,
+                                    size_t offset, size_t len);
+
 /* Some commonly used status codes */
 #define HTTPD_200      "200 OK"                     /*!< HTTP Response 200 */
 #define HTTPD_204      "204 No Content"             /*!< HTTP Response 204 */
+#define HTTPD_206      "206 Partial Content"        /*!< HTTP Response 206 */
 #define HTTPD_207      "207 Multi-Status"           /*!< HTTP Response 207 */
 #define HTTPD_400      "400 Bad Request"            /*!< HTTP Response 400 */
 #define HTTPD_404      "404 Not Found"              /*!< HTTP Response 404 */
 #define HTTPD_408      "408 Request Timeout"        /*!< HTTP Response 408 */
+#define HTTPD_416      "416 Range Not Satisfiable"  /*!< HTTP Response 416 */
 #define HTTPD_500      "500 Internal Server Error"  /*!< HTTP Response 500 */
 
 /**
@@ -1586,6 +1700,58 @@ typedef struct httpd_ws_frame {
  */
 esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *pkt, size_t max_len);
 
+/**
+ * @brief Function prototype for receiving the payload of a WebSocket message
+ *        piece by piece, as it arrives
+ *
+ * @param[in] req       Current request
+ * @param[in] data      Next piece of the payload, in the buffer given to httpd_ws_recv_message()
+ * @param[in] len       Length of the piece
+ * @param[in] final     True for the last piece of the message
+ * @param[in] arg       User argument given to httpd_ws_recv_message()
+ *
+ * @return
+ *  - ESP_OK : To continue receiving the message
+ *  - other  : To stop, httpd_ws_recv_message() returns this error
+ */
+typedef esp_err_t (*httpd_ws_recv_cb_t)(httpd_req_t *req, const uint8_t *data, size_t len, bool final, void *arg);
+
+/**
+ * @brief Receive a WebSocket message, reassembling it if the client sends it
+ *        in fragments
+ *
+ * Called from a WebSocket handler in place of httpd_ws_recv_frame(), this
+ * receives the current frame and, if its `FIN` flag isn't set, the
+ * continuation frames which follow, until the end of the message.
+ *
+ * @note
+ *  - Without a callback, the message is assembled in pkt->payload, and is
+ *    rejected if it's longer than max_len.
+ *  - With a callback, pkt->payload is a buffer of max_len bytes which is
+ *    reused for each piece of the message handed to the callback, so
+ *    messages of any length can be received.
+ *  - Control frames sent between the fragments are handled here: PING is
+ *    answered with PONG, PONG is dropped, and CLOSE fails the call and
+ *    closes the socket.
+ *  - On success pkt->type is the type of the message, pkt->len its length
+ *    and pkt->final is set.
+ *
+ * @param[in]   req         Current request
+ * @param[out]  pkt         WebSocket message
+ * @param[in]   max_len     Length of the pkt->payload buffer
+ * @param[in]   recv_cb     Function receiving the message piece by piece, or NULL
+ * @param[in]   arg         User argument passed to recv_cb
+ * @return
+ *  - ESP_OK                    : On successful
+ *  - ESP_FAIL                  : Socket errors occurs, or the client closed the connection
+ *  - ESP_ERR_INVALID_SIZE      : The message is longer than max_len
+ *  - ESP_ERR_INVALID_STATE     : No handshake was done, or the client broke the framing
+ *  - ESP_ERR_INVALID_ARG       : Argument is invalid (null or non-WebSocket)
+ *  - other                     : Error returned by recv_cb
+ */
+esp_err_t httpd_ws_recv_message(httpd_req_t *req, httpd_ws_frame_t *pkt, size_t max_len,
+                                httpd_ws_recv_cb_t recv_cb, void *arg);
+
 /**
  * @brief Construct and send a WebSocket frame
  * @param[in]   req     Current request
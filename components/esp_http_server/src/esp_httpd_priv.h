@@ -38,6 +38,14 @@ extern "C" {
 /* Calculate the maximum size needed for the scratch buffer */
 #define HTTPD_SCRATCH_BUF  MAX(HTTPD_MAX_REQ_HDR_LEN, HTTPD_MAX_URI_LEN)
 
+/* Maximum number of request headers indexed during parsing for lookup
+ * by name. Any further headers are searched in the scratch buffer */
+#define HTTPD_MAX_INDEXED_REQ_HDRS  24
+
+/* Number of slots in the hash table of indexed request headers.
+ * This must be a power of 2, larger than the number of headers */
+#define HTTPD_REQ_HDR_SLOTS  32
+
 /* Formats a log string to prepend context function name */
 #define LOG_FMT(x)      "%s: " x, __func__
 
@@ -71,6 +79,8 @@ struct sock_db {
     uint64_t lru_counter;                   /*!< LRU Counter indicating when the socket was last used */
     char pending_data[PARSER_BLOCK_SIZE];   /*!< Buffer for pending data to be received */
     size_t pending_len;                     /*!< Length of pending data to be received */
+    bool worker_busy;                       /*!< Session is with a worker task, the server task must not receive from or close it */
+    bool close_pending;                     /*!< Session is to be closed when the worker task is done with it */
 #ifdef CONFIG_HTTPD_WS_SUPPORT
     bool ws_handshake_done;                 /*!< True if it has done WebSocket handshake (if this socket is a valid WS) */
     bool ws_close;                          /*!< Set to true to close the socket later (when WS Close frame received) */
@@ -91,6 +101,15 @@ struct httpd_req_aux {
     char           *content_type;                   /*!< HTTP response's content type */
     bool            first_chunk_sent;               /*!< Used to indicate if first chunk sent */
     unsigned        req_hdrs_count;                 /*!< Count of total headers in request packet */
+    unsigned        req_hdrs_indexed;               /*!< Count of headers indexed in req_hdrs */
+    struct req_hdr {
+        uint32_t hash;                              /*!< Hash of the field name, case folded */
+        uint16_t field;                             /*!< Offset of the field name in scratch */
+        uint16_t field_len;                         /*!< Length of the field name */
+        uint16_t value;                             /*!< Offset of the null terminated value in scratch */
+        uint16_t value_len;                         /*!< Length of the value */
+    } req_hdrs[HTTPD_MAX_INDEXED_REQ_HDRS];         /*!< Headers in request packet, in order of appearance */
+    uint8_t         req_hdr_slots[HTTPD_REQ_HDR_SLOTS]; /*!< Hash table of req_hdrs, 1 + index or 0 for a free slot */
     unsigned        resp_hdrs_count;                /*!< Count of additional headers in response packet */
     struct resp_hdr {
         const char *field;
@@ -104,6 +123,17 @@ struct httpd_req_aux {
 #endif
 };
 
+/**
+ * @brief   Worker task for processing the requests of the sessions handed
+ *          over to it by the server task
+ */
+struct httpd_worker {
+    struct httpd_data *hd;                  /*!< Server instance the worker belongs to */
+    struct thread_data td;                  /*!< Information for the worker thread */
+    struct httpd_req req;                   /*!< The request being processed by this worker */
+    struct httpd_req_aux req_aux;           /*!< Additional data about the request kept unexposed */
+};
+
 /**
  * @brief   Server data for each instance. This is exposed publicly as
  *          httpd_handle_t but internal structure/members are kept private.
@@ -116,8 +146,13 @@ struct httpd_data {
     struct thread_data hd_td;               /*!< Information for the HTTPD thread */
     struct sock_db *hd_sd;                  /*!< The socket database */
     httpd_uri_t **hd_calls;                 /*!< Registered URI handlers */
+    struct httpd_uri_trie *hd_uri_trie;     /*!< Trie of the registered URIs, NULL if not in use */
+    omutex_t hd_uri_lock;                   /*!< Held while URI handlers are looked up or changed */
     struct httpd_req hd_req;                /*!< The current HTTPD request */
     struct httpd_req_aux hd_req_aux;        /*!< Additional data about the HTTPD request kept unexposed */
+    struct httpd_worker *hd_workers;        /*!< Worker tasks, NULL if requests are processed by the HTTPD thread */
+    oqueue_t hd_work_queue;                 /*!< Sessions with a request to be processed by a worker */
+    oqueue_t hd_done_queue;                 /*!< Sessions processed by a worker, to be given back to the HTTPD thread */
 
     /* Array of registered error handler functions */
     httpd_err_handler_func_t *err_handler_fns;
@@ -170,13 +205,16 @@ esp_err_t httpd_sess_new(struct httpd_data *hd, int newfd);
  * @brief   Processes incoming HTTP requests
  *
  * @param[in] hd    Server instance data
- * @param[in] clifd Descriptor of the client from which data is to be received
+ * @param[in] sd    Session of the client from which data is to be received
+ * @param[in] r     Request data to use, owned by the calling thread
+ * @param[in] ra    Auxiliary request data to use, owned by the calling thread
  *
  * @return
  *  - ESP_OK    : on successfully receiving, parsing and responding to a request
  *  - ESP_FAIL  : in case of failure in any of the stages of processing
  */
-esp_err_t httpd_sess_process(struct httpd_data *hd, int clifd);
+esp_err_t httpd_sess_process(struct httpd_data *hd, struct sock_db *sd,
+                             struct httpd_req *r, struct httpd_req_aux *ra);
 
 /**
  * @brief   Remove client descriptor from the session / socket database
@@ -292,12 +330,13 @@ esp_err_t httpd_sess_close_lru(struct httpd_data *hd);
  *          and invokes the appropriate one if found
  *
  * @param[in] hd  Server instance data for which handler needs to be invoked
+ * @param[in] r   The parsed request
  *
  * @return
  *  - ESP_OK    : if handler found and executed successfully
  *  - ESP_FAIL  : otherwise
  */
-esp_err_t httpd_uri(struct httpd_data *hd);
+esp_err_t httpd_uri(struct httpd_data *hd, struct httpd_req *r);
 
 /**
  * @brief   Unregister all URI handlers
@@ -347,24 +386,43 @@ bool httpd_validate_req_ptr(httpd_req_t *r);
  *
  * @param[in] hd  Server instance data
  * @param[in] sd  Pointer to socket which is needed for receiving TCP packets.
+ * @param[in] r   Request data to fill, owned by the calling thread
+ * @param[in] ra  Auxiliary request data to fill, owned by the calling thread
  *
  * @return
  *  - ESP_OK    : if request packet is valid
  *  - ESP_FAIL  : otherwise
  */
-esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd);
+esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd,
+                        struct httpd_req *r, struct httpd_req_aux *ra);
 
 /**
  * @brief   For an HTTP request, resets the resources allocated for it and
  *          purges any data left to be received
  *
  * @param[in] hd  Server instance data
+ * @param[in] r   The request to delete
  *
  * @return
  *  - ESP_OK    : if request packet deleted and resources cleaned.
  *  - ESP_FAIL  : otherwise.
  */
-esp_err_t httpd_req_delete(struct httpd_data *hd);
+esp_err_t httpd_req_delete(struct httpd_data *hd, struct httpd_req *r);
+
+/**
+ * @brief   Get the request data of the calling thread
+ *
+ * Requests are processed either by the HTTPD thread or, if worker tasks
+ * are configured, by the worker which the session was handed to. This
+ * is used by the APIs which can be called from inside a URI handler to
+ * find the request being handled.
+ *
+ * @param[in] hd  Server instance data
+ *
+ * @return  Request data of the worker if called from a worker task, else
+ *          the request data of the HTTPD thread
+ */
+struct httpd_req *httpd_req_of_thread(struct httpd_data *hd);
 
 /**
  * @brief   For handling HTTP errors by invoking registered
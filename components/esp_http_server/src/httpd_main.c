@@ -77,6 +77,7 @@ struct httpd_ctrl_data {
     enum httpd_ctrl_msg {
         HTTPD_CTRL_SHUTDOWN,
         HTTPD_CTRL_WORK,
+        HTTPD_CTRL_WORKER_DONE,
     } hc_msg;
     httpd_work_fn_t hc_work;
     void *hc_work_arg;
@@ -134,6 +135,164 @@ void *httpd_get_global_transport_ctx(httpd_handle_t handle)
     return ((struct httpd_data *)handle)->config.global_transport_ctx;
 }
 
+/* Session handed back to the HTTPD thread by a worker task */
+struct httpd_worker_result {
+    struct sock_db *sd;
+    esp_err_t ret;      /* Result of httpd_sess_process() */
+};
+
+struct httpd_req *httpd_req_of_thread(struct httpd_data *hd)
+{
+    if (hd->hd_workers) {
+        othread_t self = httpd_os_thread_handle();
+        for (int i = 0; i < hd->config.worker_count; i++) {
+            if (hd->hd_workers[i].td.handle == self) {
+                return &hd->hd_workers[i].req;
+            }
+        }
+    }
+    return &hd->hd_req;
+}
+
+static void httpd_worker_thread(void *arg)
+{
+    struct httpd_worker *wk = (struct httpd_worker *) arg;
+    struct httpd_data *hd = wk->hd;
+    wk->td.status = THREAD_RUNNING;
+
+    /* A NULL session is queued to stop the worker */
+    struct sock_db *sd;
+    while (httpd_os_queue_recv(hd->hd_work_queue, &sd, true) == OS_SUCCESS && sd != NULL) {
+        ESP_LOGD(TAG, LOG_FMT("processing socket %d"), sd->fd);
+        struct httpd_worker_result res = {
+            .sd  = sd,
+            .ret = httpd_sess_process(hd, sd, &wk->req, &wk->req_aux),
+        };
+
+        /* Hand the session back and wake up the HTTPD thread. If the
+         * control message gets lost, the result is still collected
+         * when the HTTPD thread processes the next control message */
+        httpd_os_queue_send(hd->hd_done_queue, &res);
+        struct httpd_ctrl_data msg = {
+            .hc_msg = HTTPD_CTRL_WORKER_DONE,
+        };
+        cs_send_to_ctrl_sock(hd->msg_fd, hd->config.ctrl_port, &msg, sizeof(msg));
+    }
+
+    ESP_LOGD(TAG, LOG_FMT("worker exiting"));
+    wk->td.status = THREAD_STOPPED;
+    httpd_os_thread_delete();
+}
+
+static void httpd_sess_to_worker(struct httpd_data *hd, struct sock_db *sd)
+{
+    ESP_LOGD(TAG, LOG_FMT("handing socket %d to a worker"), sd->fd);
+    /* The session stays out of select() until it is handed back,
+     * so that requests of a session are processed in order */
+    sd->worker_busy = true;
+    httpd_os_queue_send(hd->hd_work_queue, &sd);
+}
+
+/* Take back the sessions which the worker tasks are done with */
+static void httpd_collect_worker_results(struct httpd_data *hd)
+{
+    struct httpd_worker_result res;
+    while (httpd_os_queue_recv(hd->hd_done_queue, &res, false) == OS_SUCCESS) {
+        struct sock_db *sd = res.sd;
+        int fd = sd->fd;
+        sd->worker_busy = false;
+        if (res.ret != ESP_OK || sd->close_pending) {
+            ESP_LOGD(TAG, LOG_FMT("closing socket %d"), fd);
+            close(fd);
+            httpd_sess_delete(hd, fd);
+            continue;
+        }
+        httpd_sess_update_lru_counter(hd, fd);
+
+        /* Data un-received while parsing may hold a complete
+         * request, which select() would not report */
+        if (httpd_sess_pending(hd, fd)) {
+            httpd_sess_to_worker(hd, sd);
+        }
+    }
+}
+
+static esp_err_t httpd_workers_create(struct httpd_data *hd, const httpd_config_t *config)
+{
+    hd->hd_workers = calloc(config->worker_count, sizeof(struct httpd_worker));
+    if (!hd->hd_workers) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < config->worker_count; i++) {
+        struct httpd_worker *wk = &hd->hd_workers[i];
+        wk->hd = hd;
+        wk->req_aux.resp_hdrs = calloc(config->max_resp_headers, sizeof(struct resp_hdr));
+        if (!wk->req_aux.resp_hdrs) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    /* Every open session is in at most one of the queues at a time,
+     * and the work queue also takes one stop request per worker */
+    if (httpd_os_queue_create(&hd->hd_work_queue, config->max_open_sockets + config->worker_count,
+                              sizeof(struct sock_db *)) != OS_SUCCESS) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (httpd_os_queue_create(&hd->hd_done_queue, config->max_open_sockets,
+                              sizeof(struct httpd_worker_result)) != OS_SUCCESS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/* Frees what httpd_workers_create() allocated, even if it failed midway */
+static void httpd_workers_delete(struct httpd_data *hd, uint16_t worker_count)
+{
+    if (hd->hd_done_queue) {
+        httpd_os_queue_delete(hd->hd_done_queue);
+    }
+    if (hd->hd_work_queue) {
+        httpd_os_queue_delete(hd->hd_work_queue);
+    }
+    if (hd->hd_workers) {
+        for (int i = 0; i < worker_count; i++) {
+            free(hd->hd_workers[i].req_aux.resp_hdrs);
+        }
+        free(hd->hd_workers);
+        hd->hd_workers = NULL;
+    }
+}
+
+/* Stops the first 'count' workers and waits for them to exit */
+static void httpd_workers_stop(struct httpd_data *hd, int count)
+{
+    struct sock_db *stop = NULL;
+    for (int i = 0; i < count; i++) {
+        httpd_os_queue_send(hd->hd_work_queue, &stop);
+    }
+    for (int i = 0; i < count; i++) {
+        while (hd->hd_workers[i].td.status != THREAD_STOPPED) {
+            httpd_os_thread_sleep(10);
+        }
+    }
+}
+
+static esp_err_t httpd_workers_start(struct httpd_data *hd)
+{
+    for (int i = 0; i < hd->config.worker_count; i++) {
+        if (httpd_os_thread_create(&hd->hd_workers[i].td.handle, "httpd_worker",
+                                   hd->config.stack_size,
+                                   hd->config.task_priority,
+                                   httpd_worker_thread, &hd->hd_workers[i],
+                                   hd->config.core_id) != ESP_OK) {
+            ESP_LOGE(TAG, LOG_FMT("failed to launch worker %d"), i);
+            httpd_workers_stop(hd, i);
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
 static void httpd_close_all_sessions(struct httpd_data *hd)
 {
     int fd = -1;
@@ -144,38 +303,53 @@ static void httpd_close_all_sessions(struct httpd_data *hd)
     }
 }
 
+/* Process the pending control messages. Worker tasks send one for each session
+ * they hand back, so all of them are read at once, else they could fill up the
+ * control socket and later messages, like the one to shut down, would get lost */
 static void httpd_process_ctrl_msg(struct httpd_data *hd)
 {
     struct httpd_ctrl_data msg;
-    int ret = recv(hd->ctrl_fd, &msg, sizeof(msg), 0);
-    if (ret <= 0) {
-        ESP_LOGW(TAG, LOG_FMT("error in recv (%d)"), errno);
-        return;
-    }
-    if (ret != sizeof(msg)) {
-        ESP_LOGW(TAG, LOG_FMT("incomplete msg"));
-        return;
-    }
+    int flags = 0;
+    int ret;
+    /* Only the first message is known to be there */
+    while ((ret = recv(hd->ctrl_fd, &msg, sizeof(msg), flags)) > 0) {
+        flags = MSG_DONTWAIT;
+        if (ret != sizeof(msg)) {
+            ESP_LOGW(TAG, LOG_FMT("incomplete msg"));
+            continue;
+        }
 
-    switch (msg.hc_msg) {
-    case HTTPD_CTRL_WORK:
-        if (msg.hc_work) {
-            ESP_LOGD(TAG, LOG_FMT("work"));
-            (*msg.hc_work)(msg.hc_work_arg);
+        switch (msg.hc_msg) {
+        case HTTPD_CTRL_WORK:
+            if (msg.hc_work) {
+                ESP_LOGD(TAG, LOG_FMT("work"));
+                (*msg.hc_work)(msg.hc_work_arg);
+            }
+            break;
+        case HTTPD_CTRL_SHUTDOWN:
+            ESP_LOGD(TAG, LOG_FMT("shutdown"));
+            hd->hd_td.status = THREAD_STOPPING;
+            return;
+        case HTTPD_CTRL_WORKER_DONE:
+            /* Results are collected before the next select() */
+            ESP_LOGD(TAG, LOG_FMT("worker done"));
+            break;
+        default:
+            break;
         }
-        break;
-    case HTTPD_CTRL_SHUTDOWN:
-        ESP_LOGD(TAG, LOG_FMT("shutdown"));
-        hd->hd_td.status = THREAD_STOPPING;
-        break;
-    default:
-        break;
+    }
+    if (flags == 0) {
+        ESP_LOGW(TAG, LOG_FMT("error in recv (%d)"), errno);
     }
 }
 
 /* Manage in-coming connection or data requests */
 static esp_err_t httpd_server(struct httpd_data *hd)
 {
+    if (hd->hd_workers) {
+        httpd_collect_worker_results(hd);
+    }
+
     fd_set read_set;
     FD_ZERO(&read_set);
     if (hd->config.lru_purge_enable || httpd_is_sess_available(hd)) {
@@ -214,14 +388,24 @@ static esp_err_t httpd_server(struct httpd_data *hd)
      * sessions? */
     int fd = -1;
     while ((fd = httpd_sess_iterate(hd, fd)) != -1) {
+        struct sock_db *sd = httpd_sess_get(hd, fd);
+        if (sd->worker_busy) {
+            continue;
+        }
         if (FD_ISSET(fd, &read_set) || (httpd_sess_pending(hd, fd))) {
+            if (hd->hd_workers) {
+                httpd_sess_to_worker(hd, sd);
+                continue;
+            }
             ESP_LOGD(TAG, LOG_FMT("processing socket %d"), fd);
-            if (httpd_sess_process(hd, fd) != ESP_OK) {
+            if (httpd_sess_process(hd, sd, &hd->hd_req, &hd->hd_req_aux) != ESP_OK) {
                 ESP_LOGD(TAG, LOG_FMT("closing socket %d"), fd);
                 close(fd);
                 /* Delete session and update fd to that
                  * preceding the one being deleted */
                 fd = httpd_sess_delete(hd, fd);
+            } else {
+                httpd_sess_update_lru_counter(hd, fd);
             }
         }
     }
@@ -253,6 +437,11 @@ static void httpd_thread(void *arg)
     }
 
     ESP_LOGD(TAG, LOG_FMT("web server exiting"));
+    if (hd->hd_workers) {
+        /* Let the workers finish their requests before
+         * the sessions get closed */
+        httpd_workers_stop(hd, hd->config.worker_count);
+    }
     close(hd->msg_fd);
     cs_free_ctrl_sock(hd->ctrl_fd);
     httpd_close_all_sessions(hd);
@@ -359,6 +548,26 @@ static struct httpd_data *httpd_create(const httpd_config_t *config)
         free(hd);
         return NULL;
     }
+    if (config->worker_count && httpd_workers_create(hd, config) != ESP_OK) {
+        ESP_LOGE(TAG, LOG_FMT("Failed to allocate memory for HTTP worker tasks"));
+        httpd_workers_delete(hd, config->worker_count);
+        free(hd->err_handler_fns);
+        free(ra->resp_hdrs);
+        free(hd->hd_sd);
+        free(hd->hd_calls);
+        free(hd);
+        return NULL;
+    }
+    if (httpd_os_mutex_create(&hd->hd_uri_lock) != OS_SUCCESS) {
+        ESP_LOGE(TAG, LOG_FMT("Failed to create HTTP URI handler lock"));
+        httpd_workers_delete(hd, config->worker_count);
+        free(hd->err_handler_fns);
+        free(ra->resp_hdrs);
+        free(hd->hd_sd);
+        free(hd->hd_calls);
+        free(hd);
+        return NULL;
+    }
     /* Save the configuration for this instance */
     hd->config = *config;
     return hd;
@@ -368,12 +577,14 @@ static void httpd_delete(struct httpd_data *hd)
 {
     struct httpd_req_aux *ra = &hd->hd_req_aux;
     /* Free memory of httpd instance data */
+    httpd_workers_delete(hd, hd->config.worker_count);
     free(hd->err_handler_fns);
     free(ra->resp_hdrs);
     free(hd->hd_sd);
 
     /* Free registered URI handlers */
     httpd_unregister_all_uri_handlers(hd);
+    httpd_os_mutex_delete(hd->hd_uri_lock);
     free(hd->hd_calls);
     free(hd);
 }
@@ -413,12 +624,19 @@ esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
     }
 
     httpd_sess_init(hd);
+    if (hd->hd_workers && httpd_workers_start(hd) != ESP_OK) {
+        httpd_delete(hd);
+        return ESP_ERR_HTTPD_TASK;
+    }
     if (httpd_os_thread_create(&hd->hd_td.handle, "httpd",
                                hd->config.stack_size,
                                hd->config.task_priority,
                                httpd_thread, hd,
                                hd->config.core_id) != ESP_OK) {
         /* Failed to launch task */
+        if (hd->hd_workers) {
+            httpd_workers_stop(hd, hd->config.worker_count);
+        }
         httpd_delete(hd);
         return ESP_ERR_HTTPD_TASK;
     }
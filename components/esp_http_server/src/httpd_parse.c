@@ -14,6 +14,7 @@
 
 
 #include <stdlib.h>
+#include <ctype.h>
 #include <sys/param.h>
 #include <esp_log.h>
 #include <esp_err.h>
@@ -25,6 +26,9 @@
 
 static const char *TAG = "httpd_parse";
 
+/* Offsets of indexed request headers are kept as 16 bit values */
+_Static_assert(HTTPD_SCRATCH_BUF <= UINT16_MAX, "HTTPD_MAX_REQ_HDR_LEN and HTTPD_MAX_URI_LEN must not exceed 65535");
+
 typedef struct {
     /* Parser settings for http_parser_execute() */
     http_parser_settings settings;
@@ -54,6 +58,12 @@ typedef struct {
         size_t      length;
     } last;
 
+    /* Field of the header whose value is being parsed */
+    struct {
+        const char *at;
+        size_t      length;
+    } field;
+
     /* State variables */
     bool   paused;          /*!< Parser is paused */
     size_t pre_parsed;      /*!< Length of data to be skipped while parsing */
@@ -195,6 +205,44 @@ static size_t continue_parsing(http_parser *parser, size_t length)
     return length;
 }
 
+/* Case folded FNV-1a hash of a header field name */
+static uint32_t hdr_field_hash(const char *field, size_t length)
+{
+    uint32_t hash = 2166136261U;
+    while (length--) {
+        hash = (hash ^ (uint8_t) tolower((unsigned char) *field++)) * 16777619U;
+    }
+    return hash;
+}
+
+/* Adds the header which has just been parsed to the index of request
+ * headers, so that looking up a header by name needs no search through
+ * the scratch buffer. Headers after the first HTTPD_MAX_INDEXED_REQ_HDRS
+ * are left out of the index */
+static void index_hdr(parser_data_t *parser_data)
+{
+    struct httpd_req_aux *ra = parser_data->req->aux;
+
+    if (ra->req_hdrs_indexed == HTTPD_MAX_INDEXED_REQ_HDRS) {
+        return;
+    }
+
+    struct req_hdr *hdr = &ra->req_hdrs[ra->req_hdrs_indexed];
+    hdr->hash      = hdr_field_hash(parser_data->field.at, parser_data->field.length);
+    hdr->field     = parser_data->field.at - ra->scratch;
+    hdr->field_len = parser_data->field.length;
+    hdr->value     = parser_data->last.at - ra->scratch;
+    hdr->value_len = parser_data->last.length;
+
+    /* Linear probing keeps headers with the same
+     * field name in the order of their appearance */
+    unsigned slot = hdr->hash & (HTTPD_REQ_HDR_SLOTS - 1);
+    while (ra->req_hdr_slots[slot]) {
+        slot = (slot + 1) & (HTTPD_REQ_HDR_SLOTS - 1);
+    }
+    ra->req_hdr_slots[slot] = ++ra->req_hdrs_indexed;
+}
+
 /* http_parser callback on header field in HTTP request
  * May be invoked ATLEAST once every header field
  */
@@ -233,13 +281,14 @@ static esp_err_t cb_header_field(http_parser *parser, const char *at, size_t len
         char *term_start = (char *)parser_data->last.at + parser_data->last.length;
         memset(term_start, '\0', at - term_start);
 
+        /* Index the last header and increment header count */
+        index_hdr(parser_data);
+        ra->req_hdrs_count++;
+
         /* Store current values of the parser callback arguments */
         parser_data->last.at     = at;
         parser_data->last.length = 0;
         parser_data->status      = PARSING_HDR_FIELD;
-
-        /* Increment header count */
-        ra->req_hdrs_count++;
     } else if (parser_data->status != PARSING_HDR_FIELD) {
         ESP_LOGE(TAG, LOG_FMT("unexpected state transition"));
         parser_data->error = HTTPD_500_INTERNAL_SERVER_ERROR;
@@ -263,6 +312,10 @@ static esp_err_t cb_header_value(http_parser *parser, const char *at, size_t len
 
     /* Check previous status */
     if (parser_data->status == PARSING_HDR_FIELD) {
+        /* Keep the field for indexing the header once its value is parsed */
+        parser_data->field.at     = parser_data->last.at;
+        parser_data->field.length = parser_data->last.length;
+
         /* Store current values of the parser callback arguments */
         parser_data->last.at     = at;
         parser_data->last.length = 0;
@@ -318,6 +371,9 @@ static esp_err_t cb_headers_complete(http_parser *parser)
             return ESP_FAIL;
         }
     } else if (parser_data->status == PARSING_HDR_VALUE) {
+        /* Index the last header while last.at still points to its value */
+        index_hdr(parser_data);
+
         /* Locate end of last header */
         char *at = (char *)parser_data->last.at + parser_data->last.length;
 
@@ -622,9 +678,8 @@ static void parse_init(httpd_req_t *r, http_parser *parser, parser_data_t *data)
 
 /* Function that receives TCP data and runs parser on it
  */
-static esp_err_t httpd_parse_req(struct httpd_data *hd)
+static esp_err_t httpd_parse_req(struct httpd_data *hd, httpd_req_t *r)
 {
-    httpd_req_t *r = &hd->hd_req;
     int blk_len,  offset;
     http_parser   parser;
     parser_data_t parser_data;
@@ -664,7 +719,7 @@ static esp_err_t httpd_parse_req(struct httpd_data *hd)
     } while (parser_data.status != PARSING_COMPLETE);
 
     ESP_LOGD(TAG, LOG_FMT("parsing complete"));
-    return httpd_uri(hd);
+    return httpd_uri(hd, r);
 }
 
 static void init_req(httpd_req_t *r, httpd_config_t *config)
@@ -689,6 +744,8 @@ static void init_req_aux(struct httpd_req_aux *ra, httpd_config_t *config)
     ra->content_type = 0;
     ra->first_chunk_sent = 0;
     ra->req_hdrs_count = 0;
+    ra->req_hdrs_indexed = 0;
+    memset(ra->req_hdr_slots, 0, sizeof(ra->req_hdr_slots));
     ra->resp_hdrs_count = 0;
 #if CONFIG_HTTPD_WS_SUPPORT
     ra->ws_handshake_detect = false;
@@ -727,16 +784,15 @@ static void httpd_req_cleanup(httpd_req_t *r)
 /* Function that processes incoming TCP data and
  * updates the http request data httpd_req_t
  */
-esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd)
+esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd,
+                        httpd_req_t *r, struct httpd_req_aux *ra)
 {
-    httpd_req_t *r = &hd->hd_req;
     init_req(r, &hd->config);
-    init_req_aux(&hd->hd_req_aux, &hd->config);
+    init_req_aux(ra, &hd->config);
     r->handle = hd;
-    r->aux = &hd->hd_req_aux;
+    r->aux = ra;
 
     /* Associate the request to the socket */
-    struct httpd_req_aux *ra = r->aux;
     ra->sd = sd;
 
     /* Set defaults */
@@ -786,7 +842,7 @@ esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd)
 #endif
 
     /* Parse request */
-    ret = httpd_parse_req(hd);
+    ret = httpd_parse_req(hd, r);
     if (ret != ESP_OK) {
         httpd_req_cleanup(r);
     }
@@ -795,9 +851,8 @@ esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd)
 
 /* Function that resets the http request data
  */
-esp_err_t httpd_req_delete(struct httpd_data *hd)
+esp_err_t httpd_req_delete(struct httpd_data *hd, httpd_req_t *r)
 {
-    httpd_req_t *r = &hd->hd_req;
     struct httpd_req_aux *ra = r->aux;
 
     /* Finish off reading any pending/leftover data */
@@ -836,6 +891,11 @@ bool httpd_validate_req_ptr(httpd_req_t *r)
     if (r) {
         struct httpd_data *hd = (struct httpd_data *) r->handle;
         if (hd) {
+            /* With worker tasks, check if this function is running
+             * in the context of the worker handling this request */
+            if (hd->hd_workers) {
+                return r == httpd_req_of_thread(hd);
+            }
             /* Check if this function is running in the context of
              * the correct httpd server thread */
             if (httpd_os_thread_handle() == hd->hd_td.handle) {
@@ -954,22 +1014,51 @@ esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
     return ESP_ERR_NOT_FOUND;
 }
 
-/* Get the length of the value string of a header request field */
-size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+/* Find the value of a request header field. Returns the null
+ * terminated value and sets its length, or returns NULL if
+ * the request has no such header */
+static const char *find_hdr_value(struct httpd_req_aux *ra, const char *field, size_t *value_len)
 {
-    if (r == NULL || field == NULL) {
-        return 0;
+    size_t   field_len = strlen(field);
+    uint32_t hash      = hdr_field_hash(field, field_len);
+    unsigned slot      = hash & (HTTPD_REQ_HDR_SLOTS - 1);
+    unsigned index;
+
+    /* Once a response is sent the scratch buffer has been overwritten,
+     * and the header count cleared, so the index must not be used */
+    if (ra->req_hdrs_count == 0) {
+        return NULL;
     }
 
-    if (!httpd_valid_req(r)) {
-        return 0;
+    /* Probe the index of headers. The table always has free slots,
+     * which end the probing when the field is not found */
+    while ((index = ra->req_hdr_slots[slot]) != 0) {
+        const struct req_hdr *hdr = &ra->req_hdrs[index - 1];
+        if ((hdr->hash == hash) && (hdr->field_len == field_len) &&
+            (strncasecmp(ra->scratch + hdr->field, field, field_len) == 0)) {
+            *value_len = hdr->value_len;
+            return ra->scratch + hdr->value;
+        }
+        slot = (slot + 1) & (HTTPD_REQ_HDR_SLOTS - 1);
     }
 
-    struct httpd_req_aux *ra = r->aux;
-    const char   *hdr_ptr = ra->scratch;         /*!< Request headers are kept in scratch buffer */
-    unsigned      count   = ra->req_hdrs_count;  /*!< Count set during parsing  */
+    if (ra->req_hdrs_count == ra->req_hdrs_indexed) {
+        return NULL;
+    }
+
+    /* Search the headers which did not fit in the index, beginning
+     * after the null terminated value of the last indexed header */
+    const struct req_hdr *last = &ra->req_hdrs[ra->req_hdrs_indexed - 1];
+    const char   *hdr_ptr = ra->scratch + last->value + last->value_len;
+    unsigned      count   = ra->req_hdrs_count - ra->req_hdrs_indexed;
 
     while (count--) {
+        /* Skip all null characters (with which the line
+         * terminators had been overwritten) */
+        while (*hdr_ptr == '\0') {
+            hdr_ptr++;
+        }
+
         /* Search for the ':' character. Else, it would mean
          * that the field is invalid
          */
@@ -982,18 +1071,10 @@ size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
          * Compare lengths first as field from header is not
          * null terminated (has ':' in the end).
          */
-        if ((val_ptr - hdr_ptr != strlen(field)) ||
-            (strncasecmp(hdr_ptr, field, strlen(field)))) {
-            if (count) {
-                /* Jump to end of header field-value string */
-                hdr_ptr = 1 + strchr(hdr_ptr, '\0');
-
-                /* Skip all null characters (with which the line
-                 * terminators had been overwritten) */
-                while (*hdr_ptr == '\0') {
-                    hdr_ptr++;
-                }
-            }
+        if ((val_ptr - hdr_ptr != field_len) ||
+            (strncasecmp(hdr_ptr, field, field_len))) {
+            /* Jump to end of header field-value string */
+            hdr_ptr = strchr(hdr_ptr, '\0');
             continue;
         }
 
@@ -1004,9 +1085,28 @@ size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
         while ((*val_ptr != '\0') && (*val_ptr == ' ')) {
             val_ptr++;
         }
-        return strlen(val_ptr);
+        *value_len = strlen(val_ptr);
+        return val_ptr;
     }
-    return 0;
+    return NULL;
+}
+
+/* Get the length of the value string of a header request field */
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+    if (r == NULL || field == NULL) {
+        return 0;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return 0;
+    }
+
+    size_t value_len;
+    if (find_hdr_value(r->aux, field, &value_len) == NULL) {
+        return 0;
+    }
+    return value_len;
 }
 
 /* Get the value of a field from the request headers */
@@ -1020,58 +1120,19 @@ esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *v
         return ESP_ERR_HTTPD_INVALID_REQ;
     }
 
-    struct httpd_req_aux *ra = r->aux;
-    const char   *hdr_ptr = ra->scratch;         /*!< Request headers are kept in scratch buffer */
-    unsigned     count    = ra->req_hdrs_count;  /*!< Count set during parsing  */
-    const size_t buf_len  = val_size;
-
-    while (count--) {
-        /* Search for the ':' character. Else, it would mean
-         * that the field is invalid
-         */
-        const char *val_ptr = strchr(hdr_ptr, ':');
-        if (!val_ptr) {
-            break;
-        }
-
-        /* If the field, does not match, continue searching.
-         * Compare lengths first as field from header is not
-         * null terminated (has ':' in the end).
-         */
-        if ((val_ptr - hdr_ptr != strlen(field)) ||
-            (strncasecmp(hdr_ptr, field, strlen(field)))) {
-            if (count) {
-                /* Jump to end of header field-value string */
-                hdr_ptr = 1 + strchr(hdr_ptr, '\0');
-
-                /* Skip all null characters (with which the line
-                 * terminators had been overwritten) */
-                while (*hdr_ptr == '\0') {
-                    hdr_ptr++;
-                }
-            }
-            continue;
-        }
-
-        /* Skip ':' */
-        val_ptr++;
-
-        /* Skip preceding space */
-        while ((*val_ptr != '\0') && (*val_ptr == ' ')) {
-            val_ptr++;
-        }
-
-        /* Get the NULL terminated value and copy it to the caller's buffer. */
-        strlcpy(val, val_ptr, buf_len);
+    size_t value_len;
+    const char *value = find_hdr_value(r->aux, field, &value_len);
+    if (value == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
 
-        /* Update value length, including one byte for null */
-        val_size = strlen(val_ptr) + 1;
+    /* Get the NULL terminated value and copy it to the caller's buffer. */
+    strlcpy(val, value, val_size);
 
-        /* If buffer length is smaller than needed, return truncation error */
-        if (buf_len < val_size) {
-            return ESP_ERR_HTTPD_RESULT_TRUNC;
-        }
-        return ESP_OK;
+    /* If buffer length is smaller than needed
+     * (including one byte for null), return truncation error */
+    if (val_size < value_len + 1) {
+        return ESP_ERR_HTTPD_RESULT_TRUNC;
     }
-    return ESP_ERR_NOT_FOUND;
+    return ESP_OK;
 }
@@ -41,10 +41,11 @@ struct sock_db *httpd_sess_get(struct httpd_data *hd, int sockfd)
 
     /* Check if called inside a request handler, and the
      * session sockfd in use is same as the parameter */
-    if ((hd->hd_req_aux.sd) && (hd->hd_req_aux.sd->fd == sockfd)) {
+    struct httpd_req_aux *ra = httpd_req_of_thread(hd)->aux;
+    if ((ra) && (ra->sd) && (ra->sd->fd == sockfd)) {
         /* Just return the pointer to the sock_db
          * corresponding to the request */
-        return hd->hd_req_aux.sd;
+        return ra->sd;
     }
 
     int i;
@@ -111,9 +112,10 @@ void *httpd_sess_get_ctx(httpd_handle_t handle, int sockfd)
     /* Check if the function has been called from inside a
      * request handler, in which case fetch the context from
      * the httpd_req_t structure */
-    struct httpd_data *hd = (struct httpd_data *) handle;
-    if (hd->hd_req_aux.sd == sd) {
-        return hd->hd_req.sess_ctx;
+    struct httpd_req *r = httpd_req_of_thread((struct httpd_data *) handle);
+    struct httpd_req_aux *ra = r->aux;
+    if (ra && ra->sd == sd) {
+        return r->sess_ctx;
     }
 
     return sd->ctx;
@@ -129,18 +131,19 @@ void httpd_sess_set_ctx(httpd_handle_t handle, int sockfd, void *ctx, httpd_free
     /* Check if the function has been called from inside a
      * request handler, in which case set the context inside
      * the httpd_req_t structure */
-    struct httpd_data *hd = (struct httpd_data *) handle;
-    if (hd->hd_req_aux.sd == sd) {
-        if (hd->hd_req.sess_ctx != ctx) {
+    struct httpd_req *r = httpd_req_of_thread((struct httpd_data *) handle);
+    struct httpd_req_aux *ra = r->aux;
+    if (ra && ra->sd == sd) {
+        if (r->sess_ctx != ctx) {
             /* Don't free previous context if it is in sockdb
              * as it will be freed inside httpd_req_cleanup() */
-            if (sd->ctx != hd->hd_req.sess_ctx) {
+            if (sd->ctx != r->sess_ctx) {
                 /* Free previous context */
-                httpd_sess_free_ctx(hd->hd_req.sess_ctx, hd->hd_req.free_ctx);
+                httpd_sess_free_ctx(r->sess_ctx, r->free_ctx);
             }
-            hd->hd_req.sess_ctx = ctx;
+            r->sess_ctx = ctx;
         }
-        hd->hd_req.free_ctx = free_fn;
+        r->free_ctx = free_fn;
         return;
     }
 
@@ -184,7 +187,9 @@ void httpd_sess_set_descriptors(struct httpd_data *hd,
     int i;
     *maxfd = -1;
     for (i = 0; i < hd->config.max_open_sockets; i++) {
-        if (hd->hd_sd[i].fd != -1) {
+        /* Sessions with a worker task are not received from
+         * until the worker is done with them */
+        if (hd->hd_sd[i].fd != -1 && !hd->hd_sd[i].worker_busy) {
             FD_SET(hd->hd_sd[i].fd, fdset);
             if (hd->hd_sd[i].fd > *maxfd) {
                 *maxfd = hd->hd_sd[i].fd;
@@ -208,7 +213,7 @@ static inline uint64_t httpd_sess_get_lru_counter(void)
 void httpd_sess_delete_invalid(struct httpd_data *hd)
 {
     for (int i = 0; i < hd->config.max_open_sockets; i++) {
-        if (hd->hd_sd[i].fd != -1 && !fd_is_valid(hd->hd_sd[i].fd)) {
+        if (hd->hd_sd[i].fd != -1 && !hd->hd_sd[i].worker_busy && !fd_is_valid(hd->hd_sd[i].fd)) {
             ESP_LOGW(TAG, LOG_FMT("Closing invalid socket %d"), hd->hd_sd[i].fd);
             httpd_sess_delete(hd, hd->hd_sd[i].fd);
         }
@@ -293,23 +298,18 @@ bool httpd_sess_pending(struct httpd_data *hd, int fd)
  * value is returned, everything related to this socket will be
  * cleaned up and the socket will be closed.
  */
-esp_err_t httpd_sess_process(struct httpd_data *hd, int newfd)
+esp_err_t httpd_sess_process(struct httpd_data *hd, struct sock_db *sd,
+                             struct httpd_req *r, struct httpd_req_aux *ra)
 {
-    struct sock_db *sd = httpd_sess_get(hd, newfd);
-    if (! sd) {
-        return ESP_FAIL;
-    }
-
     ESP_LOGD(TAG, LOG_FMT("httpd_req_new"));
-    if (httpd_req_new(hd, sd) != ESP_OK) {
+    if (httpd_req_new(hd, sd, r, ra) != ESP_OK) {
         return ESP_FAIL;
     }
     ESP_LOGD(TAG, LOG_FMT("httpd_req_delete"));
-    if (httpd_req_delete(hd) != ESP_OK) {
+    if (httpd_req_delete(hd, r) != ESP_OK) {
         return ESP_FAIL;
     }
     ESP_LOGD(TAG, LOG_FMT("success"));
-    sd->lru_counter = httpd_sess_get_lru_counter();
     return ESP_OK;
 }
 
@@ -384,6 +384,13 @@ static void httpd_sess_close(void *arg)
             ESP_LOGD(TAG, "Skipping session close for %d as it seems to be a race condition", sock_db->fd);
             return;
         }
+        if (sock_db->worker_busy) {
+            /* The HTTPD thread closes the session when
+             * the worker task hands it back */
+            ESP_LOGD(TAG, LOG_FMT("deferring close of %d until its worker is done"), sock_db->fd);
+            sock_db->close_pending = true;
+            return;
+        }
         int fd = sock_db->fd;
         struct httpd_data *hd = (struct httpd_data *) sock_db->handle;
         httpd_sess_delete(hd, fd);
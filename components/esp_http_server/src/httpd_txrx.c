@@ -14,6 +14,10 @@
 
 
 #include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
 #include <esp_log.h>
 #include <esp_err.h>
 
@@ -22,6 +26,9 @@
 
 static const char *TAG = "httpd_txrx";
 
+/* Size of the regions of a partition mapped at a time for sending */
+#define HTTPD_PARTITION_MAP_WINDOW  (4 * SPI_FLASH_MMU_PAGE_SIZE)
+
 esp_err_t httpd_sess_set_send_override(httpd_handle_t hd, int sockfd, httpd_send_func_t send_func)
 {
     struct sock_db *sess = httpd_sess_get(hd, sockfd);
@@ -232,34 +239,15 @@ esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
     return ESP_OK;
 }
 
-esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+/* Send the essential headers which have been formatted into the scratch
+ * buffer, followed by the additional headers set with httpd_resp_set_hdr()
+ * and the end of the header section */
+static esp_err_t httpd_send_resp_hdrs(httpd_req_t *r)
 {
-    if (r == NULL) {
-        return ESP_ERR_INVALID_ARG;
-    }
-
-    if (!httpd_valid_req(r)) {
-        return ESP_ERR_HTTPD_INVALID_REQ;
-    }
-
     struct httpd_req_aux *ra = r->aux;
-    const char *httpd_hdr_str = "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\n";
     const char *colon_separator = ": ";
     const char *cr_lf_seperator = "\r\n";
 
-    if (buf_len == HTTPD_RESP_USE_STRLEN) {
-        buf_len = strlen(buf);
-    }
-
-    /* Request headers are no longer available */
-    ra->req_hdrs_count = 0;
-
-    /* Size of essential headers is limited by scratch buffer size */
-    if (snprintf(ra->scratch, sizeof(ra->scratch), httpd_hdr_str,
-                 ra->status, ra->content_type, buf_len) >= sizeof(ra->scratch)) {
-        return ESP_ERR_HTTPD_RESP_HDR;
-    }
-
     /* Sending essential headers */
     if (httpd_send_all(r, ra->scratch, strlen(ra->scratch)) != ESP_OK) {
         return ESP_ERR_HTTPD_RESP_SEND;
@@ -289,6 +277,39 @@ esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
     if (httpd_send_all(r, cr_lf_seperator, strlen(cr_lf_seperator)) != ESP_OK) {
         return ESP_ERR_HTTPD_RESP_SEND;
     }
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    if (r == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
+
+    struct httpd_req_aux *ra = r->aux;
+    const char *httpd_hdr_str = "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\n";
+
+    if (buf_len == HTTPD_RESP_USE_STRLEN) {
+        buf_len = strlen(buf);
+    }
+
+    /* Request headers are no longer available */
+    ra->req_hdrs_count = 0;
+
+    /* Size of essential headers is limited by scratch buffer size */
+    if (snprintf(ra->scratch, sizeof(ra->scratch), httpd_hdr_str,
+                 ra->status, ra->content_type, buf_len) >= sizeof(ra->scratch)) {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+
+    esp_err_t ret = httpd_send_resp_hdrs(r);
+    if (ret != ESP_OK) {
+        return ret;
+    }
 
     /* Sending content */
     if (buf && buf_len) {
@@ -315,8 +336,6 @@ esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len
 
     struct httpd_req_aux *ra = r->aux;
     const char *httpd_chunked_hdr_str = "HTTP/1.1 %s\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\n";
-    const char *colon_separator = ": ";
-    const char *cr_lf_seperator = "\r\n";
 
     /* Request headers are no longer available */
     ra->req_hdrs_count = 0;
@@ -328,34 +347,9 @@ esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len
             return ESP_ERR_HTTPD_RESP_HDR;
         }
 
-        /* Sending essential headers */
-        if (httpd_send_all(r, ra->scratch, strlen(ra->scratch)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-
-        /* Sending additional headers based on set_header */
-        for (unsigned i = 0; i < ra->resp_hdrs_count; i++) {
-            /* Send header field */
-            if (httpd_send_all(r, ra->resp_hdrs[i].field, strlen(ra->resp_hdrs[i].field)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
-            }
-            /* Send ': ' */
-            if (httpd_send_all(r, colon_separator, strlen(colon_separator)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
-            }
-            /* Send header value */
-            if (httpd_send_all(r, ra->resp_hdrs[i].value, strlen(ra->resp_hdrs[i].value)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
-            }
-            /* Send CR + LF */
-            if (httpd_send_all(r, cr_lf_seperator, strlen(cr_lf_seperator)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
-            }
-        }
-
-        /* End header section */
-        if (httpd_send_all(r, cr_lf_seperator, strlen(cr_lf_seperator)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
+        esp_err_t ret = httpd_send_resp_hdrs(r);
+        if (ret != ESP_OK) {
+            return ret;
         }
         ra->first_chunk_sent = true;
     }
@@ -380,6 +374,224 @@ esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len
     return ESP_OK;
 }
 
+/* Parse a decimal number, returning the character following it,
+ * or NULL if there is no number or it does not fit in size_t */
+static const char *httpd_parse_size(const char *str, size_t *value)
+{
+    const char *start = str;
+
+    *value = 0;
+    while (*str >= '0' && *str <= '9') {
+        size_t digit = *str++ - '0';
+        if (*value > (SIZE_MAX - digit) / 10) {
+            return NULL;
+        }
+        *value = *value * 10 + digit;
+    }
+    return (str == start) ? NULL : str;
+}
+
+/* Parse the value of a Range request header into the offset and length of
+ * the range within content of the given size. Only a single byte range is
+ * supported, for anything else ESP_ERR_NOT_FOUND is returned and the whole
+ * content is to be sent. ESP_ERR_INVALID_SIZE is returned if the range
+ * lies beyond the end of the content */
+static esp_err_t httpd_parse_range(const char *range, size_t size, size_t *offset, size_t *len)
+{
+    size_t first, last;
+
+    if (strncasecmp(range, "bytes=", strlen("bytes=")) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    range += strlen("bytes=");
+
+    if (*range == '-') {
+        /* Suffix range, of the last bytes of the content */
+        range = httpd_parse_size(range + 1, &last);
+        if (range == NULL || *range != '\0') {
+            return ESP_ERR_NOT_FOUND;
+        }
+        if (last == 0 || size == 0) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        *len = MIN(last, size);
+        *offset = size - *len;
+        return ESP_OK;
+    }
+
+    range = httpd_parse_size(range, &first);
+    if (range == NULL || *range++ != '-') {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (*range == '\0') {
+        /* Range up to the end of the content */
+        last = SIZE_MAX;
+    } else {
+        range = httpd_parse_size(range, &last);
+        if (range == NULL || *range != '\0' || last < first) {
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+
+    if (first >= size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *offset = first;
+    *len = MIN(last, size - 1) - first + 1;
+    return ESP_OK;
+}
+
+/* Send the headers of a response with content of known size. If the status
+ * is still 200 and the request asks for a single byte range of the content,
+ * a 206 response with that range is sent, or a 416 response with no content
+ * if the range lies beyond the end of the content. The part of the content
+ * which is then to be sent is returned in offset and len */
+static esp_err_t httpd_resp_send_sized_hdrs(httpd_req_t *r, size_t size, size_t *offset, size_t *len)
+{
+    struct httpd_req_aux *ra = r->aux;
+    esp_err_t range_ret = ESP_ERR_NOT_FOUND;
+    char range[48];
+    int hdr_len;
+
+    *offset = 0;
+    *len = size;
+
+    if (strcmp(ra->status, HTTPD_200) == 0 &&
+        httpd_req_get_hdr_value_str(r, "Range", range, sizeof(range)) == ESP_OK) {
+        range_ret = httpd_parse_range(range, size, offset, len);
+    }
+
+    /* Request headers are no longer available */
+    ra->req_hdrs_count = 0;
+
+    /* Size of essential headers is limited by scratch buffer size */
+    if (range_ret == ESP_OK) {
+        hdr_len = snprintf(ra->scratch, sizeof(ra->scratch),
+                           "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n"
+                           "Content-Range: bytes %u-%u/%u\r\n",
+                           HTTPD_206, ra->content_type, (unsigned) *len,
+                           (unsigned) *offset, (unsigned) (*offset + *len - 1), (unsigned) size);
+    } else if (range_ret == ESP_ERR_INVALID_SIZE) {
+        ESP_LOGD(TAG, LOG_FMT("range not satisfiable = %s"), range);
+        *len = 0;
+        hdr_len = snprintf(ra->scratch, sizeof(ra->scratch),
+                           "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: 0\r\n"
+                           "Content-Range: bytes */%u\r\n",
+                           HTTPD_416, ra->content_type, (unsigned) size);
+    } else {
+        hdr_len = snprintf(ra->scratch, sizeof(ra->scratch),
+                           "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n"
+                           "Accept-Ranges: bytes\r\n",
+                           ra->status, ra->content_type, (unsigned) size);
+    }
+    if (hdr_len >= sizeof(ra->scratch)) {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+    return httpd_send_resp_hdrs(r);
+}
+
+esp_err_t httpd_resp_send_file(httpd_req_t *r, int fd)
+{
+    if (r == NULL || fd < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
+
+    char *buf = malloc(CONFIG_HTTPD_SEND_FILE_BUF_LEN);
+    if (buf == NULL) {
+        ESP_LOGE(TAG, LOG_FMT("failed to allocate buffer for file"));
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_t offset, len;
+        ret = httpd_resp_send_sized_hdrs(r, st.st_size, &offset, &len);
+        if (ret == ESP_OK && len && lseek(fd, offset, SEEK_SET) != (off_t) offset) {
+            ESP_LOGE(TAG, LOG_FMT("error in lseek : %d"), errno);
+            ret = ESP_FAIL;
+        }
+        while (ret == ESP_OK && len) {
+            ssize_t nbytes = read(fd, buf, MIN(len, CONFIG_HTTPD_SEND_FILE_BUF_LEN));
+            if (nbytes <= 0) {
+                /* The file must not end before the Content-Length sent */
+                ESP_LOGE(TAG, LOG_FMT("error in read : %d"), nbytes < 0 ? errno : 0);
+                ret = ESP_FAIL;
+            } else if (httpd_send_all(r, buf, nbytes) != ESP_OK) {
+                ret = ESP_ERR_HTTPD_RESP_SEND;
+            } else {
+                len -= nbytes;
+            }
+        }
+    } else {
+        /* The size is not known, send the file
+         * in chunks until it has been read */
+        ssize_t nbytes;
+        do {
+            nbytes = read(fd, buf, CONFIG_HTTPD_SEND_FILE_BUF_LEN);
+            if (nbytes < 0) {
+                ESP_LOGE(TAG, LOG_FMT("error in read : %d"), errno);
+                ret = ESP_FAIL;
+                break;
+            }
+            ret = httpd_resp_send_chunk(r, buf, nbytes);
+        } while (ret == ESP_OK && nbytes > 0);
+    }
+
+    free(buf);
+    return ret;
+}
+
+esp_err_t httpd_resp_send_partition(httpd_req_t *r, const esp_partition_t *partition,
+                                    size_t offset, size_t len)
+{
+    if (r == NULL || partition == NULL ||
+        offset > partition->size || len > partition->size - offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
+
+    size_t range_offset;
+    esp_err_t ret = httpd_resp_send_sized_hdrs(r, len, &range_offset, &len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    offset += range_offset;
+
+    while (len) {
+        /* Windows end at multiples of the window size in flash,
+         * so that each maps no more MMU pages than necessary */
+        size_t window = HTTPD_PARTITION_MAP_WINDOW -
+                        (partition->address + offset) % HTTPD_PARTITION_MAP_WINDOW;
+        window = MIN(window, len);
+
+        const void *data;
+        spi_flash_mmap_handle_t handle;
+        ret = esp_partition_mmap(partition, offset, window, SPI_FLASH_MMAP_DATA, &data, &handle);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, LOG_FMT("error in esp_partition_mmap : %s"), esp_err_to_name(ret));
+            return ret;
+        }
+
+        /* Sending content directly from the mapped flash */
+        ret = httpd_send_all(r, data, window);
+        spi_flash_munmap(handle);
+        if (ret != ESP_OK) {
+            return ESP_ERR_HTTPD_RESP_SEND;
+        }
+        offset += window;
+        len -= window;
+    }
+    return ESP_OK;
+}
+
 esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *usr_msg)
 {
     esp_err_t ret;
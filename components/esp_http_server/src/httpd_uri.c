@@ -14,6 +14,8 @@
 
 
 #include <errno.h>
+#include <stdlib.h>
+#include <sys/param.h>
 #include <esp_log.h>
 #include <esp_err.h>
 #include <http_parser.h>
@@ -88,6 +90,260 @@ bool httpd_uri_match_wildcard(const char *template, const char *uri, size_t len)
     }
 }
 
+/* Node of the trie of registered URIs. The label of a node is the part
+ * of a URI following the label of its parent node, and points into the
+ * URI string of a registered handler. Nodes are referred to by their
+ * index in the trie, where 0 (the root) stands for no child or sibling */
+struct uri_trie_node {
+    const char *label;
+    uint16_t    label_len;
+    uint16_t    child;          /*!< First child node */
+    uint16_t    sibling;        /*!< Next node with the same parent */
+    uint16_t    exact;          /*!< 1 + first entry of handlers of URIs ending at this node, 0 if none */
+    uint16_t    prefix;         /*!< 1 + first entry of handlers of all URIs beginning with this node */
+};
+
+/* Entry in a list of handlers of a node, in the order of registration */
+struct uri_trie_entry {
+    uint16_t call;              /*!< Index of the handler in hd_calls */
+    uint16_t next;              /*!< 1 + next entry in the list, 0 if last */
+};
+
+struct httpd_uri_trie {
+    struct uri_trie_node  *nodes;
+    struct uri_trie_entry *entries;
+    unsigned               node_count;
+    unsigned               entry_count;
+};
+
+/* Add the handler at index call of hd_calls to the trie, for matching
+ * the URI uri[0..len) exactly, or any URI beginning with it if prefix */
+static bool uri_trie_add(struct httpd_uri_trie *trie, const char *uri, size_t len,
+                         uint16_t call, bool prefix)
+{
+    struct uri_trie_node *nodes = trie->nodes;
+    unsigned node = 0;
+    size_t   pos  = 0;
+
+    if (len > UINT16_MAX) {
+        return false;
+    }
+
+    while (pos < len) {
+        /* Find the child whose label begins with the next character */
+        uint16_t *link = &nodes[node].child;
+        while (*link && nodes[*link].label[0] != uri[pos]) {
+            link = &nodes[*link].sibling;
+        }
+
+        if (*link == 0) {
+            /* No such child, the rest of the URI becomes the label of a new one */
+            unsigned leaf = trie->node_count++;
+            nodes[leaf].label     = uri + pos;
+            nodes[leaf].label_len = len - pos;
+            *link = leaf;
+            node  = leaf;
+            break;
+        }
+
+        unsigned child  = *link;
+        size_t   common = 1;
+        while (common < nodes[child].label_len && pos + common < len &&
+               nodes[child].label[common] == uri[pos + common]) {
+            common++;
+        }
+
+        if (common < nodes[child].label_len) {
+            /* Split the child, by putting a node with the common part
+             * of the label in its place and making the child its only
+             * child, with the rest of the label */
+            unsigned split = trie->node_count++;
+            nodes[split].label      = nodes[child].label;
+            nodes[split].label_len  = common;
+            nodes[split].child      = child;
+            nodes[split].sibling    = nodes[child].sibling;
+            nodes[child].label     += common;
+            nodes[child].label_len -= common;
+            nodes[child].sibling    = 0;
+            *link = split;
+            child = split;
+        }
+        node = child;
+        pos += common;
+    }
+
+    /* Append an entry to the list of handlers of the node. Handlers are
+     * added in the order of registration, keeping the list in that order */
+    uint16_t *link = prefix ? &nodes[node].prefix : &nodes[node].exact;
+    while (*link) {
+        link = &trie->entries[*link - 1].next;
+    }
+    trie->entries[trie->entry_count].call = call;
+    *link = ++trie->entry_count;
+    return true;
+}
+
+/* Add the URIs matched by a handler to the trie. A wildcard template
+ * with an optional character is added both with and without it */
+static bool uri_trie_add_handler(struct httpd_uri_trie *trie, const char *template,
+                                 uint16_t call, bool wildcard)
+{
+    size_t tpl_len = strlen(template);
+    if (!wildcard) {
+        return uri_trie_add(trie, template, tpl_len, call, false);
+    }
+
+    /* Check for trailing question mark and asterisk, as in httpd_uri_match_wildcard() */
+    const char last = (const char) (tpl_len > 0 ? template[tpl_len - 1] : 0);
+    const char prevlast = (const char) (tpl_len > 1 ? template[tpl_len - 2] : 0);
+    const bool asterisk = last == '*' || (prevlast == '*' && last == '?');
+    const bool quest = last == '?' || (prevlast == '?' && last == '*');
+
+    if (tpl_len < asterisk + quest*2) {
+        /* Invalid template, which matches no URI */
+        return true;
+    }
+    size_t exact_match_chars = tpl_len - (asterisk + quest*2);
+
+    if (!quest) {
+        return uri_trie_add(trie, template, exact_match_chars, call, asterisk);
+    }
+    /* Without the optional character the URI must end there,
+     * while with it any trailing characters match if asterisk */
+    return uri_trie_add(trie, template, exact_match_chars, call, false) &&
+           uri_trie_add(trie, template, exact_match_chars + 1, call, asterisk);
+}
+
+/* Replace the trie in use, the old one can be freed as no lookup holds it */
+static void uri_trie_publish(struct httpd_data *hd, struct httpd_uri_trie *trie)
+{
+    struct httpd_uri_trie *old = hd->hd_uri_trie;
+    hd->hd_uri_trie = trie;
+    free(old);
+}
+
+/* Rebuild the trie after registered URI handlers have changed, with hd_uri_lock
+ * held. The new trie is built while the old one stays in place, and replaces it
+ * only when complete. If the trie is not in use or cannot be built, handlers
+ * are tested one by one instead */
+static void uri_trie_rebuild(struct httpd_data *hd)
+{
+    const bool wildcard = hd->config.uri_match_fn == httpd_uri_match_wildcard;
+    if (!hd->config.uri_trie_enable || (hd->config.uri_match_fn && !wildcard)) {
+        uri_trie_publish(hd, NULL);
+        return;
+    }
+
+    unsigned count = 0;
+    while (count < hd->config.max_uri_handlers && hd->hd_calls[count]) {
+        count++;
+    }
+
+    /* Every URI adds at most a leaf and a split node, and
+     * a handler adds at most two URIs and list entries */
+    const size_t max_nodes = 1 + 4 * count;
+    const size_t max_entries = 2 * count;
+    if (max_nodes > UINT16_MAX) {
+        ESP_LOGW(TAG, LOG_FMT("too many handlers for URI trie"));
+        uri_trie_publish(hd, NULL);
+        return;
+    }
+
+    struct httpd_uri_trie build = {
+        .nodes   = calloc(max_nodes, sizeof(struct uri_trie_node)),
+        .entries = calloc(max_entries ? max_entries : 1, sizeof(struct uri_trie_entry)),
+        .node_count = 1,    /* The root node, with an empty label */
+    };
+    struct httpd_uri_trie *trie = NULL;
+    if (build.nodes == NULL || build.entries == NULL) {
+        goto out;
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        if (!uri_trie_add_handler(&build, hd->hd_calls[i]->uri, i, wildcard)) {
+            goto out;
+        }
+    }
+
+    /* Copy the trie into a single allocation of the size in use */
+    trie = malloc(sizeof(struct httpd_uri_trie) +
+                  build.node_count * sizeof(struct uri_trie_node) +
+                  build.entry_count * sizeof(struct uri_trie_entry));
+    if (trie == NULL) {
+        goto out;
+    }
+    trie->nodes = (struct uri_trie_node *) (trie + 1);
+    trie->entries = (struct uri_trie_entry *) (trie->nodes + build.node_count);
+    trie->node_count = build.node_count;
+    trie->entry_count = build.entry_count;
+    memcpy(trie->nodes, build.nodes, build.node_count * sizeof(struct uri_trie_node));
+    memcpy(trie->entries, build.entries, build.entry_count * sizeof(struct uri_trie_entry));
+
+out:
+    if (trie == NULL) {
+        ESP_LOGW(TAG, LOG_FMT("failed to build URI trie"));
+    }
+    uri_trie_publish(hd, trie);
+    free(build.nodes);
+    free(build.entries);
+}
+
+/* Check a list of handlers of a trie node for the first one with the method.
+ * As lists are in the order of registration, it is the earliest in the list */
+static void uri_trie_match(const struct httpd_data *hd, unsigned entry, httpd_method_t method,
+                           unsigned *match, bool *uri_found)
+{
+    const struct uri_trie_entry *entries = hd->hd_uri_trie->entries;
+    for (; entry; entry = entries[entry - 1].next) {
+        unsigned call = entries[entry - 1].call;
+        *uri_found = true;
+        if (hd->hd_calls[call]->method == method) {
+            *match = MIN(*match, call);
+            return;
+        }
+    }
+}
+
+/* Find handler with matching URI and method in the trie. Of all
+ * handlers matching, the earliest registered one is chosen, as
+ * in the search through the handlers in order of registration */
+static httpd_uri_t* uri_trie_find(struct httpd_data *hd,
+                                  const char *uri, size_t uri_len,
+                                  httpd_method_t method,
+                                  httpd_err_code_t *err)
+{
+    const struct uri_trie_node *nodes = hd->hd_uri_trie->nodes;
+    const struct uri_trie_node *node  = &nodes[0];
+    unsigned match     = hd->config.max_uri_handlers;
+    bool     uri_found = false;
+    size_t   pos       = 0;
+
+    while (true) {
+        uri_trie_match(hd, node->prefix, method, &match, &uri_found);
+        if (pos == uri_len) {
+            uri_trie_match(hd, node->exact, method, &match, &uri_found);
+            break;
+        }
+
+        unsigned child = node->child;
+        while (child && nodes[child].label[0] != uri[pos]) {
+            child = nodes[child].sibling;
+        }
+        if (child == 0 || nodes[child].label_len > uri_len - pos ||
+            memcmp(nodes[child].label, uri + pos, nodes[child].label_len) != 0) {
+            break;
+        }
+        node = &nodes[child];
+        pos += node->label_len;
+    }
+
+    if (err) {
+        *err = (match < hd->config.max_uri_handlers) ? 0 :
+               (uri_found ? HTTPD_405_METHOD_NOT_ALLOWED : HTTPD_404_NOT_FOUND);
+    }
+    return (match < hd->config.max_uri_handlers) ? hd->hd_calls[match] : NULL;
+}
+
 /* Find handler with matching URI and method, and set
  * appropriate error code if URI or method not found */
 static httpd_uri_t* httpd_find_uri_handler(struct httpd_data *hd,
@@ -95,6 +351,10 @@ static httpd_uri_t* httpd_find_uri_handler(struct httpd_data *hd,
                                            httpd_method_t method,
                                            httpd_err_code_t *err)
 {
+    if (hd->hd_uri_trie) {
+        return uri_trie_find(hd, uri, uri_len, method, err);
+    }
+
     if (err) {
         *err = HTTPD_404_NOT_FOUND;
     }
@@ -131,20 +391,14 @@ static httpd_uri_t* httpd_find_uri_handler(struct httpd_data *hd,
     return NULL;
 }
 
-esp_err_t httpd_register_uri_handler(httpd_handle_t handle,
-                                     const httpd_uri_t *uri_handler)
+static esp_err_t httpd_register_uri_handler_locked(struct httpd_data *hd,
+                                                   const httpd_uri_t *uri_handler)
 {
-    if (handle == NULL || uri_handler == NULL) {
-        return ESP_ERR_INVALID_ARG;
-    }
-
-    struct httpd_data *hd = (struct httpd_data *) handle;
-
     /* Make sure another handler with matching URI and method
      * is not already registered. This will also catch cases
      * when a registered URI wildcard pattern already accounts
      * for the new URI being registered */
-    if (httpd_find_uri_handler(handle, uri_handler->uri,
+    if (httpd_find_uri_handler(hd, uri_handler->uri,
                                strlen(uri_handler->uri),
                                uri_handler->method, NULL) != NULL) {
         ESP_LOGW(TAG, LOG_FMT("handler %s with method %d already registered"),
@@ -177,6 +431,7 @@ esp_err_t httpd_register_uri_handler(httpd_handle_t handle,
             hd->hd_calls[i]->handle_ws_control_frames = uri_handler->handle_ws_control_frames;
 #endif
             ESP_LOGD(TAG, LOG_FMT("[%d] installed %s"), i, uri_handler->uri);
+            uri_trie_rebuild(hd);
             return ESP_OK;
         }
         ESP_LOGD(TAG, LOG_FMT("[%d] exists %s"), i, hd->hd_calls[i]->uri);
@@ -185,14 +440,25 @@ esp_err_t httpd_register_uri_handler(httpd_handle_t handle,
     return ESP_ERR_HTTPD_HANDLERS_FULL;
 }
 
-esp_err_t httpd_unregister_uri_handler(httpd_handle_t handle,
-                                       const char *uri, httpd_method_t method)
+/* Handlers may be changed by any task while the HTTPD thread or worker tasks
+ * look them up, so changes are made with hd_uri_lock held */
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle,
+                                     const httpd_uri_t *uri_handler)
 {
-    if (handle == NULL || uri == NULL) {
+    if (handle == NULL || uri_handler == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
 
     struct httpd_data *hd = (struct httpd_data *) handle;
+    httpd_os_mutex_lock(hd->hd_uri_lock);
+    esp_err_t ret = httpd_register_uri_handler_locked(hd, uri_handler);
+    httpd_os_mutex_unlock(hd->hd_uri_lock);
+    return ret;
+}
+
+static esp_err_t httpd_unregister_uri_handler_locked(struct httpd_data *hd,
+                                                     const char *uri, httpd_method_t method)
+{
     for (int i = 0; i < hd->config.max_uri_handlers; i++) {
         if (!hd->hd_calls[i]) {
             break;
@@ -215,6 +481,7 @@ esp_err_t httpd_unregister_uri_handler(httpd_handle_t handle,
             }
             /* Nullify the following non null entry */
             hd->hd_calls[i-1] = NULL;
+            uri_trie_rebuild(hd);
             return ESP_OK;
         }
     }
@@ -222,13 +489,22 @@ esp_err_t httpd_unregister_uri_handler(httpd_handle_t handle,
     return ESP_ERR_NOT_FOUND;
 }
 
-esp_err_t httpd_unregister_uri(httpd_handle_t handle, const char *uri)
+esp_err_t httpd_unregister_uri_handler(httpd_handle_t handle,
+                                       const char *uri, httpd_method_t method)
 {
     if (handle == NULL || uri == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
 
     struct httpd_data *hd = (struct httpd_data *) handle;
+    httpd_os_mutex_lock(hd->hd_uri_lock);
+    esp_err_t ret = httpd_unregister_uri_handler_locked(hd, uri, method);
+    httpd_os_mutex_unlock(hd->hd_uri_lock);
+    return ret;
+}
+
+static esp_err_t httpd_unregister_uri_locked(struct httpd_data *hd, const char *uri)
+{
     bool found = false;
 
     int i = 0, j = 0; // For keeping count of removed entries
@@ -258,10 +534,25 @@ esp_err_t httpd_unregister_uri(httpd_handle_t handle, const char *uri)
 
     if (!found) {
         ESP_LOGW(TAG, LOG_FMT("no handler found for URI %s"), uri);
+    } else {
+        uri_trie_rebuild(hd);
     }
     return (found ? ESP_OK : ESP_ERR_NOT_FOUND);
 }
 
+esp_err_t httpd_unregister_uri(httpd_handle_t handle, const char *uri)
+{
+    if (handle == NULL || uri == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct httpd_data *hd = (struct httpd_data *) handle;
+    httpd_os_mutex_lock(hd->hd_uri_lock);
+    esp_err_t ret = httpd_unregister_uri_locked(hd, uri);
+    httpd_os_mutex_unlock(hd->hd_uri_lock);
+    return ret;
+}
+
 void httpd_unregister_all_uri_handlers(struct httpd_data *hd)
 {
     for (unsigned i = 0; i < hd->config.max_uri_handlers; i++) {
@@ -274,13 +565,16 @@ void httpd_unregister_all_uri_handlers(struct httpd_data *hd)
         free(hd->hd_calls[i]);
         hd->hd_calls[i] = NULL;
     }
+    free(hd->hd_uri_trie);
+    hd->hd_uri_trie = NULL;
 }
 
-esp_err_t httpd_uri(struct httpd_data *hd)
+esp_err_t httpd_uri(struct httpd_data *hd, httpd_req_t *req)
 {
     httpd_uri_t            *uri = NULL;
-    httpd_req_t            *req = &hd->hd_req;
-    struct http_parser_url *res = &hd->hd_req_aux.url_parse_res;
+    httpd_uri_t             uri_copy;
+    struct httpd_req_aux   *ra  = req->aux;
+    struct http_parser_url *res = &ra->url_parse_res;
 
     /* For conveying URI not found/method not allowed */
     httpd_err_code_t err = 0;
@@ -289,8 +583,17 @@ esp_err_t httpd_uri(struct httpd_data *hd)
 
     /* URL parser result contains offset and length of path string */
     if (res->field_set & (1 << UF_PATH)) {
+        httpd_os_mutex_lock(hd->hd_uri_lock);
         uri = httpd_find_uri_handler(hd, req->uri + res->field_data[UF_PATH].off,
                                      res->field_data[UF_PATH].len, req->method, &err);
+        /* Work on a copy of the handler, which may be unregistered once the lock
+         * is released. The lock isn't held while the handler runs, so that the
+         * handler can register and unregister handlers itself */
+        if (uri) {
+            uri_copy = *uri;
+            uri = &uri_copy;
+        }
+        httpd_os_mutex_unlock(hd->hd_uri_lock);
     }
 
     /* If URI with method not found, respond with error code */
@@ -316,7 +619,7 @@ esp_err_t httpd_uri(struct httpd_data *hd)
     struct httpd_req_aux   *aux = req->aux;
     if (uri->is_websocket && aux->ws_handshake_detect && uri->method == HTTP_GET) {
         ESP_LOGD(TAG, LOG_FMT("Responding WS handshake to sock %d"), aux->sd->fd);
-        esp_err_t ret = httpd_ws_respond_server_handshake(&hd->hd_req);
+        esp_err_t ret = httpd_ws_respond_server_handshake(req);
         if (ret != ESP_OK) {
             return ret;
         }
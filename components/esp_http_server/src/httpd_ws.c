@@ -15,6 +15,8 @@
 
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <sys/random.h>
 #include <esp_log.h>
 #include <esp_err.h>
@@ -140,42 +142,54 @@ static esp_err_t httpd_ws_check_req(httpd_req_t *req)
     return ESP_OK;
 }
 
-static esp_err_t httpd_ws_unmask_payload(uint8_t *payload, size_t len, const uint8_t *mask_key)
-{
-    if (len < 1 || !payload) {
-        ESP_LOGW(TAG, LOG_FMT("Invalid payload provided"));
-        return ESP_ERR_INVALID_ARG;
-    }
-
-    for (size_t idx = 0; idx < len; idx++) {
-        payload[idx] = (payload[idx] ^ mask_key[idx % 4]);
-    }
-
-    return ESP_OK;
-}
+/*
+ * Word used to XOR the payload with the mask key a word at a time,
+ * it may alias the bytes of the payload buffer.
+ */
+typedef uint32_t __attribute__((__may_alias__)) httpd_ws_mask_word_t;
 
-esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *frame, size_t max_len)
+/*
+ * XOR the payload with the mask key. `offset` is the position of the payload
+ * in the frame, so that a frame can be unmasked piece by piece as it arrives.
+ * Please refer to RFC6455 Section 5.3 for more details.
+ */
+static void httpd_ws_unmask_payload(uint8_t *payload, size_t len, const uint8_t *mask_key, size_t offset)
 {
-    esp_err_t ret = httpd_ws_check_req(req);
-    if (ret != ESP_OK) {
-        return ret;
-    }
+    /* Unmask byte by byte up to the first aligned word */
+    while (len > 0 && ((uintptr_t)payload % sizeof(httpd_ws_mask_word_t)) != 0) {
+        *payload++ ^= mask_key[offset++ % 4];
+        len--;
+    }
+
+    /* Unmask whole words, with the mask key rotated to start at the offset of the first one.
+     * The loop has no dependencies between iterations, so the compiler may vectorize it. */
+    size_t word_count = len / sizeof(httpd_ws_mask_word_t);
+    if (word_count > 0) {
+        uint8_t rotated_key[4];
+        for (size_t idx = 0; idx < sizeof(rotated_key); idx++) {
+            rotated_key[idx] = mask_key[(offset + idx) % 4];
+        }
+        httpd_ws_mask_word_t mask_word;
+        memcpy(&mask_word, rotated_key, sizeof(mask_word));
 
-    struct httpd_req_aux *aux = req->aux;
-    if (aux == NULL) {
-        ESP_LOGW(TAG, LOG_FMT("Invalid Aux pointer"));
-        return ESP_ERR_INVALID_ARG;
+        httpd_ws_mask_word_t *words = (httpd_ws_mask_word_t *)payload;
+        for (size_t idx = 0; idx < word_count; idx++) {
+            words[idx] ^= mask_word;
+        }
+        payload += word_count * sizeof(httpd_ws_mask_word_t);
+        len -= word_count * sizeof(httpd_ws_mask_word_t);
     }
 
-    if (!frame) {
-        ESP_LOGW(TAG, LOG_FMT("Frame pointer is invalid"));
-        return ESP_ERR_INVALID_ARG;
+    /* Unmask the remaining bytes, the words don't change the position in the mask key */
+    while (len > 0) {
+        *payload++ ^= mask_key[offset++ % 4];
+        len--;
     }
+}
 
-    /* Assign the frame info from the previous reading */
-    frame->type = aux->ws_type;
-    frame->final = aux->ws_final;
-
+/* Receive the rest of the frame header after the first byte, that is the payload length and the mask key */
+static esp_err_t httpd_ws_recv_frame_hdr(httpd_req_t *req, size_t *payload_len, uint8_t *mask_key)
+{
     /* Grab the second byte */
     uint8_t second_byte = 0;
     if (httpd_recv_with_opt(req, (char *)&second_byte, sizeof(second_byte), false) <= 0) {
@@ -191,7 +205,7 @@ esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *frame, size_t
     uint8_t init_len = second_byte & HTTPD_WS_LENGTH_BITS;
     if (init_len < 126) {
         /* Case 1: If length is 0-125, then this length bit is 7 bits */
-        frame->len = init_len;
+        *payload_len = init_len;
     } else if (init_len == 126) {
         /* Case 2: If length byte is 126, then this frame's length bit is 16 bits */
         uint8_t length_bytes[2] = { 0 };
@@ -200,7 +214,7 @@ esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *frame, size_t
             return ESP_FAIL;
         }
 
-        frame->len = ((uint32_t)(length_bytes[0] << 8U) | (length_bytes[1]));
+        *payload_len = ((uint32_t)(length_bytes[0] << 8U) | (length_bytes[1]));
     } else if (init_len == 127) {
         /* Case 3: If length is byte 127, then this frame's length bit is 64 bits */
         uint8_t length_bytes[8] = { 0 };
@@ -209,26 +223,24 @@ esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *frame, size_t
             return ESP_FAIL;
         }
 
-        frame->len = (((uint64_t)length_bytes[0] << 56U) |
-                    ((uint64_t)length_bytes[1] << 48U) |
-                    ((uint64_t)length_bytes[2] << 40U) |
-                    ((uint64_t)length_bytes[3] << 32U) |
-                    ((uint64_t)length_bytes[4] << 24U) |
-                    ((uint64_t)length_bytes[5] << 16U) |
-                    ((uint64_t)length_bytes[6] <<  8U) |
-                    ((uint64_t)length_bytes[7]));
-    }
-
-    /* We only accept the incoming packet length that is smaller than the max_len (or it will overflow the buffer!) */
-    if (frame->len > max_len) {
-        ESP_LOGW(TAG, LOG_FMT("WS Message too long"));
-        return ESP_ERR_INVALID_SIZE;
+        uint64_t len = (((uint64_t)length_bytes[0] << 56U) |
+                        ((uint64_t)length_bytes[1] << 48U) |
+                        ((uint64_t)length_bytes[2] << 40U) |
+                        ((uint64_t)length_bytes[3] << 32U) |
+                        ((uint64_t)length_bytes[4] << 24U) |
+                        ((uint64_t)length_bytes[5] << 16U) |
+                        ((uint64_t)length_bytes[6] <<  8U) |
+                        ((uint64_t)length_bytes[7]));
+        if (len > SIZE_MAX) {
+            ESP_LOGW(TAG, LOG_FMT("WS Message too long"));
+            return ESP_ERR_INVALID_SIZE;
+        }
+        *payload_len = len;
     }
 
     /* If this frame is masked, dump the mask as well */
-    uint8_t mask_key[4] = { 0 };
     if (masked) {
-        if (httpd_recv_with_opt(req, (char *)mask_key, sizeof(mask_key), false) <= 0) {
+        if (httpd_recv_with_opt(req, (char *)mask_key, 4, false) <= 0) {
             ESP_LOGW(TAG, LOG_FMT("Failed to receive mask key"));
             return ESP_FAIL;
         }
@@ -239,25 +251,191 @@ esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *frame, size_t
         return ESP_ERR_INVALID_STATE;
     }
 
-    /* Receive buffer */
-    /* If there's nothing to receive, return and stop here. */
-    if (frame->len == 0) {
+    return ESP_OK;
+}
+
+/* Receive `len` bytes of payload, which start at `offset` in the frame, and unmask them */
+static esp_err_t httpd_ws_recv_payload(httpd_req_t *req, uint8_t *buf, size_t len,
+                                       const uint8_t *mask_key, size_t offset)
+{
+    if (len == 0) {
         return ESP_OK;
     }
 
-    if (frame->payload == NULL) {
+    if (buf == NULL) {
         ESP_LOGW(TAG, LOG_FMT("Payload buffer is null"));
         return ESP_FAIL;
     }
 
-    if (httpd_recv_with_opt(req, (char *)frame->payload, frame->len, false) <= 0) {
-        ESP_LOGW(TAG, LOG_FMT("Failed to receive payload"));
-        return ESP_FAIL;
+    /* The payload may arrive in several pieces */
+    size_t received = 0;
+    while (received < len) {
+        int ret = httpd_recv_with_opt(req, (char *)buf + received, len - received, false);
+        if (ret <= 0) {
+            ESP_LOGW(TAG, LOG_FMT("Failed to receive payload"));
+            return ESP_FAIL;
+        }
+        received += ret;
+    }
+
+    httpd_ws_unmask_payload(buf, len, mask_key, offset);
+    return ESP_OK;
+}
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *frame, size_t max_len)
+{
+    esp_err_t ret = httpd_ws_check_req(req);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    struct httpd_req_aux *aux = req->aux;
+    if (aux == NULL) {
+        ESP_LOGW(TAG, LOG_FMT("Invalid Aux pointer"));
+        return ESP_ERR_INVALID_ARG;
     }
 
-    /* Unmask payload */
-    httpd_ws_unmask_payload(frame->payload, frame->len, mask_key);
+    if (!frame) {
+        ESP_LOGW(TAG, LOG_FMT("Frame pointer is invalid"));
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* Assign the frame info from the previous reading */
+    frame->type = aux->ws_type;
+    frame->final = aux->ws_final;
+
+    uint8_t mask_key[4] = { 0 };
+    ret = httpd_ws_recv_frame_hdr(req, &frame->len, mask_key);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    /* We only accept the incoming packet length that is smaller than the max_len (or it will overflow the buffer!) */
+    if (frame->len > max_len) {
+        ESP_LOGW(TAG, LOG_FMT("WS Message too long"));
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return httpd_ws_recv_payload(req, frame->payload, frame->len, mask_key, 0);
+}
+
+/*
+ * Read the header of the next fragment of a message, handling the control
+ * frames the client may send in between. Please refer to RFC6455 Section 5.4.
+ */
+static esp_err_t httpd_ws_recv_next_fragment(httpd_req_t *req, bool *final)
+{
+    struct httpd_req_aux *aux = req->aux;
+
+    while (true) {
+        /* This also replies to PING */
+        esp_err_t ret = httpd_ws_get_frame_type(req);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+
+        switch (aux->ws_type) {
+        case HTTPD_WS_TYPE_CONTINUE:
+            *final = aux->ws_final;
+            return ESP_OK;
+        case HTTPD_WS_TYPE_PING:
+            break;
+        case HTTPD_WS_TYPE_PONG: {
+            /* Drop the PONG, control frames are at most 125 bytes long */
+            httpd_ws_frame_t frame;
+            uint8_t frame_buf[125];
+            memset(&frame, 0, sizeof(httpd_ws_frame_t));
+            frame.payload = frame_buf;
+            ret = httpd_ws_recv_frame(req, &frame, sizeof(frame_buf));
+            if (ret != ESP_OK) {
+                return ret;
+            }
+            break;
+        }
+        case HTTPD_WS_TYPE_CLOSE:
+            ESP_LOGD(TAG, LOG_FMT("WS closed in the middle of a message"));
+            aux->sd->ws_close = true;
+            return ESP_FAIL;
+        default:
+            ESP_LOGW(TAG, LOG_FMT("Expected a WS continuation frame, got type %d"), aux->ws_type);
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+}
+
+/* Hand the payload of a frame to the callback in pieces of at most buf_len bytes */
+static esp_err_t httpd_ws_recv_payload_cb(httpd_req_t *req, uint8_t *buf, size_t buf_len, size_t len,
+                                          const uint8_t *mask_key, bool final,
+                                          httpd_ws_recv_cb_t recv_cb, void *arg)
+{
+    size_t offset = 0;
+    do {
+        size_t piece_len = MIN(len - offset, buf_len);
+        esp_err_t ret = httpd_ws_recv_payload(req, buf, piece_len, mask_key, offset);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        offset += piece_len;
+
+        ret = recv_cb(req, buf, piece_len, final && offset == len, arg);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    } while (offset < len);
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_ws_recv_message(httpd_req_t *req, httpd_ws_frame_t *frame, size_t max_len,
+                                httpd_ws_recv_cb_t recv_cb, void *arg)
+{
+    esp_err_t ret = httpd_ws_check_req(req);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (!frame || (recv_cb && (max_len == 0 || frame->payload == NULL))) {
+        ESP_LOGW(TAG, LOG_FMT("Argument is invalid"));
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* The first fragment carries the type of the message */
+    struct httpd_req_aux *aux = req->aux;
+    frame->type = aux->ws_type;
+    frame->len = 0;
+
+    bool final = aux->ws_final;
+    while (true) {
+        size_t len = 0;
+        uint8_t mask_key[4] = { 0 };
+        ret = httpd_ws_recv_frame_hdr(req, &len, mask_key);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+
+        if (recv_cb) {
+            ret = httpd_ws_recv_payload_cb(req, frame->payload, max_len, len, mask_key, final, recv_cb, arg);
+        } else if (len > max_len - frame->len) {
+            ESP_LOGW(TAG, LOG_FMT("WS Message too long"));
+            ret = ESP_ERR_INVALID_SIZE;
+        } else {
+            ret = httpd_ws_recv_payload(req, frame->payload + frame->len, len, mask_key, 0);
+        }
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        frame->len += len;
+
+        if (final) {
+            break;
+        }
+        ret = httpd_ws_recv_next_fragment(req, &final);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
 
+    frame->final = true;
     return ESP_OK;
 }
 
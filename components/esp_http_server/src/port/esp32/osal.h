@@ -17,8 +17,11 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <esp_timer.h>
 
 #ifdef __cplusplus
@@ -29,6 +32,8 @@ extern "C" {
 #define OS_FAIL    ESP_FAIL
 
 typedef TaskHandle_t othread_t;
+typedef QueueHandle_t oqueue_t;
+typedef SemaphoreHandle_t omutex_t;
 
 static inline int httpd_os_thread_create(othread_t *thread,
                                  const char *name, uint16_t stacksize, int prio,
@@ -58,6 +63,62 @@ static inline othread_t httpd_os_thread_handle(void)
     return xTaskGetCurrentTaskHandle();
 }
 
+static inline int httpd_os_queue_create(oqueue_t *queue, unsigned length, unsigned item_size)
+{
+    *queue = xQueueCreate(length, item_size);
+    if (*queue != NULL) {
+        return OS_SUCCESS;
+    }
+    return OS_FAIL;
+}
+
+static inline void httpd_os_queue_delete(oqueue_t queue)
+{
+    vQueueDelete(queue);
+}
+
+/* Waits for space in the queue */
+static inline int httpd_os_queue_send(oqueue_t queue, const void *item)
+{
+    if (xQueueSendToBack(queue, item, portMAX_DELAY) == pdTRUE) {
+        return OS_SUCCESS;
+    }
+    return OS_FAIL;
+}
+
+/* Waits for an item if 'wait' is true, else fails if the queue is empty */
+static inline int httpd_os_queue_recv(oqueue_t queue, void *item, bool wait)
+{
+    if (xQueueReceive(queue, item, wait ? portMAX_DELAY : 0) == pdTRUE) {
+        return OS_SUCCESS;
+    }
+    return OS_FAIL;
+}
+
+static inline int httpd_os_mutex_create(omutex_t *mutex)
+{
+    *mutex = xSemaphoreCreateMutex();
+    if (*mutex != NULL) {
+        return OS_SUCCESS;
+    }
+    return OS_FAIL;
+}
+
+static inline void httpd_os_mutex_delete(omutex_t mutex)
+{
+    vSemaphoreDelete(mutex);
+}
+
+static inline void httpd_os_mutex_lock(omutex_t mutex)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+}
+
+static inline void httpd_os_mutex_unlock(omutex_t mutex)
+{
+    xSemaphoreGive(mutex);
+}
+
 #ifdef __cplusplus
 }
 #endif
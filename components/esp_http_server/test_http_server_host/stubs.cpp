@@ -0,0 +1,159 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Flash partition mapping from a buffer, the hashing and encoding of the WebSocket handshake, and other functions
+ * missing on the host. FreeRTOS is mocked by tools/host_test_mocks. */
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "esp_partition.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/sha1.h"
+
+using namespace std;
+
+extern "C" {
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+
+} // extern "C"
+
+const uint8_t *test_flash;
+int test_flash_mapped;
+size_t test_flash_max_pages;
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t memory,
+                             const void **out_ptr, spi_flash_mmap_handle_t *out_handle)
+{
+    if (offset > partition->size || size > partition->size - offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* Whole MMU pages are mapped, as on the target */
+    size_t addr = partition->address + offset;
+    size_t first_page = addr / SPI_FLASH_MMU_PAGE_SIZE;
+    size_t end_page = (addr + size + SPI_FLASH_MMU_PAGE_SIZE - 1) / SPI_FLASH_MMU_PAGE_SIZE;
+    test_flash_max_pages = max(test_flash_max_pages, end_page - first_page);
+    test_flash_mapped++;
+    *out_ptr = test_flash + addr;
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+    test_flash_mapped--;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    return "ERROR";
+}
+
+static uint32_t rol(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+int mbedtls_sha1_ret(const unsigned char *input, size_t ilen, unsigned char output[20])
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    /* Pad the message with 0x80, zeros and its length in bits to whole 64 byte blocks */
+    vector<uint8_t> msg(input, input + ilen);
+    msg.push_back(0x80);
+    while (msg.size() % 64 != 56) {
+        msg.push_back(0);
+    }
+    for (int i = 7; i >= 0; i--) {
+        msg.push_back((uint8_t) (((uint64_t) ilen * 8) >> (i * 8)));
+    }
+
+    for (size_t block = 0; block < msg.size(); block += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const uint8_t *p = &msg[block + i * 4];
+            w[i] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rol(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    for (int i = 0; i < 20; i++) {
+        output[i] = (uint8_t) (h[i / 4] >> (24 - (i % 4) * 8));
+    }
+    return 0;
+}
+
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen,
+                          const unsigned char *src, size_t slen)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t len = (slen + 2) / 3 * 4;
+    *olen = len + 1;
+    if (dlen < len + 1) {
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+    }
+    for (size_t i = 0; i < slen; i += 3) {
+        uint32_t n = (uint32_t) src[i] << 16;
+        n |= i + 1 < slen ? (uint32_t) src[i + 1] << 8 : 0;
+        n |= i + 2 < slen ? src[i + 2] : 0;
+        *dst++ = digits[(n >> 18) & 0x3f];
+        *dst++ = digits[(n >> 12) & 0x3f];
+        *dst++ = i + 1 < slen ? digits[(n >> 6) & 0x3f] : '=';
+        *dst++ = i + 2 < slen ? digits[n & 0x3f] : '=';
+    }
+    *dst = '\0';
+    *olen = len;
+    return 0;
+}
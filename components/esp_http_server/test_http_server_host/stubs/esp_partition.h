@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The parts of spi_flash's esp_partition.h used by the server. Partitions
+ * are mapped from a buffer of flash contents set up by the test */
+
+#define SPI_FLASH_MMU_PAGE_SIZE 0x10000
+
+typedef enum {
+    SPI_FLASH_MMAP_DATA,
+    SPI_FLASH_MMAP_INST,
+} spi_flash_mmap_memory_t;
+
+typedef uint32_t spi_flash_mmap_handle_t;
+
+typedef struct {
+    void *flash_chip;
+    int type;
+    int subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+esp_err_t esp_partition_mmap(const esp_partition_t *partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t memory,
+                             const void **out_ptr, spi_flash_mmap_handle_t *out_handle);
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle);
+
+/* Contents of the flash, from address 0 */
+extern const uint8_t *test_flash;
+
+/* Number of regions mapped and not yet unmapped, and the
+ * largest number of MMU pages mapped by a single call */
+extern int test_flash_mapped;
+extern size_t test_flash_max_pages;
+
+#ifdef __cplusplus
+}
+#endif
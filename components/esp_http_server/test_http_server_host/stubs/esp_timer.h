@@ -0,0 +1,3 @@
+#pragma once
+
+/* Included by osal.h, nothing of it is used by the server */
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The part of mbedtls used by the WebSocket handshake, implemented in stubs.cpp */
+
+int mbedtls_sha1_ret(const unsigned char *input, size_t ilen, unsigned char output[20]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#define CONFIG_LWIP_MAX_SOCKETS 32
+#define CONFIG_HTTPD_MAX_REQ_HDR_LEN 512
+#define CONFIG_HTTPD_MAX_URI_LEN 512
+#define CONFIG_HTTPD_ERR_RESP_NO_DELAY 1
+#define CONFIG_HTTPD_PURGE_BUF_LEN 32
+#define CONFIG_HTTPD_SEND_FILE_BUF_LEN 4096
+#define CONFIG_HTTPD_VALIDATE_REQ 1
+#define CONFIG_HTTPD_WS_SUPPORT 1
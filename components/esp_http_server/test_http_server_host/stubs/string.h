@@ -0,0 +1,14 @@
+#pragma once
+
+#include_next <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Provided by newlib on the target, implemented by the test */
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,10 @@
+#pragma once
+
+#include_next <sys/socket.h>
+
+/* Pulled in by lwip's sockets.h on the target */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
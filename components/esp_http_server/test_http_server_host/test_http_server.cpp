@@ -0,0 +1,1244 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "catch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "esp_http_server.h"
+
+using namespace std;
+
+/* The server runs on the loopback interface of the host, with the server
+ * and worker tasks running as host threads.
+ *
+ * Benchmarks are hidden, run them with: ./test_http_server "[benchmark]" */
+
+static const uint16_t TEST_PORT = 28080;
+static const uint16_t TEST_CTRL_PORT = 28081;
+
+/* The server sends a response with several send() calls, don't let
+ * Nagle's algorithm wait for the client's delayed ACKs in between */
+static esp_err_t nodelay_open_fn(httpd_handle_t hd, int sockfd)
+{
+    int nodelay = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    return ESP_OK;
+}
+
+static httpd_config_t test_config()
+{
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = TEST_PORT;
+    config.ctrl_port = TEST_CTRL_PORT;
+    config.max_open_sockets = 12;
+    config.open_fn = nodelay_open_fn;
+    return config;
+}
+
+static httpd_handle_t start_server(const httpd_config_t &config)
+{
+    httpd_handle_t server = NULL;
+    REQUIRE(httpd_start(&server, &config) == ESP_OK);
+    return server;
+}
+
+static httpd_handle_t start_server(uint16_t worker_count)
+{
+    httpd_config_t config = test_config();
+    config.worker_count = worker_count;
+    return start_server(config);
+}
+
+static void register_handler(httpd_handle_t server, const char *uri, esp_err_t (*handler)(httpd_req_t *r))
+{
+    httpd_uri_t uri_handler = {};
+    uri_handler.uri = uri;
+    uri_handler.method = HTTP_GET;
+    uri_handler.handler = handler;
+    REQUIRE(httpd_register_uri_handler(server, &uri_handler) == ESP_OK);
+}
+
+/* Client side of a keep-alive connection */
+struct test_client {
+    int fd;
+    string received;
+    int status;
+    string headers;
+
+    test_client()
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        REQUIRE(fd >= 0);
+        struct timeval tv = { 10, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(TEST_PORT);
+        inet_aton("127.0.0.1", &addr.sin_addr);
+        REQUIRE(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    }
+
+    ~test_client()
+    {
+        close(fd);
+    }
+
+    bool send_str(const string &data)
+    {
+        return send(fd, data.data(), data.size(), 0) == (ssize_t) data.size();
+    }
+
+    bool get(const string &uri)
+    {
+        return send_str("GET " + uri + " HTTP/1.1\r\nHost: test\r\n\r\n");
+    }
+
+    /* Returns the body of the next response, or "" on failure */
+    string response()
+    {
+        size_t hdr_end;
+        while ((hdr_end = received.find("\r\n\r\n")) == string::npos) {
+            if (!receive()) {
+                return "";
+            }
+        }
+        status = atoi(received.c_str() + strlen("HTTP/1.1 "));
+        headers = received.substr(0, hdr_end + 2);
+        if (headers.find("Transfer-Encoding: chunked\r\n") != string::npos) {
+            return chunked_body(hdr_end + 4);
+        }
+        size_t len_pos = received.find("Content-Length: ");
+        if (len_pos == string::npos || len_pos > hdr_end) {
+            return "";
+        }
+        size_t body_len = strtoul(received.c_str() + len_pos + strlen("Content-Length: "), NULL, 10);
+        while (received.size() < hdr_end + 4 + body_len) {
+            if (!receive()) {
+                return "";
+            }
+        }
+        string body = received.substr(hdr_end + 4, body_len);
+        received.erase(0, hdr_end + 4 + body_len);
+        return body;
+    }
+
+    string chunked_body(size_t pos)
+    {
+        string body;
+        size_t chunk_len;
+        do {
+            size_t line_end;
+            while ((line_end = received.find("\r\n", pos)) == string::npos) {
+                if (!receive()) {
+                    return "";
+                }
+            }
+            chunk_len = strtoul(received.c_str() + pos, NULL, 16);
+            pos = line_end + 2;
+            while (received.size() < pos + chunk_len + 2) {
+                if (!receive()) {
+                    return "";
+                }
+            }
+            body += received.substr(pos, chunk_len);
+            pos += chunk_len + 2;
+        } while (chunk_len > 0);
+        received.erase(0, pos);
+        return body;
+    }
+
+    bool receive()
+    {
+        char buf[16384];
+        ssize_t len = recv(fd, buf, sizeof(buf), 0);
+        if (len <= 0) {
+            return false;
+        }
+        received.append(buf, len);
+        return true;
+    }
+};
+
+static esp_err_t echo_query_handler(httpd_req_t *r)
+{
+    char query[64] = "";
+    httpd_req_get_url_query_str(r, query, sizeof(query));
+    return httpd_resp_send(r, query, HTTPD_RESP_USE_STRLEN);
+}
+
+TEST_CASE("requests are served by the server task or by worker tasks", "[httpd]")
+{
+    for (uint16_t worker_count : { 0, 1, 3 }) {
+        httpd_handle_t server = start_server(worker_count);
+        register_handler(server, "/echo", echo_query_handler);
+        {
+            test_client client;
+            for (int i = 0; i < 10; i++) {
+                string query = to_string(i);
+                REQUIRE(client.get("/echo?" + query));
+                CHECK(client.response() == query);
+            }
+        }
+        REQUIRE(httpd_stop(server) == ESP_OK);
+    }
+}
+
+TEST_CASE("pipelined requests of a session are processed in order by worker tasks", "[httpd]")
+{
+    const int REQUESTS = 30;
+    httpd_handle_t server = start_server(4);
+    register_handler(server, "/echo", echo_query_handler);
+    {
+        test_client client;
+        string requests;
+        for (int i = 0; i < REQUESTS; i++) {
+            requests += "GET /echo?" + to_string(i) + " HTTP/1.1\r\nHost: test\r\n\r\n";
+        }
+        REQUIRE(client.send_str(requests));
+        for (int i = 0; i < REQUESTS; i++) {
+            CHECK(client.response() == to_string(i));
+        }
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+static mutex s_slow_lock;
+static condition_variable s_slow_cond;
+static bool s_slow_release;
+
+static esp_err_t slow_handler(httpd_req_t *r)
+{
+    unique_lock<mutex> lock(s_slow_lock);
+    s_slow_cond.wait_for(lock, chrono::seconds(5), []() { return s_slow_release; });
+    return httpd_resp_send(r, s_slow_release ? "slow" : "timeout", HTTPD_RESP_USE_STRLEN);
+}
+
+TEST_CASE("a slow handler does not hold up the other sessions with worker tasks", "[httpd]")
+{
+    s_slow_release = false;
+    httpd_handle_t server = start_server(2);
+    register_handler(server, "/slow", slow_handler);
+    register_handler(server, "/echo", echo_query_handler);
+    {
+        test_client slow_client;
+        test_client client;
+        REQUIRE(slow_client.get("/slow"));
+
+        /* Served by the other worker while the slow handler blocks */
+        REQUIRE(client.get("/echo?fast"));
+        CHECK(client.response() == "fast");
+
+        {
+            lock_guard<mutex> lock(s_slow_lock);
+            s_slow_release = true;
+        }
+        s_slow_cond.notify_all();
+        CHECK(slow_client.response() == "slow");
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+static int s_ctx_frees;
+
+static void free_ctx(void *ctx)
+{
+    s_ctx_frees++;
+    free(ctx);
+}
+
+/* Counts the requests of a session in the session context */
+static esp_err_t count_handler(httpd_req_t *r)
+{
+    int fd = httpd_req_to_sockfd(r);
+    int *count = (int *) httpd_sess_get_ctx(r->handle, fd);
+    if (count == NULL) {
+        count = (int *) calloc(1, sizeof(int));
+        httpd_sess_set_ctx(r->handle, fd, count, free_ctx);
+    }
+    (*count)++;
+    string body = to_string(*count);
+    return httpd_resp_send(r, body.c_str(), body.size());
+}
+
+TEST_CASE("session context is kept per session with worker tasks", "[httpd]")
+{
+    s_ctx_frees = 0;
+    httpd_handle_t server = start_server(2);
+    register_handler(server, "/count", count_handler);
+    {
+        test_client client1;
+        test_client client2;
+        for (int i = 1; i <= 5; i++) {
+            REQUIRE(client1.get("/count"));
+            REQUIRE(client2.get("/count"));
+            CHECK(client1.response() == to_string(i));
+            CHECK(client2.response() == to_string(i));
+        }
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+    CHECK(s_ctx_frees == 2);
+}
+
+/* Responds with "<field>=<value>;" for the fields in the query, with the
+ * value "-" if the header is missing and "<length>!" if it is truncated */
+static esp_err_t hdr_handler(httpd_req_t *r)
+{
+    char query[128] = "";
+    httpd_req_get_url_query_str(r, query, sizeof(query));
+    string body;
+    char *saveptr;
+    for (char *field = strtok_r(query, ",", &saveptr); field; field = strtok_r(NULL, ",", &saveptr)) {
+        char value[8];
+        size_t len = httpd_req_get_hdr_value_len(r, field);
+        esp_err_t err = httpd_req_get_hdr_value_str(r, field, value, sizeof(value));
+        body += string(field) + "=";
+        if (err == ESP_ERR_NOT_FOUND) {
+            body += (len == 0) ? "-" : "?";
+        } else if (err == ESP_ERR_HTTPD_RESULT_TRUNC) {
+            body += (strlen(value) == sizeof(value) - 1) ? to_string(len) + "!" : "?";
+        } else {
+            body += (err == ESP_OK && len == strlen(value)) ? value : "?";
+        }
+        body += ";";
+    }
+    return httpd_resp_send(r, body.c_str(), body.size());
+}
+
+TEST_CASE("request headers are looked up by field name", "[httpd]")
+{
+    httpd_handle_t server = start_server(0);
+    register_handler(server, "/hdr", hdr_handler);
+    {
+        test_client client;
+        REQUIRE(client.send_str("GET /hdr?host,HOST,x-dup,X-Empty,X-Long,X-Missing,X-Dup-Missing HTTP/1.1\r\n"
+                                "Host: test\r\n"
+                                "X-Dup: first\r\n"
+                                "x-empty:\r\n"
+                                "X-DUP: second\r\n"
+                                "X-Long: 0123456789\r\n"
+                                "\r\n"));
+        CHECK(client.response() == "host=test;HOST=test;x-dup=first;X-Empty=;X-Long=10!;X-Missing=-;X-Dup-Missing=-;");
+
+        /* Headers beyond the ones that fit in the index are still found */
+        string request = "GET /hdr?X-0,x-17,X-29,X-30 HTTP/1.1\r\n";
+        for (int i = 0; i < 30; i++) {
+            request += "X-" + to_string(i) + ": v" + to_string(i) + "\r\n";
+        }
+        REQUIRE(client.send_str(request + "\r\n"));
+        CHECK(client.response() == "X-0=v0;x-17=v17;X-29=v29;X-30=-;");
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+static size_t s_hdr_len_after_resp;
+
+static esp_err_t hdr_after_resp_handler(httpd_req_t *r)
+{
+    esp_err_t ret = httpd_resp_send(r, "sent", HTTPD_RESP_USE_STRLEN);
+    s_hdr_len_after_resp = httpd_req_get_hdr_value_len(r, "Host");
+    return ret;
+}
+
+TEST_CASE("request headers are not available after the response is sent", "[httpd]")
+{
+    s_hdr_len_after_resp = 1;
+    httpd_handle_t server = start_server(0);
+    register_handler(server, "/after", hdr_after_resp_handler);
+    {
+        test_client client;
+        REQUIRE(client.get("/after"));
+        CHECK(client.response() == "sent");
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+    CHECK(s_hdr_len_after_resp == 0);
+}
+
+static const int LOOKUPS = 20000;
+static string s_lookup_result;
+
+/* Times the lookup of a header at the start and at the end
+ * of the request headers, and of a header which is missing */
+static esp_err_t lookup_handler(httpd_req_t *r)
+{
+    typedef chrono::steady_clock clock;
+    char result[128] = "";
+    size_t pos = 0;
+    for (const char *field : { "Host", "X-Header-19", "X-Missing" }) {
+        auto start = clock::now();
+        for (int i = 0; i < LOOKUPS; i++) {
+            httpd_req_get_hdr_value_len(r, field);
+        }
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(clock::now() - start).count();
+        pos += snprintf(result + pos, sizeof(result) - pos, "%s %4u ns  ", field,
+                        (unsigned) (ns / LOOKUPS));
+    }
+    s_lookup_result = result;
+    return httpd_resp_send(r, "ok", HTTPD_RESP_USE_STRLEN);
+}
+
+TEST_CASE("request header lookup benchmark", "[httpd][.][benchmark]")
+{
+    httpd_handle_t server = start_server(0);
+    register_handler(server, "/lookup", lookup_handler);
+    {
+        test_client client;
+        string request = "GET /lookup HTTP/1.1\r\nHost: test\r\n";
+        for (int i = 0; i < 20; i++) {
+            request += "X-Header-" + to_string(i) + ": value\r\n";
+        }
+        REQUIRE(client.send_str(request + "\r\n"));
+        REQUIRE(client.response() == "ok");
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+    printf("header lookup with 21 headers: %s\n", s_lookup_result.c_str());
+}
+
+/* Responds with the user context, a string identifying the handler */
+static esp_err_t name_handler(httpd_req_t *r)
+{
+    return httpd_resp_send(r, (const char *) r->user_ctx, HTTPD_RESP_USE_STRLEN);
+}
+
+static esp_err_t register_named(httpd_handle_t server, const char *uri, httpd_method_t method, const char *name)
+{
+    httpd_uri_t uri_handler = {};
+    uri_handler.uri = uri;
+    uri_handler.method = method;
+    uri_handler.handler = name_handler;
+    uri_handler.user_ctx = (void *) name;
+    return httpd_register_uri_handler(server, &uri_handler);
+}
+
+/* Returns "<status> <body>" of the response to a request on a new connection,
+ * as the server closes the connection after an error response */
+static string request(const string &method, const string &uri)
+{
+    test_client client;
+    REQUIRE(client.send_str(method + " " + uri + " HTTP/1.1\r\nHost: test\r\n\r\n"));
+    string body = client.response();
+    return to_string(client.status) + " " + body;
+}
+
+static bool match_nocase(const char *reference_uri, const char *uri_to_match, size_t match_upto)
+{
+    return strlen(reference_uri) == match_upto && strncasecmp(reference_uri, uri_to_match, match_upto) == 0;
+}
+
+TEST_CASE("URI handlers are matched in order of registration with and without the URI trie", "[httpd]")
+{
+    for (bool trie : { false, true }) {
+        httpd_config_t config = test_config();
+        config.uri_trie_enable = trie;
+        config.max_uri_handlers = 16;
+
+        config.uri_match_fn = NULL;
+        httpd_handle_t server = start_server(config);
+        REQUIRE(register_named(server, "/a/b", HTTP_GET, "b") == ESP_OK);
+        REQUIRE(register_named(server, "/a/bc", HTTP_GET, "bc") == ESP_OK);
+        REQUIRE(register_named(server, "/a/*", HTTP_GET, "*") == ESP_OK);
+        REQUIRE(register_named(server, "/a/b", HTTP_GET, "dup") == ESP_ERR_HTTPD_HANDLER_EXISTS);
+        CHECK(request("GET", "/a/b") == "200 b");
+        CHECK(request("GET", "/a/bc?q=1") == "200 bc");
+        CHECK(request("GET", "/a/*") == "200 *");
+        CHECK(request("GET", "/a/") == "404 This URI does not exist");
+        CHECK(request("POST", "/a/b") == "405 Request method for this URI is not handled by server");
+        REQUIRE(httpd_stop(server) == ESP_OK);
+
+        config.uri_match_fn = httpd_uri_match_wildcard;
+        server = start_server(config);
+        REQUIRE(register_named(server, "/a/b", HTTP_POST, "post b") == ESP_OK);
+        REQUIRE(register_named(server, "/a/*", HTTP_GET, "a*") == ESP_OK);
+        REQUIRE(register_named(server, "/a/b", HTTP_GET, "get b") == ESP_ERR_HTTPD_HANDLER_EXISTS);
+        REQUIRE(register_named(server, "/a/b/c", HTTP_PUT, "put c") == ESP_OK);
+        REQUIRE(register_named(server, "/opt?", HTTP_GET, "opt?") == ESP_OK);
+        REQUIRE(register_named(server, "/pre?*", HTTP_GET, "pre?*") == ESP_OK);
+        REQUIRE(register_named(server, "?", HTTP_GET, "invalid") == ESP_OK);
+        REQUIRE(register_named(server, "/a/b/*", HTTP_DELETE, "delete *") == ESP_OK);
+        CHECK(request("POST", "/a/b") == "200 post b");
+        CHECK(request("GET", "/a/b") == "200 a*");
+        CHECK(request("GET", "/a/") == "200 a*");
+        CHECK(request("GET", "/a") == "404 This URI does not exist");
+        CHECK(request("PUT", "/a/b/c") == "200 put c");
+        CHECK(request("PUT", "/a/b") == "405 Request method for this URI is not handled by server");
+        CHECK(request("DELETE", "/a/b/") == "200 delete *");
+        CHECK(request("DELETE", "/a/b") == "405 Request method for this URI is not handled by server");
+        CHECK(request("GET", "/op") == "200 opt?");
+        CHECK(request("GET", "/opt") == "200 opt?");
+        CHECK(request("GET", "/optx") == "404 This URI does not exist");
+        CHECK(request("GET", "/opx") == "404 This URI does not exist");
+        CHECK(request("GET", "/pr") == "200 pre?*");
+        CHECK(request("GET", "/prefix") == "200 pre?*");
+        CHECK(request("GET", "/prx") == "404 This URI does not exist");
+        CHECK(request("GET", "?") == "400 Server unable to understand request due to invalid syntax");
+
+        /* The trie follows changes of the registered handlers */
+        REQUIRE(httpd_unregister_uri_handler(server, "/a/*", HTTP_GET) == ESP_OK);
+        REQUIRE(register_named(server, "/a/b", HTTP_GET, "get b") == ESP_OK);
+        CHECK(request("GET", "/a/b") == "200 get b");
+        CHECK(request("GET", "/a/") == "404 This URI does not exist");
+        REQUIRE(httpd_unregister_uri(server, "/a/b") == ESP_OK);
+        CHECK(request("GET", "/a/b") == "404 This URI does not exist");
+        CHECK(request("PUT", "/a/b/c") == "200 put c");
+        REQUIRE(httpd_stop(server) == ESP_OK);
+
+        /* Other matching functions test each handler in turn */
+        config.uri_match_fn = match_nocase;
+        server = start_server(config);
+        REQUIRE(register_named(server, "/Case", HTTP_GET, "case") == ESP_OK);
+        CHECK(request("GET", "/cASE") == "200 case");
+        REQUIRE(httpd_stop(server) == ESP_OK);
+    }
+}
+
+/* Handlers are registered and unregistered by the test while the server
+ * task and workers look up the handlers of requests */
+TEST_CASE("URI handlers can be changed while requests are in flight", "[httpd]")
+{
+    const int CLIENTS = 4;
+    const int CHANGES = 300;
+    const int MIN_REQUESTS = 20;
+
+    for (bool trie : { false, true }) {
+        httpd_config_t config = test_config();
+        config.uri_trie_enable = trie;
+        config.uri_match_fn = httpd_uri_match_wildcard;
+        config.max_uri_handlers = 16;
+        config.worker_count = 2;
+        httpd_handle_t server = start_server(config);
+        REQUIRE(register_named(server, "/stable/a", HTTP_GET, "a") == ESP_OK);
+        REQUIRE(register_named(server, "/stable/*", HTTP_GET, "*") == ESP_OK);
+
+        atomic<bool> done(false);
+        atomic<int> requests(0), failures(0);
+        vector<thread> threads;
+        for (int c = 0; c < CLIENTS; c++) {
+            threads.emplace_back([&]() {
+                test_client client;
+                while (!done) {
+                    bool ok = client.get("/stable/a") && client.response() == "a" &&
+                              client.get("/stable/b") && client.response() == "*";
+                    if (!ok) {
+                        failures++;
+                        break;
+                    }
+                    requests++;
+                }
+            });
+        }
+
+        /* Keep changing the handlers until the clients have made some requests, the changes alone can finish before
+         * the first request arrives */
+        const char *names[] = { "/temp/0", "/temp/1/*", "/stable", "/temp/3?" };
+        for (int i = 0; i < CHANGES || (requests < MIN_REQUESTS && failures == 0); i++) {
+            const char *uri = names[i % 4];
+            REQUIRE(register_named(server, uri, HTTP_GET, "temp") == ESP_OK);
+            REQUIRE(register_named(server, uri, HTTP_PUT, "temp") == ESP_OK);
+            if (i % 2) {
+                REQUIRE(httpd_unregister_uri(server, uri) == ESP_OK);
+            } else {
+                REQUIRE(httpd_unregister_uri_handler(server, uri, HTTP_GET) == ESP_OK);
+                REQUIRE(httpd_unregister_uri_handler(server, uri, HTTP_PUT) == ESP_OK);
+            }
+        }
+        done = true;
+        for (auto &t : threads) {
+            t.join();
+        }
+        CHECK(failures == 0);
+        CHECK(requests >= MIN_REQUESTS);
+        REQUIRE(httpd_stop(server) == ESP_OK);
+    }
+}
+
+/* Time of looking up URI handlers of a REST API, through
+ * registration of a handler which is already registered */
+TEST_CASE("URI handler lookup benchmark", "[httpd][.][benchmark]")
+{
+    const int ENDPOINTS = 120;
+    const int LOOKUPS = 20000;
+    typedef chrono::steady_clock clock;
+
+    vector<string> uris;
+    for (int i = 0; i < ENDPOINTS / 2; i++) {
+        uris.push_back("/api/v1/resource" + to_string(i));
+        uris.push_back("/api/v1/resource" + to_string(i) + "/items/*");
+    }
+
+    for (bool trie : { false, true }) {
+        httpd_config_t config = test_config();
+        config.uri_trie_enable = trie;
+        config.max_uri_handlers = ENDPOINTS;
+        config.uri_match_fn = httpd_uri_match_wildcard;
+        httpd_handle_t server = start_server(config);
+
+        auto start = clock::now();
+        for (auto &uri : uris) {
+            REQUIRE(register_named(server, uri.c_str(), HTTP_GET, "") == ESP_OK);
+        }
+        auto register_us = chrono::duration_cast<chrono::microseconds>(clock::now() - start).count();
+
+        printf("%s, %d handlers: registration %6u us, lookup", trie ? "trie  " : "linear", ENDPOINTS, (unsigned) register_us);
+        for (const char *uri : { "/api/v1/resource0", "/api/v1/resource59/items/42" }) {
+            httpd_uri_t uri_handler = {};
+            uri_handler.uri = uri;
+            uri_handler.method = HTTP_GET;
+            uri_handler.handler = name_handler;
+            start = clock::now();
+            for (int i = 1; i < LOOKUPS; i++) {
+                httpd_register_uri_handler(server, &uri_handler);
+            }
+            REQUIRE(httpd_register_uri_handler(server, &uri_handler) == ESP_ERR_HTTPD_HANDLER_EXISTS);
+            auto ns = chrono::duration_cast<chrono::nanoseconds>(clock::now() - start).count();
+            printf(" %s %5u ns", uri, (unsigned) (ns / LOOKUPS));
+        }
+        printf("\n");
+        REQUIRE(httpd_stop(server) == ESP_OK);
+    }
+}
+
+static string random_content(size_t len)
+{
+    string content(len, '\0');
+    srand(len);
+    for (auto &c : content) {
+        c = (char) rand();
+    }
+    return content;
+}
+
+static string write_temp_file(const string &content)
+{
+    char path[] = "/tmp/test_http_server_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE(write(fd, content.data(), content.size()) == (ssize_t) content.size());
+    close(fd);
+    return path;
+}
+
+/* Sends the file at the path given as user context */
+static esp_err_t file_handler(httpd_req_t *r)
+{
+    int fd = open((const char *) r->user_ctx, O_RDONLY);
+    if (fd < 0) {
+        return httpd_resp_send_err(r, HTTPD_404_NOT_FOUND, NULL);
+    }
+    httpd_resp_set_type(r, HTTPD_TYPE_OCTET);
+    esp_err_t ret = httpd_resp_send_file(r, fd);
+    close(fd);
+    return ret;
+}
+
+static void register_file_handler(httpd_handle_t server, const char *uri, const char *path)
+{
+    httpd_uri_t uri_handler = {};
+    uri_handler.uri = uri;
+    uri_handler.method = HTTP_GET;
+    uri_handler.handler = file_handler;
+    uri_handler.user_ctx = (void *) path;
+    REQUIRE(httpd_register_uri_handler(server, &uri_handler) == ESP_OK);
+}
+
+static string get_range(test_client &client, const string &uri, const string &range)
+{
+    REQUIRE(client.send_str("GET " + uri + " HTTP/1.1\r\nHost: test\r\nRange: " + range + "\r\n\r\n"));
+    return client.response();
+}
+
+static bool has_header(const test_client &client, const string &header)
+{
+    return client.headers.find("\r\n" + header + "\r\n") != string::npos;
+}
+
+TEST_CASE("files are sent with their size, or ranges of them on request", "[httpd]")
+{
+    const string content = random_content(300000);
+    const string path = write_temp_file(content);
+    httpd_handle_t server = start_server(0);
+    register_file_handler(server, "/file", path.c_str());
+    {
+        test_client client;
+        REQUIRE(client.get("/file"));
+        CHECK(client.response() == content);
+        CHECK(client.status == 200);
+        CHECK(has_header(client, "Content-Length: 300000"));
+        CHECK(has_header(client, "Accept-Ranges: bytes"));
+
+        CHECK(get_range(client, "/file", "bytes=0-9") == content.substr(0, 10));
+        CHECK(client.status == 206);
+        CHECK(has_header(client, "Content-Range: bytes 0-9/300000"));
+
+        CHECK(get_range(client, "/file", "bytes=299990-") == content.substr(299990));
+        CHECK(has_header(client, "Content-Range: bytes 299990-299999/300000"));
+
+        CHECK(get_range(client, "/file", "bytes=-100") == content.substr(299900));
+        CHECK(has_header(client, "Content-Range: bytes 299900-299999/300000"));
+
+        CHECK(get_range(client, "/file", "bytes=100-999999") == content.substr(100));
+        CHECK(has_header(client, "Content-Range: bytes 100-299999/300000"));
+
+        CHECK(get_range(client, "/file", "bytes=300000-") == "");
+        CHECK(client.status == 416);
+        CHECK(has_header(client, "Content-Range: bytes */300000"));
+
+        /* Ranges which are not served are ignored */
+        CHECK(get_range(client, "/file", "bytes=5-2") == content);
+        CHECK(client.status == 200);
+        CHECK(get_range(client, "/file", "bytes=0-1,5-6") == content);
+        CHECK(client.status == 200);
+        CHECK(get_range(client, "/file", "lines=1-2") == content);
+        CHECK(client.status == 200);
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+    unlink(path.c_str());
+}
+
+static int s_pipe_fd;
+
+static esp_err_t pipe_handler(httpd_req_t *r)
+{
+    return httpd_resp_send_file(r, s_pipe_fd);
+}
+
+TEST_CASE("files of unknown size are sent in chunks", "[httpd]")
+{
+    const string content = random_content(20000);
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    REQUIRE(write(fds[1], content.data(), content.size()) == (ssize_t) content.size());
+    close(fds[1]);
+    s_pipe_fd = fds[0];
+
+    httpd_handle_t server = start_server(0);
+    register_handler(server, "/pipe", pipe_handler);
+    {
+        test_client client;
+        CHECK(get_range(client, "/pipe", "bytes=0-9") == content);
+        CHECK(client.status == 200);
+        CHECK(has_header(client, "Transfer-Encoding: chunked"));
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+    close(fds[0]);
+}
+
+static esp_partition_t s_partition;
+static esp_err_t s_partition_ret;
+static size_t s_partition_offset;
+static size_t s_partition_len;
+
+static esp_err_t partition_handler(httpd_req_t *r)
+{
+    s_partition_ret = httpd_resp_send_partition(r, &s_partition, s_partition_offset, s_partition_len);
+    if (s_partition_ret == ESP_ERR_INVALID_ARG) {
+        return httpd_resp_send(r, "invalid", HTTPD_RESP_USE_STRLEN);
+    }
+    return s_partition_ret;
+}
+
+TEST_CASE("partitions are sent from windows of mapped flash", "[httpd]")
+{
+    const string flash = random_content(0x400000);
+    test_flash = (const uint8_t *) flash.data();
+    test_flash_max_pages = 0;
+    s_partition.address = 0x110000;
+    s_partition.size = 0x180000;
+    s_partition_offset = 0x1234;
+    s_partition_len = 0x170000 + 5;
+    const string content = flash.substr(s_partition.address + s_partition_offset, s_partition_len);
+
+    httpd_handle_t server = start_server(0);
+    register_handler(server, "/part", partition_handler);
+    {
+        test_client client;
+        REQUIRE(client.get("/part"));
+        CHECK(client.response() == content);
+        CHECK(s_partition_ret == ESP_OK);
+        CHECK(has_header(client, "Content-Length: " + to_string(content.size())));
+
+        CHECK(get_range(client, "/part", "bytes=70000-200000") == content.substr(70000, 130001));
+        CHECK(client.status == 206);
+
+        s_partition_len = s_partition.size;
+        REQUIRE(client.get("/part"));
+        CHECK(client.response() == "invalid");
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+    CHECK(test_flash_mapped == 0);
+    CHECK(test_flash_max_pages == 4);
+}
+
+/* Static content of the size of a web UI bundle, sent by reading it into a buffer and
+ * sending chunks as in the file serving example, or with the file and partition APIs */
+static esp_err_t chunked_file_handler(httpd_req_t *r)
+{
+    FILE *f = fopen((const char *) r->user_ctx, "r");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    static char chunk[8192];
+    size_t chunksize;
+    esp_err_t ret = ESP_OK;
+    do {
+        chunksize = fread(chunk, 1, sizeof(chunk), f);
+        ret = httpd_resp_send_chunk(r, chunk, chunksize);
+    } while (ret == ESP_OK && chunksize != 0);
+    fclose(f);
+    return ret;
+}
+
+TEST_CASE("file response benchmark", "[httpd][.][benchmark]")
+{
+    const int ITERATIONS = 10;
+    const string content = random_content(1536 * 1024);
+    const string path = write_temp_file(content);
+    typedef chrono::steady_clock clock;
+
+    test_flash = (const uint8_t *) content.data();
+    s_partition.address = 0;
+    s_partition.size = content.size();
+    s_partition_offset = 0;
+    s_partition_len = content.size();
+
+    httpd_handle_t server = start_server(0);
+    httpd_uri_t uri_handler = {};
+    uri_handler.uri = "/chunked";
+    uri_handler.method = HTTP_GET;
+    uri_handler.handler = chunked_file_handler;
+    uri_handler.user_ctx = (void *) path.c_str();
+    REQUIRE(httpd_register_uri_handler(server, &uri_handler) == ESP_OK);
+    register_file_handler(server, "/file", path.c_str());
+    register_handler(server, "/part", partition_handler);
+    {
+        test_client client;
+        for (const char *uri : { "/chunked", "/file", "/part" }) {
+            auto start = clock::now();
+            for (int i = 0; i < ITERATIONS; i++) {
+                REQUIRE(client.get(uri));
+                REQUIRE(client.response().size() == content.size());
+            }
+            auto us = chrono::duration_cast<chrono::microseconds>(clock::now() - start).count();
+            printf("%-8s 1.5 MB response: %4u MB/s\n", uri,
+                   (unsigned) ((uint64_t) content.size() * ITERATIONS / us));
+        }
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+    unlink(path.c_str());
+}
+
+/* Stands in for a handler waiting for flash, a file system or another device */
+static esp_err_t load_handler(httpd_req_t *r)
+{
+    this_thread::sleep_for(chrono::milliseconds(1));
+    return httpd_resp_send(r, "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef", HTTPD_RESP_USE_STRLEN);
+}
+
+/* Request rate and latency with 8 clients each sending requests one after another on a
+ * keep-alive connection, to handlers which take 1 ms to respond */
+TEST_CASE("worker task load benchmark", "[httpd][.][benchmark]")
+{
+    const int CLIENTS = 8;
+    const int REQUESTS = 150;
+    typedef chrono::steady_clock clock;
+
+    for (uint16_t worker_count : { 0, 1, 2, 4 }) {
+        httpd_handle_t server = start_server(worker_count);
+        register_handler(server, "/load", load_handler);
+
+        /* Connect before starting the clock, connections
+         * exceeding the listen backlog would be retried later */
+        vector<test_client> clients(CLIENTS);
+        vector<vector<uint32_t>> latencies(CLIENTS);
+        vector<thread> threads;
+        auto start = clock::now();
+        for (int c = 0; c < CLIENTS; c++) {
+            threads.emplace_back([&clients, &latencies, c]() {
+                for (int i = 0; i < REQUESTS; i++) {
+                    auto sent = clock::now();
+                    if (!clients[c].get("/load") || clients[c].response().empty()) {
+                        break;
+                    }
+                    latencies[c].push_back(chrono::duration_cast<chrono::microseconds>(clock::now() - sent).count());
+                }
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        uint64_t us = chrono::duration_cast<chrono::microseconds>(clock::now() - start).count();
+        clients.clear();
+        REQUIRE(httpd_stop(server) == ESP_OK);
+
+        vector<uint32_t> all;
+        for (auto &l : latencies) {
+            all.insert(all.end(), l.begin(), l.end());
+        }
+        REQUIRE(all.size() == CLIENTS * REQUESTS);
+        sort(all.begin(), all.end());
+        printf("%d workers: %6u requests/s, p99 latency %6u us\n", worker_count,
+               (unsigned) (all.size() * 1000000 / us), all[all.size() * 99 / 100]);
+    }
+}
+
+/* Client side of a WebSocket connection, which masks the frames it sends as RFC6455 requires */
+struct ws_test_client : test_client {
+    uint8_t mask_key[4] = { 0x12, 0x34, 0x56, 0x78 };
+
+    bool handshake(const string &uri)
+    {
+        /* The key and its accept value from RFC6455 Section 1.3 */
+        if (!send_str("GET " + uri + " HTTP/1.1\r\nHost: test\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                      "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n")) {
+            return false;
+        }
+        size_t hdr_end;
+        while ((hdr_end = received.find("\r\n\r\n")) == string::npos) {
+            if (!receive()) {
+                return false;
+            }
+        }
+        status = atoi(received.c_str() + strlen("HTTP/1.1 "));
+        headers = received.substr(0, hdr_end + 2);
+        received.erase(0, hdr_end + 4);
+        return status == 101 && headers.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != string::npos;
+    }
+
+    string frame(uint8_t first_byte, const string &payload)
+    {
+        string frame(1, (char) first_byte);
+        if (payload.size() < 126) {
+            frame += (char) (0x80 | payload.size());
+        } else if (payload.size() <= UINT16_MAX) {
+            frame += (char) (0x80 | 126);
+            frame += (char) (payload.size() >> 8);
+            frame += (char) payload.size();
+        } else {
+            frame += (char) (0x80 | 127);
+            for (int i = 7; i >= 0; i--) {
+                frame += (char) ((uint64_t) payload.size() >> (i * 8));
+            }
+        }
+        frame.append((const char *) mask_key, sizeof(mask_key));
+        for (size_t i = 0; i < payload.size(); i++) {
+            frame += (char) (payload[i] ^ mask_key[i % 4]);
+        }
+        /* Use another mask key for the next frame */
+        for (auto &k : mask_key) {
+            k += 0x11;
+        }
+        return frame;
+    }
+
+    bool send_frame(uint8_t first_byte, const string &payload)
+    {
+        return send_str(frame(first_byte, payload));
+    }
+
+    /* Returns the payload of the next frame from the server, or "" with first_byte 0 on failure */
+    string recv_frame(uint8_t &first_byte)
+    {
+        first_byte = 0;
+        while (received.size() < 2) {
+            if (!receive()) {
+                return "";
+            }
+        }
+        size_t hdr_len = 2;
+        size_t len = received[1] & 0x7f;
+        if (len == 126) {
+            hdr_len = 4;
+            while (received.size() < hdr_len) {
+                if (!receive()) {
+                    return "";
+                }
+            }
+            len = (uint8_t) received[2] << 8 | (uint8_t) received[3];
+        }
+        while (received.size() < hdr_len + len) {
+            if (!receive()) {
+                return "";
+            }
+        }
+        first_byte = received[0];
+        string payload = received.substr(hdr_len, len);
+        received.erase(0, hdr_len + len);
+        return payload;
+    }
+};
+
+static const uint8_t WS_FIN = 0x80;
+static const uint8_t WS_CONTINUE = HTTPD_WS_TYPE_CONTINUE;
+static const uint8_t WS_TEXT = HTTPD_WS_TYPE_TEXT;
+static const uint8_t WS_BINARY = HTTPD_WS_TYPE_BINARY;
+static const uint8_t WS_PING = HTTPD_WS_TYPE_PING;
+static const uint8_t WS_PONG = HTTPD_WS_TYPE_PONG;
+
+static void register_ws_handler(httpd_handle_t server, const char *uri, esp_err_t (*handler)(httpd_req_t *r))
+{
+    httpd_uri_t uri_handler = {};
+    uri_handler.uri = uri;
+    uri_handler.method = HTTP_GET;
+    uri_handler.handler = handler;
+    uri_handler.is_websocket = true;
+    REQUIRE(httpd_register_uri_handler(server, &uri_handler) == ESP_OK);
+}
+
+static esp_err_t ws_send(httpd_req_t *r, httpd_ws_type_t type, const void *payload, size_t len)
+{
+    httpd_ws_frame_t frame = {};
+    frame.type = type;
+    frame.payload = (uint8_t *) payload;
+    frame.len = len;
+    return httpd_ws_send_frame(r, &frame);
+}
+
+/* Echoes each frame, received at an offset from a word boundary which changes from frame to frame */
+static esp_err_t ws_echo_frame_handler(httpd_req_t *r)
+{
+    static uint32_t buf[70000 / sizeof(uint32_t)];
+    static unsigned count;
+    httpd_ws_frame_t frame = {};
+    frame.payload = (uint8_t *) buf + count++ % 4;
+    esp_err_t ret = httpd_ws_recv_frame(r, &frame, sizeof(buf) - 4);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    return ws_send(r, frame.type, frame.payload, frame.len);
+}
+
+TEST_CASE("WebSocket frames are unmasked at any length and alignment", "[httpd][ws]")
+{
+    httpd_handle_t server = start_server(0);
+    register_ws_handler(server, "/ws", ws_echo_frame_handler);
+    {
+        ws_test_client client;
+        REQUIRE(client.handshake("/ws"));
+        const string content = random_content(60000);
+        for (size_t len : { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 125, 126, 127, 1000, 60000 }) {
+            for (int i = 0; i < 4; i++) {
+                string payload = content.substr(i, len);
+                REQUIRE(client.send_frame(WS_FIN | WS_BINARY, payload));
+                uint8_t first_byte;
+                CHECK(client.recv_frame(first_byte) == payload);
+                CHECK(first_byte == (WS_FIN | WS_BINARY));
+            }
+        }
+
+        /* The payload of a frame may arrive in several pieces */
+        string frame = client.frame(WS_FIN | WS_TEXT, content.substr(0, 3001));
+        REQUIRE(client.send_str(frame.substr(0, 1000)));
+        this_thread::sleep_for(chrono::milliseconds(10));
+        REQUIRE(client.send_str(frame.substr(1000)));
+        uint8_t first_byte;
+        CHECK(client.recv_frame(first_byte) == content.substr(0, 3001));
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+/* Echoes each message in a single frame */
+static esp_err_t ws_echo_message(httpd_req_t *r, size_t max_len)
+{
+    static uint8_t buf[60000];
+    httpd_ws_frame_t frame = {};
+    frame.payload = buf;
+    esp_err_t ret = httpd_ws_recv_message(r, &frame, max_len, NULL, NULL);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    return ws_send(r, frame.type, frame.payload, frame.len);
+}
+
+static esp_err_t ws_echo_message_handler(httpd_req_t *r)
+{
+    return ws_echo_message(r, 60000);
+}
+
+static esp_err_t ws_echo_small_message_handler(httpd_req_t *r)
+{
+    return ws_echo_message(r, 10);
+}
+
+TEST_CASE("fragmented WebSocket messages are reassembled", "[httpd][ws]")
+{
+    httpd_handle_t server = start_server(0);
+    register_ws_handler(server, "/ws", ws_echo_message_handler);
+    register_ws_handler(server, "/ws/small", ws_echo_small_message_handler);
+    {
+        ws_test_client client;
+        REQUIRE(client.handshake("/ws"));
+        uint8_t first_byte;
+
+        /* Messages which aren't fragmented */
+        REQUIRE(client.send_frame(WS_FIN | WS_TEXT, "WebSocket"));
+        CHECK(client.recv_frame(first_byte) == "WebSocket");
+        CHECK(first_byte == (WS_FIN | WS_TEXT));
+
+        /* A message in fragments, with control frames in between */
+        REQUIRE(client.send_frame(WS_TEXT, "Hello, "));
+        REQUIRE(client.send_frame(WS_FIN | WS_PING, "ping"));
+        REQUIRE(client.send_frame(WS_CONTINUE, ""));
+        REQUIRE(client.send_frame(WS_FIN | WS_PONG, "pong"));
+        REQUIRE(client.send_frame(WS_CONTINUE, "Web"));
+        REQUIRE(client.send_frame(WS_FIN | WS_CONTINUE, "Socket"));
+        CHECK(client.recv_frame(first_byte) == "ping");
+        CHECK(first_byte == (WS_FIN | WS_PONG));
+        CHECK(client.recv_frame(first_byte) == "Hello, WebSocket");
+        CHECK(first_byte == (WS_FIN | WS_TEXT));
+
+        /* Fragments of odd lengths */
+        const string content = random_content(50000);
+        REQUIRE(client.send_frame(WS_BINARY, content.substr(0, 3)));
+        REQUIRE(client.send_frame(WS_CONTINUE, content.substr(3, 30001)));
+        REQUIRE(client.send_frame(WS_FIN | WS_CONTINUE, content.substr(30004)));
+        CHECK(client.recv_frame(first_byte) == content);
+        CHECK(first_byte == (WS_FIN | WS_BINARY));
+    }
+    {
+        /* Messages which don't fit in the buffer close the connection */
+        ws_test_client client;
+        REQUIRE(client.handshake("/ws/small"));
+        uint8_t first_byte;
+        REQUIRE(client.send_frame(WS_FIN | WS_TEXT, "0123456789"));
+        CHECK(client.recv_frame(first_byte) == "0123456789");
+        REQUIRE(client.send_frame(WS_TEXT, "01234"));
+        REQUIRE(client.send_frame(WS_FIN | WS_CONTINUE, "567890"));
+        CHECK(client.recv_frame(first_byte) == "");
+        CHECK(first_byte == 0);
+    }
+    {
+        /* A new message can't start before the last one is complete */
+        ws_test_client client;
+        REQUIRE(client.handshake("/ws"));
+        uint8_t first_byte;
+        REQUIRE(client.send_frame(WS_TEXT, "Hello"));
+        REQUIRE(client.send_frame(WS_FIN | WS_TEXT, "Hello"));
+        CHECK(client.recv_frame(first_byte) == "");
+        CHECK(first_byte == 0);
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+struct ws_stream {
+    string message;
+    size_t pieces;
+    size_t max_piece_len;
+    bool final;
+};
+
+static esp_err_t ws_stream_cb(httpd_req_t *r, const uint8_t *data, size_t len, bool final, void *arg)
+{
+    ws_stream *stream = (ws_stream *) arg;
+    REQUIRE_FALSE(stream->final);
+    stream->message.append((const char *) data, len);
+    stream->pieces++;
+    stream->max_piece_len = max(stream->max_piece_len, len);
+    stream->final = final;
+    return ESP_OK;
+}
+
+/* Receives each message through a buffer of 100 bytes, and echoes it with the number of pieces
+ * received and the length of the longest one */
+static esp_err_t ws_stream_handler(httpd_req_t *r)
+{
+    uint32_t buf[101 / sizeof(uint32_t) + 1];
+    ws_stream stream = {};
+    httpd_ws_frame_t frame = {};
+    frame.payload = (uint8_t *) buf + 1;
+    esp_err_t ret = httpd_ws_recv_message(r, &frame, 100, ws_stream_cb, &stream);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    REQUIRE(stream.final);
+    REQUIRE(frame.len == stream.message.size());
+    string reply = to_string(stream.pieces) + " " + to_string(stream.max_piece_len) + " " + stream.message;
+    return ws_send(r, frame.type, reply.data(), reply.size());
+}
+
+TEST_CASE("WebSocket messages are streamed to a callback", "[httpd][ws]")
+{
+    httpd_handle_t server = start_server(0);
+    register_ws_handler(server, "/ws", ws_stream_handler);
+    {
+        ws_test_client client;
+        REQUIRE(client.handshake("/ws"));
+        uint8_t first_byte;
+
+        REQUIRE(client.send_frame(WS_FIN | WS_TEXT, "WebSocket"));
+        CHECK(client.recv_frame(first_byte) == "1 9 WebSocket");
+
+        /* Pieces of 250 + 1 + 30001 bytes */
+        const string content = random_content(30252);
+        REQUIRE(client.send_frame(WS_BINARY, content.substr(0, 250)));
+        REQUIRE(client.send_frame(WS_FIN | WS_PING, ""));
+        REQUIRE(client.send_frame(WS_CONTINUE, content.substr(250, 1)));
+        REQUIRE(client.send_frame(WS_FIN | WS_CONTINUE, content.substr(251)));
+        CHECK(client.recv_frame(first_byte) == "");
+        CHECK(first_byte == (WS_FIN | WS_PONG));
+        CHECK(client.recv_frame(first_byte) == "305 100 " + content);
+        CHECK(first_byte == (WS_FIN | WS_BINARY));
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+/* Receives each message and replies with its length */
+static esp_err_t ws_sink_handler(httpd_req_t *r)
+{
+    static uint8_t buf[1024 * 1024];
+    httpd_ws_frame_t frame = {};
+    frame.payload = buf;
+    esp_err_t ret = httpd_ws_recv_message(r, &frame, sizeof(buf), NULL, NULL);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    string reply = to_string(frame.len);
+    return ws_send(r, HTTPD_WS_TYPE_TEXT, reply.data(), reply.size());
+}
+
+TEST_CASE("WebSocket receive benchmark", "[httpd][ws][.][benchmark]")
+{
+    typedef chrono::steady_clock clock;
+
+    httpd_handle_t server = start_server(0);
+    register_ws_handler(server, "/ws", ws_sink_handler);
+    {
+        ws_test_client client;
+        REQUIRE(client.handshake("/ws"));
+        for (size_t len : { 1024, 64 * 1024, 1024 * 1024 }) {
+            const int iterations = 64 * 1024 * 1024 / len;
+            const string frame = client.frame(WS_FIN | WS_BINARY, random_content(len));
+            const string reply = to_string(len);
+            uint8_t first_byte;
+            auto start = clock::now();
+            for (int i = 0; i < iterations; i++) {
+                if (!client.send_str(frame) || client.recv_frame(first_byte) != reply) {
+                    FAIL("message " << i << " of " << len << " bytes not received");
+                }
+            }
+            auto us = chrono::duration_cast<chrono::microseconds>(clock::now() - start).count();
+            printf("%7u byte messages: %4u MB/s\n", (unsigned) len, (unsigned) ((uint64_t) len * iterations / us));
+        }
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
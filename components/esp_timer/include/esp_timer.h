@@ -204,7 +204,7 @@ int64_t esp_timer_get_next_alarm(void);
  *
  * The format is:
  *
- *   name  period  alarm  times_armed  times_triggered  total_callback_run_time
+ *   name  period  alarm  times_armed  times_triggered  total_callback_run_time  max_callback_run_time  max_dispatch_lag
  *
  * where:
  *
@@ -218,6 +218,9 @@ int64_t esp_timer_get_next_alarm(void);
  * times_armed — number of times the timer was armed via esp_timer_start_X
  * times_triggered - number of times the callback was called
  * total_callback_run_time - total time taken by callback to execute, across all calls
+ * max_callback_run_time - longest time taken by one call of the callback
+ * max_dispatch_lag - longest delay between the alarm time and the start of the callback,
+ *                    a large value means that other callbacks delay this timer
  *
  * @param stream stream (such as stdout) to dump the information to
  * @return
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <sys/param.h>
+#include <stdlib.h>
 #include <string.h>
 #include "soc/soc.h"
 #include "esp_types.h"
@@ -20,6 +21,7 @@
 #include "esp_err.h"
 #include "esp_task.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
@@ -61,6 +63,12 @@
 
 #define TIMER_EVENT_QUEUE_SIZE      16
 
+// initial capacity of s_timer_heap, it doubles when more timers are created
+#define TIMER_HEAP_MIN_CAPACITY     8
+
+// maximum number of expired timers taken from s_timer_heap in one pass of timer_process_alarm
+#define TIMER_DISPATCH_BATCH_SIZE   16
+
 struct esp_timer {
     uint64_t alarm;
     uint64_t period;
@@ -69,13 +77,17 @@ struct esp_timer {
         uint32_t event_id;
     };
     void* arg;
+    size_t heap_index;      // position in s_timer_heap while armed
+    uint32_t seq;           // order of arming, timers with the same alarm time run in this order
 #if WITH_PROFILING
     const char* name;
     size_t times_triggered;
     size_t times_armed;
     uint64_t total_callback_run_time;
-#endif // WITH_PROFILING
+    uint64_t max_callback_run_time;
+    uint64_t max_dispatch_lag;      // longest time from the alarm until the callback was called
     LIST_ENTRY(esp_timer) list_entry;
+#endif // WITH_PROFILING
 };
 
 static inline bool is_initialized(void);
@@ -84,6 +96,12 @@ static esp_err_t timer_remove(esp_timer_handle_t timer);
 static bool timer_armed(esp_timer_handle_t timer);
 static void timer_list_lock(void);
 static void timer_list_unlock(void);
+static esp_err_t timer_heap_reserve(void);
+static void timer_heap_push(esp_timer_handle_t timer);
+static void timer_heap_remove(esp_timer_handle_t timer);
+static inline esp_timer_handle_t timer_heap_first(void);
+static bool timer_dispatch_pending(esp_timer_handle_t timer);
+static bool timer_cancel_dispatch(esp_timer_handle_t timer);
 
 #if WITH_PROFILING
 static void timer_insert_inactive(esp_timer_handle_t timer);
@@ -92,14 +110,39 @@ static void timer_remove_inactive(esp_timer_handle_t timer);
 
 static const char* TAG = "esp_timer";
 
-// list of currently armed timers
-static LIST_HEAD(esp_timer_list, esp_timer) s_timers =
-        LIST_HEAD_INITIALIZER(s_timers);
+// currently armed timers, as a binary min-heap ordered by alarm time (and seq)
+static esp_timer_handle_t* s_timer_heap;
+// number of armed timers in s_timer_heap
+static size_t s_timer_heap_size;
+// number of entries allocated in s_timer_heap, always >= s_timer_count
+static size_t s_timer_heap_capacity;
+// number of timers created and not yet freed, each of which may be armed
+static size_t s_timer_count;
+// incremented each time a timer is armed, see esp_timer::seq
+static uint32_t s_timer_seq;
+
+/* Callback of an expired timer, taken from s_timer_heap by timer_process_alarm */
+typedef struct {
+    esp_timer_handle_t pending;     // cleared when the callback is called, or if the timer is stopped before that
+    esp_timer_cb_t callback;
+    void* arg;
+#if WITH_PROFILING
+    esp_timer_handle_t timer;       // NULL if the callback wasn't called
+    uint64_t alarm;
+    uint64_t dispatch_lag;
+    uint64_t run_time;
+#endif
+} timer_dispatch_t;
+
+// callbacks being dispatched by timer_process_alarm, protected by s_timer_lock except for the 'pending' field
+static timer_dispatch_t s_dispatch_batch[TIMER_DISPATCH_BATCH_SIZE];
+// number of entries of s_dispatch_batch in use
+static size_t s_dispatch_count;
 #if WITH_PROFILING
 // list of unarmed timers, used only to be able to dump statistics about
 // all the timers
 static LIST_HEAD(esp_inactive_timer_list, esp_timer) s_inactive_timers =
-        LIST_HEAD_INITIALIZER(s_timers);
+        LIST_HEAD_INITIALIZER(s_inactive_timers);
 #endif
 // task used to dispatch timer callbacks
 static TaskHandle_t s_timer_task;
@@ -111,7 +154,7 @@ static SemaphoreHandle_t s_timer_semaphore;
 static StaticQueue_t s_timer_semaphore_memory;
 #endif
 
-// lock protecting s_timers, s_inactive_timers
+// lock protecting s_timer_heap, s_inactive_timers
 static portMUX_TYPE s_timer_lock = portMUX_INITIALIZER_UNLOCKED;
 
 
@@ -124,8 +167,15 @@ esp_err_t esp_timer_create(const esp_timer_create_args_t* args,
     if (args == NULL || args->callback == NULL || out_handle == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
+    /* Make room for the timer in s_timer_heap now, so that arming it never allocates */
+    if (timer_heap_reserve() != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
     esp_timer_handle_t result = (esp_timer_handle_t) calloc(1, sizeof(*result));
     if (result == NULL) {
+        timer_list_lock();
+        s_timer_count--;
+        timer_list_unlock();
         return ESP_ERR_NO_MEM;
     }
     result->callback = args->callback;
@@ -210,23 +260,9 @@ static IRAM_ATTR esp_err_t timer_insert(esp_timer_handle_t timer)
 #if WITH_PROFILING
     timer_remove_inactive(timer);
 #endif
-    esp_timer_handle_t it, last = NULL;
-    if (LIST_FIRST(&s_timers) == NULL) {
-        LIST_INSERT_HEAD(&s_timers, timer, list_entry);
-    } else {
-        LIST_FOREACH(it, &s_timers, list_entry) {
-            if (timer->alarm < it->alarm) {
-                LIST_INSERT_BEFORE(it, timer, list_entry);
-                break;
-            }
-            last = it;
-        }
-        if (it == NULL) {
-            assert(last);
-            LIST_INSERT_AFTER(last, timer, list_entry);
-        }
-    }
-    if (timer == LIST_FIRST(&s_timers)) {
+    timer->seq = s_timer_seq++;
+    timer_heap_push(timer);
+    if (timer == timer_heap_first()) {
         esp_timer_impl_set_alarm(timer->alarm);
     }
     return ESP_OK;
@@ -235,14 +271,131 @@ static IRAM_ATTR esp_err_t timer_insert(esp_timer_handle_t timer)
 static IRAM_ATTR esp_err_t timer_remove(esp_timer_handle_t timer)
 {
     timer_list_lock();
-    LIST_REMOVE(timer, list_entry);
-    timer->alarm = 0;
-    timer->period = 0;
+    /* The timer may have expired but its callback is not called yet */
+    bool cancelled = timer_cancel_dispatch(timer);
+    bool in_heap = timer->alarm > 0;
+    if (in_heap) {
+        timer_heap_remove(timer);
+        timer->alarm = 0;
+        timer->period = 0;
 #if WITH_PROFILING
-    timer_insert_inactive(timer);
+        timer_insert_inactive(timer);
 #endif
+    }
     timer_list_unlock();
-    return ESP_OK;
+    return (in_heap || cancelled) ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+/* Make sure s_timer_heap can hold one more timer, and count it in s_timer_count.
+ * The array can't be allocated while holding the timer lock, so it is allocated
+ * first and only swapped in under the lock.
+ */
+static esp_err_t timer_heap_reserve(void)
+{
+    while (true) {
+        timer_list_lock();
+        size_t capacity = s_timer_heap_capacity;
+        if (s_timer_count < capacity) {
+            s_timer_count++;
+            timer_list_unlock();
+            return ESP_OK;
+        }
+        timer_list_unlock();
+
+        size_t new_capacity = MAX(capacity * 2, TIMER_HEAP_MIN_CAPACITY);
+        /* accessed from IRAM functions, which may run while the flash cache is disabled */
+        esp_timer_handle_t* new_heap = heap_caps_malloc(new_capacity * sizeof(esp_timer_handle_t),
+                                                        MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (new_heap == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        esp_timer_handle_t* old_heap = new_heap;
+        timer_list_lock();
+        if (s_timer_heap_capacity == capacity) {
+            memcpy(new_heap, s_timer_heap, s_timer_heap_size * sizeof(esp_timer_handle_t));
+            old_heap = s_timer_heap;
+            s_timer_heap = new_heap;
+            s_timer_heap_capacity = new_capacity;
+        }
+        /* else another task has grown the heap meanwhile, try again with its array */
+        timer_list_unlock();
+        free(old_heap);
+    }
+}
+
+static IRAM_ATTR inline bool timer_before(const struct esp_timer* a, const struct esp_timer* b)
+{
+    if (a->alarm != b->alarm) {
+        return a->alarm < b->alarm;
+    }
+    return (int32_t) (a->seq - b->seq) < 0;
+}
+
+static IRAM_ATTR inline void timer_heap_set(size_t index, esp_timer_handle_t timer)
+{
+    s_timer_heap[index] = timer;
+    timer->heap_index = index;
+}
+
+static IRAM_ATTR void timer_heap_sift_up(size_t index, esp_timer_handle_t timer)
+{
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (!timer_before(timer, s_timer_heap[parent])) {
+            break;
+        }
+        timer_heap_set(index, s_timer_heap[parent]);
+        index = parent;
+    }
+    timer_heap_set(index, timer);
+}
+
+static IRAM_ATTR void timer_heap_sift_down(size_t index, esp_timer_handle_t timer)
+{
+    while (true) {
+        size_t child = index * 2 + 1;
+        if (child >= s_timer_heap_size) {
+            break;
+        }
+        if (child + 1 < s_timer_heap_size && timer_before(s_timer_heap[child + 1], s_timer_heap[child])) {
+            child++;
+        }
+        if (!timer_before(s_timer_heap[child], timer)) {
+            break;
+        }
+        timer_heap_set(index, s_timer_heap[child]);
+        index = child;
+    }
+    timer_heap_set(index, timer);
+}
+
+/* Called with the timer lock held. Capacity was reserved when the timer was created. */
+static IRAM_ATTR void timer_heap_push(esp_timer_handle_t timer)
+{
+    assert(s_timer_heap_size < s_timer_heap_capacity);
+    timer_heap_sift_up(s_timer_heap_size++, timer);
+}
+
+/* Called with the timer lock held */
+static IRAM_ATTR void timer_heap_remove(esp_timer_handle_t timer)
+{
+    size_t index = timer->heap_index;
+    assert(index < s_timer_heap_size && s_timer_heap[index] == timer);
+    esp_timer_handle_t last = s_timer_heap[--s_timer_heap_size];
+    if (last == timer) {
+        return;
+    }
+    /* move the last timer into the hole, then up or down to where it belongs */
+    if (index > 0 && timer_before(last, s_timer_heap[(index - 1) / 2])) {
+        timer_heap_sift_up(index, last);
+    } else {
+        timer_heap_sift_down(index, last);
+    }
+}
+
+static IRAM_ATTR inline esp_timer_handle_t timer_heap_first(void)
+{
+    return (s_timer_heap_size > 0) ? s_timer_heap[0] : NULL;
 }
 
 #if WITH_PROFILING
@@ -276,7 +429,31 @@ static IRAM_ATTR void timer_remove_inactive(esp_timer_handle_t timer)
 
 static IRAM_ATTR bool timer_armed(esp_timer_handle_t timer)
 {
-    return timer->alarm > 0;
+    return timer->alarm > 0 || timer_dispatch_pending(timer);
+}
+
+static IRAM_ATTR bool timer_dispatch_pending(esp_timer_handle_t timer)
+{
+    for (size_t i = 0; i < s_dispatch_count; ++i) {
+        if (__atomic_load_n(&s_dispatch_batch[i].pending, __ATOMIC_RELAXED) == timer) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Called with the timer lock held. A periodic timer may be in the batch more than once. */
+static IRAM_ATTR bool timer_cancel_dispatch(esp_timer_handle_t timer)
+{
+    bool cancelled = false;
+    for (size_t i = 0; i < s_dispatch_count; ++i) {
+        esp_timer_handle_t expected = timer;
+        if (__atomic_compare_exchange_n(&s_dispatch_batch[i].pending, &expected, NULL,
+                false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            cancelled = true;
+        }
+    }
+    return cancelled;
 }
 
 static IRAM_ATTR void timer_list_lock(void)
@@ -289,51 +466,108 @@ static IRAM_ATTR void timer_list_unlock(void)
     portEXIT_CRITICAL_SAFE(&s_timer_lock);
 }
 
+/* Calls the callbacks in s_dispatch_batch, with the timer lock released */
+static void timer_dispatch(size_t count)
+{
+#if WITH_PROFILING
+    int64_t callback_start = esp_timer_impl_get_time();
+#endif
+    for (size_t i = 0; i < count; ++i) {
+        timer_dispatch_t* d = &s_dispatch_batch[i];
+        if (__atomic_exchange_n(&d->pending, NULL, __ATOMIC_RELAXED) == NULL) {
+            // stopped by one of the previous callbacks
+#if WITH_PROFILING
+            d->timer = NULL;
+#endif
+            continue;
+        }
+        (*d->callback)(d->arg);
+#if WITH_PROFILING
+        int64_t callback_end = esp_timer_impl_get_time();
+        d->dispatch_lag = callback_start - d->alarm;
+        d->run_time = callback_end - callback_start;
+        callback_start = callback_end;
+#endif
+    }
+}
+
+#if WITH_PROFILING
+/* Called with the timer lock held, before any of the timers in the batch can be freed */
+static void timer_update_stats(size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const timer_dispatch_t* d = &s_dispatch_batch[i];
+        esp_timer_handle_t it = d->timer;
+        if (it == NULL) {
+            continue;
+        }
+        it->times_triggered++;
+        it->total_callback_run_time += d->run_time;
+        it->max_callback_run_time = MAX(it->max_callback_run_time, d->run_time);
+        it->max_dispatch_lag = MAX(it->max_dispatch_lag, d->dispatch_lag);
+    }
+}
+#endif // WITH_PROFILING
+
 static void timer_process_alarm(esp_timer_dispatch_t dispatch_method)
 {
     /* unused, provision to allow running callbacks from ISR */
     (void) dispatch_method;
 
     timer_list_lock();
-    int64_t now = esp_timer_impl_get_time();
-    esp_timer_handle_t it = LIST_FIRST(&s_timers);
-    while (it != NULL &&
-            it->alarm < now) {  // NOLINT(clang-analyzer-unix.Malloc)
-            // Static analyser reports "Use of memory after it is freed" since the "it" variable
-            // is freed below (if EVENT_ID_DELETE_TIMER) and assigned to the (new) LIST_FIRST()
-            // so possibly (if the "it" hasn't been removed from the list) it might keep the same ptr.
-            // Ignoring this warning, as this couldn't happen if queue.h used to populate the list
-        LIST_REMOVE(it, list_entry);
-        if (it->event_id == EVENT_ID_DELETE_TIMER) {
-            free(it);
-            it = LIST_FIRST(&s_timers);
-            continue;
-        }
-        if (it->period > 0) {
-            it->alarm += it->period;
-            timer_insert(it);
-        } else {
-            it->alarm = 0;
+    while (true) {
+        /* Take all the timers which have expired by now from the heap in one pass, rearming
+         * the periodic ones, then call their callbacks with the lock released. Until its
+         * callback is called, an expired timer is still armed and can be stopped.
+         */
+        int64_t now = esp_timer_impl_get_time();
+        size_t count = 0;
+        esp_timer_handle_t it = timer_heap_first();
+        while (count < TIMER_DISPATCH_BATCH_SIZE && it != NULL &&
+                it->alarm < now) {  // NOLINT(clang-analyzer-unix.Malloc)
+                // Static analyser reports "Use of memory after it is freed" since the "it" variable
+                // is freed below (if EVENT_ID_DELETE_TIMER) and assigned to the (new) first timer
+                // so possibly (if the "it" hasn't been removed from the heap) it might keep the same ptr.
+                // Ignoring this warning, as this couldn't happen since timer_heap_remove removes it
+            timer_heap_remove(it);
+            if (it->event_id == EVENT_ID_DELETE_TIMER) {
+                free(it);
+                s_timer_count--;
+                it = timer_heap_first();
+                continue;
+            }
+            timer_dispatch_t* d = &s_dispatch_batch[count++];
+            d->pending = it;
+            d->callback = it->callback;
+            d->arg = it->arg;
 #if WITH_PROFILING
-            timer_insert_inactive(it);
+            d->timer = it;
+            d->alarm = it->alarm;
 #endif
-        }
+            if (it->period > 0) {
+                it->alarm += it->period;
+                timer_insert(it);
+            } else {
+                it->alarm = 0;
 #if WITH_PROFILING
-        uint64_t callback_start = now;
+                timer_insert_inactive(it);
 #endif
-        esp_timer_cb_t callback = it->callback;
-        void* arg = it->arg;
+            }
+            it = timer_heap_first();
+        }
+        if (count == 0) {
+            break;
+        }
+        s_dispatch_count = count;
         timer_list_unlock();
-        (*callback)(arg);
+        timer_dispatch(count);
         timer_list_lock();
-        now = esp_timer_impl_get_time();
 #if WITH_PROFILING
-        it->times_triggered++;
-        it->total_callback_run_time += now - callback_start;
+        timer_update_stats(count);
 #endif
-        it = LIST_FIRST(&s_timers);
+        s_dispatch_count = 0;
     }
-    esp_timer_handle_t first = LIST_FIRST(&s_timers);
+    esp_timer_handle_t first = timer_heap_first();
     if (first) {
         esp_timer_impl_set_alarm(first->alarm);
     }
@@ -423,7 +657,7 @@ esp_err_t esp_timer_deinit(void)
     }
 
     /* Check if there are any active timers */
-    if (!LIST_EMPTY(&s_timers)) {
+    if (s_timer_heap_size != 0) {
         return ESP_ERR_INVALID_STATE;
     }
 
@@ -445,41 +679,47 @@ esp_err_t esp_timer_deinit(void)
     return ESP_OK;
 }
 
-static void print_timer_info(esp_timer_handle_t t, char** dst, size_t* dst_size)
+typedef struct {
+    esp_timer_handle_t handle;  // only printed, the timer may be deleted after the lock is released
+    struct esp_timer copy;
+} timer_snapshot_t;
+
+/* Returns the length of the line, which is only written if it fits into dst_size */
+static size_t print_timer_info(const timer_snapshot_t* snapshot, char* dst, size_t dst_size)
 {
-    size_t cb = snprintf(*dst, *dst_size,
+    const struct esp_timer* t = &snapshot->copy;
+    return snprintf(dst, dst_size,
 #if WITH_PROFILING
-            "%-12s  %12lld  %12lld  %9d  %9d  %12lld\n",
+            "%-12s  %12lld  %12lld  %9d  %9d  %12lld  %12lld  %12lld\n",
             t->name, t->period, t->alarm,
-            t->times_armed, t->times_triggered, t->total_callback_run_time);
-    /* keep this in sync with the format string, used in esp_timer_dump */
-#define TIMER_INFO_LINE_LEN 78
+            t->times_armed, t->times_triggered, t->total_callback_run_time,
+            t->max_callback_run_time, t->max_dispatch_lag);
 #else
-            "timer@%p  %12lld  %12lld\n", t, t->period, t->alarm);
-#define TIMER_INFO_LINE_LEN 46
+            "timer@%p  %12lld  %12lld\n", snapshot->handle, t->period, t->alarm);
 #endif
-    *dst += cb;
-    *dst_size -= cb;
 }
 
+static int compare_snapshots(const void* a, const void* b)
+{
+    const struct esp_timer* ta = &((const timer_snapshot_t*) a)->copy;
+    const struct esp_timer* tb = &((const timer_snapshot_t*) b)->copy;
+    return timer_before(ta, tb) ? -1 : timer_before(tb, ta) ? 1 : 0;
+}
 
 esp_err_t esp_timer_dump(FILE* stream)
 {
     /* Since timer lock is a critical section, we don't want to print directly
      * to stdout, since that may cause a deadlock if stdout is interrupt-driven
-     * (via the UART driver). Allocate sufficiently large chunk of memory first,
-     * print to it, then dump this memory to stdout.
+     * (via the UART driver). Copy the timers while holding the lock, then
+     * format them and print them to stdout.
      */
 
-    esp_timer_handle_t it;
-
     /* First count the number of timers */
     size_t timer_count = 0;
     timer_list_lock();
-    LIST_FOREACH(it, &s_timers, list_entry) {
-        ++timer_count;
-    }
+    timer_count += s_timer_heap_size;
 #if WITH_PROFILING
+    esp_timer_handle_t it;
     LIST_FOREACH(it, &s_inactive_timers, list_entry) {
         ++timer_count;
     }
@@ -489,27 +729,52 @@ esp_err_t esp_timer_dump(FILE* stream)
     /* Allocate the memory for this number of timers. Since we have unlocked,
      * we may find that there are more timers. There's no bulletproof solution
      * for this (can't allocate from a critical section), but we allocate
-     * slightly more and the output will be truncated if that is not enough.
+     * slightly more and the list will be truncated if that is not enough.
      */
-    size_t buf_size = TIMER_INFO_LINE_LEN * (timer_count + 3);
-    char* print_buf = calloc(1, buf_size + 1);
-    if (print_buf == NULL) {
+    size_t max_count = timer_count + 3;
+    timer_snapshot_t* snapshots = calloc(max_count, sizeof(timer_snapshot_t));
+    if (snapshots == NULL) {
         return ESP_ERR_NO_MEM;
     }
 
-    /* Print to the buffer */
+    /* Copy the timers, armed timers first */
     timer_list_lock();
-    char* pos = print_buf;
-    LIST_FOREACH(it, &s_timers, list_entry) {
-        print_timer_info(it, &pos, &buf_size);
+    size_t armed_count = MIN(s_timer_heap_size, max_count);
+    size_t count = 0;
+    for (; count < armed_count; ++count) {
+        snapshots[count].handle = s_timer_heap[count];
+        snapshots[count].copy = *s_timer_heap[count];
     }
 #if WITH_PROFILING
     LIST_FOREACH(it, &s_inactive_timers, list_entry) {
-        print_timer_info(it, &pos, &buf_size);
+        if (count == max_count) {
+            break;
+        }
+        snapshots[count].handle = it;
+        snapshots[count].copy = *it;
+        ++count;
     }
 #endif
     timer_list_unlock();
 
+    /* Armed timers are printed in the order they will run */
+    qsort(snapshots, armed_count, sizeof(timer_snapshot_t), compare_snapshots);
+
+    size_t buf_size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        buf_size += print_timer_info(&snapshots[i], NULL, 0);
+    }
+    char* print_buf = calloc(1, buf_size + 1);
+    if (print_buf == NULL) {
+        free(snapshots);
+        return ESP_ERR_NO_MEM;
+    }
+    char* pos = print_buf;
+    for (size_t i = 0; i < count; ++i) {
+        pos += print_timer_info(&snapshots[i], pos, buf_size + 1 - (pos - print_buf));
+    }
+    free(snapshots);
+
     /* Print the buffer */
     fputs(print_buf, stream);
 
@@ -521,7 +786,7 @@ int64_t IRAM_ATTR esp_timer_get_next_alarm(void)
 {
     int64_t next_alarm = INT64_MAX;
     timer_list_lock();
-    esp_timer_handle_t it = LIST_FIRST(&s_timers);
+    esp_timer_handle_t it = timer_heap_first();
     if (it) {
         next_alarm = it->alarm;
     }
@@ -0,0 +1,3 @@
+#pragma once
+
+typedef void (*intr_handler_t)(void *arg);
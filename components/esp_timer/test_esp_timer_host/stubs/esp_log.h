@@ -0,0 +1,3 @@
+#pragma once
+
+#define ESP_EARLY_LOGD(tag, format, ...) do { (void)(tag); } while(0)
@@ -0,0 +1,3 @@
+#pragma once
+
+#define PRO_CPU_NUM 0
@@ -0,0 +1,20 @@
+#!/usr/bin/env bash
+#
+# Run the test suite with and without timer profiling
+#
+
+FAIL=0
+
+for FLAGS in "" "-DCONFIG_ESP_TIMER_PROFILING"; do
+    echo "==== Testing with config: ${FLAGS:-no profiling} ===="
+    CPPFLAGS="${FLAGS}" make clean test || FAIL=1
+done
+
+make clean
+
+if [ $FAIL == 0 ]; then
+    echo "All configurations passed"
+else
+    echo "Some configurations failed, see log."
+    exit 1
+fi
@@ -0,0 +1,480 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "catch.hpp"
+#include <algorithm>
+#include <chrono>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+extern "C" {
+#include "esp_timer_impl.h"
+}
+
+using namespace std;
+
+/* Hardware layer stubs, and replacements for the FreeRTOS mock functions the timer uses. Time only moves when a test
+   calls advance_time(), which calls the alarm interrupt handler if the alarm has passed, then runs the timer task
+   until it waits for the next alarm. */
+
+static int64_t s_now = 1;
+static uint64_t s_alarm = UINT64_MAX;
+static intr_handler_t s_alarm_handler;
+static TaskFunction_t s_timer_task;
+static int s_semaphore_count;
+static jmp_buf s_task_blocked;
+static int s_dummy_handle;
+static int s_lock_depth;
+static int s_lock_count;
+
+extern "C" {
+
+esp_err_t esp_timer_impl_init(intr_handler_t alarm_handler)
+{
+    s_alarm_handler = alarm_handler;
+    return ESP_OK;
+}
+
+void esp_timer_impl_deinit(void)
+{
+    s_alarm_handler = NULL;
+}
+
+void esp_timer_impl_set_alarm(uint64_t timestamp)
+{
+    s_alarm = timestamp;
+}
+
+int64_t esp_timer_impl_get_time(void)
+{
+    return s_now;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return s_now;
+}
+
+uint64_t esp_timer_impl_get_min_period_us(void)
+{
+    return 50;
+}
+
+void esp_timer_private_advance(int64_t time_us)
+{
+    s_now += time_us;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    s_timer_task = task;
+    *created_task = &s_dummy_handle;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    s_timer_task = NULL;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    s_semaphore_count = initial_count;
+    return &s_dummy_handle;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    if (s_semaphore_count == 0) {
+        longjmp(s_task_blocked, 1); // back to run_timer_task()
+    }
+    s_semaphore_count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higher_priority_task_woken)
+{
+    s_semaphore_count++;
+    *higher_priority_task_woken = pdFALSE;
+    return pdTRUE;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    if (s_lock_depth++ == 0) {
+        s_lock_count++;
+    }
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    s_lock_depth--; // checked by run_timer_task()
+}
+
+} // extern "C"
+
+static void run_timer_task()
+{
+    if (setjmp(s_task_blocked) == 0) {
+        s_timer_task(NULL);
+    }
+    REQUIRE(s_lock_depth == 0);
+}
+
+static void advance_time(int64_t now)
+{
+    s_now = now;
+    if ((int64_t) s_alarm <= s_now) {
+        s_alarm = UINT64_MAX;
+        s_alarm_handler(NULL);
+    }
+    run_timer_task();
+}
+
+static void init_timers()
+{
+    if (s_timer_task == NULL) {
+        REQUIRE(esp_timer_init() == ESP_OK);
+    }
+}
+
+static vector<int> s_fired;
+
+static void record_callback(void *arg)
+{
+    s_fired.push_back((int)(intptr_t) arg);
+}
+
+static esp_timer_handle_t create_timer(int id, esp_timer_cb_t callback = record_callback)
+{
+    esp_timer_create_args_t args = {};
+    args.callback = callback;
+    args.arg = (void *)(intptr_t) id;
+    args.name = "test";
+    esp_timer_handle_t timer;
+    REQUIRE(esp_timer_create(&args, &timer) == ESP_OK);
+    return timer;
+}
+
+static void delete_timers(vector<esp_timer_handle_t> &timers)
+{
+    for (esp_timer_handle_t timer : timers) {
+        esp_timer_stop(timer);
+        REQUIRE(esp_timer_delete(timer) == ESP_OK);
+    }
+    timers.clear();
+    advance_time(s_now + 1); // timers are freed by the timer task
+}
+
+TEST_CASE("one-shot timers run in the order of their alarms", "[esp_timer]")
+{
+    init_timers();
+    s_fired.clear();
+    const int COUNT = 300;
+    vector<esp_timer_handle_t> timers;
+    vector<pair<int64_t, int>> expected;
+    uint32_t seed = 1;
+    for (int i = 0; i < COUNT; i++) {
+        timers.push_back(create_timer(i));
+        seed = seed * 1103515245 + 12345;
+        uint64_t timeout = 100 + (seed >> 8) % 1000;
+        REQUIRE(esp_timer_start_once(timers[i], timeout) == ESP_OK);
+        expected.push_back(make_pair(s_now + (int64_t) timeout, i));
+    }
+    /* timers with the same alarm run in the order they were started */
+    stable_sort(expected.begin(), expected.end(),
+                [](const pair<int64_t, int> &a, const pair<int64_t, int> &b) { return a.first < b.first; });
+    CHECK(esp_timer_get_next_alarm() == expected[0].first);
+
+    int64_t start = s_now;
+    for (int64_t t = start; t <= start + 1200; t += 7) {
+        advance_time(t);
+    }
+    REQUIRE(s_fired.size() == COUNT);
+    for (int i = 0; i < COUNT; i++) {
+        CHECK(s_fired[i] == expected[i].second);
+    }
+    CHECK(esp_timer_get_next_alarm() == INT64_MAX);
+    delete_timers(timers);
+}
+
+TEST_CASE("stopped timers don't run, others keep their order", "[esp_timer]")
+{
+    init_timers();
+    s_fired.clear();
+    const int COUNT = 100;
+    vector<esp_timer_handle_t> timers;
+    for (int i = 0; i < COUNT; i++) {
+        timers.push_back(create_timer(i));
+        REQUIRE(esp_timer_start_once(timers[i], 1000 + (i * 37) % COUNT * 10) == ESP_OK);
+    }
+    vector<pair<int, int>> expected;
+    for (int i = 0; i < COUNT; i++) {
+        if (i % 3 == 0) {
+            REQUIRE(esp_timer_stop(timers[i]) == ESP_OK);
+            CHECK(esp_timer_stop(timers[i]) == ESP_ERR_INVALID_STATE);
+        } else {
+            expected.push_back(make_pair((i * 37) % COUNT, i));
+        }
+    }
+    sort(expected.begin(), expected.end());
+    advance_time(s_now + 2000);
+    REQUIRE(s_fired.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+        CHECK(s_fired[i] == expected[i].second);
+    }
+    delete_timers(timers);
+}
+
+TEST_CASE("periodic timers are rearmed", "[esp_timer]")
+{
+    init_timers();
+    s_fired.clear();
+    vector<esp_timer_handle_t> timers;
+    timers.push_back(create_timer(0));
+    timers.push_back(create_timer(1));
+    timers.push_back(create_timer(2));
+    int64_t start = s_now;
+    REQUIRE(esp_timer_start_periodic(timers[0], 100) == ESP_OK);
+    REQUIRE(esp_timer_start_periodic(timers[1], 250) == ESP_OK);
+    REQUIRE(esp_timer_start_periodic(timers[2], 10) == ESP_OK); // less than the minimum period of 50
+    for (int64_t t = start; t <= start + 500; t += 5) {
+        advance_time(t);
+    }
+    CHECK(count(s_fired.begin(), s_fired.end(), 0) == 4);
+    CHECK(count(s_fired.begin(), s_fired.end(), 1) == 1);
+    CHECK(count(s_fired.begin(), s_fired.end(), 2) == 9);
+
+    REQUIRE(esp_timer_stop(timers[0]) == ESP_OK);
+    s_fired.clear();
+    advance_time(start + 1000);
+    CHECK(count(s_fired.begin(), s_fired.end(), 0) == 0);
+    CHECK(count(s_fired.begin(), s_fired.end(), 1) > 0);
+    delete_timers(timers);
+}
+
+static esp_timer_handle_t s_self_deleting;
+
+static void delete_self_callback(void *arg)
+{
+    s_fired.push_back(-1);
+    REQUIRE(esp_timer_delete(s_self_deleting) == ESP_OK);
+}
+
+TEST_CASE("timer can be deleted from its callback", "[esp_timer]")
+{
+    init_timers();
+    s_fired.clear();
+    s_self_deleting = create_timer(0, delete_self_callback);
+    esp_timer_handle_t other = create_timer(1);
+    REQUIRE(esp_timer_start_once(s_self_deleting, 100) == ESP_OK);
+    REQUIRE(esp_timer_start_once(other, 200) == ESP_OK);
+    advance_time(s_now + 300);
+    CHECK(s_fired == vector<int>({-1, 1}));
+    vector<esp_timer_handle_t> timers = {other};
+    delete_timers(timers);
+}
+
+TEST_CASE("esp_timer_dump lists armed timers in alarm order", "[esp_timer]")
+{
+    init_timers();
+    vector<esp_timer_handle_t> timers;
+    const int COUNT = 20;
+    for (int i = 0; i < COUNT; i++) {
+        timers.push_back(create_timer(i));
+        REQUIRE(esp_timer_start_once(timers[i], 1000 - i * 10) == ESP_OK);
+    }
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *stream = open_memstream(&buf, &size);
+    REQUIRE(esp_timer_dump(stream) == ESP_OK);
+    fclose(stream);
+
+    string expected;
+    for (int i = COUNT - 1; i >= 0; i--) {
+        char line[128];
+#ifdef CONFIG_ESP_TIMER_PROFILING
+        snprintf(line, sizeof(line), "%-12s  %12lld  %12lld  %9d  %9d  %12lld  %12lld  %12lld\n",
+                 "test", 0LL, (long long)(s_now + 1000 - i * 10), 1, 0, 0LL, 0LL, 0LL);
+#else
+        snprintf(line, sizeof(line), "timer@%p  %12lld  %12lld\n",
+                 timers[i], 0LL, (long long)(s_now + 1000 - i * 10));
+#endif
+        expected += line;
+    }
+    CHECK(string(buf) == expected);
+    free(buf);
+    delete_timers(timers);
+}
+
+TEST_CASE("expired timers are dispatched with few lock operations", "[esp_timer]")
+{
+    init_timers();
+    s_fired.clear();
+    const int COUNT = 50;
+    vector<esp_timer_handle_t> timers;
+    for (int i = 0; i < COUNT; i++) {
+        timers.push_back(create_timer(i));
+        REQUIRE(esp_timer_start_once(timers[i], 100) == ESP_OK);
+    }
+    s_lock_count = 0;
+    advance_time(s_now + 200);
+    REQUIRE(s_fired.size() == COUNT);
+    for (int i = 0; i < COUNT; i++) {
+        CHECK(s_fired[i] == i);
+    }
+    /* the timers are taken from the heap in batches of up to 16, not one by one */
+    CHECK(s_lock_count <= 5);
+    delete_timers(timers);
+}
+
+static esp_timer_handle_t s_stopped_by_callback[2];
+
+static void stop_others_callback(void *arg)
+{
+    s_fired.push_back(-1);
+    /* both timers have expired, but their callbacks haven't been called yet */
+    CHECK(esp_timer_start_once(s_stopped_by_callback[0], 100) == ESP_ERR_INVALID_STATE);
+    CHECK(esp_timer_delete(s_stopped_by_callback[0]) == ESP_ERR_INVALID_STATE);
+    CHECK(esp_timer_stop(s_stopped_by_callback[0]) == ESP_OK);
+    CHECK(esp_timer_stop(s_stopped_by_callback[0]) == ESP_ERR_INVALID_STATE);
+    CHECK(esp_timer_stop(s_stopped_by_callback[1]) == ESP_OK);
+}
+
+TEST_CASE("expired timer can be stopped until its callback is called", "[esp_timer]")
+{
+    init_timers();
+    s_fired.clear();
+    vector<esp_timer_handle_t> timers;
+    timers.push_back(create_timer(0, stop_others_callback));
+    timers.push_back(create_timer(1));
+    timers.push_back(create_timer(2));
+    timers.push_back(create_timer(3));
+    s_stopped_by_callback[0] = timers[1];
+    s_stopped_by_callback[1] = timers[2];
+    REQUIRE(esp_timer_start_once(timers[0], 100) == ESP_OK);
+    REQUIRE(esp_timer_start_once(timers[1], 100) == ESP_OK);
+    REQUIRE(esp_timer_start_periodic(timers[2], 100) == ESP_OK);
+    REQUIRE(esp_timer_start_once(timers[3], 100) == ESP_OK);
+    advance_time(s_now + 150);
+    CHECK(s_fired == vector<int>({-1, 3}));
+    advance_time(s_now + 1000);
+    CHECK(s_fired == vector<int>({-1, 3}));
+    delete_timers(timers);
+}
+
+#ifdef CONFIG_ESP_TIMER_PROFILING
+static void slow_callback(void *arg)
+{
+    s_fired.push_back((int)(intptr_t) arg);
+    s_now += (intptr_t) arg; // the callback takes 'arg' microseconds
+}
+
+TEST_CASE("esp_timer_dump reports callback run time and dispatch lag", "[esp_timer]")
+{
+    init_timers();
+    s_fired.clear();
+    vector<esp_timer_handle_t> timers;
+    timers.push_back(create_timer(30, slow_callback));
+    timers.push_back(create_timer(5, slow_callback));
+    int64_t start = s_now;
+    REQUIRE(esp_timer_start_periodic(timers[0], 1000) == ESP_OK);
+    REQUIRE(esp_timer_start_periodic(timers[1], 1000) == ESP_OK);
+    advance_time(start + 1010); // both run, the second one 30 us after the first one
+    advance_time(start + 2001);
+    REQUIRE(s_fired == vector<int>({30, 5, 30, 5}));
+    /* stopped timers are dumped in the reverse order of stopping */
+    REQUIRE(esp_timer_stop(timers[1]) == ESP_OK);
+    REQUIRE(esp_timer_stop(timers[0]) == ESP_OK);
+
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *stream = open_memstream(&buf, &size);
+    REQUIRE(esp_timer_dump(stream) == ESP_OK);
+    fclose(stream);
+
+    char name[16];
+    long long period, alarm, total_run_time, max_run_time, max_lag;
+    int times_armed, times_triggered;
+    char *line = strtok(buf, "\n");
+    REQUIRE(line != NULL);
+    REQUIRE(sscanf(line, "%15s %lld %lld %d %d %lld %lld %lld", name, &period, &alarm, &times_armed,
+                   &times_triggered, &total_run_time, &max_run_time, &max_lag) == 8);
+    CHECK(times_armed == 1);
+    CHECK(times_triggered == 2);
+    CHECK(total_run_time == 60);
+    CHECK(max_run_time == 30);
+    CHECK(max_lag == 10);
+
+    line = strtok(NULL, "\n");
+    REQUIRE(line != NULL);
+    REQUIRE(sscanf(line, "%15s %lld %lld %d %d %lld %lld %lld", name, &period, &alarm, &times_armed,
+                   &times_triggered, &total_run_time, &max_run_time, &max_lag) == 8);
+    CHECK(times_triggered == 2);
+    CHECK(total_run_time == 10);
+    CHECK(max_run_time == 5);
+    CHECK(max_lag == 40);
+    free(buf);
+    delete_timers(timers);
+}
+#endif // CONFIG_ESP_TIMER_PROFILING
+
+/* Time to arm and disarm one timer, with a number of other timers already armed. Each iteration arms a timer at a
+   pseudo-random time, so it lands anywhere in the queue, then stops it again. */
+TEST_CASE("esp_timer insert benchmark", "[esp_timer][benchmark]")
+{
+    init_timers();
+    const int ITERATIONS = 20000;
+    const int counts[] = { 10, 100, 300, 1000, 3000 };
+    typedef std::chrono::steady_clock clock;
+
+    for (int count : counts) {
+        vector<esp_timer_handle_t> timers;
+        uint32_t seed = 1;
+        auto next_random = [&seed]() {
+            seed = seed * 1103515245 + 12345;
+            return (seed >> 8) & 0xffffff;
+        };
+        for (int i = 0; i < count; i++) {
+            timers.push_back(create_timer(i));
+            REQUIRE(esp_timer_start_once(timers[i], 1000000 + next_random() % 1000000) == ESP_OK);
+        }
+        esp_timer_handle_t timer = create_timer(count);
+        uint64_t start_ns = 0, stop_ns = 0;
+        for (int i = 0; i < ITERATIONS; i++) {
+            uint64_t timeout = 1000000 + next_random() % 1000000;
+            auto start = clock::now();
+            esp_timer_start_once(timer, timeout);
+            auto armed = clock::now();
+            esp_timer_stop(timer);
+            auto stopped = clock::now();
+            start_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(armed - start).count();
+            stop_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(stopped - armed).count();
+        }
+        printf("%5d armed timers: esp_timer_start_once %u ns, esp_timer_stop %u ns\n", count,
+               (unsigned)(start_ns / ITERATIONS), (unsigned)(stop_ns / ITERATIONS));
+        timers.push_back(timer);
+        delete_timers(timers);
+    }
+}
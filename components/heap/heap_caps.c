@@ -22,6 +22,13 @@
 #include "esp_log.h"
 #include "heap_private.h"
 #include "esp_system.h"
+#include "sdkconfig.h"
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_freertos_hooks.h"
+#include "multi_heap_internal.h"
+#endif
 
 /*
 This file, combined with a region allocator that supports multiple heaps, solves the problem that the ESP32 has RAM
@@ -84,6 +91,324 @@ bool heap_caps_match(const heap_t *heap, uint32_t caps)
     return heap->heap != NULL && ((get_all_caps(heap) & caps) == caps);
 }
 
+/*
+Allocate from the first heap (in priority order) which has all of the capabilities in caps.
+Returns NULL on failure, without calling the failed allocation hook.
+*/
+IRAM_ATTR static void *heap_caps_malloc_base( size_t size, uint32_t caps )
+{
+    void *ret = NULL;
+
+    for (int prio = 0; prio < SOC_MEMORY_TYPE_NO_PRIOS; prio++) {
+        //Iterate over heaps and check capabilities at this priority
+        heap_t *heap;
+        SLIST_FOREACH(heap, &registered_heaps, next) {
+            if (heap->heap == NULL) {
+                continue;
+            }
+            if ((heap->caps[prio] & caps) != 0) {
+                //Heap has at least one of the caps requested. If caps has other bits set that this prio
+                //doesn't cover, see if they're available in other prios.
+                if ((get_all_caps(heap) & caps) == caps) {
+                    //This heap can satisfy all the requested capabilities. See if we can grab some memory using it.
+                    if ((caps & MALLOC_CAP_EXEC) && esp_ptr_in_diram_dram((void *)heap->start)) {
+                        //This is special, insofar that what we're going to get back is a DRAM address. If so,
+                        //we need to 'invert' it (lowest address in DRAM == highest address in IRAM and vice-versa) and
+                        //add a pointer to the DRAM equivalent before the address we're going to return.
+                        ret = multi_heap_malloc(heap->heap, size + 4);  // int overflow checked by caller
+
+                        if (ret != NULL) {
+                            return dram_alloc_to_iram_addr(ret, size + 4);  // int overflow checked by caller
+                        }
+                    } else {
+                        //Just try to alloc, nothing special.
+                        ret = multi_heap_malloc(heap->heap, size);
+                        if (ret != NULL) {
+                            return ret;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    //Nothing usable found.
+    return NULL;
+}
+
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+static heap_t *find_containing_heap(void *ptr);
+
+/*
+Small object cache
+
+Allocations of up to SMALL_CACHE_MAX_SIZE bytes from general purpose internal memory are served from per-core
+"magazines" of free blocks, one magazine per 16 byte size class. Popping or pushing a block only takes the lock of the
+current core's cache, which is never contended unless another core is flushing or reading statistics, so small
+malloc()/free() pairs mostly don't touch the heap lock at all.
+
+Cached blocks are still allocated blocks as far as multi_heap is concerned. An empty magazine is refilled with a
+batch of blocks allocated under a single heap lock, and a full magazine passes freed blocks back to the heap. Each
+core's idle hook releases blocks which haven't been needed since the previous trim, and all magazines are flushed
+before an allocation is allowed to fail.
+
+Heap tracing wraps the public heap_caps_xxx() functions, so it records the caller's allocations and frees and is not
+affected by blocks moving between the cache and the heap.
+*/
+
+#define SMALL_CACHE_CAPS (MALLOC_CAP_DEFAULT | MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT | MALLOC_CAP_32BIT)
+#define SMALL_CACHE_GRANULE 16
+#define SMALL_CACHE_CLASSES 4
+#define SMALL_CACHE_MAX_SIZE (SMALL_CACHE_GRANULE * SMALL_CACHE_CLASSES)
+#define SMALL_CACHE_DEPTH CONFIG_HEAP_SMALL_OBJECT_CACHE_DEPTH
+#define SMALL_CACHE_BATCH ((SMALL_CACHE_DEPTH + 1) / 2)
+#define SMALL_CACHE_TRIM_INTERVAL_MS 1000
+
+typedef struct {
+    void *objects[SMALL_CACHE_DEPTH];
+    uint16_t count;
+    uint16_t low_water; ///< Lowest count since the last trim, these blocks weren't needed
+} small_magazine_t;
+
+typedef struct {
+    portMUX_TYPE mux;
+    TickType_t last_trim;
+    small_magazine_t magazines[SMALL_CACHE_CLASSES];
+} small_cache_t;
+
+static small_cache_t s_small_cache[portNUM_PROCESSORS] = {
+    [0 ... portNUM_PROCESSORS - 1] = { .mux = portMUX_INITIALIZER_UNLOCKED },
+};
+
+/* Lock and return the cache of the current core. Interrupts stay disabled until small_cache_unlock(), so the task
+   can't migrate to the other core meanwhile. */
+IRAM_ATTR static inline small_cache_t *small_cache_lock(unsigned *state)
+{
+    *state = portENTER_CRITICAL_NESTED();
+    small_cache_t *cache = &s_small_cache[xPortGetCoreID()];
+    vPortCPUAcquireMutex(&cache->mux);
+    return cache;
+}
+
+IRAM_ATTR static inline void small_cache_unlock(small_cache_t *cache, unsigned state)
+{
+    vPortCPUReleaseMutex(&cache->mux);
+    portEXIT_CRITICAL_NESTED(state);
+}
+
+IRAM_ATTR static bool small_cache_heap(const heap_t *heap)
+{
+    return (get_all_caps(heap) & SMALL_CACHE_CAPS) == SMALL_CACHE_CAPS;
+}
+
+/* Return blocks taken out of the cache to their heaps */
+IRAM_ATTR static void small_cache_release(void **objects, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        heap_t *heap = find_containing_heap(objects[i]);
+        assert(heap != NULL);
+        multi_heap_free(heap->heap, objects[i]);
+    }
+}
+
+/* Allocate a batch of blocks of the given size class from one heap, keep the first and cache the others */
+IRAM_ATTR static void *small_cache_refill(int cls)
+{
+    const size_t size = (cls + 1) * SMALL_CACHE_GRANULE;
+    void *batch[SMALL_CACHE_BATCH];
+    size_t count = 0;
+
+    batch[0] = heap_caps_malloc_base(size, SMALL_CACHE_CAPS);
+    if (batch[0] == NULL) {
+        return NULL;
+    }
+    count = 1;
+
+    heap_t *heap = find_containing_heap(batch[0]);
+    multi_heap_internal_lock(heap->heap);
+    while (count < SMALL_CACHE_BATCH) {
+        batch[count] = multi_heap_malloc(heap->heap, size);
+        if (batch[count] == NULL) {
+            break;
+        }
+        count++;
+    }
+    multi_heap_internal_unlock(heap->heap);
+
+    /* The task may have moved to another core while the heap was locked, that doesn't matter */
+    unsigned state;
+    small_cache_t *cache = small_cache_lock(&state);
+    small_magazine_t *mag = &cache->magazines[cls];
+    size_t keep = 1;
+    while (keep < count && mag->count < SMALL_CACHE_DEPTH) {
+        mag->objects[mag->count++] = batch[keep++];
+    }
+    small_cache_unlock(cache, state);
+
+    small_cache_release(&batch[keep], count - keep);
+    return batch[0];
+}
+
+IRAM_ATTR static void *small_cache_malloc(size_t size)
+{
+    int cls = (size - 1) / SMALL_CACHE_GRANULE;
+    void *ret = NULL;
+    unsigned state;
+
+    small_cache_t *cache = small_cache_lock(&state);
+    small_magazine_t *mag = &cache->magazines[cls];
+    if (mag->count > 0) {
+        ret = mag->objects[--mag->count];
+        mag->low_water = MIN(mag->low_water, mag->count);
+    }
+    small_cache_unlock(cache, state);
+
+    if (ret == NULL) {
+        ret = small_cache_refill(cls);
+    }
+    return ret;
+}
+
+/* Try to put a freed block into the cache, returns false if the block should be freed to the heap */
+IRAM_ATTR static bool small_cache_free(heap_t *heap, void *ptr)
+{
+    if (!small_cache_heap(heap)) {
+        return false;
+    }
+    size_t size = multi_heap_get_allocated_size(heap->heap, ptr);
+    if (size < SMALL_CACHE_GRANULE || size >= SMALL_CACHE_MAX_SIZE + SMALL_CACHE_GRANULE) {
+        return false;
+    }
+    int cls = size / SMALL_CACHE_GRANULE - 1;
+    bool cached = false;
+    unsigned state;
+
+    small_cache_t *cache = small_cache_lock(&state);
+    small_magazine_t *mag = &cache->magazines[cls];
+    if (mag->count < SMALL_CACHE_DEPTH) {
+        mag->objects[mag->count++] = ptr;
+        cached = true;
+    }
+    small_cache_unlock(cache, state);
+    return cached;
+}
+
+/* Empty the magazines of every core back into the heaps */
+IRAM_ATTR static void small_cache_flush(void)
+{
+    void *objects[SMALL_CACHE_DEPTH];
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        small_cache_t *cache = &s_small_cache[core];
+        for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+            size_t count;
+            portENTER_CRITICAL(&cache->mux);
+            small_magazine_t *mag = &cache->magazines[cls];
+            count = mag->count;
+            memcpy(objects, mag->objects, count * sizeof(void *));
+            mag->count = 0;
+            mag->low_water = 0;
+            portEXIT_CRITICAL(&cache->mux);
+
+            small_cache_release(objects, count);
+        }
+    }
+}
+
+/* Idle hook, releases the blocks of the current core which weren't used since the last trim */
+static bool small_cache_trim(void)
+{
+    void *objects[SMALL_CACHE_DEPTH];
+    unsigned state;
+
+    small_cache_t *cache = small_cache_lock(&state);
+    TickType_t now = xTaskGetTickCount();
+    if (now - cache->last_trim < pdMS_TO_TICKS(SMALL_CACHE_TRIM_INTERVAL_MS)) {
+        small_cache_unlock(cache, state);
+        return true;
+    }
+    cache->last_trim = now;
+    small_cache_unlock(cache, state);
+
+    for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+        size_t count;
+        cache = small_cache_lock(&state);
+        small_magazine_t *mag = &cache->magazines[cls];
+        count = mag->low_water;
+        mag->count -= count;
+        memcpy(objects, &mag->objects[mag->count], count * sizeof(void *));
+        mag->low_water = mag->count;
+        small_cache_unlock(cache, state);
+
+        small_cache_release(objects, count);
+    }
+    return true;
+}
+
+void heap_caps_small_cache_init(void)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        esp_err_t err = esp_register_freertos_idle_hook_for_cpu(small_cache_trim, core);
+        if (err != ESP_OK) {
+            ESP_EARLY_LOGW("heap_caps", "Small object cache won't be trimmed on CPU %d (0x%x)", core, err);
+        }
+    }
+}
+
+/* Add the blocks held in the small object cache which belong to heap to its info, as free blocks */
+static void small_cache_add_info(const heap_t *heap, multi_heap_info_t *info)
+{
+    if (!small_cache_heap(heap)) {
+        return;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        small_cache_t *cache = &s_small_cache[core];
+        portENTER_CRITICAL(&cache->mux);
+        for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+            small_magazine_t *mag = &cache->magazines[cls];
+            for (int i = 0; i < mag->count; i++) {
+                intptr_t p = (intptr_t)mag->objects[i];
+                if (p >= heap->start && p < heap->end) {
+                    size_t size = multi_heap_get_allocated_size(heap->heap, mag->objects[i]);
+                    info->total_free_bytes += size;
+                    info->total_allocated_bytes -= size;
+                    info->allocated_blocks--;
+                    info->free_blocks++;
+                }
+            }
+        }
+        portEXIT_CRITICAL(&cache->mux);
+    }
+}
+
+/* Add the blocks held in the small object cache which belong to heap to its fragmentation stats, as free blocks.
+   The cache holds a bounded number of blocks, so this doesn't change the cost of heap_caps_get_fragmentation_stats() */
+static void small_cache_add_fragmentation_stats(const heap_t *heap, multi_heap_fragmentation_stats_t *stats)
+{
+    if (!small_cache_heap(heap)) {
+        return;
+    }
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        small_cache_t *cache = &s_small_cache[core];
+        portENTER_CRITICAL(&cache->mux);
+        for (int cls = 0; cls < SMALL_CACHE_CLASSES; cls++) {
+            small_magazine_t *mag = &cache->magazines[cls];
+            for (int i = 0; i < mag->count; i++) {
+                intptr_t p = (intptr_t)mag->objects[i];
+                if (p >= heap->start && p < heap->end) {
+                    size_t size = multi_heap_get_allocated_size(heap->heap, mag->objects[i]);
+                    stats->total_free_bytes += size;
+                    stats->largest_free_block = MAX(stats->largest_free_block, size);
+                    stats->free_blocks++;
+                    stats->free_block_histogram[multi_heap_fragmentation_bucket(size)]++;
+                }
+            }
+        }
+        portEXIT_CRITICAL(&cache->mux);
+    }
+}
+#endif // CONFIG_HEAP_SMALL_OBJECT_CACHE
+
 /*
 Routine to allocate a bit of memory with certain capabilities. caps is a bitfield of MALLOC_CAP_* bits.
 */
@@ -119,43 +444,31 @@ IRAM_ATTR void *heap_caps_malloc( size_t size, uint32_t caps )
         size = (size + 3) & (~3); // int overflow checked above
     }
 
-    for (int prio = 0; prio < SOC_MEMORY_TYPE_NO_PRIOS; prio++) {
-        //Iterate over heaps and check capabilities at this priority
-        heap_t *heap;
-        SLIST_FOREACH(heap, &registered_heaps, next) {
-            if (heap->heap == NULL) {
-                continue;
-            }
-            if ((heap->caps[prio] & caps) != 0) {
-                //Heap has at least one of the caps requested. If caps has other bits set that this prio
-                //doesn't cover, see if they're available in other prios.
-                if ((get_all_caps(heap) & caps) == caps) {
-                    //This heap can satisfy all the requested capabilities. See if we can grab some memory using it.
-                    if ((caps & MALLOC_CAP_EXEC) && esp_ptr_in_diram_dram((void *)heap->start)) {
-                        //This is special, insofar that what we're going to get back is a DRAM address. If so,
-                        //we need to 'invert' it (lowest address in DRAM == highest address in IRAM and vice-versa) and
-                        //add a pointer to the DRAM equivalent before the address we're going to return.
-                        ret = multi_heap_malloc(heap->heap, size + 4);  // int overflow checked above
-
-                        if (ret != NULL) {
-                            return dram_alloc_to_iram_addr(ret, size + 4);  // int overflow checked above
-                        }
-                    } else {
-                        //Just try to alloc, nothing special.
-                        ret = multi_heap_malloc(heap->heap, size);
-                        if (ret != NULL) {
-                            return ret;
-                        }
-                    }
-                }
-            }
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+    if (size > 0 && size <= SMALL_CACHE_MAX_SIZE
+        && (caps & MALLOC_CAP_INTERNAL) && (caps & ~SMALL_CACHE_CAPS) == 0) {
+        ret = small_cache_malloc(size);
+        if (ret != NULL) {
+            return ret;
         }
     }
+#endif
 
-    heap_caps_alloc_failed(size, caps, __func__);
+    ret = heap_caps_malloc_base(size, caps);
 
-    //Nothing usable found.
-    return NULL;
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+    if (ret == NULL && size > 0) {
+        //Blocks held in the small object cache may be what's missing, give them back and retry
+        small_cache_flush();
+        ret = heap_caps_malloc_base(size, caps);
+    }
+#endif
+
+    if (ret == NULL) {
+        heap_caps_alloc_failed(size, caps, __func__);
+    }
+
+    return ret;
 }
 
 
@@ -274,7 +587,7 @@ IRAM_ATTR void *heap_caps_calloc_prefer( size_t n, size_t size, size_t num, ...
    (This confirms if ptr is inside the heap's region, doesn't confirm if 'ptr'
    is an allocated block or is some other random address inside the heap.)
 */
-IRAM_ATTR static heap_t *find_containing_heap(void *ptr )
+IRAM_ATTR static heap_t *find_containing_heap(void *ptr)
 {
     intptr_t p = (intptr_t)ptr;
     heap_t *heap;
@@ -302,6 +615,11 @@ IRAM_ATTR void heap_caps_free( void *ptr)
 
     heap_t *heap = find_containing_heap(ptr);
     assert(heap != NULL && "free() target pointer is outside heap areas");
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+    if (small_cache_free(heap, ptr)) {
+        return;
+    }
+#endif
     multi_heap_free(heap->heap, ptr);
 }
 
@@ -418,6 +736,11 @@ size_t heap_caps_get_free_size( uint32_t caps )
     SLIST_FOREACH(heap, &registered_heaps, next) {
         if (heap_caps_match(heap, caps)) {
             ret += multi_heap_free_size(heap->heap);
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+            multi_heap_info_t cached = { 0 };
+            small_cache_add_info(heap, &cached);
+            ret += cached.total_free_bytes;
+#endif
         }
     }
     return ret;
@@ -451,6 +774,9 @@ void heap_caps_get_info( multi_heap_info_t *info, uint32_t caps )
         if (heap_caps_match(heap, caps)) {
             multi_heap_info_t hinfo;
             multi_heap_get_info(heap->heap, &hinfo);
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+            small_cache_add_info(heap, &hinfo);
+#endif
 
             info->total_free_bytes += hinfo.total_free_bytes;
             info->total_allocated_bytes += hinfo.total_allocated_bytes;
@@ -464,6 +790,30 @@ void heap_caps_get_info( multi_heap_info_t *info, uint32_t caps )
     }
 }
 
+void heap_caps_get_fragmentation_stats( multi_heap_fragmentation_stats_t *stats, uint32_t caps )
+{
+    bzero(stats, sizeof(multi_heap_fragmentation_stats_t));
+
+    heap_t *heap;
+    SLIST_FOREACH(heap, &registered_heaps, next) {
+        if (heap_caps_match(heap, caps)) {
+            multi_heap_fragmentation_stats_t hstats;
+            multi_heap_get_fragmentation_stats(heap->heap, &hstats);
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+            small_cache_add_fragmentation_stats(heap, &hstats);
+#endif
+
+            stats->total_free_bytes += hstats.total_free_bytes;
+            stats->largest_free_block = MAX(stats->largest_free_block,
+                                            hstats.largest_free_block);
+            stats->free_blocks += hstats.free_blocks;
+            for (int i = 0; i < MULTI_HEAP_FRAGMENTATION_BUCKETS; i++) {
+                stats->free_block_histogram[i] += hstats.free_block_histogram[i];
+            }
+        }
+    }
+}
+
 void heap_caps_print_heap_info( uint32_t caps )
 {
     multi_heap_info_t info;
@@ -472,6 +822,9 @@ void heap_caps_print_heap_info( uint32_t caps )
     SLIST_FOREACH(heap, &registered_heaps, next) {
         if (heap_caps_match(heap, caps)) {
             multi_heap_get_info(heap->heap, &info);
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+            small_cache_add_info(heap, &info);
+#endif
 
             printf("  At 0x%08x len %d free %d allocated %d min_free %d\n",
                    heap->start, heap->end - heap->start, info.total_free_bytes, info.total_allocated_bytes, info.minimum_free_bytes);
@@ -50,6 +50,9 @@ void heap_caps_enable_nonos_stack_heaps(void)
             }
         }
     }
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+    heap_caps_small_cache_init();
+#endif
 }
 
 /* Initialize the heap allocator to use all of the memory not
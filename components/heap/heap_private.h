@@ -71,6 +71,12 @@ inline static IRAM_ATTR uint32_t get_all_caps(const heap_t *heap)
 void *heap_caps_realloc_default(void *p, size_t size);
 void *heap_caps_malloc_default(size_t size);
 
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+/* Registers the idle hooks which return unused blocks from the small object cache to the heap.
+   Called once the scheduler is running on all cores. */
+void heap_caps_small_cache_init(void);
+#endif
+
 
 #ifdef __cplusplus
 }
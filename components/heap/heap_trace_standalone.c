@@ -19,6 +19,7 @@
 #undef HEAP_TRACE_SRCFILE
 
 #include "esp_attr.h"
+#include "esp_heap_caps.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
@@ -32,10 +33,33 @@ static bool tracing;
 static heap_trace_mode_t mode;
 
 /* Buffer used for records, starting at offset 0
+
+   The 'count' records in use are always kept at the start of the buffer. The order they were allocated in is
+   kept by the 'records' list, and a hash map of addresses finds the record for a freed address. The hash map has
+   at least as many buckets as the buffer has records, so adding, finding and removing a record all take constant
+   time however large the buffer is.
 */
 static heap_trace_record_t *buffer;
 static size_t total_records;
 
+TAILQ_HEAD(heap_trace_record_list, heap_trace_record_t);
+LIST_HEAD(heap_trace_hash_bucket, heap_trace_record_t);
+
+/* All records in use, oldest first */
+static struct heap_trace_record_list records;
+
+/* Records of allocations which haven't been freed, by hash of their address. Newest record first in each bucket.
+
+   Allocated by heap_trace_init_standalone(), 'hash_map_size' is a power of two.
+*/
+static struct heap_trace_hash_bucket *hash_map;
+static size_t hash_map_size;
+
+/* Last record returned by heap_trace_get(), so reading all records in order doesn't walk the list each time.
+   Reset whenever the list changes. */
+static heap_trace_record_t *last_get;
+static size_t last_get_index;
+
 /* Count of entries logged in the buffer.
 
    Maximum total_records
@@ -51,14 +75,46 @@ static size_t total_frees;
 /* Has the buffer overflowed and lost trace entries? */
 static bool has_overflowed = false;
 
+static void clear_records(void)
+{
+    TAILQ_INIT(&records);
+    for (size_t i = 0; i < hash_map_size; i++) {
+        LIST_INIT(&hash_map[i]);
+    }
+    last_get = NULL;
+    count = 0;
+}
+
 esp_err_t heap_trace_init_standalone(heap_trace_record_t *record_buffer, size_t num_records)
 {
     if (tracing) {
         return ESP_ERR_INVALID_STATE;
     }
+
+    heap_caps_free(hash_map);
+    hash_map = NULL;
+    hash_map_size = 0;
+    buffer = NULL;
+    total_records = 0;
+    if (record_buffer == NULL || num_records == 0) {
+        return ESP_OK;
+    }
+
+    /* must be in internal memory, it is used while the flash cache is disabled */
+    size_t size = 1;
+    while (size < num_records) {
+        size <<= 1;
+    }
+    hash_map = heap_caps_malloc(size * sizeof(struct heap_trace_hash_bucket), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (hash_map == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    hash_map_size = size;
+
     buffer = record_buffer;
     total_records = num_records;
     memset(buffer, 0, num_records * sizeof(heap_trace_record_t));
+    clear_records();
     return ESP_OK;
 }
 
@@ -72,7 +128,7 @@ esp_err_t heap_trace_start(heap_trace_mode_t mode_param)
 
     tracing = false;
     mode = mode_param;
-    count = 0;
+    clear_records();
     total_allocations = 0;
     total_frees = 0;
     has_overflowed = false;
@@ -117,7 +173,21 @@ esp_err_t heap_trace_get(size_t index, heap_trace_record_t *record)
     if (index >= count) {
         result = ESP_ERR_INVALID_ARG; /* out of range for 'count' */
     } else {
-        memcpy(record, &buffer[index], sizeof(heap_trace_record_t));
+        heap_trace_record_t *rec;
+        size_t i;
+        if (last_get != NULL && last_get_index <= index) {
+            rec = last_get;
+            i = last_get_index;
+        } else {
+            rec = TAILQ_FIRST(&records);
+            i = 0;
+        }
+        for (; i < index; i++) {
+            rec = TAILQ_NEXT(rec, list);
+        }
+        last_get = rec;
+        last_get_index = index;
+        memcpy(record, rec, sizeof(heap_trace_record_t));
     }
     portEXIT_CRITICAL(&trace_mux);
     return result;
@@ -131,9 +201,8 @@ void heap_trace_dump(void)
     printf("%u allocations trace (%u entry buffer)\n",
            count, total_records);
     size_t start_count = count;
-    for (int i = 0; i < count; i++) {
-        heap_trace_record_t *rec = &buffer[i];
-
+    heap_trace_record_t *rec;
+    TAILQ_FOREACH(rec, &records, list) {
         if (rec->address != NULL) {
             printf("%d bytes (@ %p) allocated CPU %d ccount 0x%08x caller ",
                    rec->size, rec->address, rec->ccount & 1, rec->ccount & ~3);
@@ -170,6 +239,15 @@ void heap_trace_dump(void)
     }
 }
 
+static inline struct heap_trace_hash_bucket *hash_bucket(const void *address)
+{
+    /* allocations are at least 4 byte aligned, so the lowest bits say little */
+    return &hash_map[((uintptr_t)address >> 3) & (hash_map_size - 1)];
+}
+
+/* remove a record, used when freeing or when the buffer overflows */
+static void remove_record(heap_trace_record_t *rec);
+
 /* Add a new allocation to the heap trace records */
 static IRAM_ATTR void record_allocation(const heap_trace_record_t *record)
 {
@@ -181,27 +259,24 @@ static IRAM_ATTR void record_allocation(const heap_trace_record_t *record)
     if (tracing) {
         if (count == total_records) {
             has_overflowed = true;
-            /* Move the whole buffer back one slot.
-
-               This is a bit slow, compared to treating this buffer as a ringbuffer and rotating a head pointer.
-
-               However, ringbuffer code gets tricky when we remove elements in mid-buffer (for leak trace mode) while
-               trying to keep track of an item count that may overflow.
-            */
-            memmove(&buffer[0], &buffer[1], sizeof(heap_trace_record_t) * (total_records -1));
-            count--;
+            /* Drop the oldest record to make room */
+            remove_record(TAILQ_FIRST(&records));
         }
-        // Copy new record into place
-        memcpy(&buffer[count], record, sizeof(heap_trace_record_t));
+        // Copy new record into the first unused slot
+        heap_trace_record_t *rec = &buffer[count];
+        rec->ccount = record->ccount;
+        rec->address = record->address;
+        rec->size = record->size;
+        memcpy(rec->alloced_by, record->alloced_by, sizeof(void *) * STACK_DEPTH);
+        memcpy(rec->freed_by, record->freed_by, sizeof(void *) * STACK_DEPTH);
+        TAILQ_INSERT_TAIL(&records, rec, list);
+        LIST_INSERT_HEAD(hash_bucket(rec->address), rec, hash_list);
         count++;
         total_allocations++;
     }
     portEXIT_CRITICAL(&trace_mux);
 }
 
-// remove a record, used when freeing
-static void remove_record(int index);
-
 /* record a free event in the heap trace log
 
    For HEAP_TRACE_ALL, this means filling in the freed_by pointer.
@@ -216,37 +291,52 @@ static IRAM_ATTR void record_free(void *p, void **callers)
     portENTER_CRITICAL(&trace_mux);
     if (tracing && count > 0) {
         total_frees++;
-        /* search backwards for the allocation record matching this free */
-        int i;
-        for (i = count - 1; i >= 0; i--) {
-            if (buffer[i].address == p) {
+        /* find the newest allocation record matching this free */
+        heap_trace_record_t *rec;
+        LIST_FOREACH(rec, hash_bucket(p), hash_list) {
+            if (rec->address == p) {
                 break;
             }
         }
 
-        if (i >= 0) {
+        if (rec != NULL) {
             if (mode == HEAP_TRACE_ALL) {
-                memcpy(buffer[i].freed_by, callers, sizeof(void *) * STACK_DEPTH);
+                memcpy(rec->freed_by, callers, sizeof(void *) * STACK_DEPTH);
+                /* the record stays in the log, but a later free of the same address belongs to a newer allocation */
+                LIST_REMOVE(rec, hash_list);
+                rec->hash_list.le_prev = NULL;
             } else { // HEAP_TRACE_LEAKS
                 // Leak trace mode, once an allocation is freed we remove it from the list
-                remove_record(i);
+                remove_record(rec);
             }
         }
     }
     portEXIT_CRITICAL(&trace_mux);
 }
 
-/* remove the entry at 'index' from the ringbuffer of saved records */
-static IRAM_ATTR void remove_record(int index)
+/* remove a record from the buffer, moving the last record in the buffer into its slot */
+static IRAM_ATTR void remove_record(heap_trace_record_t *rec)
 {
-    if (index < count - 1) {
-        // Remove the buffer entry from the list
-        memmove(&buffer[index], &buffer[index+1],
-                sizeof(heap_trace_record_t) * (total_records - index - 1));
-    } else {
-        // For last element, just zero it out to avoid ambiguity
-        memset(&buffer[index], 0, sizeof(heap_trace_record_t));
+    heap_trace_record_t *last = &buffer[count - 1];
+
+    TAILQ_REMOVE(&records, rec, list);
+    /* records of freed allocations (HEAP_TRACE_ALL) are no longer in the hash map */
+    if (rec->hash_list.le_prev != NULL) {
+        LIST_REMOVE(rec, hash_list);
+    }
+    if (rec != last) {
+        /* copy the last record over the removed one, then swap it into the lists in place of the original */
+        memcpy(rec, last, sizeof(heap_trace_record_t));
+        TAILQ_INSERT_AFTER(&records, last, rec, list);
+        TAILQ_REMOVE(&records, last, list);
+        if (last->hash_list.le_prev != NULL) {
+            LIST_INSERT_AFTER(last, rec, hash_list);
+            LIST_REMOVE(last, hash_list);
+        }
     }
+    // Zero out the now unused last slot to avoid ambiguity
+    memset(last, 0, sizeof(heap_trace_record_t));
+    last_get = NULL;
     count--;
 }
 
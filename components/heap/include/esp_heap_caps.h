@@ -241,6 +241,21 @@ size_t heap_caps_get_largest_free_block( uint32_t caps );
  */
 void heap_caps_get_info( multi_heap_info_t *info, uint32_t caps );
 
+/**
+ * @brief Get free block statistics for all regions with the given capabilities.
+ *
+ * Calls multi_heap_get_fragmentation_stats() on all heaps which share the given capabilities. The statistics
+ * returned are an aggregate across all matching heaps. Unlike heap_caps_get_info(), this doesn't walk the heaps, so
+ * it is cheap enough to poll periodically to monitor heap fragmentation.
+ *
+ * @param stats       Pointer to a structure which will be filled with the
+ *                    free block statistics.
+ * @param caps        Bitwise OR of MALLOC_CAP_* flags indicating the type
+ *                    of memory
+ *
+ */
+void heap_caps_get_fragmentation_stats( multi_heap_fragmentation_stats_t *stats, uint32_t caps );
+
 
 /**
  * @brief Print a summary of all memory with the given capabilities.
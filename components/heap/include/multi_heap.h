@@ -185,6 +185,27 @@ typedef struct {
  */
 void multi_heap_get_info(multi_heap_handle_t heap, multi_heap_info_t *info);
 
+/** @brief Number of entries in the free block size histogram of multi_heap_fragmentation_stats_t */
+#define MULTI_HEAP_FRAGMENTATION_BUCKETS 16
+
+/** @brief Structure to access free block statistics via multi_heap_get_fragmentation_stats */
+typedef struct {
+    size_t total_free_bytes;      ///<  Total free bytes in the heap. Equivalent to multi_free_heap_size().
+    size_t largest_free_block;    ///<  Size of largest free block in the heap. This is the largest malloc-able size.
+    size_t free_blocks;           ///<  Number of (variable size) free blocks in the heap.
+    size_t free_block_histogram[MULTI_HEAP_FRAGMENTATION_BUCKETS]; ///<  Number of free blocks by size. Entry 0 counts blocks of less than 32 bytes, entry N counts blocks of 2^(N+4) to 2^(N+5)-1 bytes, and the last entry also counts any larger blocks.
+} multi_heap_fragmentation_stats_t;
+
+/** @brief Return free block statistics of a given heap
+ *
+ * Unlike multi_heap_get_info(), this doesn't walk the heap. The statistics are kept up to date as blocks are
+ * allocated and freed, so this function takes constant time and can be polled frequently.
+ *
+ * @param heap Handle to a registered heap.
+ * @param stats Pointer to a structure to fill with the statistics.
+ */
+void multi_heap_get_fragmentation_stats(multi_heap_handle_t heap, multi_heap_fragmentation_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -28,6 +28,8 @@
 /* Defines compile-time configuration macros */
 #include "multi_heap_config.h"
 
+#ifndef MULTI_HEAP_TLSF
+
 #ifndef MULTI_HEAP_POISONING
 /* if no heap poisoning, public API aliases directly to these implementations */
 void *multi_heap_malloc(multi_heap_handle_t heap, size_t size)
@@ -60,6 +62,9 @@ size_t multi_heap_free_size(multi_heap_handle_t heap)
 size_t multi_heap_minimum_free_size(multi_heap_handle_t heap)
     __attribute__((alias("multi_heap_minimum_free_size_impl")));
 
+void multi_heap_get_fragmentation_stats(multi_heap_handle_t heap, multi_heap_fragmentation_stats_t *stats)
+    __attribute__((alias("multi_heap_get_fragmentation_stats_impl")));
+
 void *multi_heap_get_block_address(multi_heap_block_handle_t block)
     __attribute__((alias("multi_heap_get_block_address_impl")));
 
@@ -103,11 +108,14 @@ typedef struct heap_block {
 
    'last_block' is a pointer to a final free block of length 0, which is added at the end of the heap when it is
    registered. This block is also never allocated or merged into an adjacent block.
+
+   'free_stats' counts the free blocks between these two.
  */
 typedef struct multi_heap_info {
     void *lock;
     size_t free_bytes;
     size_t minimum_free_bytes;
+    multi_heap_free_stats_t free_stats;
     heap_block_t *last_block;
     heap_block_t first_block; /* initial 'free block', never allocated */
 } heap_t;
@@ -236,6 +244,11 @@ static heap_block_t *merge_adjacent(heap_t *heap, heap_block_t *a, heap_block_t
         prev_free->next_free = free_block->next_free;
 
         heap->free_bytes -= block_data_size(free_block);
+        multi_heap_free_stats_remove(&heap->free_stats, block_data_size(free_block));
+    } else if (free) {
+        /* 'a' is replaced by the merged block below */
+        multi_heap_free_stats_remove(&heap->free_stats, block_data_size(a));
+        multi_heap_free_stats_remove(&heap->free_stats, block_data_size(b));
     }
 
     a->header = b->header & NEXT_BLOCK_MASK;
@@ -250,6 +263,7 @@ static heap_block_t *merge_adjacent(heap_t *heap, heap_block_t *a, heap_block_t
 
         /* b's header can be put into the pool of free bytes */
         heap->free_bytes += sizeof(a->header);
+        multi_heap_free_stats_add(&heap->free_stats, block_data_size(a));
     }
 
 #ifdef MULTI_HEAP_POISONING_SLOW
@@ -285,6 +299,7 @@ static void split_if_necessary(heap_t *heap, heap_block_t *block, size_t size, h
 
     if (is_free(next_block) && !is_last_block(next_block)) {
         /* The next block is free, just extend it upwards. */
+        multi_heap_free_stats_remove(&heap->free_stats, block_data_size(next_block));
         new_block->header = next_block->header;
         new_block->next_free = next_block->next_free;
         if (prev_free_block == NULL) {
@@ -295,6 +310,7 @@ static void split_if_necessary(heap_t *heap, heap_block_t *block, size_t size, h
                           &prev_free_block->next_free); // free blocks should be in order
         /* Note: We have not introduced a new block header, hence the simple math. */
         heap->free_bytes += block_size - size;
+        multi_heap_free_stats_add(&heap->free_stats, block_data_size(new_block));
 #ifdef MULTI_HEAP_POISONING_SLOW
         /* next_block header needs to be replaced with a fill pattern */
         multi_heap_internal_poison_fill_region(next_block, sizeof(heap_block_t), true /* free */);
@@ -314,11 +330,32 @@ static void split_if_necessary(heap_t *heap, heap_block_t *block, size_t size, h
         MULTI_HEAP_ASSERT(prev_free_block->next_free > new_block,
                           &prev_free_block->next_free); // free blocks should be in order
         heap->free_bytes += block_data_size(new_block);
+        multi_heap_free_stats_add(&heap->free_stats, block_data_size(new_block));
     }
     block->header = (intptr_t)new_block;
     prev_free_block->next_free = new_block;
 }
 
+/* If the largest free block was taken off the free list, find the new one.
+
+   This walks the whole free list, so it is only called when the free block statistics are read, never when
+   allocating or freeing.
+*/
+static void update_largest_free_block(heap_t *heap)
+{
+    if (!heap->free_stats.largest_stale) {
+        return;
+    }
+    size_t largest = 0;
+    for (heap_block_t *b = heap->first_block.next_free; b != NULL && !is_last_block(b); b = b->next_free) {
+        if (block_data_size(b) > largest) {
+            largest = block_data_size(b);
+        }
+    }
+    heap->free_stats.largest_free_block = largest;
+    heap->free_stats.largest_stale = false;
+}
+
 void *multi_heap_get_block_address_impl(multi_heap_block_handle_t block)
 {
     return ((char *)block + offsetof(heap_block_t, data));
@@ -369,6 +406,9 @@ multi_heap_handle_t multi_heap_register_impl(void *start_ptr, size_t size)
     heap->free_bytes = size - sizeof(heap_t) - sizeof(first_free_block->header) - sizeof(heap_block_t);
     heap->minimum_free_bytes = heap->free_bytes;
 
+    memset(&heap->free_stats, 0, sizeof(heap->free_stats));
+    multi_heap_free_stats_add(&heap->free_stats, block_data_size(first_free_block));
+
     return heap;
 }
 
@@ -458,6 +498,7 @@ void *multi_heap_malloc_impl(multi_heap_handle_t heap, size_t size)
     best_block->header &= ~BLOCK_FREE_FLAG;
 
     heap->free_bytes -= block_data_size(best_block);
+    multi_heap_free_stats_remove(&heap->free_stats, block_data_size(best_block));
 
     split_if_necessary(heap, best_block, size, prev_free);
 
@@ -554,6 +595,7 @@ void multi_heap_free_impl(multi_heap_handle_t heap, void *p)
     pb->header |= BLOCK_FREE_FLAG;
 
     heap->free_bytes += block_data_size(pb);
+    multi_heap_free_stats_add(&heap->free_stats, block_data_size(pb));
 
     /* Try and merge previous free block into this one */
     if (get_next_block(prev_free) == pb) {
@@ -673,6 +715,7 @@ bool multi_heap_check(multi_heap_handle_t heap, bool print_errors)
 {
     bool valid = true;
     size_t total_free_bytes = 0;
+    multi_heap_free_stats_t free_stats = { 0 };
     assert(heap != NULL);
 
     multi_heap_internal_lock(heap);
@@ -708,6 +751,9 @@ bool multi_heap_check(multi_heap_handle_t heap, bool print_errors)
             if (!is_first_block(heap, b)) {
                 total_free_bytes += block_data_size(b);
             }
+            if (!is_first_block(heap, b) && !is_last_block(b)) {
+                multi_heap_free_stats_add(&free_stats, block_data_size(b));
+            }
         }
         prev = b;
 
@@ -739,6 +785,15 @@ bool multi_heap_check(multi_heap_handle_t heap, bool print_errors)
         FAIL_PRINT("CORRUPT HEAP: Expected %u free bytes counted %u\n", (unsigned)heap->free_bytes, (unsigned)total_free_bytes);
     }
 
+    if (heap->free_stats.free_blocks != free_stats.free_blocks
+        || heap->free_stats.largest_free_block < free_stats.largest_free_block
+        || (!heap->free_stats.largest_stale && heap->free_stats.largest_free_block != free_stats.largest_free_block)
+        || memcmp(heap->free_stats.histogram, free_stats.histogram, sizeof(free_stats.histogram)) != 0) {
+        FAIL_PRINT("CORRUPT HEAP: Expected %u free blocks (largest %u) counted %u (largest %u)\n",
+                   (unsigned)heap->free_stats.free_blocks, (unsigned)heap->free_stats.largest_free_block,
+                   (unsigned)free_stats.free_blocks, (unsigned)free_stats.largest_free_block);
+    }
+
  done:
     multi_heap_internal_unlock(heap);
 
@@ -809,3 +864,24 @@ void multi_heap_get_info_impl(multi_heap_handle_t heap, multi_heap_info_t *info)
     multi_heap_internal_unlock(heap);
 
 }
+
+void multi_heap_get_fragmentation_stats_impl(multi_heap_handle_t heap, multi_heap_fragmentation_stats_t *stats)
+{
+    memset(stats, 0, sizeof(multi_heap_fragmentation_stats_t));
+
+    if (heap == NULL) {
+        return;
+    }
+
+    multi_heap_internal_lock(heap);
+    update_largest_free_block(heap);
+    stats->total_free_bytes = heap->free_bytes;
+    stats->largest_free_block = heap->free_stats.largest_free_block;
+    stats->free_blocks = heap->free_stats.free_blocks;
+    for (int i = 0; i < MULTI_HEAP_FRAGMENTATION_BUCKETS; i++) {
+        stats->free_block_histogram[i] = heap->free_stats.histogram[i];
+    }
+    multi_heap_internal_unlock(heap);
+}
+
+#endif // MULTI_HEAP_TLSF
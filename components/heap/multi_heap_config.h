@@ -27,3 +27,7 @@
 #define MULTI_HEAP_POISONING
 #define MULTI_HEAP_POISONING_SLOW
 #endif
+
+#ifdef CONFIG_HEAP_ALLOCATOR_TLSF
+#define MULTI_HEAP_TLSF
+#endif
@@ -17,7 +17,7 @@
 typedef const struct heap_block *multi_heap_block_handle_t;
 
 /* Internal definitions for the "implementation" of the multi_heap API,
-   as defined in multi_heap.c.
+   as defined in multi_heap.c (or multi_heap_tlsf.c if CONFIG_HEAP_ALLOCATOR_TLSF is set).
 
    If heap poisioning is disabled, these are aliased directly to the public API.
 
@@ -33,6 +33,7 @@ multi_heap_handle_t multi_heap_register_impl(void *start, size_t size);
 void multi_heap_get_info_impl(multi_heap_handle_t heap, multi_heap_info_t *info);
 size_t multi_heap_free_size_impl(multi_heap_handle_t heap);
 size_t multi_heap_minimum_free_size_impl(multi_heap_handle_t heap);
+void multi_heap_get_fragmentation_stats_impl(multi_heap_handle_t heap, multi_heap_fragmentation_stats_t *stats);
 size_t multi_heap_get_allocated_size_impl(multi_heap_handle_t heap, void *p);
 void *multi_heap_get_block_address_impl(multi_heap_block_handle_t block);
 
@@ -69,3 +70,47 @@ void *multi_heap_get_block_address(multi_heap_block_handle_t block);
 
 /* Get the owner identification for a heap block */
 void *multi_heap_get_block_owner(multi_heap_block_handle_t block);
+
+/* Free block statistics, kept up to date by the allocator as blocks are added to and removed from its free lists
+   so multi_heap_get_fragmentation_stats() doesn't need to walk the heap.
+
+   'largest_free_block' is never smaller than the largest free block. It is exact unless 'largest_stale' is set, which
+   happens when a block of that size is removed. Both updates take constant time. The allocator only finds the new
+   largest free block when the statistics are read.
+*/
+typedef struct {
+    size_t free_blocks;
+    size_t largest_free_block;
+    bool largest_stale;
+    uint32_t histogram[MULTI_HEAP_FRAGMENTATION_BUCKETS];
+} multi_heap_free_stats_t;
+
+/* Index in the histogram for a free block of 'size' bytes */
+static inline int multi_heap_fragmentation_bucket(size_t size)
+{
+    if (size < 32) {
+        return 0;
+    }
+    int bucket = (int)(sizeof(unsigned long) * 8) - 1 - __builtin_clzl(size) - 4;
+    return (bucket < MULTI_HEAP_FRAGMENTATION_BUCKETS) ? bucket : MULTI_HEAP_FRAGMENTATION_BUCKETS - 1;
+}
+
+static inline void multi_heap_free_stats_add(multi_heap_free_stats_t *stats, size_t size)
+{
+    stats->free_blocks++;
+    stats->histogram[multi_heap_fragmentation_bucket(size)]++;
+    if (size >= stats->largest_free_block) {
+        /* nothing else can be larger, as largest_free_block is never too small */
+        stats->largest_free_block = size;
+        stats->largest_stale = false;
+    }
+}
+
+static inline void multi_heap_free_stats_remove(multi_heap_free_stats_t *stats, size_t size)
+{
+    stats->free_blocks--;
+    stats->histogram[multi_heap_fragmentation_bucket(size)]--;
+    if (size == stats->largest_free_block) {
+        stats->largest_stale = true;
+    }
+}
@@ -384,6 +384,14 @@ void multi_heap_get_info(multi_heap_handle_t heap, multi_heap_info_t *info)
     subtract_poison_overhead(&info->minimum_free_bytes);
 }
 
+void multi_heap_get_fragmentation_stats(multi_heap_handle_t heap, multi_heap_fragmentation_stats_t *stats)
+{
+    multi_heap_get_fragmentation_stats_impl(heap, stats);
+    /* as for multi_heap_get_info(), the histogram still counts whole free blocks */
+    subtract_poison_overhead(&stats->largest_free_block);
+    subtract_poison_overhead(&stats->total_free_bytes);
+}
+
 size_t multi_heap_free_size(multi_heap_handle_t heap)
 {
     size_t r = multi_heap_free_size_impl(heap);
@@ -0,0 +1,975 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <multi_heap.h>
+#include "multi_heap_internal.h"
+
+/* Note: Keep platform-specific parts in this header, this source
+   file should depend on libc only */
+#include "multi_heap_platform.h"
+
+/* Defines compile-time configuration macros */
+#include "multi_heap_config.h"
+
+#ifdef MULTI_HEAP_TLSF
+
+/* Two-Level Segregated Fit (TLSF) implementation of the multi_heap "impl" API.
+
+   This is an alternative to the address ordered free list in multi_heap.c, selected with
+   CONFIG_HEAP_ALLOCATOR_TLSF. Free blocks are kept in a two-level array of doubly linked lists,
+   indexed by size class: the first level splits sizes into powers of two, the second level
+   splits each power of two into SL_INDEX_COUNT linear ranges. Two bitmaps record which lists
+   are non-empty, so finding a suitable free block is a couple of bit scans instead of a walk of
+   the free list.
+
+   Every block also records the previous block in the heap, so a freed block is merged with both
+   of its neighbours without searching. malloc() and free() therefore run in bounded time
+   regardless of the number of blocks in the heap.
+
+   The cost is a per-heap control structure (a list head per size class, sized at registration
+   time for the size of the region) and one more pointer per block header than multi_heap.c.
+*/
+
+#ifndef MULTI_HEAP_POISONING
+/* if no heap poisoning, public API aliases directly to these implementations */
+void *multi_heap_malloc(multi_heap_handle_t heap, size_t size)
+    __attribute__((alias("multi_heap_malloc_impl")));
+
+void *multi_heap_aligned_alloc(multi_heap_handle_t heap, size_t size, size_t alignment)
+    __attribute__((alias("multi_heap_aligned_alloc_impl")));
+
+void multi_heap_free(multi_heap_handle_t heap, void *p)
+    __attribute__((alias("multi_heap_free_impl")));
+
+void multi_heap_aligned_free(multi_heap_handle_t heap, void *p)
+    __attribute__((alias("multi_heap_aligned_free_impl")));
+
+void *multi_heap_realloc(multi_heap_handle_t heap, void *p, size_t size)
+    __attribute__((alias("multi_heap_realloc_impl")));
+
+size_t multi_heap_get_allocated_size(multi_heap_handle_t heap, void *p)
+    __attribute__((alias("multi_heap_get_allocated_size_impl")));
+
+multi_heap_handle_t multi_heap_register(void *start, size_t size)
+    __attribute__((alias("multi_heap_register_impl")));
+
+void multi_heap_get_info(multi_heap_handle_t heap, multi_heap_info_t *info)
+    __attribute__((alias("multi_heap_get_info_impl")));
+
+size_t multi_heap_free_size(multi_heap_handle_t heap)
+    __attribute__((alias("multi_heap_free_size_impl")));
+
+size_t multi_heap_minimum_free_size(multi_heap_handle_t heap)
+    __attribute__((alias("multi_heap_minimum_free_size_impl")));
+
+void multi_heap_get_fragmentation_stats(multi_heap_handle_t heap, multi_heap_fragmentation_stats_t *stats)
+    __attribute__((alias("multi_heap_get_fragmentation_stats_impl")));
+
+void *multi_heap_get_block_address(multi_heap_block_handle_t block)
+    __attribute__((alias("multi_heap_get_block_address_impl")));
+
+void *multi_heap_get_block_owner(multi_heap_block_handle_t block)
+{
+    return NULL;
+}
+
+#endif
+
+#define ALIGN(X) ((X) & ~(sizeof(void *)-1))
+#define ALIGN_UP(X) ALIGN((X)+sizeof(void *)-1)
+#define ALIGN_UP_BY(num, align) (((num) + ((align) - 1)) & ~((align) - 1))
+
+/* Each power of two size range is split into 2^SL_INDEX_COUNT_LOG2 free lists. 8 lists keeps
+   the control structure small for the many small regions registered on ESP32, while still
+   limiting the size mismatch between a request and the blocks on a list to 1/8th. */
+#define SL_INDEX_COUNT_LOG2 3
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+
+#define ALIGN_SIZE_LOG2 (sizeof(void *) == 8 ? 3 : 2)
+
+/* Blocks smaller than SMALL_BLOCK_SIZE all go in the first level list 0, which is split
+   linearly so each second level list holds exactly one (aligned) block size. */
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + ALIGN_SIZE_LOG2)
+#define SMALL_BLOCK_SIZE ((size_t)1 << FL_INDEX_SHIFT)
+
+/* fl_bitmap is a 32-bit word, which bounds the number of first level lists */
+#define FL_INDEX_COUNT_MAX 32
+
+/* When no list above a request holds a block, at most this many blocks of the list the request
+   maps to are checked for one which is large enough. This keeps malloc() bounded, at the cost of
+   occasionally failing an allocation which a block further down that list could have held. */
+#define FREE_LIST_SCAN_MAX 4
+
+/* Block in the heap
+
+   Blocks are laid out back to back in the heap, so the next block (used or free) is found by adding the data size
+   to the block's data pointer. 'prev_phys' points to the previous block in the heap (used or free), so both neighbours
+   of a block can be found in constant time when it is freed.
+
+   'header' holds the data size of the block, ORed with a free flag (the LSB, as sizes are always aligned.)
+
+   'next_free' & 'prev_free' are valid if the block is free and link the block into the free list for its size class.
+*/
+typedef struct heap_block {
+    struct heap_block *prev_phys;          /* Previous block in the heap, NULL for the first block */
+    size_t header;                         /* Data size of the block ORed with the free flag */
+    union {
+        uint8_t data[1];                   /* First byte of data, valid if block is used. Actual size of data is 'block_data_size(block)' */
+        struct {
+            struct heap_block *next_free;  /* Next block in the same free list, valid if block is free */
+            struct heap_block *prev_free;  /* Previous block in the same free list, valid if block is free */
+        };
+    };
+} heap_block_t;
+
+/* These masks apply to the 'header' field of heap_block_t */
+#define BLOCK_FREE_FLAG 0x1                          /* If set, this block is free & on a free list */
+#define BLOCK_SIZE_MASK (~(size_t)(sizeof(void *)-1)) /* AND header with this mask to get the data size */
+
+/* Size of the part of a block which is always present (used or free) */
+#define BLOCK_HEADER_SIZE offsetof(heap_block_t, data)
+
+/* Smallest data size for a block, so it can hold the free list pointers once it is freed */
+#define BLOCK_MIN_DATA_SIZE (sizeof(heap_block_t) - BLOCK_HEADER_SIZE)
+
+/* Metadata header for the heap, stored at the beginning of heap space.
+
+   'free_lists' and 'sl_bitmap' are arrays which follow this structure in the heap, sized when the heap is registered
+   so they only cover the block sizes which can exist in the heap.
+
+   'first_block' is the first allocatable block in the heap, it follows the free lists.
+
+   'last_block' is a header-only block of length 0 at the end of the heap. It is always marked in use, so freed
+   blocks never merge with it.
+
+   'free_stats' counts the blocks on the free lists.
+ */
+typedef struct multi_heap_info {
+    void *lock;
+    size_t free_bytes;
+    size_t minimum_free_bytes;
+    multi_heap_free_stats_t free_stats;
+    heap_block_t *first_block;
+    heap_block_t *last_block;
+    uint32_t fl_bitmap;         /* bit N is set if any second level list of first level N is non-empty */
+    uint32_t fl_count;          /* number of first level lists */
+    uint32_t *sl_bitmap;        /* [fl_count], bit M of entry N is set if free list N,M is non-empty */
+    heap_block_t **free_lists;  /* [fl_count * SL_INDEX_COUNT] heads of the free lists */
+} heap_t;
+
+/* Index of the most significant bit set in 'size', which must be non-zero */
+static inline int fls_size(size_t size)
+{
+    return (int)(sizeof(unsigned long) * 8) - 1 - __builtin_clzl(size);
+}
+
+/* Index of the least significant bit set in 'word', which must be non-zero */
+static inline int ffs_word(uint32_t word)
+{
+    return __builtin_ctz(word);
+}
+
+/* Given a pointer to the 'data' field of a block (ie the previous malloc/realloc result), return a pointer to the
+   containing block.
+*/
+static inline heap_block_t *get_block(const void *data_ptr)
+{
+    return (heap_block_t *)((char *)data_ptr - offsetof(heap_block_t, data));
+}
+
+/* Data size of the block (excludes this block's header) */
+static inline size_t block_data_size(const heap_block_t *block)
+{
+    return block->header & BLOCK_SIZE_MASK;
+}
+
+/* Return the next sequential block in the heap. */
+static inline heap_block_t *get_next_block(const heap_block_t *block)
+{
+    return (heap_block_t *)(block->data + block_data_size(block));
+}
+
+/* Return true if this block is free. */
+static inline bool is_free(const heap_block_t *block)
+{
+    return block->header & BLOCK_FREE_FLAG;
+}
+
+/* Return true if this block is the last_block in the heap */
+static inline bool is_last_block(const heap_t *heap, const heap_block_t *block)
+{
+    return block == heap->last_block;
+}
+
+/* Check a block is valid for this heap. Used to verify parameters. */
+static void assert_valid_block(const heap_t *heap, const heap_block_t *block)
+{
+    MULTI_HEAP_ASSERT(block >= heap->first_block && block <= heap->last_block,
+                      block); // block not in heap
+    if (!is_last_block(heap, block)) {
+        const heap_block_t *next = get_next_block(block);
+        MULTI_HEAP_ASSERT(next > block && next <= heap->last_block, block); // Next block not in heap
+        MULTI_HEAP_ASSERT(next->prev_phys == block, &next->prev_phys); // Next block doesn't point back to this one
+    }
+}
+
+/* Find the free list which a free block of 'size' bytes is stored in */
+static inline void mapping_insert(size_t size, int *fl, int *sl)
+{
+    if (size < SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT);
+    } else {
+        int f = fls_size(size);
+        *sl = (size >> (f - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        *fl = f - (FL_INDEX_SHIFT - 1);
+    }
+}
+
+/* Find the first free list where every block is at least 'size' bytes */
+static inline void mapping_search(size_t size, int *fl, int *sl)
+{
+    if (size >= SMALL_BLOCK_SIZE) {
+        size += ((size_t)1 << (fls_size(size) - SL_INDEX_COUNT_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+static inline heap_block_t **get_free_list(heap_t *heap, int fl, int sl)
+{
+    return &heap->free_lists[fl * SL_INDEX_COUNT + sl];
+}
+
+/* Add a free block to the head of the free list for its size */
+static void insert_free_block(heap_t *heap, heap_block_t *block)
+{
+    int fl, sl;
+    mapping_insert(block_data_size(block), &fl, &sl);
+    MULTI_HEAP_ASSERT(fl < heap->fl_count, block); // block is larger than the heap
+
+    heap_block_t **list = get_free_list(heap, fl, sl);
+    block->next_free = *list;
+    block->prev_free = NULL;
+    if (*list != NULL) {
+        (*list)->prev_free = block;
+    }
+    *list = block;
+
+    heap->fl_bitmap |= 1U << fl;
+    heap->sl_bitmap[fl] |= 1U << sl;
+    multi_heap_free_stats_add(&heap->free_stats, block_data_size(block));
+}
+
+/* Take a free block out of the free list for its size */
+static void remove_free_block(heap_t *heap, heap_block_t *block)
+{
+    int fl, sl;
+    mapping_insert(block_data_size(block), &fl, &sl);
+    MULTI_HEAP_ASSERT(fl < heap->fl_count, block); // block is larger than the heap
+
+    if (block->next_free != NULL) {
+        block->next_free->prev_free = block->prev_free;
+    }
+    if (block->prev_free != NULL) {
+        block->prev_free->next_free = block->next_free;
+    } else {
+        heap_block_t **list = get_free_list(heap, fl, sl);
+        MULTI_HEAP_ASSERT(*list == block, list); // free list head doesn't match the block
+        *list = block->next_free;
+        if (*list == NULL) {
+            heap->sl_bitmap[fl] &= ~(1U << sl);
+            if (heap->sl_bitmap[fl] == 0) {
+                heap->fl_bitmap &= ~(1U << fl);
+            }
+        }
+    }
+    multi_heap_free_stats_remove(&heap->free_stats, block_data_size(block));
+}
+
+/* If the largest free block was taken off its free list, find the new one.
+
+   It is on the highest non-empty free list, so only that list is searched. That list can be long, so this is only
+   called when the free block statistics are read, never when allocating or freeing.
+*/
+static void update_largest_free_block(heap_t *heap)
+{
+    if (!heap->free_stats.largest_stale) {
+        return;
+    }
+    size_t largest = 0;
+    if (heap->fl_bitmap != 0) {
+        int fl = 31 - __builtin_clz(heap->fl_bitmap);
+        int sl = 31 - __builtin_clz(heap->sl_bitmap[fl]);
+        for (heap_block_t *b = *get_free_list(heap, fl, sl); b != NULL; b = b->next_free) {
+            if (block_data_size(b) > largest) {
+                largest = block_data_size(b);
+            }
+        }
+    }
+    heap->free_stats.largest_free_block = largest;
+    heap->free_stats.largest_stale = false;
+}
+
+/* Find a free block with at least 'size' bytes of data. The block is not removed from its free list.
+
+   Searching from the list above 'size' means any block found is large enough, so this is a pair of bit scans.
+   Only if that fails are the first FREE_LIST_SCAN_MAX blocks of the list 'size' maps to checked for one which
+   happens to be large enough, so that allocating the largest free block of a sparse heap doesn't fail.
+*/
+static heap_block_t *find_free_block(heap_t *heap, size_t size)
+{
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+
+    if (fl < heap->fl_count) {
+        uint32_t sl_map = heap->sl_bitmap[fl] & (~0U << sl);
+        if (sl_map == 0) {
+            uint32_t fl_map = (fl + 1 < FL_INDEX_COUNT_MAX) ? heap->fl_bitmap & (~0U << (fl + 1)) : 0;
+            if (fl_map != 0) {
+                fl = ffs_word(fl_map);
+                sl_map = heap->sl_bitmap[fl];
+            }
+        }
+        if (sl_map != 0) {
+            sl = ffs_word(sl_map);
+            return *get_free_list(heap, fl, sl);
+        }
+    }
+
+    mapping_insert(size, &fl, &sl);
+    if (fl < heap->fl_count) {
+        heap_block_t *b = *get_free_list(heap, fl, sl);
+        for (int i = 0; i < FREE_LIST_SCAN_MAX && b != NULL; i++, b = b->next_free) {
+            if (block_data_size(b) >= size) {
+                return b;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Merge block 'b' into the preceding block 'a'.
+
+   Neither block may be on a free list. The result keeps the free flag of 'a', the caller is responsible for
+   updating heap->free_bytes.
+*/
+static heap_block_t *merge_adjacent(heap_t *heap, heap_block_t *a, heap_block_t *b)
+{
+    MULTI_HEAP_ASSERT(get_next_block(a) == b, a); // Blocks should be in order
+    MULTI_HEAP_ASSERT(!is_last_block(heap, b), b); // last_block is never merged
+
+    heap_block_t *next = get_next_block(b);
+    a->header += BLOCK_HEADER_SIZE + block_data_size(b);
+    next->prev_phys = a;
+
+#ifdef MULTI_HEAP_POISONING_SLOW
+    /* b's former block header needs to be replaced with a fill pattern */
+    multi_heap_internal_poison_fill_region(b, sizeof(heap_block_t), is_free(a));
+#endif
+
+    return a;
+}
+
+/* Split a block so it holds 'size' bytes of data, making any spare space into a new free block.
+
+   'block' should be marked in-use when this function is called. If the next block is free, the spare space is added
+   to it, otherwise a new free block is only created if it can hold the free list pointers.
+*/
+static void split_if_necessary(heap_t *heap, heap_block_t *block, size_t size)
+{
+    const size_t block_size = block_data_size(block);
+    MULTI_HEAP_ASSERT(!is_free(block), block); // split block shouldn't be free
+    MULTI_HEAP_ASSERT(size <= block_size, block); // size should be valid
+
+    heap_block_t *next = get_next_block(block);
+    const size_t spare = block_size - size;
+    size_t new_size;
+
+    if (is_free(next)) {
+        if (spare == 0) {
+            return;
+        }
+        /* The next block is free, extend it downwards. */
+        remove_free_block(heap, next);
+        new_size = spare + block_data_size(next);
+        heap->free_bytes += spare;
+        heap_block_t *old_next = next;
+        next = get_next_block(next);
+#ifdef MULTI_HEAP_POISONING_SLOW
+        /* old_next header needs to be replaced with a fill pattern */
+        multi_heap_internal_poison_fill_region(old_next, sizeof(heap_block_t), true /* free */);
+#else
+        (void)old_next;
+#endif
+    } else {
+        if (spare < sizeof(heap_block_t)) {
+            /* Can't split 'block' if we're not going to get a usable free block afterwards */
+            return;
+        }
+        new_size = spare - BLOCK_HEADER_SIZE;
+        heap->free_bytes += new_size;
+    }
+
+    heap_block_t *new_block = (heap_block_t *)(block->data + size);
+    block->header = size;
+    new_block->prev_phys = block;
+    new_block->header = new_size | BLOCK_FREE_FLAG;
+    next->prev_phys = new_block;
+    insert_free_block(heap, new_block);
+}
+
+void *multi_heap_get_block_address_impl(multi_heap_block_handle_t block)
+{
+    return ((char *)block + offsetof(heap_block_t, data));
+}
+
+size_t multi_heap_get_allocated_size_impl(multi_heap_handle_t heap, void *p)
+{
+    heap_block_t *pb = get_block(p);
+
+    assert_valid_block(heap, pb);
+    MULTI_HEAP_ASSERT(!is_free(pb), pb); // block shouldn't be free
+    return block_data_size(pb);
+}
+
+multi_heap_handle_t multi_heap_register_impl(void *start_ptr, size_t size)
+{
+    uintptr_t start = ALIGN_UP((uintptr_t)start_ptr);
+    uintptr_t end = ALIGN((uintptr_t)start_ptr + size);
+    heap_t *heap = (heap_t *)start;
+    size = end - start;
+
+    if (end < start || size < sizeof(heap_t) + sizeof(heap_block_t) + BLOCK_HEADER_SIZE) {
+        return NULL; /* 'size' is too small to fit a heap here */
+    }
+
+    /* The free lists only need to cover the sizes of blocks which fit in the heap */
+    int fl, sl;
+    mapping_insert(size - sizeof(heap_t) - 2 * BLOCK_HEADER_SIZE, &fl, &sl);
+    const size_t fl_count = fl + 1;
+    const size_t control_size = sizeof(heap_t)
+        + fl_count * SL_INDEX_COUNT * sizeof(heap_block_t *)
+        + ALIGN_UP(fl_count * sizeof(uint32_t));
+
+    if (fl_count > FL_INDEX_COUNT_MAX || size < control_size + sizeof(heap_block_t) + BLOCK_HEADER_SIZE) {
+        return NULL; /* 'size' is too small to fit the free lists and a block */
+    }
+
+    heap->lock = NULL;
+    heap->fl_bitmap = 0;
+    heap->fl_count = fl_count;
+    heap->free_lists = (heap_block_t **)(start + sizeof(heap_t));
+    heap->sl_bitmap = (uint32_t *)(heap->free_lists + fl_count * SL_INDEX_COUNT);
+    memset(heap->free_lists, 0, fl_count * SL_INDEX_COUNT * sizeof(heap_block_t *));
+    memset(heap->sl_bitmap, 0, fl_count * sizeof(uint32_t));
+    memset(&heap->free_stats, 0, sizeof(heap->free_stats));
+
+    heap->first_block = (heap_block_t *)(start + control_size);
+    heap->last_block = (heap_block_t *)(end - BLOCK_HEADER_SIZE);
+
+    /* the whole heap is one free block, followed by last_block which has length 0 and is never free */
+    heap_block_t *first_free_block = heap->first_block;
+    first_free_block->prev_phys = NULL;
+    first_free_block->header = ((intptr_t)heap->last_block - (intptr_t)first_free_block->data) | BLOCK_FREE_FLAG;
+
+    heap->last_block->prev_phys = first_free_block;
+    heap->last_block->header = 0;
+
+    heap->free_bytes = block_data_size(first_free_block);
+    heap->minimum_free_bytes = heap->free_bytes;
+
+    insert_free_block(heap, first_free_block);
+
+    return heap;
+}
+
+void multi_heap_set_lock(multi_heap_handle_t heap, void *lock)
+{
+    heap->lock = lock;
+}
+
+void inline multi_heap_internal_lock(multi_heap_handle_t heap)
+{
+    MULTI_HEAP_LOCK(heap->lock);
+}
+
+void inline multi_heap_internal_unlock(multi_heap_handle_t heap)
+{
+    MULTI_HEAP_UNLOCK(heap->lock);
+}
+
+multi_heap_block_handle_t multi_heap_get_first_block(multi_heap_handle_t heap)
+{
+    return heap->first_block;
+}
+
+multi_heap_block_handle_t multi_heap_get_next_block(multi_heap_handle_t heap, multi_heap_block_handle_t block)
+{
+    heap_block_t *next = get_next_block(block);
+    if (is_last_block(heap, next)) {
+        return NULL;
+    }
+    assert_valid_block(heap, next);
+    return next;
+}
+
+bool multi_heap_is_free(multi_heap_block_handle_t block)
+{
+    return is_free(block);
+}
+
+void *multi_heap_malloc_impl(multi_heap_handle_t heap, size_t size)
+{
+    size = ALIGN_UP(size);
+
+    if (size == 0 || heap == NULL) {
+        return NULL;
+    }
+
+    if (size < BLOCK_MIN_DATA_SIZE) {
+        size = BLOCK_MIN_DATA_SIZE;
+    }
+
+    multi_heap_internal_lock(heap);
+
+    if (heap->free_bytes < size) {
+        multi_heap_internal_unlock(heap);
+        return NULL;
+    }
+
+    heap_block_t *block = find_free_block(heap, size);
+    if (block == NULL) {
+        multi_heap_internal_unlock(heap);
+        return NULL; /* No room in heap */
+    }
+
+    MULTI_HEAP_ASSERT(is_free(block), block); // block should be free
+    remove_free_block(heap, block);
+    block->header &= ~BLOCK_FREE_FLAG;
+
+    heap->free_bytes -= block_data_size(block);
+
+    split_if_necessary(heap, block, size);
+
+    if (heap->free_bytes < heap->minimum_free_bytes) {
+        heap->minimum_free_bytes = heap->free_bytes;
+    }
+
+    multi_heap_internal_unlock(heap);
+
+    return block->data;
+}
+
+void *multi_heap_aligned_alloc_impl(multi_heap_handle_t heap, size_t size, size_t alignment)
+{
+    if (heap == NULL) {
+        return NULL;
+    }
+
+    if (!size) {
+        return NULL;
+    }
+
+    if (!alignment) {
+        return NULL;
+    }
+
+    //Alignment must be a power of two...
+    if ((alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+
+    uint32_t overhead = (sizeof(uint32_t) + (alignment - 1));
+
+    multi_heap_internal_lock(heap);
+    void *head = multi_heap_malloc_impl(heap, size + overhead);
+    if (head == NULL) {
+        multi_heap_internal_unlock(heap);
+        return NULL;
+    }
+
+    //Lets align our new obtained block address:
+    //and save information to recover original block pointer
+    //to allow us to deallocate the memory when needed
+    void *ptr = (void *)ALIGN_UP_BY((uintptr_t)head + sizeof(uint32_t), alignment);
+    *((uint32_t *)ptr - 1) = (uint32_t)((uintptr_t)ptr - (uintptr_t)head);
+
+    multi_heap_internal_unlock(heap);
+    return ptr;
+}
+
+void multi_heap_aligned_free_impl(multi_heap_handle_t heap, void *p)
+{
+    if (p == NULL) {
+        return;
+    }
+
+    multi_heap_internal_lock(heap);
+    uint32_t offset = *((uint32_t *)p - 1);
+    void *block_head = (void *)((uint8_t *)p - offset);
+
+#ifdef MULTI_HEAP_POISONING_SLOW
+        multi_heap_internal_poison_fill_region(block_head, multi_heap_get_allocated_size_impl(heap, block_head), true /* free */);
+#endif
+
+    multi_heap_free_impl(heap, block_head);
+    multi_heap_internal_unlock(heap);
+}
+
+void multi_heap_free_impl(multi_heap_handle_t heap, void *p)
+{
+    heap_block_t *pb = get_block(p);
+
+    if (heap == NULL || p == NULL) {
+        return;
+    }
+
+    multi_heap_internal_lock(heap);
+
+    assert_valid_block(heap, pb);
+    MULTI_HEAP_ASSERT(!is_free(pb), pb); // block should not be free
+    MULTI_HEAP_ASSERT(!is_last_block(heap, pb), pb); // block should not be last block
+
+    /* Mark this block as free */
+    pb->header |= BLOCK_FREE_FLAG;
+    heap->free_bytes += block_data_size(pb);
+
+    /* Try and merge previous free block into this one */
+    heap_block_t *prev = pb->prev_phys;
+    if (prev != NULL && is_free(prev)) {
+        remove_free_block(heap, prev);
+        pb = merge_adjacent(heap, prev, pb);
+        /* the merged block's header can be put into the pool of free bytes */
+        heap->free_bytes += BLOCK_HEADER_SIZE;
+    }
+
+    /* If next block is free, try to merge the two */
+    heap_block_t *next = get_next_block(pb);
+    if (is_free(next)) {
+        remove_free_block(heap, next);
+        pb = merge_adjacent(heap, pb, next);
+        heap->free_bytes += BLOCK_HEADER_SIZE;
+    }
+
+    insert_free_block(heap, pb);
+
+    multi_heap_internal_unlock(heap);
+}
+
+void *multi_heap_realloc_impl(multi_heap_handle_t heap, void *p, size_t size)
+{
+    heap_block_t *pb = get_block(p);
+    void *result;
+    size = ALIGN_UP(size);
+
+    assert(heap != NULL);
+
+    if (p == NULL) {
+        return multi_heap_malloc_impl(heap, size);
+    }
+
+    assert_valid_block(heap, pb);
+    // non-null realloc arg should be allocated
+    MULTI_HEAP_ASSERT(!is_free(pb), pb);
+
+    if (size == 0) {
+        /* note: calling multi_free_impl() here as we've already been
+           through any poison-unwrapping */
+        multi_heap_free_impl(heap, p);
+        return NULL;
+    }
+
+    if (size < BLOCK_MIN_DATA_SIZE) {
+        size = BLOCK_MIN_DATA_SIZE;
+    }
+
+    multi_heap_internal_lock(heap);
+    result = NULL;
+
+    const size_t orig_size = block_data_size(pb);
+
+    if (size <= orig_size) {
+        // Shrinking....
+        split_if_necessary(heap, pb, size);
+        result = pb->data;
+    }
+    else if (heap->free_bytes < size - orig_size) {
+        // Growing, but there's not enough total free space in the heap
+        multi_heap_internal_unlock(heap);
+        return NULL;
+    }
+    else {
+        // See if we can grow into one or both adjacent blocks
+        heap_block_t *next = get_next_block(pb);
+        heap_block_t *prev = pb->prev_phys;
+        size_t next_grow_size = is_free(next) ? BLOCK_HEADER_SIZE + block_data_size(next) : 0;
+        size_t prev_grow_size = (prev != NULL && is_free(prev)) ? BLOCK_HEADER_SIZE + block_data_size(prev) : 0;
+
+        if (next_grow_size > 0 && orig_size + next_grow_size + prev_grow_size >= size) {
+            remove_free_block(heap, next);
+            heap->free_bytes -= block_data_size(next);
+            pb = merge_adjacent(heap, pb, next);
+        }
+
+        // Only move the data into the previous block if growing in place wasn't enough
+        if (prev_grow_size > 0 && block_data_size(pb) < size && block_data_size(pb) + prev_grow_size >= size) {
+            remove_free_block(heap, prev);
+            heap->free_bytes -= block_data_size(prev);
+            pb = merge_adjacent(heap, prev, pb);
+            pb->header &= ~BLOCK_FREE_FLAG;
+            memmove(pb->data, p, orig_size);
+        }
+
+        if (block_data_size(pb) >= size) {
+            split_if_necessary(heap, pb, size);
+            result = pb->data;
+        }
+    }
+
+    if (result == NULL) {
+        // Need to allocate elsewhere and copy data over
+        //
+        // (Calling _impl versions here as we've already been through any
+        // unwrapping for heap poisoning features.)
+        result = multi_heap_malloc_impl(heap, size);
+        if (result != NULL) {
+            memcpy(result, pb->data, block_data_size(pb));
+            multi_heap_free_impl(heap, pb->data);
+        }
+    }
+
+    if (heap->free_bytes < heap->minimum_free_bytes) {
+        heap->minimum_free_bytes = heap->free_bytes;
+    }
+
+    multi_heap_internal_unlock(heap);
+    return result;
+}
+
+#define FAIL_PRINT(MSG, ...) do {                                       \
+        if (print_errors) {                                             \
+            MULTI_HEAP_STDERR_PRINTF(MSG, __VA_ARGS__);                 \
+        }                                                               \
+        valid = false;                                                  \
+    }                                                                   \
+    while(0)
+
+bool multi_heap_check(multi_heap_handle_t heap, bool print_errors)
+{
+    bool valid = true;
+    size_t total_free_bytes = 0;
+    size_t free_blocks = 0;
+    size_t listed_blocks = 0;
+    multi_heap_free_stats_t free_stats = { 0 };
+    assert(heap != NULL);
+
+    multi_heap_internal_lock(heap);
+
+    heap_block_t *prev = NULL;
+
+    for(heap_block_t *b = heap->first_block; b != heap->last_block; b = get_next_block(b)) {
+        if (b < heap->first_block || b > heap->last_block) {
+            FAIL_PRINT("CORRUPT HEAP: Block %p is outside heap (last valid block %p)\n", b, prev);
+            goto done;
+        }
+        if (b->prev_phys != prev) {
+            FAIL_PRINT("CORRUPT HEAP: Block %p points to prev block %p but prev block is %p\n", b, b->prev_phys, prev);
+            goto done;
+        }
+        if (get_next_block(b) <= b || get_next_block(b) > heap->last_block) {
+            FAIL_PRINT("CORRUPT HEAP: Block %p data size 0x%08x runs outside heap\n", b, (unsigned)block_data_size(b));
+            goto done;
+        }
+        if (is_free(b)) {
+            if (prev != NULL && is_free(prev)) {
+                FAIL_PRINT("CORRUPT HEAP: Two adjacent free blocks found, %p and %p\n", prev, b);
+            }
+            total_free_bytes += block_data_size(b);
+            free_blocks++;
+            multi_heap_free_stats_add(&free_stats, block_data_size(b));
+        }
+        prev = b;
+
+#ifdef MULTI_HEAP_POISONING
+        /* For slow heap poisoning, any block should contain correct poisoning patterns and/or fills */
+        bool poison_ok;
+        if (is_free(b)) {
+            uint32_t block_len = block_data_size(b) - BLOCK_MIN_DATA_SIZE;
+            poison_ok = multi_heap_internal_check_block_poisoning(&b[1], block_len, true, print_errors);
+        }
+        else {
+            poison_ok = multi_heap_internal_check_block_poisoning(b->data, block_data_size(b), false, print_errors);
+        }
+        valid = poison_ok && valid;
+#endif
+
+    } /* for(heap_block_t b = ... */
+
+    if (heap->last_block->prev_phys != prev) {
+        FAIL_PRINT("CORRUPT HEAP: Last block %p points to prev block %p but prev block is %p\n",
+                   heap->last_block, heap->last_block->prev_phys, prev);
+    }
+    if (heap->last_block->header != 0) {
+        FAIL_PRINT("CORRUPT HEAP: Expected last block %p to be used and empty\n", heap->last_block);
+    }
+
+    if (heap->free_bytes != total_free_bytes) {
+        FAIL_PRINT("CORRUPT HEAP: Expected %u free bytes counted %u\n", (unsigned)heap->free_bytes, (unsigned)total_free_bytes);
+    }
+
+    /* every free block should be on the free list for its size, and the bitmaps should match the lists */
+    for (int fl = 0; fl < heap->fl_count; fl++) {
+        if (((heap->fl_bitmap >> fl) & 1) != (heap->sl_bitmap[fl] != 0)) {
+            FAIL_PRINT("CORRUPT HEAP: First level bitmap 0x%08x doesn't match second level bitmap %d 0x%08x\n",
+                       heap->fl_bitmap, fl, heap->sl_bitmap[fl]);
+        }
+        for (int sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            heap_block_t *list = *get_free_list(heap, fl, sl);
+            if (((heap->sl_bitmap[fl] >> sl) & 1) != (list != NULL)) {
+                FAIL_PRINT("CORRUPT HEAP: Second level bitmap %d 0x%08x doesn't match free list %d\n",
+                           fl, heap->sl_bitmap[fl], sl);
+            }
+            heap_block_t *prev_free = NULL;
+            for (heap_block_t *b = list; b != NULL; b = b->next_free) {
+                if (b < heap->first_block || b >= heap->last_block || !is_free(b)) {
+                    FAIL_PRINT("CORRUPT HEAP: Block %p on free list %d,%d is not a free block\n", b, fl, sl);
+                    goto done;
+                }
+                if (b->prev_free != prev_free) {
+                    FAIL_PRINT("CORRUPT HEAP: Free block %p points to prev free %p but prev free is %p\n", b, b->prev_free, prev_free);
+                }
+                int b_fl, b_sl;
+                mapping_insert(block_data_size(b), &b_fl, &b_sl);
+                if (b_fl != fl || b_sl != sl) {
+                    FAIL_PRINT("CORRUPT HEAP: Free block %p data size 0x%08x is on wrong free list %d,%d\n",
+                               b, (unsigned)block_data_size(b), fl, sl);
+                }
+                if (++listed_blocks > free_blocks) {
+                    FAIL_PRINT("CORRUPT HEAP: Free lists hold more than the %u free blocks in the heap\n", (unsigned)free_blocks);
+                    goto done;
+                }
+                prev_free = b;
+            }
+        }
+    }
+
+    if (listed_blocks != free_blocks) {
+        FAIL_PRINT("CORRUPT HEAP: Free lists hold %u blocks but heap has %u free blocks\n", (unsigned)listed_blocks, (unsigned)free_blocks);
+    }
+
+    if (heap->free_stats.free_blocks != free_stats.free_blocks
+        || heap->free_stats.largest_free_block < free_stats.largest_free_block
+        || (!heap->free_stats.largest_stale && heap->free_stats.largest_free_block != free_stats.largest_free_block)
+        || memcmp(heap->free_stats.histogram, free_stats.histogram, sizeof(free_stats.histogram)) != 0) {
+        FAIL_PRINT("CORRUPT HEAP: Expected %u free blocks (largest %u) counted %u (largest %u)\n",
+                   (unsigned)heap->free_stats.free_blocks, (unsigned)heap->free_stats.largest_free_block,
+                   (unsigned)free_stats.free_blocks, (unsigned)free_stats.largest_free_block);
+    }
+
+ done:
+    multi_heap_internal_unlock(heap);
+
+    return valid;
+}
+
+void multi_heap_dump(multi_heap_handle_t heap)
+{
+    assert(heap != NULL);
+
+    multi_heap_internal_lock(heap);
+    MULTI_HEAP_STDERR_PRINTF("Heap start %p end %p\nFree list bitmap 0x%08x\n", heap->first_block, heap->last_block, heap->fl_bitmap);
+    for(heap_block_t *b = heap->first_block; b != heap->last_block; b = get_next_block(b)) {
+        MULTI_HEAP_STDERR_PRINTF("Block %p data size 0x%08x bytes prev block %p", b, (unsigned)block_data_size(b), b->prev_phys);
+        if (is_free(b)) {
+            MULTI_HEAP_STDERR_PRINTF(" FREE. Next free %p\n", b->next_free);
+        } else {
+            MULTI_HEAP_STDERR_PRINTF("%s", "\n"); /* C macros & optional __VA_ARGS__ */
+        }
+    }
+    multi_heap_internal_unlock(heap);
+}
+
+size_t multi_heap_free_size_impl(multi_heap_handle_t heap)
+{
+    if (heap == NULL) {
+        return 0;
+    }
+    return heap->free_bytes;
+}
+
+size_t multi_heap_minimum_free_size_impl(multi_heap_handle_t heap)
+{
+    if (heap == NULL) {
+        return 0;
+    }
+    return heap->minimum_free_bytes;
+}
+
+void multi_heap_get_info_impl(multi_heap_handle_t heap, multi_heap_info_t *info)
+{
+    memset(info, 0, sizeof(multi_heap_info_t));
+
+    if (heap == NULL) {
+        return;
+    }
+
+    multi_heap_internal_lock(heap);
+    for(heap_block_t *b = heap->first_block; !is_last_block(heap, b); b = get_next_block(b)) {
+        info->total_blocks++;
+        if (is_free(b)) {
+            size_t s = block_data_size(b);
+            info->total_free_bytes += s;
+            if (s > info->largest_free_block) {
+                info->largest_free_block = s;
+            }
+            info->free_blocks++;
+        } else {
+            info->total_allocated_bytes += block_data_size(b);
+            info->allocated_blocks++;
+        }
+    }
+
+    info->minimum_free_bytes = heap->minimum_free_bytes;
+    // heap has wrong total size (address printed here is not indicative of the real error)
+    MULTI_HEAP_ASSERT(info->total_free_bytes == heap->free_bytes, heap);
+
+    multi_heap_internal_unlock(heap);
+}
+
+void multi_heap_get_fragmentation_stats_impl(multi_heap_handle_t heap, multi_heap_fragmentation_stats_t *stats)
+{
+    memset(stats, 0, sizeof(multi_heap_fragmentation_stats_t));
+
+    if (heap == NULL) {
+        return;
+    }
+
+    multi_heap_internal_lock(heap);
+    update_largest_free_block(heap);
+    stats->total_free_bytes = heap->free_bytes;
+    stats->largest_free_block = heap->free_stats.largest_free_block;
+    stats->free_blocks = heap->free_stats.free_blocks;
+    for (int i = 0; i < MULTI_HEAP_FRAGMENTATION_BUCKETS; i++) {
+        stats->free_block_histogram[i] = heap->free_stats.histogram[i];
+    }
+    multi_heap_internal_unlock(heap);
+}
+
+#endif // MULTI_HEAP_TLSF
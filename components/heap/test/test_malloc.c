@@ -134,3 +134,55 @@ TEST_CASE("malloc(0) should return a NULL pointer", "[heap]")
     TEST_ASSERT(p == NULL);
 }
 
+
+#ifdef CONFIG_HEAP_SMALL_OBJECT_CACHE
+TEST_CASE("small allocations are reused from the per-core cache", "[heap]")
+{
+    void *p = malloc(24);
+    TEST_ASSERT_NOT_NULL(p);
+    free(p);
+    /* same size class on the same core, so the block comes back from the cache */
+    void *q = malloc(30);
+    TEST_ASSERT_EQUAL_PTR(p, q);
+
+    /* a cached block counts as free memory */
+    size_t free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    multi_heap_info_t info_before;
+    heap_caps_get_info(&info_before, MALLOC_CAP_8BIT);
+    free(q);
+    multi_heap_info_t info_after;
+    heap_caps_get_info(&info_after, MALLOC_CAP_8BIT);
+    size_t size = heap_caps_get_allocated_size(q);
+    TEST_ASSERT_EQUAL(free_before + size, heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    TEST_ASSERT_EQUAL(info_before.total_free_bytes + size, info_after.total_free_bytes);
+    TEST_ASSERT_EQUAL(info_before.total_allocated_bytes - size, info_after.total_allocated_bytes);
+    TEST_ASSERT_EQUAL(info_before.allocated_blocks - 1, info_after.allocated_blocks);
+    TEST_ASSERT(heap_caps_check_integrity_all(true));
+}
+
+TEST_CASE("small object cache is flushed before an allocation fails", "[heap]")
+{
+    const int max_blocks = 8192;
+    void **blocks = malloc(max_blocks * sizeof(void *));
+    TEST_ASSERT_NOT_NULL(blocks);
+
+    /* use up all internal memory with 64 byte blocks */
+    int count = 0;
+    while (count < max_blocks && (blocks[count] = heap_caps_malloc(64, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)) != NULL) {
+        count++;
+    }
+    TEST_ASSERT(count < max_blocks);
+    TEST_ASSERT(count > 0);
+
+    /* the freed block only goes into the 64 byte cache, so a 48 byte block can only come from flushing it */
+    free(blocks[--count]);
+    void *p = heap_caps_malloc(48, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(p);
+    free(p);
+
+    for (int i = 0; i < count; i++) {
+        free(blocks[i]);
+    }
+    free(blocks);
+}
+#endif
@@ -159,6 +159,32 @@ TEST_CASE("heap_caps metadata test", "[heap]")
     TEST_ASSERT(after.minimum_free_bytes < original.total_free_bytes);
 }
 
+TEST_CASE("heap_caps fragmentation stats match heap info", "[heap]")
+{
+    multi_heap_info_t info;
+    multi_heap_fragmentation_stats_t stats;
+
+    heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+    heap_caps_get_fragmentation_stats(&stats, MALLOC_CAP_8BIT);
+
+    /* Allow some leeway for background allocations, as in the metadata test above */
+    TEST_ASSERT_INT32_WITHIN(200, info.total_free_bytes, stats.total_free_bytes);
+    TEST_ASSERT_INT32_WITHIN(200, info.largest_free_block, stats.largest_free_block);
+
+    size_t blocks = 0;
+    for (int i = 0; i < MULTI_HEAP_FRAGMENTATION_BUCKETS; i++) {
+        blocks += stats.free_block_histogram[i];
+    }
+    TEST_ASSERT_EQUAL(stats.free_blocks, blocks);
+
+    void *b = heap_caps_malloc(stats.largest_free_block, MALLOC_CAP_8BIT);
+    TEST_ASSERT_NOT_NULL(b);
+    multi_heap_fragmentation_stats_t after;
+    heap_caps_get_fragmentation_stats(&after, MALLOC_CAP_8BIT);
+    TEST_ASSERT(after.largest_free_block < stats.largest_free_block);
+    free(b);
+}
+
 /* Small function runs from IRAM to check that malloc/free/realloc
    all work OK when cache is disabled...
 */
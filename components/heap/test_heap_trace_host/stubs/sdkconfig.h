@@ -0,0 +1,6 @@
+#pragma once
+
+#define CONFIG_HEAP_TRACING 1
+#define CONFIG_HEAP_TRACING_STANDALONE 1
+#define CONFIG_HEAP_TRACING_STACK_DEPTH 2
+#define CONFIG_FREERTOS_UNICORE 1
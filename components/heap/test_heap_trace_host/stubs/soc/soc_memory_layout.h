@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdbool.h>
+
+static inline bool esp_ptr_executable(const void *p)
+{
+    return p != 0;
+}
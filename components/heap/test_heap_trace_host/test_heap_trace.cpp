@@ -0,0 +1,344 @@
+#include "catch.hpp"
+#include "esp_heap_trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+/* The standalone tracer normally wraps the heap_caps functions at link time. Here the tests call the __wrap_
+   functions directly, and the __real_ functions hand out fixed size slots from a static arena so the cost of a
+   real allocator doesn't hide the cost of tracing. Freed slots are reused newest first, like a heap would. */
+
+static const size_t SLOT_SIZE = 32;
+static const size_t NUM_SLOTS = 32768;
+static uint8_t arena[NUM_SLOTS][SLOT_SIZE];
+static std::vector<size_t> free_slots;
+static size_t next_slot;
+
+static void reset_arena()
+{
+    free_slots.clear();
+    next_slot = 0;
+}
+
+extern "C" {
+
+void *__real_heap_caps_malloc(size_t size, uint32_t caps)
+{
+    if (size > SLOT_SIZE) {
+        return NULL;
+    }
+    if (!free_slots.empty()) {
+        size_t slot = free_slots.back();
+        free_slots.pop_back();
+        return arena[slot];
+    }
+    if (next_slot == NUM_SLOTS) {
+        return NULL;
+    }
+    return arena[next_slot++];
+}
+
+void *__real_heap_caps_malloc_default(size_t size)
+{
+    return __real_heap_caps_malloc(size, 0);
+}
+
+void __real_heap_caps_free(void *p)
+{
+    if (p != NULL) {
+        free_slots.push_back(((uint8_t (*)[SLOT_SIZE])p) - arena);
+    }
+}
+
+void *__real_heap_caps_realloc(void *p, size_t size, uint32_t caps)
+{
+    if (size > SLOT_SIZE) {
+        return NULL;
+    }
+    return p;
+}
+
+void *__real_heap_caps_realloc_default(void *p, size_t size)
+{
+    return __real_heap_caps_realloc(p, size, 0);
+}
+
+/* Used untraced by heap_trace_init_standalone() for the hash map, which is too big for the arena */
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
+
+void heap_caps_free(void *p)
+{
+    free(p);
+}
+
+void *__wrap_malloc(size_t size);
+void __wrap_free(void *p);
+void *__wrap_realloc(void *p, size_t size);
+
+}
+
+static std::vector<heap_trace_record_t> trace_records(void)
+{
+    std::vector<heap_trace_record_t> result(heap_trace_get_count());
+    for (size_t i = 0; i < result.size(); i++) {
+        REQUIRE(heap_trace_get(i, &result[i]) == ESP_OK);
+    }
+    return result;
+}
+
+TEST_CASE("leak trace removes freed allocations", "[heap_trace]")
+{
+    heap_trace_record_t recs[8];
+    reset_arena();
+    REQUIRE(heap_trace_init_standalone(recs, 8) == ESP_OK);
+    REQUIRE(heap_trace_start(HEAP_TRACE_LEAKS) == ESP_OK);
+
+    void *a = __wrap_malloc(10);
+    void *b = __wrap_malloc(20);
+    void *c = __wrap_malloc(30);
+    REQUIRE(heap_trace_get_count() == 3);
+
+    __wrap_free(b);
+    std::vector<heap_trace_record_t> traced = trace_records();
+    REQUIRE(traced.size() == 2);
+    REQUIRE(traced[0].address == a);
+    REQUIRE(traced[0].size == 10);
+    REQUIRE(traced[1].address == c);
+    REQUIRE(traced[1].size == 30);
+
+    /* records in use stay at the start of the buffer */
+    REQUIRE(recs[0].address == a);
+    REQUIRE(recs[1].address == c);
+    REQUIRE(recs[2].address == NULL);
+
+    /* freeing something which wasn't traced changes nothing */
+    void *untraced = __real_heap_caps_malloc(4, 0);
+    __wrap_free(untraced);
+    REQUIRE(heap_trace_get_count() == 2);
+
+    __wrap_free(a);
+    __wrap_free(c);
+    REQUIRE(heap_trace_get_count() == 0);
+    REQUIRE(heap_trace_get(0, &traced[0]) == ESP_ERR_INVALID_ARG);
+
+    REQUIRE(heap_trace_stop() == ESP_OK);
+}
+
+TEST_CASE("full trace buffer drops the oldest records", "[heap_trace]")
+{
+    const size_t N = 8;
+    heap_trace_record_t recs[N];
+    void *ptrs[N + 4];
+    reset_arena();
+    REQUIRE(heap_trace_init_standalone(recs, N) == ESP_OK);
+    REQUIRE(heap_trace_start(HEAP_TRACE_LEAKS) == ESP_OK);
+
+    for (size_t i = 0; i < N + 4; i++) {
+        ptrs[i] = __wrap_malloc(i + 1);
+    }
+    std::vector<heap_trace_record_t> traced = trace_records();
+    REQUIRE(traced.size() == N);
+    for (size_t i = 0; i < N; i++) {
+        REQUIRE(traced[i].address == ptrs[i + 4]);
+    }
+
+    /* records dropped from the buffer can't be found any more, the others can */
+    __wrap_free(ptrs[0]);
+    REQUIRE(heap_trace_get_count() == N);
+    __wrap_free(ptrs[6]);
+    traced = trace_records();
+    REQUIRE(traced.size() == N - 1);
+    REQUIRE(traced[1].address == ptrs[5]);
+    REQUIRE(traced[2].address == ptrs[7]);
+
+    REQUIRE(heap_trace_stop() == ESP_OK);
+}
+
+TEST_CASE("trace all records which allocation was freed", "[heap_trace]")
+{
+    heap_trace_record_t recs[8];
+    reset_arena();
+    REQUIRE(heap_trace_init_standalone(recs, 8) == ESP_OK);
+    REQUIRE(heap_trace_start(HEAP_TRACE_ALL) == ESP_OK);
+
+    void *a = __wrap_malloc(10);
+    __wrap_free(a);
+    void *b = __wrap_malloc(20); // reuses the address of 'a'
+    REQUIRE(a == b);
+
+    std::vector<heap_trace_record_t> traced = trace_records();
+    REQUIRE(traced.size() == 2);
+    REQUIRE(traced[0].freed_by[0] != NULL);
+    REQUIRE(traced[1].freed_by[0] == NULL);
+
+    __wrap_free(b);
+    traced = trace_records();
+    REQUIRE(traced[1].freed_by[0] != NULL);
+
+    /* realloc is traced as free then malloc */
+    void *c = __wrap_malloc(5);
+    void *d = __wrap_realloc(c, 15);
+    traced = trace_records();
+    REQUIRE(traced.size() == 4);
+    REQUIRE(traced[2].freed_by[0] != NULL);
+    REQUIRE(traced[3].address == d);
+    REQUIRE(traced[3].size == 15);
+
+    heap_trace_dump();
+    REQUIRE(heap_trace_stop() == ESP_OK);
+}
+
+TEST_CASE("leak trace matches a simple model", "[heap_trace]")
+{
+    const size_t N = 64;
+    heap_trace_record_t recs[N];
+    std::deque<std::pair<void *, size_t> > model;
+    std::vector<void *> live;
+    reset_arena();
+    srand(42);
+    REQUIRE(heap_trace_init_standalone(recs, N) == ESP_OK);
+    REQUIRE(heap_trace_start(HEAP_TRACE_LEAKS) == ESP_OK);
+
+    for (int i = 0; i < 20000; i++) {
+        if (live.empty() || (rand() % 3 != 0 && live.size() < 200)) {
+            size_t size = 1 + rand() % SLOT_SIZE;
+            void *p = __wrap_malloc(size);
+            REQUIRE(p != NULL);
+            live.push_back(p);
+            if (model.size() == N) {
+                model.pop_front();
+            }
+            model.push_back(std::make_pair(p, size));
+        } else {
+            size_t index = rand() % live.size();
+            void *p = live[index];
+            live[index] = live.back();
+            live.pop_back();
+            __wrap_free(p);
+            for (auto it = model.begin(); it != model.end(); ++it) {
+                if (it->first == p) {
+                    model.erase(it);
+                    break;
+                }
+            }
+        }
+
+        if (i % 97 == 0) {
+            std::vector<heap_trace_record_t> traced = trace_records();
+            REQUIRE(traced.size() == model.size());
+            for (size_t j = 0; j < traced.size(); j++) {
+                REQUIRE(traced[j].address == model[j].first);
+                REQUIRE(traced[j].size == model[j].second);
+            }
+        }
+    }
+
+    REQUIRE(heap_trace_stop() == ESP_OK);
+}
+
+TEST_CASE("trace all matches a simple model", "[heap_trace]")
+{
+    const size_t N = 16;
+    heap_trace_record_t recs[N];
+    struct traced_alloc {
+        void *address;
+        size_t size;
+        bool freed;
+    };
+    std::deque<traced_alloc> model;
+    std::vector<void *> live;
+    reset_arena();
+    srand(43);
+    REQUIRE(heap_trace_init_standalone(recs, N) == ESP_OK);
+    REQUIRE(heap_trace_start(HEAP_TRACE_ALL) == ESP_OK);
+
+    /* few live allocations, so freed addresses are reused often and the buffer wraps over freed records */
+    for (int i = 0; i < 20000; i++) {
+        if (live.empty() || (rand() % 2 == 0 && live.size() < 8)) {
+            size_t size = 1 + rand() % SLOT_SIZE;
+            void *p = __wrap_malloc(size);
+            REQUIRE(p != NULL);
+            live.push_back(p);
+            if (model.size() == N) {
+                model.pop_front();
+            }
+            model.push_back({ p, size, false });
+        } else {
+            size_t index = rand() % live.size();
+            void *p = live[index];
+            live[index] = live.back();
+            live.pop_back();
+            __wrap_free(p);
+            for (auto it = model.rbegin(); it != model.rend(); ++it) {
+                if (it->address == p) {
+                    REQUIRE(!it->freed);
+                    it->freed = true;
+                    break;
+                }
+            }
+        }
+
+        if (i % 97 == 0) {
+            std::vector<heap_trace_record_t> traced = trace_records();
+            REQUIRE(traced.size() == model.size());
+            for (size_t j = 0; j < traced.size(); j++) {
+                REQUIRE(traced[j].address == model[j].address);
+                REQUIRE(traced[j].size == model[j].size);
+                REQUIRE((traced[j].freed_by[0] != NULL) == model[j].freed);
+            }
+        }
+    }
+
+    REQUIRE(heap_trace_stop() == ESP_OK);
+    REQUIRE(heap_trace_init_standalone(NULL, 0) == ESP_OK);
+    REQUIRE(heap_trace_start(HEAP_TRACE_ALL) == ESP_ERR_INVALID_STATE);
+}
+
+/* Time malloc/free pairs traced in leak mode while 'live' allocations are held in the trace buffer. Each pair frees
+   the oldest allocation, which is the worst case for searching the buffer from the newest record. The cost per pair
+   should stay about the same however many records are in the buffer. */
+static double benchmark_leak_trace(size_t live)
+{
+    const size_t pairs = 100000;
+    std::vector<heap_trace_record_t> recs(live);
+    std::vector<void *> held(live);
+    reset_arena();
+    REQUIRE(heap_trace_init_standalone(recs.data(), recs.size()) == ESP_OK);
+    REQUIRE(heap_trace_start(HEAP_TRACE_LEAKS) == ESP_OK);
+
+    for (size_t i = 0; i < live; i++) {
+        held[i] = __wrap_malloc(16);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < pairs; i++) {
+        __wrap_free(held[i % live]);
+        held[i % live] = __wrap_malloc(16);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    REQUIRE(heap_trace_get_count() == live);
+    for (size_t i = 0; i < live; i++) {
+        __wrap_free(held[i]);
+    }
+    REQUIRE(heap_trace_get_count() == 0);
+    REQUIRE(heap_trace_stop() == ESP_OK);
+
+    return std::chrono::duration<double, std::nano>(end - start).count() / pairs;
+}
+
+TEST_CASE("heap trace record and free benchmark", "[heap_trace][benchmark]")
+{
+    const size_t sizes[] = { 100, 2000, 16000 };
+    for (size_t live : sizes) {
+        printf("[heap_trace] %5u records in buffer: %.0f ns per traced malloc/free pair\n",
+               (unsigned)live, benchmark_leak_trace(live));
+    }
+}
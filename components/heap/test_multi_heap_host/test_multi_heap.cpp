@@ -2,9 +2,11 @@
 #include "multi_heap.h"
 
 #include "../multi_heap_config.h"
+#include "../multi_heap_internal.h"
 
 #include <string.h>
 #include <assert.h>
+#include <chrono>
 
 /* Insurance against accidentally using libc heap functions in tests */
 #undef free
@@ -16,9 +18,24 @@
 #undef realloc
 #define realloc #error
 
+/* The heap header holds the free block statistics, and under TLSF also a free list head per size class and a
+   bitmap per power of two (16 powers of two covers any heap in these tests.) Tiny test heaps are made larger by
+   the same amount, so they have the space for allocations these tests were written for.
+ */
+#ifdef MULTI_HEAP_TLSF
+#define HEAP_CONTROL_SIZE (sizeof(multi_heap_free_stats_t) + 16 * (8 * sizeof(void *) + sizeof(uint32_t)))
+#else
+#define HEAP_CONTROL_SIZE sizeof(multi_heap_free_stats_t)
+#endif
+#define SMALL_HEAP_SIZE(SIZE) ((SIZE) + HEAP_CONTROL_SIZE)
+
+/* Note: The TLSF allocator keeps its free lists at the start of the heap, which takes most of the tiny heaps
+   used by some of these tests. The "TLSF" test cases below cover the same behaviour with larger heaps.
+ */
+#ifndef MULTI_HEAP_TLSF
 TEST_CASE("multi_heap simple allocations", "[multi_heap]")
 {
-    uint8_t small_heap[128];
+    uint8_t small_heap[SMALL_HEAP_SIZE(128)];
 
     multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
 
@@ -59,7 +76,7 @@ TEST_CASE("multi_heap simple allocations", "[multi_heap]")
 
 TEST_CASE("multi_heap fragmentation", "[multi_heap]")
 {
-    uint8_t small_heap[256];
+    uint8_t small_heap[SMALL_HEAP_SIZE(256)];
     multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
 
     const size_t alloc_size = 24;
@@ -109,7 +126,7 @@ TEST_CASE("multi_heap fragmentation", "[multi_heap]")
 TEST_CASE("multi_heap defrag", "[multi_heap]")
 {
     void *p[4];
-    uint8_t small_heap[512];
+    uint8_t small_heap[SMALL_HEAP_SIZE(512)];
     multi_heap_info_t info, info2;
     multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
 
@@ -159,7 +176,7 @@ TEST_CASE("multi_heap defrag", "[multi_heap]")
 TEST_CASE("multi_heap defrag realloc", "[multi_heap]")
 {
     void *p[4];
-    uint8_t small_heap[512];
+    uint8_t small_heap[SMALL_HEAP_SIZE(512)];
     multi_heap_info_t info, info2;
     multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
 
@@ -200,11 +217,12 @@ TEST_CASE("multi_heap defrag realloc", "[multi_heap]")
     REQUIRE( info.total_free_bytes == info2.total_free_bytes );
 }
 #endif
+#endif /* MULTI_HEAP_TLSF */
 
 
 TEST_CASE("multi_heap many random allocations", "[multi_heap]")
 {
-    uint8_t big_heap[1024];
+    uint8_t big_heap[SMALL_HEAP_SIZE(1024)];
     const int NUM_POINTERS = 64;
 
     printf("Running multi-allocation test...\n");
@@ -296,7 +314,7 @@ TEST_CASE("multi_heap many random allocations", "[multi_heap]")
 
 TEST_CASE("multi_heap_get_info() function", "[multi_heap]")
 {
-    uint8_t heapdata[256];
+    uint8_t heapdata[SMALL_HEAP_SIZE(256)];
     multi_heap_handle_t heap = multi_heap_register(heapdata, sizeof(heapdata));
     multi_heap_info_t before, after, freed;
 
@@ -347,6 +365,79 @@ TEST_CASE("multi_heap_get_info() function", "[multi_heap]")
     REQUIRE( after.minimum_free_bytes == freed.minimum_free_bytes );
 }
 
+/* Check the incrementally maintained free block statistics against multi_heap_get_info(), which walks the heap.
+   multi_heap_check() also checks the histogram against the free blocks in the heap. */
+static void check_fragmentation_stats(multi_heap_handle_t heap)
+{
+    multi_heap_info_t info;
+    multi_heap_fragmentation_stats_t stats;
+    multi_heap_get_info(heap, &info);
+    multi_heap_get_fragmentation_stats(heap, &stats);
+
+    REQUIRE( stats.total_free_bytes == info.total_free_bytes );
+    REQUIRE( stats.largest_free_block == info.largest_free_block );
+    REQUIRE( stats.free_blocks == info.free_blocks );
+    size_t histogram_blocks = 0;
+    for (int i = 0; i < MULTI_HEAP_FRAGMENTATION_BUCKETS; i++) {
+        histogram_blocks += stats.free_block_histogram[i];
+    }
+    REQUIRE( histogram_blocks == stats.free_blocks );
+}
+
+TEST_CASE("multi_heap_get_fragmentation_stats() function", "[multi_heap]")
+{
+    const int NUM_POINTERS = 64;
+    static uint8_t heapdata[16384];
+    void *p[NUM_POINTERS] = { 0 };
+    multi_heap_handle_t heap = multi_heap_register(heapdata, sizeof(heapdata));
+    multi_heap_fragmentation_stats_t stats;
+
+    multi_heap_get_fragmentation_stats(heap, &stats);
+    REQUIRE( 1 == stats.free_blocks );
+    REQUIRE( stats.total_free_bytes == stats.largest_free_block );
+    REQUIRE( 1 == stats.free_block_histogram[9] ); // blocks of 8KB to 16KB
+    check_fragmentation_stats(heap);
+
+    uint32_t seed = 1;
+    auto next_random = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) & 0xffffff;
+    };
+
+    for (int i = 0; i < 5000; i++) {
+        int n = next_random() % NUM_POINTERS;
+        size_t size = 1 + next_random() % ((next_random() % 8 == 0) ? 2048 : 128);
+        switch (next_random() % 3) {
+        case 0:
+            multi_heap_free(heap, p[n]);
+            p[n] = NULL;
+            break;
+        case 1:
+            if (p[n] == NULL) {
+                p[n] = multi_heap_malloc(heap, size);
+                break;
+            }
+            /* fall through */
+        default: {
+            void *r = multi_heap_realloc(heap, p[n], size);
+            if (r != NULL) {
+                p[n] = r;
+            }
+            break;
+        }
+        }
+        REQUIRE( multi_heap_check(heap, true) );
+        check_fragmentation_stats(heap);
+    }
+
+    for (int i = 0; i < NUM_POINTERS; i++) {
+        multi_heap_free(heap, p[i]);
+    }
+    REQUIRE( multi_heap_check(heap, true) );
+    multi_heap_get_fragmentation_stats(heap, &stats);
+    REQUIRE( 1 == stats.free_blocks );
+}
+
 TEST_CASE("multi_heap minimum-size allocations", "[multi_heap]")
 {
     uint8_t heapdata[16384];
@@ -388,10 +479,11 @@ TEST_CASE("multi_heap minimum-size allocations", "[multi_heap]")
     REQUIRE( before_free == multi_heap_free_size(heap) );
 }
 
+#ifndef MULTI_HEAP_TLSF
 TEST_CASE("multi_heap_realloc()", "[multi_heap]")
 {
     const uint32_t PATTERN = 0xABABDADA;
-    uint8_t small_heap[300];
+    uint8_t small_heap[SMALL_HEAP_SIZE(300)];
     multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
 
     uint32_t *a = (uint32_t *)multi_heap_malloc(heap, 64);
@@ -442,10 +534,11 @@ TEST_CASE("multi_heap_realloc()", "[multi_heap]")
     REQUIRE( e == g ); /* 'g' extends 'e' in place, into the space formerly held by 'f' */
 #endif
 }
+#endif
 
 TEST_CASE("corrupt heap block", "[multi_heap]")
 {
-    uint8_t small_heap[256];
+    uint8_t small_heap[SMALL_HEAP_SIZE(256)];
     multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
 
     void *a = multi_heap_malloc(heap, 32);
@@ -454,6 +547,7 @@ TEST_CASE("corrupt heap block", "[multi_heap]")
     REQUIRE( !multi_heap_check(heap, true) );
 }
 
+#ifndef MULTI_HEAP_TLSF
 TEST_CASE("unaligned heaps", "[multi_heap]")
 {
     const size_t CHUNK_LEN = 256;
@@ -494,6 +588,7 @@ TEST_CASE("unaligned heaps", "[multi_heap]")
         }
     }
 }
+#endif
 
 TEST_CASE("multi_heap aligned allocations", "[multi_heap]")
 {
@@ -544,4 +639,235 @@ TEST_CASE("multi_heap aligned allocations", "[multi_heap]")
 
     printf("[ALIGNED_ALLOC] heap_size after: %d \n", multi_heap_free_size(heap));
     REQUIRE((old_size - multi_heap_free_size(heap)) <= leakage);
-}
\ No newline at end of file
+}
+#ifdef MULTI_HEAP_TLSF
+TEST_CASE("multi_heap TLSF good fit", "[multi_heap][tlsf]")
+{
+    uint8_t heapdata[4096];
+    multi_heap_handle_t heap = multi_heap_register(heapdata, sizeof(heapdata));
+    multi_heap_info_t before, after;
+    REQUIRE( heap != NULL );
+    multi_heap_get_info(heap, &before);
+
+    void *a = multi_heap_malloc(heap, 64);
+    void *b = multi_heap_malloc(heap, 256);
+    void *c = multi_heap_malloc(heap, 64);
+    void *d = multi_heap_malloc(heap, 512);
+    void *e = multi_heap_malloc(heap, 64);
+    REQUIRE( (a && b && c && d && e) );
+    REQUIRE( multi_heap_check(heap, true) );
+
+    multi_heap_free(heap, b);
+    multi_heap_free(heap, d);
+    REQUIRE( multi_heap_check(heap, true) );
+
+    /* each allocation goes in the smallest free block which can hold it, not the first or the last one */
+    void *f = multi_heap_malloc(heap, 200);
+    REQUIRE( f == b );
+    void *g = multi_heap_malloc(heap, 400);
+    REQUIRE( g == d );
+    REQUIRE( multi_heap_check(heap, true) );
+
+    /* freeing blocks in any order merges them back into one free block */
+    multi_heap_free(heap, c);
+    multi_heap_free(heap, a);
+    multi_heap_free(heap, g);
+    multi_heap_free(heap, e);
+    multi_heap_free(heap, f);
+    REQUIRE( multi_heap_check(heap, true) );
+
+    multi_heap_get_info(heap, &after);
+    REQUIRE( 0 == after.allocated_blocks );
+    REQUIRE( 1 == after.free_blocks );
+    REQUIRE( before.total_free_bytes == after.total_free_bytes );
+    REQUIRE( before.largest_free_block == after.largest_free_block );
+
+    /* the whole heap can be allocated in one block */
+    void *all = multi_heap_malloc(heap, after.largest_free_block);
+    REQUIRE( all != NULL );
+    REQUIRE( 0 == multi_heap_free_size(heap) );
+    multi_heap_free(heap, all);
+}
+
+TEST_CASE("multi_heap TLSF realloc", "[multi_heap][tlsf]")
+{
+    const uint32_t PATTERN = 0xABABDADA;
+    uint8_t heapdata[2048];
+    multi_heap_handle_t heap = multi_heap_register(heapdata, sizeof(heapdata));
+
+    uint32_t *a = (uint32_t *)multi_heap_malloc(heap, 64);
+    uint32_t *b = (uint32_t *)multi_heap_malloc(heap, 32);
+    REQUIRE( a != NULL );
+    REQUIRE( b > a ); /* 'b' takes the block after 'a' */
+
+    *a = PATTERN;
+
+    uint32_t *c = (uint32_t *)multi_heap_realloc(heap, a, 72);
+    REQUIRE( multi_heap_check(heap, true) );
+    REQUIRE( c > b ); /* 'a' moves, 'c' takes the block after 'b' */
+    REQUIRE( *c == PATTERN );
+
+#ifndef MULTI_HEAP_POISONING_SLOW
+    uint32_t *d = (uint32_t *)multi_heap_realloc(heap, c, 36);
+    REQUIRE( multi_heap_check(heap, true) );
+    REQUIRE( c == d ); /* 'c' block should be shrunk in-place */
+    REQUIRE( *d == PATTERN );
+
+    /* 'd' is the last allocation, so it can grow in-place into the rest of the heap */
+    uint32_t *e = (uint32_t *)multi_heap_realloc(heap, d, 1024);
+    REQUIRE( multi_heap_check(heap, true) );
+    REQUIRE( e == d );
+    REQUIRE( *e == PATTERN );
+
+    /* 'b' grows into the free block before it (formerly 'a') and moves down */
+    *b = PATTERN;
+    uint32_t *f = (uint32_t *)multi_heap_realloc(heap, b, 80);
+    REQUIRE( multi_heap_check(heap, true) );
+    REQUIRE( f == a );
+    REQUIRE( *f == PATTERN );
+
+    multi_heap_free(heap, e);
+    multi_heap_free(heap, f);
+    REQUIRE( multi_heap_check(heap, true) );
+#endif
+}
+
+TEST_CASE("multi_heap TLSF unaligned heaps", "[multi_heap][tlsf]")
+{
+    const size_t CHUNK_LEN = 1024;
+    const size_t CANARY_LEN = 16;
+    const uint8_t CANARY_BYTE = 0x3E;
+    uint8_t heap_chunk[CHUNK_LEN + CANARY_LEN * 2];
+
+    memset(heap_chunk, CANARY_BYTE, CANARY_LEN);
+    memset(heap_chunk + CANARY_LEN + CHUNK_LEN, CANARY_BYTE, CANARY_LEN);
+
+    for (int i = 0; i < 8; i++) {
+        printf("Testing with offset %d\n", i);
+        multi_heap_handle_t heap = multi_heap_register(heap_chunk + CANARY_LEN + i, CHUNK_LEN - i);
+        multi_heap_info_t info;
+        REQUIRE( heap != NULL );
+        REQUIRE( multi_heap_check(heap, true) );
+
+        multi_heap_get_info(heap, &info);
+        REQUIRE( info.largest_free_block == info.total_free_bytes );
+
+        void *a = multi_heap_malloc(heap, info.largest_free_block);
+        REQUIRE( a != NULL );
+        memset(a, 0xAA, info.largest_free_block);
+        REQUIRE( multi_heap_check(heap, true) );
+
+        multi_heap_free(heap, a);
+        REQUIRE( multi_heap_check(heap, true) );
+
+        for (unsigned j = 0; j < CANARY_LEN; j++) { // check canaries
+            REQUIRE( heap_chunk[j] == CANARY_BYTE );
+            REQUIRE( heap_chunk[CHUNK_LEN + CANARY_LEN + j] == CANARY_BYTE );
+        }
+    }
+}
+#endif
+
+/* Fragmentation & latency benchmark, run with each allocator (see test_all_configs.sh) to compare them.
+
+   Runs the same pseudo-random mix of small, medium & large allocations against a heap, timing every malloc & free,
+   then reports the worst case & average time per call and how fragmented the free space is at the end.
+ */
+TEST_CASE("multi_heap fragmentation and latency benchmark", "[multi_heap][benchmark]")
+{
+#ifdef MULTI_HEAP_TLSF
+    const char *allocator = "TLSF";
+#else
+    const char *allocator = "multi_heap";
+#endif
+    const size_t HEAP_SIZE = 256 * 1024;
+    const int NUM_POINTERS = 512;
+    const int ITERATIONS = 200000;
+    static uint8_t heapdata[HEAP_SIZE];
+    void *p[NUM_POINTERS] = { 0 };
+    memset(heapdata, 0, sizeof(heapdata)); // touch the heap first, so page faults aren't timed as allocator latency
+    multi_heap_handle_t heap = multi_heap_register(heapdata, sizeof(heapdata));
+    const size_t initial_free = multi_heap_free_size(heap);
+
+    uint32_t seed = 1; // fixed seed, so every allocator sees the same sequence
+    auto next_random = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 8) & 0xffffff;
+    };
+
+    typedef std::chrono::steady_clock clock;
+    uint64_t malloc_total_ns = 0, malloc_max_ns = 0, free_total_ns = 0, free_max_ns = 0;
+    unsigned mallocs = 0, frees = 0, failed = 0;
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        int n = next_random() % NUM_POINTERS;
+        if (p[n] != NULL) {
+            auto start = clock::now();
+            multi_heap_free(heap, p[n]);
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+            free_total_ns += ns;
+            free_max_ns = (ns > free_max_ns) ? ns : free_max_ns;
+            frees++;
+            p[n] = NULL;
+            continue;
+        }
+
+        /* mostly small allocations, some medium sized buffers and a few large ones */
+        uint32_t kind = next_random() % 100;
+        size_t size;
+        if (kind < 70) {
+            size = 8 + next_random() % 120;
+        } else if (kind < 95) {
+            size = 128 + next_random() % 1920;
+        } else {
+            size = 2048 + next_random() % (14 * 1024);
+        }
+
+        auto start = clock::now();
+        p[n] = multi_heap_malloc(heap, size);
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+        malloc_total_ns += ns;
+        malloc_max_ns = (ns > malloc_max_ns) ? ns : malloc_max_ns;
+        mallocs++;
+        if (p[n] == NULL) {
+            failed++;
+        } else {
+            memset(p[n], 0xEE, size);
+        }
+    }
+
+    REQUIRE( multi_heap_check(heap, true) );
+
+    multi_heap_info_t info;
+    multi_heap_get_info(heap, &info);
+    printf("[%s] malloc: %u calls, %u failed, avg %u ns, max %u ns\n", allocator, mallocs, failed,
+           (unsigned)(malloc_total_ns / mallocs), (unsigned)malloc_max_ns);
+    printf("[%s] free: %u calls, avg %u ns, max %u ns\n", allocator, frees,
+           (unsigned)(free_total_ns / frees), (unsigned)free_max_ns);
+    printf("[%s] fragmentation: %u free bytes in %u free blocks, largest free block %u (%u%% of free space)\n",
+           allocator, (unsigned)info.total_free_bytes, (unsigned)info.free_blocks, (unsigned)info.largest_free_block,
+           (unsigned)(info.largest_free_block * 100 / info.total_free_bytes));
+
+    /* the incrementally maintained statistics give the same answer without walking the heap */
+    const int QUERIES = 1000;
+    multi_heap_fragmentation_stats_t stats;
+    auto start = clock::now();
+    for (int i = 0; i < QUERIES; i++) {
+        multi_heap_get_info(heap, &info);
+    }
+    uint64_t info_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count() / QUERIES;
+    start = clock::now();
+    for (int i = 0; i < QUERIES; i++) {
+        multi_heap_get_fragmentation_stats(heap, &stats);
+    }
+    uint64_t stats_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count() / QUERIES;
+    REQUIRE( stats.largest_free_block == info.largest_free_block );
+    printf("[%s] multi_heap_get_info %u ns, multi_heap_get_fragmentation_stats %u ns\n", allocator,
+           (unsigned)info_ns, (unsigned)stats_ns);
+
+    for (int i = 0; i < NUM_POINTERS; i++) {
+        multi_heap_free(heap, p[i]);
+    }
+    REQUIRE( multi_heap_check(heap, true) );
+    REQUIRE( initial_free == multi_heap_free_size(heap) );
+}
@@ -0,0 +1,240 @@
+#!/usr/bin/env python
+#
+# Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Formats the log output of an application built with CONFIG_LOG_DEFERRED_BINARY.
+#
+# Each log message is output by the chip as a line "@L:<base64 record>", see log_deferred.c for the record layout.
+# The format string of the message is read from the application ELF file. Other lines are output unchanged.
+#
+# Usage:
+#   esp_log_decode.py build/app.elf serial_output.txt
+#   miniterm.py /dev/ttyUSB0 115200 | esp_log_decode.py build/app.elf
+
+from __future__ import print_function
+import argparse
+import base64
+import binascii
+import re
+import struct
+import sys
+
+try:
+    import elftools.elf.elffile as elffile
+    import elftools.elf.constants as elfconst
+except ImportError:
+    sys.stderr.write('pyelftools is missing. Please install all the packages for interpreter {} from the '
+                     '$IDF_PATH/requirements.txt file.\n'.format(sys.executable))
+    sys.exit(1)
+
+BINARY_LINE_PREFIX = '@L:'
+RECORD_FLAG_PADDING = 0x01
+STRING_NULL = 0xFFFFFFFF
+
+# Same conversions as parse_conversion() in log_deferred.c
+CONVERSION_RE = re.compile(r'%([-+ #0]*)(\*|[0-9]*)(?:\.(\*|[0-9]*))?(hh|h|ll|l|j|z|t)?([diouxXcfFeEgGaAps%])')
+
+
+class DecodeError(RuntimeError):
+    pass
+
+
+class ElfStrings(object):
+    """ Reads zero-terminated strings from the loadable sections of an ELF file """
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            elf = elffile.ELFFile(f)
+            self.pointer_size = elf.elfclass // 8
+            self.endian = '<' if elf.little_endian else '>'
+            self.sections = []
+            for sect in elf.iter_sections():
+                if sect['sh_addr'] == 0 or (sect['sh_flags'] & elfconst.SH_FLAGS.SHF_ALLOC) == 0:
+                    continue
+                if sect['sh_type'] == 'SHT_NOBITS':
+                    continue
+                self.sections.append((sect['sh_addr'], bytearray(sect.data())))
+        self.cache = {}
+
+    def get(self, addr):
+        if addr in self.cache:
+            return self.cache[addr]
+        for start, data in self.sections:
+            if start <= addr < start + len(data):
+                end = data.find(b'\0', addr - start)
+                if end < 0:
+                    end = len(data)
+                s = data[addr - start:end].decode('utf-8', 'replace')
+                self.cache[addr] = s
+                return s
+        raise DecodeError('format string address 0x%x is not in the ELF file' % addr)
+
+
+class RecordReader(object):
+    def __init__(self, data, endian):
+        self.data = data
+        self.pos = 0
+        self.endian = endian
+
+    def read(self, fmt):
+        fmt = self.endian + fmt
+        size = struct.calcsize(fmt)
+        if self.pos + size > len(self.data):
+            raise DecodeError('record is too short')
+        value = struct.unpack_from(fmt, self.data, self.pos)[0]
+        self.pos += size
+        return value
+
+    def read_string(self):
+        length = self.read('I')
+        if length == STRING_NULL:
+            return None
+        if self.pos + length > len(self.data):
+            raise DecodeError('record is too short')
+        s = self.data[self.pos:self.pos + length].decode('utf-8', 'replace')
+        self.pos += (length + 1 + 3) & ~3
+        return s
+
+
+def arg_size(length_modifier, pointer_size):
+    if length_modifier in ('ll', 'j'):
+        return 8
+    if length_modifier in ('l', 'z', 't'):
+        return pointer_size
+    return 4
+
+
+def to_unsigned(value, bits):
+    return value & ((1 << bits) - 1)
+
+
+def to_signed(value, bits):
+    value = to_unsigned(value, bits)
+    return value - (1 << bits) if value & (1 << (bits - 1)) else value
+
+
+def format_conversion(m, reader, pointer_size):
+    flags, width, precision, length_modifier, conv = m.groups()
+    if conv == '%':
+        return '%'
+
+    if width == '*':
+        width = reader.read('i')
+        if width < 0:
+            flags += '-'
+            width = -width
+        width = str(width)
+    if precision == '*':
+        precision = reader.read('i')
+        precision = None if precision < 0 else str(precision)
+    elif precision == '':
+        precision = '0'
+
+    size = 4
+    if conv in 'diouxXc':
+        size = arg_size(length_modifier, pointer_size)
+    bits = {'hh': 8, 'h': 16}.get(length_modifier, size * 8)
+
+    def spec(c, flags=flags, precision=precision):
+        return '%' + flags + width + ('.' + precision if precision is not None else '') + c
+
+    if conv in 'di':
+        value = reader.read('q' if size == 8 else 'i')
+        return spec('d') % to_signed(value, bits)
+    if conv == 'u':
+        value = reader.read('q' if size == 8 else 'i')
+        return spec('d') % to_unsigned(value, bits)
+    if conv in 'oxX':
+        value = to_unsigned(reader.read('q' if size == 8 else 'i'), bits)
+        if conv == 'o' and '#' in flags:
+            # C prints a leading 0, not 0o
+            digits = ('%o' % value) if value == 0 else ('0%o' % value)
+            return spec('s', flags.replace('#', '').replace('0', ''), None) % digits
+        return spec(conv) % value
+    if conv == 'c':
+        return spec('s', precision=None) % chr(reader.read('i') & 0xFF)
+    if conv in 'fFeEgG':
+        return spec(conv) % reader.read('d')
+    if conv in 'aA':
+        # float.hex() doesn't drop trailing zeros, C does
+        value = re.sub(r'\.?0*p', 'p', reader.read('d').hex())
+        return spec('s', precision=None) % (value.upper() if conv == 'A' else value)
+    if conv == 'p':
+        value = reader.read('Q' if pointer_size == 8 else 'I')
+        return spec('s', precision=None) % ('0x%x' % value)
+    if conv == 's':
+        value = reader.read_string()
+        return spec('s') % ('(null)' if value is None else value)
+    raise DecodeError('unsupported conversion %s' % m.group(0))
+
+
+def decode_record(record, strings):
+    """ Returns the formatted message stored in 'record', or None for padding records """
+    ptr_fmt = 'Q' if strings.pointer_size == 8 else 'I'
+    header_fmt = strings.endian + 'HBB' + ('4x' if strings.pointer_size == 8 else '') + ptr_fmt
+    header_size = struct.calcsize(header_fmt)
+    if len(record) < header_size:
+        raise DecodeError('record is too short')
+    length, _, flags, format_addr = struct.unpack_from(header_fmt, record)
+    if flags & RECORD_FLAG_PADDING:
+        return None
+    if length != len(record):
+        raise DecodeError('record length is %d, expected %d' % (len(record), length))
+
+    fmt = strings.get(format_addr)
+    reader = RecordReader(record, strings.endian)
+    reader.pos = header_size
+    out = []
+    pos = 0
+    for m in CONVERSION_RE.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        out.append(format_conversion(m, reader, strings.pointer_size))
+        pos = m.end()
+    out.append(fmt[pos:])
+    return ''.join(out)
+
+
+def decode_line(line, strings):
+    idx = line.find(BINARY_LINE_PREFIX)
+    if idx < 0:
+        return line
+    try:
+        record = bytearray(base64.b64decode(line[idx + len(BINARY_LINE_PREFIX):].strip()))
+        message = decode_record(record, strings)
+    except (DecodeError, binascii.Error, TypeError, ValueError) as e:
+        return '%s  [decode failed: %s]\n' % (line.rstrip('\r\n'), e)
+    return line[:idx] + (message or '')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Format the binary log output of an ESP-IDF application')
+    parser.add_argument('elf_file', help='Path to the application ELF file')
+    parser.add_argument('input', help='Log output to decode (default: standard input)', nargs='?',
+                        type=argparse.FileType('r'), default=sys.stdin)
+    args = parser.parse_args()
+
+    try:
+        strings = ElfStrings(args.elf_file)
+    except (IOError, OSError) as e:
+        sys.stderr.write('Failed to open ELF file: %s\n' % e)
+        sys.exit(2)
+
+    for line in iter(args.input.readline, ''):
+        sys.stdout.write(decode_line(line, strings))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
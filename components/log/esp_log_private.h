@@ -1,6 +1,19 @@
 #pragma once
 #include <stdbool.h>
+#include <stdarg.h>
+#include "esp_log.h"
 
 void esp_log_impl_lock(void);
 bool esp_log_impl_lock_timeout(void);
 void esp_log_impl_unlock(void);
+
+/* Output with the function set by esp_log_set_vprintf() */
+int esp_log_impl_vprintf(const char *format, va_list args);
+int esp_log_impl_printf(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+
+/* Store the message to be output by the log task, see log_deferred.c.
+   Returns false if the message has to be output immediately. */
+bool esp_log_deferred_writev(esp_log_level_t level, const char *format, va_list args);
+
+/* Output the messages stored by esp_log_deferred_writev() */
+void esp_log_deferred_flush(void);
@@ -137,6 +137,17 @@ void esp_log_write(esp_log_level_t level, const char* tag, const char* format, .
  */
 void esp_log_writev(esp_log_level_t level, const char* tag, const char* format, va_list args);
 
+/**
+ * @brief Output the log messages which are waiting to be formatted
+ *
+ * With CONFIG_LOG_DEFERRED enabled, log messages are formatted and output by a background task.
+ * Messages which haven't been output when the chip resets are lost. Call this function
+ * before a planned reset (or to see all messages logged so far) to output them from the calling task.
+ *
+ * When CONFIG_LOG_DEFERRED is disabled, messages are output as they are logged and this function does nothing.
+ */
+void esp_log_flush(void);
+
 /** @cond */
 
 #include "esp_log_internal.h"
@@ -15,25 +15,27 @@
 /*
  * Log library implementation notes.
  *
- * Log library stores all tags provided to esp_log_level_set as a linked
- * list. See uncached_tag_entry_t structure.
+ * Log library stores all tags provided to esp_log_level_set in a hash
+ * table, see tag_table_t. Tags are hashed as strings, so the level of a
+ * tag is found without comparing it to every tag which has been set.
  *
- * To avoid looking up log level for given tag each time message is
- * printed, this library caches pointers to tags. Because the suggested
- * way of creating tags uses one 'TAG' constant per file, this caching
- * should be effective. Cache is a binary min-heap of cached_tag_entry_t
- * items, ordering is done on 'generation' member. In this context,
- * generation is an integer which is incremented each time an operation
- * with cache is performed. When cache is full, new item is inserted in
- * place of an oldest item (that is, with smallest 'generation' value).
- * After that, bubble-down operation is performed to fix ordering in the
- * min-heap.
+ * esp_log_writev looks up the tag without taking a lock, so that tasks
+ * logging from both cores don't wait for each other. esp_log_level_set
+ * updates the table with the lock held, in such a way that a concurrent
+ * reader always sees a consistent table:
  *
- * The potential problem with wrap-around of cache generation counter is
- * ignored for now. This will happen if someone happens to output more
- * than 4 billion log entries, at which point wrap-around will not be
- * the biggest problem.
+ * - The level of an existing entry is changed with a single byte store.
+ * - A new entry is filled in before the pointer to it is stored into an
+ *   empty slot. Entries are never removed: esp_log_level_set("*", ...)
+ *   marks them as unset, they are reused if the tag is set again.
+ * - When the table is 3/4 full, a table twice as large is filled in and
+ *   then published by storing the pointer to it. The old version of the
+ *   table is kept (not freed), as a reader on the other core may still be
+ *   looking through it. Versions double in size, so all the old versions
+ *   together take less memory than the current one.
  *
+ * A reader which races with esp_log_level_set may get the level the tag
+ * had before the call.
  */
 
 #include <stdbool.h>
@@ -41,51 +43,37 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <assert.h>
 #include "esp_log.h"
 #include "esp_log_private.h"
 
-#ifndef NDEBUG
-// Enable built-in checks in queue.h in debug builds
-#define INVARIANTS
-// Enable consistency checks and cache statistics in this file.
-#define LOG_BUILTIN_CHECKS
-#endif
-
-#include "sys/queue.h"
-
-// Number of tags to be cached. Must be 2**n - 1, n >= 2.
-#define TAG_CACHE_SIZE 31
+// Number of slots in the first version of the tag table. Must be 2**n.
+#define TAG_TABLE_MIN_SIZE 16
+// Level of an entry after esp_log_level_set("*", ...), the default level applies
+#define LEVEL_UNSET 0xff
 
 typedef struct {
-    const char *tag;
-    uint32_t level : 3;
-    uint32_t generation : 29;
-} cached_tag_entry_t;
-
-typedef struct uncached_tag_entry_ {
-    SLIST_ENTRY(uncached_tag_entry_) entries;
-    uint8_t level;  // esp_log_level_t as uint8_t
+    uint32_t hash;
+    uint8_t level;  // esp_log_level_t as uint8_t, or LEVEL_UNSET
     char tag[0];    // beginning of a zero-terminated string
-} uncached_tag_entry_t;
+} tag_entry_t;
+
+typedef struct tag_table_ {
+    struct tag_table_ *prev;    // previous (smaller) version of the table, kept for concurrent readers
+    uint32_t size;              // number of slots, 2**n
+    uint32_t count;             // number of entries
+    uint32_t set_count;         // number of entries which aren't LEVEL_UNSET
+    tag_entry_t *slots[0];
+} tag_table_t;
 
 static esp_log_level_t s_log_default_level = ESP_LOG_VERBOSE;
-static SLIST_HEAD(log_tags_head, uncached_tag_entry_) s_log_tags = SLIST_HEAD_INITIALIZER(s_log_tags);
-static cached_tag_entry_t s_log_cache[TAG_CACHE_SIZE];
-static uint32_t s_log_cache_max_generation = 0;
-static uint32_t s_log_cache_entry_count = 0;
+static tag_table_t *s_log_tags = NULL;
 static vprintf_like_t s_log_print_func = &vprintf;
 
-#ifdef LOG_BUILTIN_CHECKS
-static uint32_t s_log_cache_misses = 0;
-#endif
-
-
-static inline bool get_cached_log_level(const char *tag, esp_log_level_t *level);
-static inline bool get_uncached_log_level(const char *tag, esp_log_level_t *level);
-static inline void add_to_cache(const char *tag, esp_log_level_t level);
-static void heap_bubble_down(int index);
-static inline void heap_swap(int i, int j);
+static inline uint32_t tag_hash(const char *tag);
+static inline tag_entry_t *tag_table_find(const tag_table_t *table, const char *tag, uint32_t hash);
+static inline void tag_table_insert(tag_table_t *table, tag_entry_t *entry);
+static tag_table_t *tag_table_grow(tag_table_t *table);
+static inline esp_log_level_t get_log_level(const char *tag);
 static inline bool should_output(esp_log_level_t level_for_message, esp_log_level_t level_for_tag);
 static inline void clear_log_level_list(void);
 
@@ -102,64 +90,67 @@ void esp_log_level_set(const char *tag, esp_log_level_t level)
 {
     esp_log_impl_lock();
 
-    // for wildcard tag, remove all linked list items and clear the cache
+    // for wildcard tag, mark all tags as unset
     if (strcmp(tag, "*") == 0) {
-        s_log_default_level = level;
+        __atomic_store_n(&s_log_default_level, level, __ATOMIC_RELAXED);
         clear_log_level_list();
         esp_log_impl_unlock();
         return;
     }
 
     // search for existing tag
-    uncached_tag_entry_t *it = NULL;
-    SLIST_FOREACH(it, &s_log_tags, entries) {
-        if (strcmp(it->tag, tag) == 0) {
-            // one tag in the linked list matched, update the level
-            it->level = level;
-            // quit with it != NULL
-            break;
+    uint32_t hash = tag_hash(tag);
+    tag_table_t *table = s_log_tags;
+    tag_entry_t *entry = (table != NULL) ? tag_table_find(table, tag, hash) : NULL;
+    if (entry != NULL) {
+        // one tag in the table matched, update the level
+        if (entry->level == LEVEL_UNSET) {
+            __atomic_store_n(&table->set_count, table->set_count + 1, __ATOMIC_RELAXED);
         }
+        __atomic_store_n(&entry->level, (uint8_t) level, __ATOMIC_RELAXED);
+        esp_log_impl_unlock();
+        return;
     }
-    // no existing tag, append new one
-    if (it == NULL) {
-        // allocate new linked list entry and append it to the head of the list
-        size_t tag_len = strlen(tag) + 1;
-        size_t entry_size = offsetof(uncached_tag_entry_t, tag) + tag_len;
-        uncached_tag_entry_t *new_entry = (uncached_tag_entry_t *) malloc(entry_size);
-        if (!new_entry) {
-            esp_log_impl_unlock();
-            return;
-        }
-        new_entry->level = (uint8_t) level;
-        strlcpy(new_entry->tag, tag, tag_len);
-        SLIST_INSERT_HEAD(&s_log_tags, new_entry, entries);
+
+    // no existing tag, allocate new entry and add it to the table
+    size_t tag_len = strlen(tag) + 1;
+    entry = (tag_entry_t *) malloc(sizeof(tag_entry_t) + tag_len);
+    if (!entry) {
+        esp_log_impl_unlock();
+        return;
     }
+    entry->hash = hash;
+    entry->level = (uint8_t) level;
+    strlcpy(entry->tag, tag, tag_len);
 
-    // search in the cache and update the entry it if exists
-    for (int i = 0; i < s_log_cache_entry_count; ++i) {
-#ifdef LOG_BUILTIN_CHECKS
-        assert(i == 0 || s_log_cache[(i - 1) / 2].generation < s_log_cache[i].generation);
-#endif
-        if (strcmp(s_log_cache[i].tag, tag) == 0) {
-            s_log_cache[i].level = level;
-            break;
+    if (table == NULL || (table->count + 1) * 4 > table->size * 3) {
+        tag_table_t *new_table = tag_table_grow(table);
+        if (new_table == NULL) {
+            free(entry);
+            esp_log_impl_unlock();
+            return;
         }
+        // readers see either the old version or the complete new one
+        __atomic_store_n(&s_log_tags, new_table, __ATOMIC_RELEASE);
+        table = new_table;
     }
+    tag_table_insert(table, entry);
+    __atomic_store_n(&table->set_count, table->set_count + 1, __ATOMIC_RELAXED);
     esp_log_impl_unlock();
 }
 
 void clear_log_level_list(void)
 {
-    uncached_tag_entry_t *it;
-    while ((it = SLIST_FIRST(&s_log_tags)) != NULL) {
-        SLIST_REMOVE_HEAD(&s_log_tags, entries);
-        free(it);
+    tag_table_t *table = s_log_tags;
+    if (table == NULL) {
+        return;
     }
-    s_log_cache_entry_count = 0;
-    s_log_cache_max_generation = 0;
-#ifdef LOG_BUILTIN_CHECKS
-    s_log_cache_misses = 0;
-#endif
+    for (uint32_t i = 0; i < table->size; ++i) {
+        if (table->slots[i] != NULL) {
+            __atomic_store_n(&table->slots[i]->level, LEVEL_UNSET, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_store_n(&table->set_count, 0, __ATOMIC_RELAXED);
 }
 
 void esp_log_writev(esp_log_level_t level,
@@ -167,25 +158,15 @@ void esp_log_writev(esp_log_level_t level,
                    const char *format,
                    va_list args)
 {
-    if (!esp_log_impl_lock_timeout()) {
+    if (!should_output(level, get_log_level(tag))) {
         return;
     }
-    esp_log_level_t level_for_tag;
-    // Look for the tag in cache first, then in the linked list of all tags
-    if (!get_cached_log_level(tag, &level_for_tag)) {
-        if (!get_uncached_log_level(tag, &level_for_tag)) {
-            level_for_tag = s_log_default_level;
-        }
-        add_to_cache(tag, level_for_tag);
-#ifdef LOG_BUILTIN_CHECKS
-        ++s_log_cache_misses;
-#endif
-    }
-    esp_log_impl_unlock();
-    if (!should_output(level, level_for_tag)) {
+
+#if CONFIG_LOG_DEFERRED && !BOOTLOADER_BUILD
+    if (esp_log_deferred_writev(level, format, args)) {
         return;
     }
-
+#endif
     (*s_log_print_func)(format, args);
 
 }
@@ -200,97 +181,104 @@ void esp_log_write(esp_log_level_t level,
     va_end(list);
 }
 
-static inline bool get_cached_log_level(const char *tag, esp_log_level_t *level)
+void esp_log_flush(void)
 {
-    // Look for `tag` in cache
-    int i;
-    for (i = 0; i < s_log_cache_entry_count; ++i) {
-#ifdef LOG_BUILTIN_CHECKS
-        assert(i == 0 || s_log_cache[(i - 1) / 2].generation < s_log_cache[i].generation);
+#if CONFIG_LOG_DEFERRED && !BOOTLOADER_BUILD
+    esp_log_deferred_flush();
 #endif
-        if (s_log_cache[i].tag == tag) {
-            break;
-        }
-    }
-    if (i == s_log_cache_entry_count) { // Not found in cache
-        return false;
+}
+
+int esp_log_impl_vprintf(const char *format, va_list args)
+{
+    return (*s_log_print_func)(format, args);
+}
+
+int esp_log_impl_printf(const char *format, ...)
+{
+    va_list list;
+    va_start(list, format);
+    int ret = esp_log_impl_vprintf(format, list);
+    va_end(list);
+    return ret;
+}
+
+static inline esp_log_level_t get_log_level(const char *tag)
+{
+    esp_log_level_t default_level = __atomic_load_n(&s_log_default_level, __ATOMIC_RELAXED);
+    const tag_table_t *table = __atomic_load_n(&s_log_tags, __ATOMIC_ACQUIRE);
+    // Skip hashing the tag when no tag has its own level, this is the common case
+    if (table == NULL || __atomic_load_n(&table->set_count, __ATOMIC_RELAXED) == 0) {
+        return default_level;
     }
-    // Return level from cache
-    *level = (esp_log_level_t) s_log_cache[i].level;
-    // If cache has been filled, start taking ordering into account
-    // (other options are: dynamically resize cache, add "dummy" entries
-    //  to the cache; this option was chosen because code is much simpler,
-    //  and the unfair behavior of cache will show it self at most once, when
-    //  it has just been filled)
-    if (s_log_cache_entry_count == TAG_CACHE_SIZE) {
-        // Update item generation
-        s_log_cache[i].generation = s_log_cache_max_generation++;
-        // Restore heap ordering
-        heap_bubble_down(i);
+    const tag_entry_t *entry = tag_table_find(table, tag, tag_hash(tag));
+    if (entry != NULL) {
+        uint8_t level = __atomic_load_n(&entry->level, __ATOMIC_RELAXED);
+        if (level != LEVEL_UNSET) {
+            return (esp_log_level_t) level;
+        }
     }
-    return true;
+    return default_level;
 }
 
-static inline void add_to_cache(const char *tag, esp_log_level_t level)
+static inline uint32_t tag_hash(const char *tag)
 {
-    uint32_t generation = s_log_cache_max_generation++;
-    // First consider the case when cache is not filled yet.
-    // In this case, just add new entry at the end.
-    // This happens to satisfy binary min-heap ordering.
-    if (s_log_cache_entry_count < TAG_CACHE_SIZE) {
-        s_log_cache[s_log_cache_entry_count] = (cached_tag_entry_t) {
-            .generation = generation,
-            .level = level,
-            .tag = tag
-        };
-        ++s_log_cache_entry_count;
-        return;
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char *p = tag; *p != '\0'; ++p) {
+        hash = (hash ^ (uint8_t) *p) * 16777619u;
     }
-
-    // Cache is full, so we replace the oldest entry (which is at index 0
-    // because this is a min-heap) with the new one, and do bubble-down
-    // operation to restore min-heap ordering.
-    s_log_cache[0] = (cached_tag_entry_t) {
-        .tag = tag,
-        .level = level,
-        .generation = generation
-    };
-    heap_bubble_down(0);
+    return hash;
 }
 
-static inline bool get_uncached_log_level(const char *tag, esp_log_level_t *level)
+static inline tag_entry_t *tag_table_find(const tag_table_t *table, const char *tag, uint32_t hash)
 {
-    // Walk the linked list of all tags and see if given tag is present in the list.
-    // This is slow because tags are compared as strings.
-    uncached_tag_entry_t *it;
-    SLIST_FOREACH(it, &s_log_tags, entries) {
-        if (strcmp(tag, it->tag) == 0) {
-            *level = it->level;
-            return true;
+    // Linear probing. The table is never full, so there is always an empty slot to stop at.
+    uint32_t mask = table->size - 1;
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        tag_entry_t *entry = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+        if (entry == NULL) {
+            return NULL;
+        }
+        if (entry->hash == hash && strcmp(entry->tag, tag) == 0) {
+            return entry;
         }
     }
-    return false;
 }
 
-static inline bool should_output(esp_log_level_t level_for_message, esp_log_level_t level_for_tag)
+static inline void tag_table_insert(tag_table_t *table, tag_entry_t *entry)
 {
-    return level_for_message <= level_for_tag;
+    uint32_t mask = table->size - 1;
+    uint32_t i = entry->hash & mask;
+    while (table->slots[i] != NULL) {
+        i = (i + 1) & mask;
+    }
+    // the entry is filled in before a reader can find it
+    __atomic_store_n(&table->slots[i], entry, __ATOMIC_RELEASE);
+    table->count++;
 }
 
-static void heap_bubble_down(int index)
+/* Returns a new version of 'table' (which may be NULL) with twice as many slots, not yet published. */
+static tag_table_t *tag_table_grow(tag_table_t *table)
 {
-    while (index < TAG_CACHE_SIZE / 2) {
-        int left_index = index * 2 + 1;
-        int right_index = left_index + 1;
-        int next = (s_log_cache[left_index].generation < s_log_cache[right_index].generation) ? left_index : right_index;
-        heap_swap(index, next);
-        index = next;
+    uint32_t size = (table != NULL) ? table->size * 2 : TAG_TABLE_MIN_SIZE;
+    tag_table_t *new_table = (tag_table_t *) calloc(1, sizeof(tag_table_t) + size * sizeof(tag_entry_t *));
+    if (new_table == NULL) {
+        return NULL;
+    }
+    new_table->prev = table;
+    new_table->size = size;
+    if (table != NULL) {
+        for (uint32_t i = 0; i < table->size; ++i) {
+            if (table->slots[i] != NULL) {
+                tag_table_insert(new_table, table->slots[i]);
+            }
+        }
+        new_table->set_count = table->set_count;
     }
+    return new_table;
 }
 
-static inline void heap_swap(int i, int j)
+static inline bool should_output(esp_log_level_t level_for_message, esp_log_level_t level_for_tag)
 {
-    cached_tag_entry_t tmp = s_log_cache[i];
-    s_log_cache[i] = s_log_cache[j];
-    s_log_cache[j] = tmp;
+    return level_for_message <= level_for_tag;
 }
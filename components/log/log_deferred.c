@@ -0,0 +1,584 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Deferred log output, see CONFIG_LOG_DEFERRED.
+ *
+ * esp_log_writev() doesn't format the message. The format string pointer and the arguments (which include the
+ * timestamp and the tag, see LOG_FORMAT) are stored as a record in the ring buffer of the CPU core the caller runs
+ * on. A background task takes the records out of the rings and formats them with the log vprintf function, or with
+ * CONFIG_LOG_DEFERRED_BINARY outputs each record as a line of base64 text, which esp_log_decode.py formats on the
+ * host using the format strings from the application ELF file.
+ *
+ * The type of each argument is found by parsing the format string. Strings are copied into the record, as the
+ * caller may reuse the buffer as soon as the log call returns. Messages which can't be recorded (too long, or
+ * with a conversion which isn't supported such as %n) are formatted immediately, as without deferred logging.
+ *
+ * Each ring has a single producer, the CPU core it belongs to, which writes records with interrupts disabled, and
+ * a single consumer, the log task. So the ring indexes can be updated without taking a lock.
+ *
+ * Record layout (all fields in CPU byte order, a record starts at a 4 byte boundary):
+ *
+ * - record_header_t. 'length' is the length of the whole record, a multiple of 4. If RECORD_FLAG_PADDING is set,
+ *   the record only fills the rest of the ring and the next record starts at the beginning of the ring.
+ * - For each conversion in the format string, the '*' width and precision as int, then the value:
+ *   - int or shorter: int
+ *   - long long (or long, size_t etc. if these are 64 bits): 8 bytes
+ *   - floating point: double
+ *   - pointer: void *
+ *   - string: uint32_t length, or UINT32_MAX for NULL, then the string with its terminating zero, padded to a
+ *     multiple of 4 bytes.
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_log_private.h"
+#include "sdkconfig.h"
+
+// Longest record which can be stored. Longer messages are formatted immediately.
+#define MAX_RECORD_SIZE 256
+// Longest conversion specification, including the '%'
+#define MAX_SPEC_LENGTH 16
+// Formatted messages are put together in a buffer of this size, longer messages are output in several parts.
+#define LINE_BUFFER_SIZE 256
+#define LOG_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+#define RING_SIZE ((CONFIG_LOG_DEFERRED_BUFFER_SIZE + 3) & ~3)
+
+#define RECORD_FLAG_PADDING 0x01
+#define STRING_NULL UINT32_MAX
+#define BINARY_LINE_PREFIX "@L:"
+
+typedef struct {
+    uint16_t length;
+    uint8_t level;
+    uint8_t flags;
+    const char *format;
+} record_header_t;
+
+typedef enum {
+    ARG_NONE,
+    ARG_INT,
+    ARG_INT64,
+    ARG_DOUBLE,
+    ARG_POINTER,
+    ARG_STRING,
+} arg_type_t;
+
+typedef struct {
+    size_t length;   // of the conversion specification, including the '%'
+    int stars;       // number of '*' width and precision arguments
+    int precision;   // precision given in the format string, or -1
+    bool precision_star; // the last '*' argument is the precision
+    arg_type_t type;
+} conversion_t;
+
+typedef struct {
+    uint8_t buf[RING_SIZE] __attribute__((aligned(4)));
+    uint32_t head;      // written by the producer
+    uint32_t tail;      // written by the consumer
+    uint32_t dropped;   // written by the producer
+    uint32_t reported_dropped;
+} log_ring_t;
+
+typedef struct {
+    char buf[LINE_BUFFER_SIZE];
+    size_t len;
+} line_writer_t;
+
+static log_ring_t s_rings[portNUM_PROCESSORS];
+static TaskHandle_t volatile s_log_task;
+static bool s_log_task_started;
+static portMUX_TYPE s_log_task_lock = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t s_consumer_mutex;
+static line_writer_t s_line;
+
+static void log_task(void *arg);
+
+/* Parse the conversion specification 'p' points to, which starts with '%'. Returns false if it isn't supported. */
+static bool parse_conversion(const char *p, conversion_t *conv)
+{
+    const char *s = p + 1;
+    size_t size = sizeof(int);
+    bool wide = false;
+
+    conv->stars = 0;
+    conv->precision = -1;
+    conv->precision_star = false;
+    while (*s == '-' || *s == '+' || *s == ' ' || *s == '#' || *s == '0') {
+        s++;
+    }
+    if (*s == '*') {
+        conv->stars++;
+        s++;
+    } else {
+        while (*s >= '0' && *s <= '9') {
+            s++;
+        }
+    }
+    if (*s == '.') {
+        s++;
+        if (*s == '*') {
+            conv->stars++;
+            conv->precision_star = true;
+            s++;
+        } else {
+            conv->precision = 0;
+            for (; *s >= '0' && *s <= '9'; s++) {
+                conv->precision = conv->precision * 10 + (*s - '0');
+            }
+        }
+    }
+
+    switch (*s) {
+    case 'h':
+        s += (s[1] == 'h') ? 2 : 1;
+        break;
+    case 'l':
+        if (s[1] == 'l') {
+            size = sizeof(long long);
+            s += 2;
+        } else {
+            size = sizeof(long);
+            wide = true;
+            s++;
+        }
+        break;
+    case 'j':
+        size = sizeof(long long);
+        s++;
+        break;
+    case 'z':
+        size = sizeof(size_t);
+        s++;
+        break;
+    case 't':
+        size = sizeof(ptrdiff_t);
+        s++;
+        break;
+    default:
+        break;
+    }
+
+    switch (*s) {
+    case '%':
+        conv->type = ARG_NONE;
+        break;
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        conv->type = (size == sizeof(long long)) ? ARG_INT64 : ARG_INT;
+        break;
+    case 'c':
+        conv->type = ARG_INT;
+        if (wide) {
+            return false; // wide character
+        }
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        conv->type = ARG_DOUBLE;
+        break;
+    case 'p':
+        conv->type = ARG_POINTER;
+        break;
+    case 's':
+        conv->type = ARG_STRING;
+        if (wide) {
+            return false; // wide string
+        }
+        break;
+    default:
+        return false; // %n, long double, or not a valid conversion
+    }
+
+    conv->length = s + 1 - p;
+    return conv->length < MAX_SPEC_LENGTH;
+}
+
+/* Store the message in 'record'. Returns the length of the record, or 0 if it can't be stored. */
+static size_t encode_record(uint8_t *record, esp_log_level_t level, const char *format, va_list args)
+{
+    size_t pos = sizeof(record_header_t);
+    const char *p = format;
+    conversion_t conv;
+
+#define RECORD_PUT(VALUE) do {                                  \
+        if (pos + sizeof(VALUE) > MAX_RECORD_SIZE) {            \
+            return 0;                                           \
+        }                                                       \
+        memcpy(record + pos, &(VALUE), sizeof(VALUE));          \
+        pos += sizeof(VALUE);                                   \
+    } while(0)
+
+    while ((p = strchr(p, '%')) != NULL) {
+        if (!parse_conversion(p, &conv)) {
+            return 0;
+        }
+        p += conv.length;
+
+        int precision = conv.precision;
+        for (int i = 0; i < conv.stars; i++) {
+            int star = va_arg(args, int);
+            RECORD_PUT(star);
+            if (conv.precision_star && i == conv.stars - 1) {
+                precision = star;
+            }
+        }
+
+        switch (conv.type) {
+        case ARG_NONE:
+            break;
+        case ARG_INT: {
+            int value = va_arg(args, int);
+            RECORD_PUT(value);
+            break;
+        }
+        case ARG_INT64: {
+            long long value = va_arg(args, long long);
+            RECORD_PUT(value);
+            break;
+        }
+        case ARG_DOUBLE: {
+            double value = va_arg(args, double);
+            RECORD_PUT(value);
+            break;
+        }
+        case ARG_POINTER: {
+            void *value = va_arg(args, void *);
+            RECORD_PUT(value);
+            break;
+        }
+        case ARG_STRING: {
+            const char *str = va_arg(args, const char *);
+            uint32_t len = STRING_NULL;
+            if (str != NULL) {
+                len = (precision >= 0) ? strnlen(str, precision) : strlen(str);
+            }
+            RECORD_PUT(len);
+            if (str != NULL) {
+                size_t padded = (len + 1 + 3) & ~3;
+                if (pos + padded > MAX_RECORD_SIZE) {
+                    return 0;
+                }
+                memcpy(record + pos, str, len);
+                memset(record + pos + len, 0, padded - len);
+                pos += padded;
+            }
+            break;
+        }
+        }
+    }
+#undef RECORD_PUT
+
+    record_header_t header = {
+        .length = pos,
+        .level = level,
+        .flags = 0,
+        .format = format,
+    };
+    memcpy(record, &header, sizeof(header));
+    return pos;
+}
+
+/* Copy a record into the ring. Called with interrupts disabled, on the core the ring belongs to.
+   Returns true if the consumer may have found the ring empty and needs to be woken up. */
+static bool ring_write(log_ring_t *ring, const uint8_t *record, size_t length)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t used = (head >= tail) ? head - tail : head + RING_SIZE - tail;
+    uint32_t to_end = RING_SIZE - head;
+    uint32_t needed = (length <= to_end) ? length : to_end + length;
+
+    // keep at least one word free, so that head == tail only if the ring is empty
+    if (used + needed >= RING_SIZE) {
+        ring->dropped++;
+        return false;
+    }
+
+    uint32_t start = head;
+    if (length > to_end) {
+        record_header_t padding = {
+            .length = to_end,
+            .flags = RECORD_FLAG_PADDING,
+        };
+        memcpy(ring->buf + head, &padding, offsetof(record_header_t, format));
+        head = 0;
+    }
+    memcpy(ring->buf + head, record, length);
+    head += length;
+    if (head == RING_SIZE) {
+        head = 0;
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+
+    /* If the consumer had already taken every record before this one, it may not have seen this one */
+    return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == start;
+}
+
+static bool start_log_task(void)
+{
+    /* Messages logged before the scheduler starts, or while the task is being created, are output immediately */
+    if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING || xPortInIsrContext()) {
+        return false;
+    }
+    portENTER_CRITICAL(&s_log_task_lock);
+    bool started = s_log_task_started;
+    s_log_task_started = true;
+    portEXIT_CRITICAL(&s_log_task_lock);
+    if (started) {
+        return false;
+    }
+
+    TaskHandle_t task = NULL;
+    s_consumer_mutex = xSemaphoreCreateMutex();
+    if (s_consumer_mutex == NULL
+        || xTaskCreate(log_task, "log", CONFIG_LOG_DEFERRED_TASK_STACK_SIZE, NULL, LOG_TASK_PRIORITY, &task) != pdPASS) {
+        return false;
+    }
+    s_log_task = task;
+    return true;
+}
+
+bool esp_log_deferred_writev(esp_log_level_t level, const char *format, va_list args)
+{
+    if (s_log_task == NULL && (s_log_task_started || !start_log_task())) {
+        return false;
+    }
+    if (xPortInIsrContext()) {
+        return false; // the log task can't be notified with xTaskNotifyGive()
+    }
+
+    uint32_t record[MAX_RECORD_SIZE / sizeof(uint32_t)];
+    va_list args_copy;
+    va_copy(args_copy, args); // 'args' is still needed if the message is formatted immediately
+    size_t length = encode_record((uint8_t *)record, level, format, args_copy);
+    va_end(args_copy);
+    if (length == 0) {
+        return false;
+    }
+
+    unsigned state = portENTER_CRITICAL_NESTED();
+    bool wake = ring_write(&s_rings[xPortGetCoreID()], (const uint8_t *)record, length);
+    portEXIT_CRITICAL_NESTED(state);
+
+    if (wake) {
+        xTaskNotifyGive(s_log_task);
+    }
+    return true;
+}
+
+static void line_flush(line_writer_t *w)
+{
+    if (w->len > 0) {
+        esp_log_impl_printf("%s", w->buf);
+        w->len = 0;
+    }
+}
+
+static void line_printf(line_writer_t *w, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(w->buf + w->len, sizeof(w->buf) - w->len, format, args);
+    va_end(args);
+    if (n < 0) {
+        return;
+    }
+    if (w->len + n >= sizeof(w->buf)) {
+        // doesn't fit after the text already in the buffer, output that and start again
+        w->buf[w->len] = '\0';
+        line_flush(w);
+        va_start(args, format);
+        n = vsnprintf(w->buf, sizeof(w->buf), format, args);
+        va_end(args);
+        if (n >= (int)sizeof(w->buf)) {
+            // longer than the whole buffer, output it directly
+            va_start(args, format);
+            esp_log_impl_vprintf(format, args);
+            va_end(args);
+            n = 0;
+        }
+    }
+    w->len += n;
+}
+
+#if !CONFIG_LOG_DEFERRED_BINARY
+/* Format with 'spec' after any '*' width and precision arguments */
+#define LINE_PRINTF_STARS(w, spec, conv, stars, value) do {                     \
+        if ((conv)->stars == 0) {                                               \
+            line_printf(w, spec, value);                                        \
+        } else if ((conv)->stars == 1) {                                        \
+            line_printf(w, spec, (stars)[0], value);                            \
+        } else {                                                                \
+            line_printf(w, spec, (stars)[0], (stars)[1], value);                \
+        }                                                                       \
+    } while(0)
+
+static void format_record(line_writer_t *w, const uint8_t *record)
+{
+    record_header_t header;
+    memcpy(&header, record, sizeof(header));
+    const uint8_t *arg = record + sizeof(header);
+    const char *p = header.format;
+    const char *next;
+    conversion_t conv;
+    char spec[MAX_SPEC_LENGTH];
+    int stars[2];
+
+    while ((next = strchr(p, '%')) != NULL) {
+        if (next > p) {
+            line_printf(w, "%.*s", (int)(next - p), p);
+        }
+        parse_conversion(next, &conv); // already checked when the record was written
+        memcpy(spec, next, conv.length);
+        spec[conv.length] = '\0';
+        p = next + conv.length;
+
+        for (int i = 0; i < conv.stars; i++) {
+            memcpy(&stars[i], arg, sizeof(int));
+            arg += sizeof(int);
+        }
+
+        switch (conv.type) {
+        case ARG_NONE:
+            line_printf(w, "%%");
+            break;
+        case ARG_INT: {
+            int value;
+            memcpy(&value, arg, sizeof(value));
+            arg += sizeof(value);
+            LINE_PRINTF_STARS(w, spec, &conv, stars, value);
+            break;
+        }
+        case ARG_INT64: {
+            long long value;
+            memcpy(&value, arg, sizeof(value));
+            arg += sizeof(value);
+            LINE_PRINTF_STARS(w, spec, &conv, stars, value);
+            break;
+        }
+        case ARG_DOUBLE: {
+            double value;
+            memcpy(&value, arg, sizeof(value));
+            arg += sizeof(value);
+            LINE_PRINTF_STARS(w, spec, &conv, stars, value);
+            break;
+        }
+        case ARG_POINTER: {
+            void *value;
+            memcpy(&value, arg, sizeof(value));
+            arg += sizeof(value);
+            LINE_PRINTF_STARS(w, spec, &conv, stars, value);
+            break;
+        }
+        case ARG_STRING: {
+            uint32_t len;
+            memcpy(&len, arg, sizeof(len));
+            arg += sizeof(len);
+            const char *value = NULL;
+            if (len != STRING_NULL) {
+                value = (const char *)arg;
+                arg += (len + 1 + 3) & ~3;
+            }
+            LINE_PRINTF_STARS(w, spec, &conv, stars, value);
+            break;
+        }
+        }
+    }
+    if (*p != '\0') {
+        line_printf(w, "%s", p);
+    }
+    line_flush(w);
+}
+#else
+static void output_binary_record(line_writer_t *w, const uint8_t *record, size_t length)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    char quad[5] = { 0 };
+
+    line_printf(w, BINARY_LINE_PREFIX);
+    // records are a multiple of 4 bytes long, so only the last group can be short
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t n = record[i] << 16;
+        if (i + 1 < length) {
+            n |= record[i + 1] << 8;
+        }
+        if (i + 2 < length) {
+            n |= record[i + 2];
+        }
+        quad[0] = alphabet[(n >> 18) & 0x3f];
+        quad[1] = alphabet[(n >> 12) & 0x3f];
+        quad[2] = (i + 1 < length) ? alphabet[(n >> 6) & 0x3f] : '=';
+        quad[3] = (i + 2 < length) ? alphabet[n & 0x3f] : '=';
+        line_printf(w, "%s", quad);
+    }
+    line_printf(w, "\n");
+    line_flush(w);
+}
+#endif
+
+/* Output the records in the ring. Called by the consumer, with s_consumer_mutex held. */
+static void ring_drain(log_ring_t *ring)
+{
+    uint32_t tail = ring->tail;
+    while (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != tail) {
+        const uint8_t *record = ring->buf + tail;
+        uint16_t length;
+        memcpy(&length, record + offsetof(record_header_t, length), sizeof(length));
+        if (!(record[offsetof(record_header_t, flags)] & RECORD_FLAG_PADDING)) {
+#if CONFIG_LOG_DEFERRED_BINARY
+            output_binary_record(&s_line, record, length);
+#else
+            format_record(&s_line, record);
+#endif
+        }
+        tail += length;
+        if (tail == RING_SIZE) {
+            tail = 0;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+    }
+
+    uint32_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    if (dropped != ring->reported_dropped) {
+        esp_log_impl_printf(LOG_FORMAT(W, "%u messages dropped, log buffer of CPU %d was full"),
+                            esp_log_timestamp(), "log", (unsigned)(dropped - ring->reported_dropped), (int)(ring - s_rings));
+        ring->reported_dropped = dropped;
+    }
+}
+
+void esp_log_deferred_flush(void)
+{
+    if (s_log_task == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_consumer_mutex, portMAX_DELAY);
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        ring_drain(&s_rings[i]);
+    }
+    xSemaphoreGive(s_consumer_mutex);
+}
+
+static void log_task(void *arg)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        esp_log_deferred_flush();
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+/* strlcpy() is provided by newlib, but not by older versions of glibc. Included before log.c with -include. */
+
+#include <string.h>
+
+#ifndef __GLIBC__
+#include <sys/cdefs.h>
+#elif !__GLIBC_PREREQ(2, 38)
+static inline size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = (len < size - 1) ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#endif
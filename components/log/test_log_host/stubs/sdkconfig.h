@@ -0,0 +1,7 @@
+#pragma once
+
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#define CONFIG_LOG_TIMESTAMP_SOURCE_RTOS 1
+#define CONFIG_LOG_DEFERRED 1
+#define CONFIG_LOG_DEFERRED_BUFFER_SIZE 1024
+#define CONFIG_LOG_DEFERRED_TASK_STACK_SIZE 3072
@@ -0,0 +1,20 @@
+#!/usr/bin/env bash
+#
+# Run the test suite with the text and the binary output of deferred logging
+#
+
+FAIL=0
+
+for FLAGS in "" "-DCONFIG_LOG_DEFERRED_BINARY"; do
+    echo "==== Testing with config: ${FLAGS:-text output} ===="
+    CPPFLAGS="${FLAGS}" make clean test || FAIL=1
+done
+
+make clean
+
+if [ $FAIL == 0 ]; then
+    echo "All configurations passed"
+else
+    echo "Some configurations failed, see log."
+    exit 1
+fi
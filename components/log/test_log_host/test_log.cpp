@@ -0,0 +1,640 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "catch.hpp"
+#include <cctype>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+using namespace std;
+
+/* Replacements for some of the FreeRTOS mock functions, and log port stubs. The log task is created but never runs,
+   tests output the messages with esp_log_flush(). */
+
+extern "C" {
+
+static int s_core_id = 0;
+static BaseType_t s_scheduler_state = taskSCHEDULER_RUNNING;
+static int s_task_notifications = 0;
+static uint32_t s_timestamp = 0;
+static int s_dummy_handle;
+
+BaseType_t xPortGetCoreID(void)
+{
+    return s_core_id;
+}
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+    return s_scheduler_state;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *arg,
+                       UBaseType_t priority, TaskHandle_t *created_task)
+{
+    *created_task = &s_dummy_handle;
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    s_task_notifications++;
+    return pdPASS;
+}
+
+void esp_log_impl_lock(void)
+{
+}
+
+bool esp_log_impl_lock_timeout(void)
+{
+    return true;
+}
+
+void esp_log_impl_unlock(void)
+{
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return s_timestamp;
+}
+
+} // extern "C"
+
+static const char *TAG = "test";
+static string s_output;
+
+static int capture_vprintf(const char *format, va_list args)
+{
+    char buf[512];
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    s_output += buf;
+    return n;
+}
+
+static string format_expected(const char *format, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    return buf;
+}
+
+/* Output whatever an earlier test left in the buffers, and start capturing */
+static void reset_output()
+{
+    s_core_id = 0;
+    s_scheduler_state = taskSCHEDULER_RUNNING;
+    esp_log_set_vprintf(capture_vprintf);
+    esp_log_flush();
+    s_output.clear();
+}
+
+#if !CONFIG_LOG_DEFERRED_BINARY
+
+/* Must be the first test, as the log task is started by the first message logged while the scheduler is running */
+TEST_CASE("messages logged before the scheduler runs are output immediately", "[log]")
+{
+    reset_output();
+    s_scheduler_state = taskSCHEDULER_NOT_STARTED;
+    s_timestamp = 5;
+    ESP_LOGI(TAG, "early %s", "message");
+    CHECK(s_output == "I (5) test: early message\n");
+
+    s_output.clear();
+    s_scheduler_state = taskSCHEDULER_RUNNING;
+    ESP_LOGI(TAG, "late %s", "message");
+    CHECK(s_output == "");
+    esp_log_flush();
+    CHECK(s_output == "I (5) test: late message\n");
+}
+
+TEST_CASE("messages are output by esp_log_flush", "[log]")
+{
+    reset_output();
+    s_timestamp = 1234;
+    ESP_LOGI(TAG, "hello %d", 42);
+    ESP_LOGW(TAG, "second");
+    CHECK(s_output == "");
+    esp_log_flush();
+    CHECK(s_output == "I (1234) test: hello 42\nW (1234) test: second\n");
+    s_output.clear();
+    esp_log_flush();
+    CHECK(s_output == "");
+}
+
+TEST_CASE("all supported conversions are formatted as with vprintf", "[log]")
+{
+    reset_output();
+    s_timestamp = 77;
+    const char *null_str = NULL;
+    void *ptr = (void *) 0x3ffb1234;
+    long long big = -1234567890123LL;
+    size_t size = 65536;
+
+    ESP_LOGI(TAG, "%d %5i %-4u| %x %08X %o %c %%", -5, 12, 7u, 0xbeef, 0xcafe, 8, 'z');
+    ESP_LOGI(TAG, "%lld %llu %zu %ld %hhd %hu", big, (unsigned long long) big, size, -100000L, 300, 70000);
+    ESP_LOGI(TAG, "%f %.2f %e %g %10.3f", 1.5, 3.14159, 12345.678, 0.0001, -2.5);
+    ESP_LOGI(TAG, "%p [%s] [%.3s] [%10s] [%-6s] [%s]", ptr, "string", "truncated", "right", "left", null_str);
+    ESP_LOGI(TAG, "[%*d] [%-*d] [%.*s] [%*.*f]", 6, 42, 4, 7, 2, "abcdef", 8, 2, 1.0 / 3);
+    esp_log_flush();
+
+    string expected;
+    expected += format_expected(LOG_FORMAT(I, "%d %5i %-4u| %x %08X %o %c %%"), 77, TAG, -5, 12, 7u, 0xbeef, 0xcafe, 8, 'z');
+    expected += format_expected(LOG_FORMAT(I, "%lld %llu %zu %ld %hhd %hu"), 77, TAG,
+                                big, (unsigned long long) big, size, -100000L, 300, 70000);
+    expected += format_expected(LOG_FORMAT(I, "%f %.2f %e %g %10.3f"), 77, TAG, 1.5, 3.14159, 12345.678, 0.0001, -2.5);
+    expected += format_expected(LOG_FORMAT(I, "%p [%s] [%.3s] [%10s] [%-6s] [%s]"), 77, TAG,
+                                ptr, "string", "truncated", "right", "left", null_str);
+    expected += format_expected(LOG_FORMAT(I, "[%*d] [%-*d] [%.*s] [%*.*f]"), 77, TAG, 6, 42, 4, 7, 2, "abcdef", 8, 2, 1.0 / 3);
+    CHECK(s_output == expected);
+}
+
+TEST_CASE("string arguments are copied when the message is logged", "[log]")
+{
+    reset_output();
+    s_timestamp = 1;
+    char buf[16];
+    strcpy(buf, "before");
+    ESP_LOGI(TAG, "buf=%s", buf);
+    strcpy(buf, "after");
+    esp_log_flush();
+    CHECK(s_output == "I (1) test: buf=before\n");
+}
+
+TEST_CASE("messages which can't be stored are output immediately, in order", "[log]")
+{
+    reset_output();
+    s_timestamp = 2;
+    string long_string(300, 'x');
+
+    ESP_LOGI(TAG, "first");
+    ESP_LOGI(TAG, "long %s", long_string.c_str());
+    CHECK(s_output == "I (2) test: long " + long_string + "\n");
+    s_output.clear();
+    ESP_LOGI(TAG, "long double %.1Lf", (long double) 2.5);
+    CHECK(s_output == "I (2) test: long double 2.5\n");
+    s_output.clear();
+    esp_log_flush();
+    CHECK(s_output == "I (2) test: first\n");
+}
+
+TEST_CASE("each CPU core has its own buffer", "[log]")
+{
+    reset_output();
+    s_timestamp = 3;
+    s_core_id = 1;
+    ESP_LOGI(TAG, "from core %d", 1);
+    s_core_id = 0;
+    ESP_LOGI(TAG, "from core %d", 0);
+    esp_log_flush();
+    CHECK(s_output == "I (3) test: from core 0\nI (3) test: from core 1\n");
+}
+
+TEST_CASE("messages are dropped when the buffer is full, and counted", "[log]")
+{
+    reset_output();
+    s_timestamp = 4;
+    const int COUNT = 200; // each record is 24 bytes, buffer is 1024 bytes
+    for (int i = 0; i < COUNT; i++) {
+        ESP_LOGI(TAG, "message %d", i);
+    }
+    CHECK(s_output == "");
+    esp_log_flush();
+
+    string expected;
+    int stored = 0;
+    for (; stored < COUNT; stored++) {
+        string line = format_expected(LOG_FORMAT(I, "message %d"), 4, TAG, stored);
+        if (s_output.compare(expected.size(), line.size(), line) != 0) {
+            break;
+        }
+        expected += line;
+    }
+    CHECK(stored > 10);
+    CHECK(stored < COUNT);
+    expected += format_expected(LOG_FORMAT(W, "%u messages dropped, log buffer of CPU %d was full"),
+                                4, "log", (unsigned)(COUNT - stored), 0);
+    CHECK(s_output == expected);
+
+    /* after the buffer is emptied, messages are stored again */
+    s_output.clear();
+    ESP_LOGI(TAG, "after");
+    esp_log_flush();
+    CHECK(s_output == "I (4) test: after\n");
+}
+
+TEST_CASE("records wrap around the end of the buffer", "[log]")
+{
+    reset_output();
+    for (int i = 0; i < 500; i++) {
+        s_timestamp = i;
+        string arg(i % 40, 'a' + i % 26);
+        ESP_LOGI(TAG, "record %d %s", i, arg.c_str());
+        if (i % 7 == 6) {
+            ESP_LOGD(TAG, "not output, level is INFO");
+            esp_log_flush();
+        }
+    }
+    esp_log_flush();
+
+    string expected;
+    for (int i = 0; i < 500; i++) {
+        string arg(i % 40, 'a' + i % 26);
+        expected += format_expected(LOG_FORMAT(I, "record %d %s"), i, TAG, i, arg.c_str());
+    }
+    CHECK(s_output == expected);
+}
+
+TEST_CASE("log task is woken up only when its buffer was empty", "[log]")
+{
+    reset_output();
+    int notifications = s_task_notifications;
+    ESP_LOGI(TAG, "first");
+    CHECK(s_task_notifications == notifications + 1);
+    ESP_LOGI(TAG, "second");
+    CHECK(s_task_notifications == notifications + 1);
+    esp_log_flush();
+    ESP_LOGI(TAG, "third");
+    CHECK(s_task_notifications == notifications + 2);
+    esp_log_flush();
+}
+
+TEST_CASE("log level can be set for each tag", "[log]")
+{
+    reset_output();
+    s_timestamp = 6;
+    esp_log_level_set("quiet", ESP_LOG_ERROR);
+    esp_log_level_set("loud", ESP_LOG_VERBOSE);
+    char quiet[] = "quiet"; // tags are compared as strings, not as pointers
+    ESP_LOGI(quiet, "filtered");
+    ESP_LOGE(quiet, "error");
+    ESP_LOGI("loud", "info");
+    ESP_LOGI(TAG, "default");
+    esp_log_flush();
+    CHECK(s_output == "E (6) quiet: error\nI (6) loud: info\nI (6) test: default\n");
+
+    s_output.clear();
+    esp_log_level_set("quiet", ESP_LOG_INFO);
+    ESP_LOGI(quiet, "not filtered");
+    esp_log_flush();
+    CHECK(s_output == "I (6) quiet: not filtered\n");
+
+    /* the wildcard sets the default level and clears the level of every tag */
+    s_output.clear();
+    esp_log_level_set("*", ESP_LOG_WARN);
+    ESP_LOGI(quiet, "filtered");
+    ESP_LOGI("loud", "filtered");
+    ESP_LOGW(TAG, "warning");
+    esp_log_level_set("loud", ESP_LOG_INFO);
+    ESP_LOGI("loud", "set again");
+    esp_log_flush();
+    CHECK(s_output == "W (6) test: warning\nI (6) loud: set again\n");
+    esp_log_level_set("*", ESP_LOG_VERBOSE);
+}
+
+TEST_CASE("log level of many tags", "[log]")
+{
+    reset_output();
+    s_timestamp = 7;
+    const int TAGS = 200; // the tag table grows several times
+    char tag[16];
+    for (int i = 0; i < TAGS; i++) {
+        snprintf(tag, sizeof(tag), "tag%d", i);
+        esp_log_level_set(tag, (i % 2) ? ESP_LOG_ERROR : ESP_LOG_INFO);
+    }
+    string expected;
+    for (int i = 0; i < TAGS; i++) {
+        snprintf(tag, sizeof(tag), "tag%d", i);
+        ESP_LOGI(tag, "%d", i);
+        if (i % 2 == 0) {
+            expected += format_expected(LOG_FORMAT(I, "%d"), 7, tag, i);
+        }
+        if (i % 16 == 15) {
+            esp_log_flush();
+        }
+    }
+    ESP_LOGI("tag200", "not set");
+    esp_log_flush();
+    expected += "I (7) tag200: not set\n";
+    CHECK(s_output == expected);
+    esp_log_level_set("*", ESP_LOG_VERBOSE);
+}
+
+#else // CONFIG_LOG_DEFERRED_BINARY
+
+/* Same layout as record_header_t in log_deferred.c */
+struct record_header_t {
+    uint16_t length;
+    uint8_t level;
+    uint8_t flags;
+    const char *format;
+};
+
+static vector<uint8_t> base64_decode(const string &text)
+{
+    static const string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    vector<uint8_t> out;
+    uint32_t bits = 0;
+    int bit_count = 0;
+    for (char c : text) {
+        if (c == '=') {
+            break;
+        }
+        size_t value = alphabet.find(c);
+        REQUIRE(value != string::npos);
+        bits = (bits << 6) | value;
+        bit_count += 6;
+        if (bit_count >= 8) {
+            bit_count -= 8;
+            out.push_back((bits >> bit_count) & 0xff);
+        }
+    }
+    return out;
+}
+
+class RecordReader
+{
+public:
+    RecordReader(const vector<uint8_t> &data) : mData(data), mPos(0) { }
+
+    template<typename T>
+    T read()
+    {
+        T value;
+        REQUIRE(mPos + sizeof(T) <= mData.size());
+        memcpy(&value, mData.data() + mPos, sizeof(T));
+        mPos += sizeof(T);
+        return value;
+    }
+
+    const char *read_string()
+    {
+        uint32_t len = read<uint32_t>();
+        if (len == UINT32_MAX) {
+            return NULL;
+        }
+        const char *str = (const char *) mData.data() + mPos;
+        REQUIRE(mPos + len < mData.size());
+        CHECK(str[len] == '\0');
+        mPos += (len + 1 + 3) & ~3;
+        return str;
+    }
+
+    bool at_end() const
+    {
+        return mPos == mData.size();
+    }
+
+private:
+    const vector<uint8_t> &mData;
+    size_t mPos;
+};
+
+/* Formats a record the way esp_log_decode.py does, using the layout described in log_deferred.c. The format
+   string is read through the pointer stored in the record, which is valid in this process. */
+static string decode_record(const vector<uint8_t> &record, int *level)
+{
+    RecordReader reader(record);
+    record_header_t header = reader.read<record_header_t>();
+    CHECK(header.length == record.size());
+    CHECK(header.flags == 0);
+    *level = header.level;
+
+    string out;
+    const char *p = header.format;
+    while (*p != '\0') {
+        if (*p != '%') {
+            out += *p++;
+            continue;
+        }
+        string spec = "%";
+        for (p++; strchr("-+ #0", *p) != NULL; p++) {
+            spec += *p;
+        }
+        if (*p == '*') {
+            int width = reader.read<int>();
+            spec += to_string(width);
+            p++;
+        }
+        while (isdigit((unsigned char) *p)) {
+            spec += *p++;
+        }
+        if (*p == '.') {
+            p++;
+            int precision = 0;
+            if (*p == '*') {
+                precision = reader.read<int>();
+                p++;
+            } else {
+                for (; isdigit((unsigned char) *p); p++) {
+                    precision = precision * 10 + (*p - '0');
+                }
+            }
+            if (precision >= 0) {
+                spec += "." + to_string(precision);
+            }
+        }
+        size_t size = sizeof(int);
+        int bits = 0; // arguments shorter than int are stored as int, and converted by printf
+        if (p[0] == 'l' && p[1] == 'l') {
+            size = sizeof(long long);
+            p += 2;
+        } else if (*p == 'l' || *p == 'z' || *p == 't') {
+            size = sizeof(long);
+            p++;
+        } else if (*p == 'j') {
+            size = sizeof(long long);
+            p++;
+        } else if (*p == 'h') {
+            bits = (p[1] == 'h') ? 8 : 16;
+            p += (bits == 8) ? 2 : 1;
+        }
+        char conv = *p++;
+        spec += conv;
+
+        char buf[512];
+        if (conv == '%') {
+            snprintf(buf, sizeof(buf), "%%");
+        } else if (strchr("di", conv) != NULL) {
+            long long value = (size == sizeof(long long)) ? reader.read<long long>() : reader.read<int>();
+            if (bits != 0) {
+                value = (bits == 8) ? (long long)(signed char) value : (long long)(short) value;
+            }
+            snprintf(buf, sizeof(buf), (spec.substr(0, spec.size() - 1) + "lld").c_str(), value);
+        } else if (strchr("ouxX", conv) != NULL) {
+            unsigned long long value = (size == sizeof(long long)) ? reader.read<long long>() : reader.read<unsigned>();
+            if (bits != 0) {
+                value &= (1ULL << bits) - 1;
+            }
+            snprintf(buf, sizeof(buf), (spec.substr(0, spec.size() - 1) + "ll" + conv).c_str(), value);
+        } else if (conv == 'c') {
+            snprintf(buf, sizeof(buf), spec.c_str(), reader.read<int>());
+        } else if (strchr("fFeEgGaA", conv) != NULL) {
+            snprintf(buf, sizeof(buf), spec.c_str(), reader.read<double>());
+        } else if (conv == 'p') {
+            snprintf(buf, sizeof(buf), spec.c_str(), reader.read<void *>());
+        } else if (conv == 's') {
+            snprintf(buf, sizeof(buf), spec.c_str(), reader.read_string());
+        } else {
+            FAIL("unsupported conversion " << spec);
+        }
+        out += buf;
+    }
+    CHECK(reader.at_end());
+    return out;
+}
+
+/* Decodes every line of the output, which must all be binary records. Returns the concatenated messages. */
+static string decode_output(const string &output, vector<int> *levels = NULL)
+{
+    string result;
+    size_t pos = 0;
+    while (pos < output.size()) {
+        size_t end = output.find('\n', pos);
+        REQUIRE(end != string::npos);
+        string line = output.substr(pos, end - pos);
+        pos = end + 1;
+        REQUIRE(line.compare(0, 3, "@L:") == 0);
+        int level;
+        result += decode_record(base64_decode(line.substr(3)), &level);
+        if (levels != NULL) {
+            levels->push_back(level);
+        }
+    }
+    return result;
+}
+
+TEST_CASE("messages are output as binary records which decode to the formatted message", "[log][binary]")
+{
+    reset_output();
+    s_timestamp = 77;
+    const char *null_str = NULL;
+    void *ptr = (void *) 0x3ffb1234;
+    long long big = -1234567890123LL;
+    size_t size = 65536;
+
+    ESP_LOGE(TAG, "%d %5i %-4u| %x %08X %o %c %%", -5, 12, 7u, 0xbeef, 0xcafe, 8, 'z');
+    ESP_LOGW(TAG, "%lld %llu %zu %ld %hhd %hu", big, (unsigned long long) big, size, -100000L, 300, 70000);
+    ESP_LOGI(TAG, "%f %.2f %e %g %10.3f", 1.5, 3.14159, 12345.678, 0.0001, -2.5);
+    ESP_LOGI(TAG, "%p [%s] [%.3s] [%10s] [%-6s] [%s]", ptr, "string", "truncated", "right", "left", null_str);
+    ESP_LOGI(TAG, "[%*d] [%-*d] [%.*s] [%*.*f]", 6, 42, 4, 7, 2, "abcdef", 8, 2, 1.0 / 3);
+    esp_log_flush();
+
+    string expected;
+    expected += format_expected(LOG_FORMAT(E, "%d %5i %-4u| %x %08X %o %c %%"), 77, TAG, -5, 12, 7u, 0xbeef, 0xcafe, 8, 'z');
+    expected += format_expected(LOG_FORMAT(W, "%lld %llu %zu %ld %hhd %hu"), 77, TAG,
+                                big, (unsigned long long) big, size, -100000L, 300, 70000);
+    expected += format_expected(LOG_FORMAT(I, "%f %.2f %e %g %10.3f"), 77, TAG, 1.5, 3.14159, 12345.678, 0.0001, -2.5);
+    expected += format_expected(LOG_FORMAT(I, "%p [%s] [%.3s] [%10s] [%-6s] [%s]"), 77, TAG,
+                                ptr, "string", "truncated", "right", "left", null_str);
+    expected += format_expected(LOG_FORMAT(I, "[%*d] [%-*d] [%.*s] [%*.*f]"), 77, TAG, 6, 42, 4, 7, 2, "abcdef", 8, 2, 1.0 / 3);
+    vector<int> levels;
+    CHECK(decode_output(s_output, &levels) == expected);
+    CHECK(levels == vector<int>({ ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_INFO, ESP_LOG_INFO }));
+}
+
+TEST_CASE("binary records of every length are decoded", "[log][binary]")
+{
+    reset_output();
+    s_timestamp = 8;
+    string expected;
+    // records are a multiple of 4 bytes long, strings of 0 to 11 characters give every length modulo 3 (base64 padding)
+    for (int i = 0; i < 12; i++) {
+        string arg(i, 'a' + i);
+        ESP_LOGI(TAG, "%d [%s]", i, arg.c_str());
+        expected += format_expected(LOG_FORMAT(I, "%d [%s]"), 8, TAG, i, arg.c_str());
+    }
+    esp_log_flush();
+    CHECK(decode_output(s_output) == expected);
+}
+
+TEST_CASE("messages which can't be stored are output as text", "[log][binary]")
+{
+    reset_output();
+    s_timestamp = 9;
+    string long_string(300, 'x');
+    ESP_LOGI(TAG, "long %s", long_string.c_str());
+    CHECK(s_output == "I (9) test: long " + long_string + "\n");
+    s_output.clear();
+    ESP_LOGI(TAG, "short");
+    esp_log_flush();
+    CHECK(decode_output(s_output) == "I (9) test: short\n");
+}
+
+#endif // CONFIG_LOG_DEFERRED_BINARY
+
+/* Output function with the cost of formatting, but not of a UART */
+static int discard_vprintf(const char *format, va_list args)
+{
+    char buf[256];
+    return vsnprintf(buf, sizeof(buf), format, args);
+}
+
+static int immediate_log(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int ret = discard_vprintf(format, args);
+    va_end(args);
+    return ret;
+}
+
+/* Time taken by the calling task for each ESP_LOGI. Messages logged immediately are formatted by the calling task
+   (as esp_log_writev() does when the message can't be deferred), deferred messages are only stored and formatted
+   later by the log task, which is measured separately. */
+TEST_CASE("deferred logging benchmark", "[log][benchmark]")
+{
+    reset_output();
+    esp_log_set_vprintf(discard_vprintf);
+    const int ITERATIONS = 20000;
+    const int BATCH = 16; // fits in the buffer
+    const char *name = "sensor";
+    typedef std::chrono::steady_clock clock;
+    uint64_t immediate_ns = 0, deferred_ns = 0, task_ns = 0;
+
+    for (int i = 0; i < ITERATIONS; i += BATCH) {
+        auto start = clock::now();
+        for (int j = 0; j < BATCH; j++) {
+            if (LOG_LOCAL_LEVEL >= ESP_LOG_INFO) {
+                immediate_log(LOG_FORMAT(I, "%s reading %d: %d.%02d C"), esp_log_timestamp(), TAG, name, i + j, 21, 50);
+            }
+        }
+        immediate_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+        start = clock::now();
+        for (int j = 0; j < BATCH; j++) {
+            ESP_LOGI(TAG, "%s reading %d: %d.%02d C", name, i + j, 21, 50);
+        }
+        deferred_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+        start = clock::now();
+        esp_log_flush();
+        task_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    }
+
+    printf("ESP_LOGI on the calling task: formatted immediately %u ns, deferred %u ns\n",
+           (unsigned)(immediate_ns / ITERATIONS), (unsigned)(deferred_ns / ITERATIONS));
+    printf("log task: %u ns per deferred message\n", (unsigned)(task_ns / ITERATIONS));
+}
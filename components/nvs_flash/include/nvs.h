@@ -114,6 +114,17 @@ typedef struct {
  */
 typedef struct nvs_opaque_iterator_t *nvs_iterator_t;
 
+/**
+ * @brief Callback receiving the data of a blob read by nvs_blob_read_stream
+ *
+ * @param[in] data    Next part of the blob. Only valid until the callback returns.
+ * @param[in] length  Length of the part, in bytes
+ * @param[in] ctx     Argument passed to nvs_blob_read_stream
+ *
+ * @return ESP_OK to continue reading. Any other value stops reading and is returned by nvs_blob_read_stream.
+ */
+typedef esp_err_t (*nvs_blob_read_cb_t)(const void* data, size_t length, void* ctx);
+
 /**
  * @brief      Open non-volatile storage with a given namespace from the default NVS partition
  *
@@ -339,6 +350,34 @@ esp_err_t nvs_get_str (nvs_handle_t handle, const char* key, char* out_value, si
 esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length);
 /**@}*/
 
+/**
+ * @brief      Read a blob piece by piece, without a buffer for the whole value
+ *
+ * Blobs are stored in chunks of up to 4000 bytes. This function reads one chunk
+ * at a time into a temporary buffer, checks it, and passes it to the callback,
+ * so that large blobs can be hashed or parsed without allocating memory for all
+ * of the data.
+ *
+ * The callback is called with the storage locked for reading. It must not call
+ * other NVS functions: these could wait for the lock of a partition which is
+ * being written by another task, while that task waits for this callback.
+ *
+ * @param[in]  handle  Handle obtained from nvs_open function.
+ * @param[in]  key     Key name. Maximal length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn't be empty.
+ * @param[in]  cb      Callback receiving the data, in order
+ * @param[in]  ctx     Argument passed to the callback
+ *
+ * @return
+ *             - ESP_OK if the whole blob was passed to the callback
+ *             - ESP_ERR_NVS_NOT_FOUND if the requested key doesn't exist, or if a part of the blob is missing
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_INVALID_NAME if key name doesn't satisfy constraints
+ *             - ESP_ERR_INVALID_ARG if cb is NULL
+ *             - ESP_ERR_NO_MEM if the buffer for one chunk couldn't be allocated
+ *             - the value returned by the callback, if it isn't ESP_OK
+ */
+esp_err_t nvs_blob_read_stream(nvs_handle_t handle, const char* key, nvs_blob_read_cb_t cb, void* ctx);
+
 /**
  * @brief      Erase key-value pair with given key name.
  *
@@ -399,6 +438,8 @@ esp_err_t nvs_commit(nvs_handle_t handle);
  * write the changes to nonvolatile storage. This has to be done explicitly using
  * nvs_commit function.
  * Once this function is called on a handle, the handle should no longer be used.
+ * If another task is using the handle at the same time, this function waits
+ * until that operation has finished.
  *
  * @param[in]  handle  Storage handle to close
  */
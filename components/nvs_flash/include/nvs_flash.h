@@ -89,6 +89,9 @@ esp_err_t nvs_flash_deinit(void);
 /**
  * @brief Deinitialize NVS storage for the given NVS partition
  *
+ * All handles of the partition are closed. The function must not be called while
+ * other tasks are still accessing the partition.
+ *
  * @param[in]  partition_label   Label of the partition
  *
  * @return
@@ -98,6 +101,31 @@ esp_err_t nvs_flash_deinit(void);
  */
 esp_err_t nvs_flash_deinit_partition(const char* partition_label);
 
+/**
+ * @brief Compact one page of an NVS partition ahead of time
+ *
+ * When a value is written and the partition has only one free page left, the
+ * write has to move the remaining values of some page to that free page and
+ * erase the old page first. This function does that work in advance, so that
+ * it can be called while the system is idle to keep the duration of nvs_set_*
+ * calls short. The values are moved to the page which receives new values,
+ * one at a time, and other tasks may access the partition in between. Nothing
+ * is done unless only one free page is left, some page has at least
+ * CONFIG_NVS_GC_MIN_ERASED_ENTRIES erased entries, and its values fit into the
+ * page receiving new values. At most one page is compacted per call, and the
+ * function returns early if another task is using the partition.
+ *
+ * @note If CONFIG_NVS_BACKGROUND_GC is enabled, a background task calls this function periodically.
+ *
+ * @param[in]  partition_label  Label of the partition, or NULL for the default NVS partition
+ *
+ * @return
+ *      - ESP_OK if there was nothing to do or a page was compacted
+ *      - ESP_ERR_NVS_NOT_INITIALIZED if the partition is not initialized
+ *      - one of the error codes from the underlying flash storage driver
+ */
+esp_err_t nvs_flash_collect_garbage(const char* partition_label);
+
 /**
  * @brief Erase the default NVS partition
  *
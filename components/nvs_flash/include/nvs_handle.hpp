@@ -157,6 +157,14 @@ public:
      */
     virtual esp_err_t get_item_size(ItemType datatype, const char *key, size_t &size) = 0;
 
+    /**
+     * @brief Passes the data of a blob to the callback, one chunk at a time.
+     *
+     * Only a buffer for one chunk (up to 4000 bytes) is allocated. The callback must not modify the partition.
+     * See \ref nvs_blob_read_stream for the return values.
+     */
+    virtual esp_err_t read_blob_stream(const char *key, nvs_blob_read_cb_t cb, void* ctx) = 0;
+
     /**
      * @brief Erases an entry.
      */
@@ -191,6 +199,39 @@ public:
      */
     virtual esp_err_t get_used_entry_count(size_t& usedEntries) = 0;
 
+    /**
+     * @brief Starts collecting values in a batch.
+     *
+     * Until \ref commit_batch or \ref abort_batch is called, set_item, set_string and set_blob only store the
+     * values in RAM. They are neither written to flash nor visible to get_item & co. Setting a key twice keeps
+     * the last value. erase_item and erase_all are not allowed while a batch is open.
+     *
+     * @return
+     *             - ESP_OK if the batch was started
+     *             - ESP_ERR_NVS_READ_ONLY if the handle was opened as read only
+     *             - ESP_ERR_NVS_INVALID_STATE if a batch is open already
+     */
+    virtual esp_err_t begin_batch() = 0;
+
+    /**
+     * @brief Writes all values of the open batch and closes it.
+     *
+     * Values are packed together, so that writing many small values takes only a few flash write operations
+     * instead of several per value. Other tasks reading the same partition see either none or all of the new values.
+     * If an error is returned or power is lost while writing, only some of the values may have been written.
+     *
+     * @return
+     *             - ESP_OK if all values have been written
+     *             - ESP_ERR_NVS_INVALID_STATE if no batch is open
+     *             - same error codes as set_item otherwise
+     */
+    virtual esp_err_t commit_batch() = 0;
+
+    /**
+     * @brief Discards all values of the open batch and closes it.
+     */
+    virtual void abort_batch() = 0;
+
 protected:
     virtual esp_err_t set_typed_item(ItemType datatype, const char *key, const void* data, size_t dataSize) = 0;
 
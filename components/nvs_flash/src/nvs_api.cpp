@@ -23,6 +23,7 @@
 
 #ifdef ESP_PLATFORM
 #include <esp32/rom/crc.h>
+#include "freertos/task.h"
 
 // Uncomment this line to force output from this module
 // #define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
@@ -64,17 +65,41 @@ using namespace nvs;
 
 static intrusive_list<NVSHandleEntry> s_nvs_handles;
 
-static nvs::Storage* lookup_storage_from_name(const char *name)
+/*
+ * Looks up the storage and takes its lock (SharedLock or ExclusiveLock) before the global lock is released,
+ * so that the storage can't be deinitialized while it's used, see nvs_find_ns_handle.
+ */
+template<typename TLock>
+static nvs::Storage* lookup_storage_from_name(const char *name, TLock& storageLock)
 {
-    return NVSPartitionManager::get_instance()->lookup_storage_from_name(name);
+    Lock lock;
+    nvs::Storage* pStorage = NVSPartitionManager::get_instance()->lookup_storage_from_name(name);
+    if (pStorage != nullptr) {
+        storageLock.acquire(pStorage->getLock());
+    }
+    return pStorage;
+}
+
+/*
+ * Removes the handle from the list and deletes it, once operations which are still using it have finished.
+ * Called with the global lock held, so no other operation can find the handle and lock its storage meanwhile.
+ */
+static void free_handle_entry(NVSHandleEntry* entry)
+{
+    s_nvs_handles.erase(entry);
+    RWLock* storageLock = entry->nvs_handle->get_lock();
+    if (storageLock) {
+        ExclusiveLock wait(*storageLock);
+    }
+    delete entry;
 }
 
 extern "C" void nvs_dump(const char *partName)
 {
-    Lock lock;
     nvs::Storage* pStorage;
+    SharedLock storageLock;
 
-    pStorage = lookup_storage_from_name(partName);
+    pStorage = lookup_storage_from_name(partName, storageLock);
     if (pStorage == nullptr) {
         return;
     }
@@ -82,13 +107,111 @@ extern "C" void nvs_dump(const char *partName)
     pStorage->debugDump();
 }
 
+/*
+ * One step of Storage::collectGarbage on the storage returned by lookup. The storage lock is only tried:
+ * waiting for it with the global lock held would block all other NVS calls meanwhile, and a partition
+ * which is in use isn't idle anyway.
+ * Once the storage is locked, it can't be deinitialized, so the global lock is released for the step.
+ */
+template<typename TLookup>
+static esp_err_t collect_garbage_step(TLookup lookup)
+{
+    nvs::Storage* pStorage;
+    {
+        Lock lock;
+        pStorage = lookup();
+        if (pStorage == nullptr) {
+            return ESP_ERR_NVS_NOT_INITIALIZED;
+        }
+        if (!pStorage->getLock().tryLock()) {
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+
+    esp_err_t err = pStorage->collectGarbage(CONFIG_NVS_GC_MIN_ERASED_ENTRIES);
+    pStorage->getLock().unlock();
+    return err;
+}
+
+// other tasks may use the storage between two steps, each of them only moves one item
+template<typename TLookup>
+static esp_err_t collect_garbage(TLookup lookup)
+{
+    esp_err_t err;
+    do {
+        err = collect_garbage_step(lookup);
+    } while (err == ESP_OK);
+
+    if (err == ESP_ERR_NVS_NOT_FOUND || err == ESP_ERR_TIMEOUT) {
+        return ESP_OK;
+    }
+    return err;
+}
+
+#if defined(ESP_PLATFORM) && defined(CONFIG_NVS_BACKGROUND_GC)
+static TaskHandle_t s_gc_task = nullptr;
+
+static void nvs_gc_task(void* arg)
+{
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_NVS_BACKGROUND_GC_INTERVAL_MS));
+        for (size_t i = 0; ; ++i) {
+            esp_err_t err = collect_garbage([=]() {
+                return NVSPartitionManager::get_instance()->storage_at(i);
+            });
+            if (err == ESP_ERR_NVS_NOT_INITIALIZED) {
+                break;
+            }
+        }
+    }
+}
+
+// called with Lock held, after a partition was initialized
+static esp_err_t start_gc_task()
+{
+    if (s_gc_task) {
+        return ESP_OK;
+    }
+    if (xTaskCreate(nvs_gc_task, "nvs_gc", 2560, nullptr, tskIDLE_PRIORITY + 1, &s_gc_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// called with Lock held, after a partition was deinitialized
+static void stop_gc_task()
+{
+    /* deinit_partition waited for the storage lock, so the task isn't compacting the last partition,
+     * and it can't start another step without the global lock */
+    if (s_gc_task && NVSPartitionManager::get_instance()->storage_count() == 0) {
+        vTaskDelete(s_gc_task);
+        s_gc_task = nullptr;
+    }
+}
+#else
+static esp_err_t start_gc_task()
+{
+    return ESP_OK;
+}
+
+static void stop_gc_task()
+{
+}
+#endif // ESP_PLATFORM && CONFIG_NVS_BACKGROUND_GC
+
 static esp_err_t close_handles_and_deinit(const char* part_name)
 {
     // Delete all corresponding open handles
-    s_nvs_handles.clearAndFreeNodes();
+    while (!s_nvs_handles.empty()) {
+        free_handle_entry(&s_nvs_handles.front());
+    }
 
     // Deinit partition
-    return NVSPartitionManager::get_instance()->deinit_partition(part_name);
+    esp_err_t err = NVSPartitionManager::get_instance()->deinit_partition(part_name);
+    if (err == ESP_OK) {
+        stop_gc_task();
+    }
+    return err;
 }
 
 extern "C" esp_err_t nvs_flash_init_partition_ptr(const esp_partition_t *partition)
@@ -111,9 +234,10 @@ extern "C" esp_err_t nvs_flash_init_partition_ptr(const esp_partition_t *partiti
 
     if (init_res != ESP_OK) {
         delete part;
+        return init_res;
     }
 
-    return init_res;
+    return start_gc_task();
 }
 
 #ifdef ESP_PLATFORM
@@ -122,7 +246,11 @@ extern "C" esp_err_t nvs_flash_init_partition(const char *part_name)
     Lock::init();
     Lock lock;
 
-    return NVSPartitionManager::get_instance()->init_partition(part_name);
+    esp_err_t err = NVSPartitionManager::get_instance()->init_partition(part_name);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return start_gc_task();
 }
 
 extern "C" esp_err_t nvs_flash_init(void)
@@ -136,7 +264,11 @@ extern "C" esp_err_t nvs_flash_secure_init_partition(const char *part_name, nvs_
     Lock::init();
     Lock lock;
 
-    return NVSPartitionManager::get_instance()->secure_init_partition(part_name, cfg);
+    esp_err_t err = NVSPartitionManager::get_instance()->secure_init_partition(part_name, cfg);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return start_gc_task();
 }
 
 extern "C" esp_err_t nvs_flash_secure_init(nvs_sec_cfg_t* cfg)
@@ -210,14 +342,30 @@ extern "C" esp_err_t nvs_flash_deinit(void)
     return nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME);
 }
 
-static esp_err_t nvs_find_ns_handle(nvs_handle_t c_handle, NVSHandleSimple** handle)
+/*
+ * The global lock only protects the list of handles and the list of partitions. Operations on a partition
+ * are serialized by the lock of its storage, so that tasks using different partitions don't block each other
+ * and tasks only reading from a partition (nvs_get_*) can run in parallel.
+ *
+ * The storage lock is taken (in the mode given by storageLock, SharedLock or ExclusiveLock) before the global
+ * lock is released. nvs_close and the partition deinitialization hold the global lock while they wait for the
+ * storage lock, so they can't free the handle or the storage while an operation found here is still using it,
+ * and the operation returns ESP_ERR_NVS_INVALID_HANDLE if they ran first.
+ */
+template<typename TLock>
+static esp_err_t nvs_find_ns_handle(nvs_handle_t c_handle, NVSHandleSimple** handle, TLock& storageLock)
 {
+    Lock lock;
     auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), [=](NVSHandleEntry& e) -> bool {
         return e.mHandle == c_handle;
     });
     if (it == end(s_nvs_handles)) {
         return ESP_ERR_NVS_INVALID_HANDLE;
     }
+    RWLock* lockPtr = it->nvs_handle->get_lock();
+    if (lockPtr) {
+        storageLock.acquire(*lockPtr);
+    }
     *handle = it->nvs_handle;
     return ESP_OK;
 }
@@ -258,16 +406,15 @@ extern "C" void nvs_close(nvs_handle_t handle)
     if (it == end(s_nvs_handles)) {
         return;
     }
-    s_nvs_handles.erase(it);
-    delete static_cast<NVSHandleEntry*>(it);
+    free_handle_entry(static_cast<NVSHandleEntry*>(it));
 }
 
 extern "C" esp_err_t nvs_erase_key(nvs_handle_t c_handle, const char* key)
 {
-    Lock lock;
     ESP_LOGD(TAG, "%s %s\r\n", __func__, key);
     NVSHandleSimple *handle;
-    auto err = nvs_find_ns_handle(c_handle, &handle);
+    ExclusiveLock storageLock;
+    auto err = nvs_find_ns_handle(c_handle, &handle, storageLock);
     if (err != ESP_OK) {
         return err;
     }
@@ -277,10 +424,10 @@ extern "C" esp_err_t nvs_erase_key(nvs_handle_t c_handle, const char* key)
 
 extern "C" esp_err_t nvs_erase_all(nvs_handle_t c_handle)
 {
-    Lock lock;
     ESP_LOGD(TAG, "%s\r\n", __func__);
     NVSHandleSimple *handle;
-    auto err = nvs_find_ns_handle(c_handle, &handle);
+    ExclusiveLock storageLock;
+    auto err = nvs_find_ns_handle(c_handle, &handle, storageLock);
     if (err != ESP_OK) {
         return err;
     }
@@ -291,10 +438,10 @@ extern "C" esp_err_t nvs_erase_all(nvs_handle_t c_handle)
 template<typename T>
 static esp_err_t nvs_set(nvs_handle_t c_handle, const char* key, T value)
 {
-    Lock lock;
     ESP_LOGD(TAG, "%s %s %d %d", __func__, key, sizeof(T), (uint32_t) value);
     NVSHandleSimple *handle;
-    auto err = nvs_find_ns_handle(c_handle, &handle);
+    ExclusiveLock storageLock;
+    auto err = nvs_find_ns_handle(c_handle, &handle, storageLock);
     if (err != ESP_OK) {
         return err;
     }
@@ -344,10 +491,10 @@ extern "C" esp_err_t nvs_set_u64 (nvs_handle_t handle, const char* key, uint64_t
 
 extern "C" esp_err_t nvs_commit(nvs_handle_t c_handle)
 {
-    Lock lock;
     // no-op for now, to be used when intermediate cache is added
     NVSHandleSimple *handle;
-    auto err = nvs_find_ns_handle(c_handle, &handle);
+    ExclusiveLock storageLock;
+    auto err = nvs_find_ns_handle(c_handle, &handle, storageLock);
     if (err != ESP_OK) {
         return err;
     }
@@ -356,10 +503,10 @@ extern "C" esp_err_t nvs_commit(nvs_handle_t c_handle)
 
 extern "C" esp_err_t nvs_set_str(nvs_handle_t c_handle, const char* key, const char* value)
 {
-    Lock lock;
     ESP_LOGD(TAG, "%s %s %s", __func__, key, value);
     NVSHandleSimple *handle;
-    auto err = nvs_find_ns_handle(c_handle, &handle);
+    ExclusiveLock storageLock;
+    auto err = nvs_find_ns_handle(c_handle, &handle, storageLock);
     if (err != ESP_OK) {
         return err;
     }
@@ -368,10 +515,10 @@ extern "C" esp_err_t nvs_set_str(nvs_handle_t c_handle, const char* key, const c
 
 extern "C" esp_err_t nvs_set_blob(nvs_handle_t c_handle, const char* key, const void* value, size_t length)
 {
-    Lock lock;
     ESP_LOGD(TAG, "%s %s %d", __func__, key, length);
     NVSHandleSimple *handle;
-    auto err = nvs_find_ns_handle(c_handle, &handle);
+    ExclusiveLock storageLock;
+    auto err = nvs_find_ns_handle(c_handle, &handle, storageLock);
     if (err != ESP_OK) {
         return err;
     }
@@ -382,10 +529,10 @@ extern "C" esp_err_t nvs_set_blob(nvs_handle_t c_handle, const char* key, const
 template<typename T>
 static esp_err_t nvs_get(nvs_handle_t c_handle, const char* key, T* out_value)
 {
-    Lock lock;
     ESP_LOGD(TAG, "%s %s %d", __func__, key, sizeof(T));
     NVSHandleSimple *handle;
-    auto err = nvs_find_ns_handle(c_handle, &handle);
+    SharedLock storageLock;
+    auto err = nvs_find_ns_handle(c_handle, &handle, storageLock);
     if (err != ESP_OK) {
         return err;
     }
@@ -434,10 +581,10 @@ extern "C" esp_err_t nvs_get_u64 (nvs_handle_t c_handle, const char* key, uint64
 
 static esp_err_t nvs_get_str_or_blob(nvs_handle_t c_handle, nvs::ItemType type, const char* key, void* out_value, size_t* length)
 {
-    Lock lock;
     ESP_LOGD(TAG, "%s %s", __func__, key);
     NVSHandleSimple *handle;
-    auto err = nvs_find_ns_handle(c_handle, &handle);
+    SharedLock storageLock;
+    auto err = nvs_find_ns_handle(c_handle, &handle, storageLock);
     if (err != ESP_OK) {
         return err;
     }
@@ -472,9 +619,33 @@ extern "C" esp_err_t nvs_get_blob(nvs_handle_t c_handle, const char* key, void*
     return nvs_get_str_or_blob(c_handle, nvs::ItemType::BLOB, key, out_value, length);
 }
 
+extern "C" esp_err_t nvs_blob_read_stream(nvs_handle_t c_handle, const char* key, nvs_blob_read_cb_t cb, void* ctx)
+{
+    ESP_LOGD(TAG, "%s %s", __func__, key);
+    if (cb == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    NVSHandleSimple *handle;
+    SharedLock storageLock;
+    auto err = nvs_find_ns_handle(c_handle, &handle, storageLock);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return handle->read_blob_stream(key, cb, ctx);
+}
+
+extern "C" esp_err_t nvs_flash_collect_garbage(const char* partition_label)
+{
+    if (partition_label == nullptr) {
+        partition_label = NVS_DEFAULT_PART_NAME;
+    }
+    return collect_garbage([=]() {
+        return NVSPartitionManager::get_instance()->lookup_storage_from_name(partition_label);
+    });
+}
+
 extern "C" esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats)
 {
-    Lock lock;
     nvs::Storage* pStorage;
 
     if (nvs_stats == nullptr) {
@@ -485,7 +656,8 @@ extern "C" esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats
     nvs_stats->total_entries    = 0;
     nvs_stats->namespace_count  = 0;
 
-    pStorage = lookup_storage_from_name((part_name == nullptr) ? NVS_DEFAULT_PART_NAME : part_name);
+    SharedLock storageLock;
+    pStorage = lookup_storage_from_name((part_name == nullptr) ? NVS_DEFAULT_PART_NAME : part_name, storageLock);
     if (pStorage == nullptr) {
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
@@ -499,14 +671,14 @@ extern "C" esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats
 
 extern "C" esp_err_t nvs_get_used_entry_count(nvs_handle_t c_handle, size_t* used_entries)
 {
-    Lock lock;
     if(used_entries == nullptr){
         return ESP_ERR_INVALID_ARG;
     }
     *used_entries = 0;
 
     NVSHandleSimple *handle;
-    auto err = nvs_find_ns_handle(c_handle, &handle);
+    SharedLock storageLock;
+    auto err = nvs_find_ns_handle(c_handle, &handle, storageLock);
     if (err != ESP_OK) {
         return err;
     }
@@ -653,14 +825,15 @@ static nvs_iterator_t create_iterator(nvs::Storage *storage, nvs_type_t type)
 
 extern "C" nvs_iterator_t nvs_entry_find(const char *part_name, const char *namespace_name, nvs_type_t type)
 {
-    Lock lock;
     nvs::Storage *pStorage;
+    SharedLock storageLock;
 
-    pStorage = lookup_storage_from_name(part_name);
+    pStorage = lookup_storage_from_name(part_name, storageLock);
     if (pStorage == nullptr) {
         return nullptr;
     }
 
+
     nvs_iterator_t it = create_iterator(pStorage, type);
     if (it == nullptr) {
         return nullptr;
@@ -677,9 +850,9 @@ extern "C" nvs_iterator_t nvs_entry_find(const char *part_name, const char *name
 
 extern "C" nvs_iterator_t nvs_entry_next(nvs_iterator_t it)
 {
-    Lock lock;
     assert(it);
 
+    SharedLock storageLock(it->storage->getLock());
     bool entryFound = it->storage->nextEntry(it);
     if (!entryFound) {
         free(it);
@@ -72,15 +72,44 @@ esp_err_t NVSEncryptedPartition::read(size_t src_offset, void* dst, size_t size)
 
 esp_err_t NVSEncryptedPartition::write(size_t addr, const void* src, size_t size)
 {
-    if (size % ESP_ENCRYPT_BLOCK_SIZE != 0) return ESP_ERR_INVALID_SIZE;
+    WriteBuffer buffer = {src, size};
+    return NVSEncryptedPartition::write_gather(addr, &buffer, 1);
+}
+
+esp_err_t NVSEncryptedPartition::write_gather(size_t addr, const WriteBuffer* buffers, size_t count)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (buffers[i].size % ESP_ENCRYPT_BLOCK_SIZE != 0) return ESP_ERR_INVALID_SIZE;
+        size += buffers[i].size;
+    }
 
     // copy data to buffer for encryption
-    uint8_t* buf = new (std::nothrow) uint8_t [size];
+    uint8_t stack_buf[STACK_BUFFER_SIZE];
+    uint8_t* buf = stack_buf;
+
+    if (size > sizeof(stack_buf)) {
+        buf = new (std::nothrow) uint8_t [size];
+        if (!buf) return ESP_ERR_NO_MEM;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(buf + offset, buffers[i].src, buffers[i].size);
+        offset += buffers[i].size;
+    }
 
-    if (!buf) return ESP_ERR_NO_MEM;
+    esp_err_t result = encrypt_and_write(addr, buf, size);
 
-    memcpy(buf, src, size);
+    if (buf != stack_buf) {
+        delete [] buf;
+    }
+
+    return result;
+}
 
+esp_err_t NVSEncryptedPartition::encrypt_and_write(size_t addr, uint8_t* buf, size_t size)
+{
     // encrypt data
     uint8_t entrySize = sizeof(Item);
 
@@ -93,9 +122,10 @@ esp_err_t NVSEncryptedPartition::write(size_t addr, const void* src, size_t size
 
     memset(data_unit, 0, sizeof(data_unit));
 
-    for(uint8_t entry = 0; entry < (size/entrySize); entry++)
+    /* The XTS data unit is one entry (this is what nvs_partition_gen.py produces), so even a
+     * contiguous span has to be encrypted entry by entry, with the entry address as tweak. */
+    for (size_t offset = 0; offset < size; offset += entrySize)
     {
-        uint32_t offset = entry * entrySize;
         uint32_t *addr_loc = (uint32_t*) &data_unit[0];
 
         *addr_loc = relAddr + offset;
@@ -105,17 +135,12 @@ esp_err_t NVSEncryptedPartition::write(size_t addr, const void* src, size_t size
                                   data_unit,
                                   buf + offset,
                                   buf + offset) != 0)  {
-            delete buf;
             return ESP_ERR_NVS_XTS_ENCR_FAILED;
         }
     }
 
     // write data
-    esp_err_t result = esp_partition_write(mESPPartition, addr, buf, size);
-
-    delete buf;
-
-    return result;
+    return esp_partition_write(mESPPartition, addr, buf, size);
 }
 
 } // nvs
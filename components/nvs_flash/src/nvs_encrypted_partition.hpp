@@ -33,7 +33,23 @@ public:
 
     esp_err_t write(size_t dst_offset, const void* src, size_t size) override;
 
+    /**
+     * Copies all buffers into one, encrypts it and writes it with a single flash operation.
+     */
+    esp_err_t write_gather(size_t dst_offset, const WriteBuffer* buffers, size_t count) override;
+
 protected:
+    /**
+     * Writes up to this many bytes are staged on the stack instead of the heap.
+     * This covers all primitive type entries.
+     */
+    static const size_t STACK_BUFFER_SIZE = 64;
+
+    /**
+     * Encrypts buf in place, entry by entry, and writes it to flash.
+     */
+    esp_err_t encrypt_and_write(size_t addr, uint8_t* buf, size_t size);
+
     mbedtls_aes_xts_context mEctxt;
     mbedtls_aes_xts_context mDctxt;
 };
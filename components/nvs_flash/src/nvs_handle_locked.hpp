@@ -21,6 +21,9 @@ namespace nvs {
 /**
  * @brief A class which behaves the same as NVSHandleSimple, except that all public member functions are locked.
  *
+ * The functions hold the lock of the underlying storage, exclusively if they modify the storage and in shared mode
+ * otherwise. Hence, handles to different partitions and handles which only read don't block each other.
+ *
  * This class follows the decorator design pattern. The reason why we don't want locks in NVSHandleSimple is that
  * NVSHandleSimple can also be used by the C-API which locks its public functions already.
  * Thus, we avoid double-locking.
@@ -44,6 +47,8 @@ public:
 
     esp_err_t get_item_size(ItemType datatype, const char *key, size_t &size) override;
 
+    esp_err_t read_blob_stream(const char *key, nvs_blob_read_cb_t cb, void* ctx) override;
+
     esp_err_t erase_item(const char* key) override;
 
     esp_err_t erase_all() override;
@@ -52,12 +57,39 @@ public:
 
     esp_err_t get_used_entry_count(size_t& usedEntries) override;
 
+    esp_err_t begin_batch() override;
+
+    esp_err_t commit_batch() override;
+
+    void abort_batch() override;
+
 protected:
     esp_err_t set_typed_item(ItemType datatype, const char *key, const void* data, size_t dataSize) override;
 
     esp_err_t get_typed_item(ItemType datatype, const char *key, void* data, size_t dataSize) override;
 
 private:
+    /**
+     * Calls func while holding the storage lock in the mode given by TLock (SharedLock or ExclusiveLock).
+     * The global lock is only held while looking up and taking the storage lock, so that the partition
+     * can't be deinitialized in between.
+     */
+    template<typename TLock, typename TFunc>
+    esp_err_t with_lock(TFunc func)
+    {
+        TLock storage_lock;
+        {
+            Lock lock;
+            RWLock *lock_ptr = handle->get_lock();
+            // if the storage is gone, the handle will report that it's invalid
+            if (lock_ptr != nullptr) {
+                storage_lock.acquire(*lock_ptr);
+            }
+        }
+
+        return func();
+    }
+
     NVSHandleSimple *handle;
 };
 
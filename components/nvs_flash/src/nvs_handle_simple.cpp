@@ -25,6 +25,7 @@ esp_err_t NVSHandleSimple::set_typed_item(ItemType datatype, const char *key, co
 {
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
     if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
+    if (mBatchOpen) return mBatch.add(datatype, key, data, dataSize);
 
     return mStoragePtr->writeItem(mNsIndex, datatype, key, data, dataSize);
 }
@@ -40,6 +41,7 @@ esp_err_t NVSHandleSimple::set_string(const char *key, const char* str)
 {
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
     if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
+    if (mBatchOpen) return mBatch.add(nvs::ItemType::SZ, key, str, strlen(str) + 1);
 
     return mStoragePtr->writeItem(mNsIndex, nvs::ItemType::SZ, key, str, strlen(str) + 1);
 }
@@ -48,6 +50,7 @@ esp_err_t NVSHandleSimple::set_blob(const char *key, const void* blob, size_t le
 {
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
     if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
+    if (mBatchOpen) return mBatch.add(nvs::ItemType::BLOB, key, blob, len);
 
     return mStoragePtr->writeItem(mNsIndex, nvs::ItemType::BLOB, key, blob, len);
 }
@@ -73,10 +76,18 @@ esp_err_t NVSHandleSimple::get_item_size(ItemType datatype, const char *key, siz
     return mStoragePtr->getItemDataSize(mNsIndex, datatype, key, size);
 }
 
+esp_err_t NVSHandleSimple::read_blob_stream(const char *key, nvs_blob_read_cb_t cb, void* ctx)
+{
+    if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
+
+    return mStoragePtr->readBlobStream(mNsIndex, key, cb, ctx);
+}
+
 esp_err_t NVSHandleSimple::erase_item(const char* key)
 {
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
     if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
+    if (mBatchOpen) return ESP_ERR_NVS_INVALID_STATE;
 
     return mStoragePtr->eraseItem(mNsIndex, key);
 }
@@ -85,6 +96,7 @@ esp_err_t NVSHandleSimple::erase_all()
 {
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
     if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
+    if (mBatchOpen) return ESP_ERR_NVS_INVALID_STATE;
 
     return mStoragePtr->eraseNamespace(mNsIndex);
 }
@@ -110,6 +122,32 @@ esp_err_t NVSHandleSimple::get_used_entry_count(size_t& used_entries)
     return err;
 }
 
+esp_err_t NVSHandleSimple::begin_batch()
+{
+    if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
+    if (mBatchOpen) return ESP_ERR_NVS_INVALID_STATE;
+
+    mBatchOpen = true;
+    return ESP_OK;
+}
+
+esp_err_t NVSHandleSimple::commit_batch()
+{
+    if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (!mBatchOpen) return ESP_ERR_NVS_INVALID_STATE;
+
+    esp_err_t err = mStoragePtr->writeItems(mNsIndex, mBatch);
+    abort_batch();
+    return err;
+}
+
+void NVSHandleSimple::abort_batch()
+{
+    mBatch.clear();
+    mBatchOpen = false;
+}
+
 void NVSHandleSimple::debugDump() {
     return mStoragePtr->debugDump();
 }
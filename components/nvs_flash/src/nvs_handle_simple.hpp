@@ -37,7 +37,8 @@ public:
         mStoragePtr(StoragePtr),
         mNsIndex(nsIndex),
         mReadOnly(readOnly),
-        valid(1)
+        valid(1),
+        mBatchOpen(false)
     { }
 
     ~NVSHandleSimple();
@@ -56,6 +57,8 @@ public:
 
     esp_err_t get_item_size(ItemType datatype, const char *key, size_t &size) override;
 
+    esp_err_t read_blob_stream(const char *key, nvs_blob_read_cb_t cb, void* ctx) override;
+
     esp_err_t erase_item(const char *key) override;
 
     esp_err_t erase_all() override;
@@ -64,6 +67,12 @@ public:
 
     esp_err_t get_used_entry_count(size_t &usedEntries) override;
 
+    esp_err_t begin_batch() override;
+
+    esp_err_t commit_batch() override;
+
+    void abort_batch() override;
+
     esp_err_t getItemDataSize(ItemType datatype, const char *key, size_t &dataSize);
 
     void debugDump();
@@ -76,6 +85,16 @@ public:
 
     bool nextEntry(nvs_opaque_iterator_t *it);
 
+    /**
+     * Returns the lock of the underlying storage or nullptr if the storage has been de-initialized.
+     * The lock has to be held while calling the member functions above,
+     * exclusively for those which modify the storage and in shared mode for the others.
+     */
+    RWLock* get_lock()
+    {
+        return valid ? &mStoragePtr->getLock() : nullptr;
+    }
+
 private:
     /**
      * The underlying storage's object.
@@ -98,6 +117,13 @@ private:
      * Upon opening, a handle is valid. It becomes invalid if the underlying storage is de-initialized.
      */
     uint8_t valid;
+
+    /**
+     * Whether set_* calls are collected in mBatch instead of being written immediately.
+     */
+    bool mBatchOpen;
+
+    ItemBatch mBatch;
 };
 
 } // nvs
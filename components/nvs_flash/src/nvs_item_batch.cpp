@@ -0,0 +1,64 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs_item_batch.hpp"
+#include "nvs_page.hpp"
+
+namespace nvs
+{
+
+esp_err_t ItemBatch::add(ItemType datatype, const char* key, const void* data, size_t dataSize)
+{
+    if (strlen(key) > Item::MAX_KEY_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    // blobs are split into chunks when written, other values must fit into a page
+    if (datatype != ItemType::BLOB && dataSize > Page::CHUNK_MAX_SIZE) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+
+    Entry* entry = new (std::nothrow) Entry;
+    if (!entry) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (dataSize <= sizeof(entry->inlineData)) {
+        entry->data = entry->inlineData;
+    } else {
+        entry->data = new (std::nothrow) uint8_t[dataSize];
+        if (!entry->data) {
+            delete entry;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    entry->datatype = datatype;
+    strncpy(entry->key, key, sizeof(entry->key) - 1);
+    entry->key[sizeof(entry->key) - 1] = 0;
+    entry->dataSize = dataSize;
+    memcpy(entry->data, data, dataSize);
+
+    for (auto it = mEntries.begin(); it != mEntries.end(); ++it) {
+        if (it->datatype == datatype && strcmp(it->key, entry->key) == 0) {
+            mEntries.erase(it);
+            delete static_cast<Entry*>(it);
+            break;
+        }
+    }
+    mEntries.push_back(entry);
+    return ESP_OK;
+}
+
+} // namespace nvs
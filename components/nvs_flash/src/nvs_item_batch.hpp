@@ -0,0 +1,96 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef nvs_item_batch_hpp
+#define nvs_item_batch_hpp
+
+#include "nvs.h"
+#include "nvs_types.hpp"
+#include "intrusive_list.h"
+
+namespace nvs
+{
+
+/**
+ * Values of several keys of one namespace, collected in RAM until they are written by Storage::writeItems.
+ *
+ * Setting a key which is already in the batch replaces the earlier value.
+ */
+class ItemBatch
+{
+public:
+    struct Entry : public intrusive_list_node<Entry> {
+        Entry() : data(nullptr) { }
+
+        ~Entry()
+        {
+            if (data != inlineData) {
+                delete[] data;
+            }
+        }
+
+        ItemType datatype;
+        char key[Item::MAX_KEY_LENGTH + 1];
+        size_t dataSize;
+        uint8_t* data;          // points to inlineData for primitive types
+        uint8_t inlineData[8];
+    };
+
+    typedef intrusive_list<Entry>::iterator iterator;
+
+    ItemBatch() { }
+
+    ~ItemBatch()
+    {
+        clear();
+    }
+
+    esp_err_t add(ItemType datatype, const char* key, const void* data, size_t dataSize);
+
+    void clear()
+    {
+        mEntries.clearAndFreeNodes();
+    }
+
+    bool empty() const
+    {
+        return mEntries.empty();
+    }
+
+    size_t size() const
+    {
+        return mEntries.size();
+    }
+
+    iterator begin()
+    {
+        return mEntries.begin();
+    }
+
+    iterator end()
+    {
+        return mEntries.end();
+    }
+
+private:
+    ItemBatch(const ItemBatch& other);
+    const ItemBatch& operator= (const ItemBatch& rhs);
+
+protected:
+    intrusive_list<Entry> mEntries;
+}; // class ItemBatch
+
+} // namespace nvs
+
+#endif /* nvs_item_batch_hpp */
@@ -23,78 +23,53 @@ HashList::HashList()
 
 void HashList::clear()
 {
-    for (auto it = mBlockList.begin(); it != mBlockList.end();) {
-        auto tmp = it;
-        ++it;
-        mBlockList.erase(tmp);
-        delete static_cast<HashListBlock*>(tmp);
-    }
+    std::fill_n(mNodes, SLOT_COUNT, HashListNode());
+    mSize = 0;
 }
 
-HashList::~HashList()
+esp_err_t HashList::insert(const Item& item, size_t index)
 {
-    clear();
-}
+    // keep at least one empty slot, it terminates the probe sequence in find()
+    if (mSize + 1 >= SLOT_COUNT) {
+        return ESP_ERR_NO_MEM;
+    }
 
-HashList::HashListBlock::HashListBlock()
-{
-    static_assert(sizeof(HashListBlock) == HashListBlock::BYTE_SIZE,
-                  "cache block size calculation incorrect");
+    const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
+    size_t slot = homeSlot(hash_24);
+    while (mNodes[slot].mIndex != EMPTY_INDEX) {
+        slot = nextSlot(slot);
+    }
+    mNodes[slot] = HashListNode(hash_24, index);
+    ++mSize;
+
+    return ESP_OK;
 }
 
-esp_err_t HashList::insert(const Item& item, size_t index)
+void HashList::eraseSlot(size_t slot)
 {
-    const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
-    // add entry to the end of last block if possible
-    if (mBlockList.size()) {
-        auto& block = mBlockList.back();
-        if (block.mCount < HashListBlock::ENTRY_COUNT) {
-            block.mNodes[block.mCount++] = HashListNode(hash_24, index);
-            return ESP_OK;
+    /* Move the following nodes of the probe sequence into the hole, unless
+     * that would put them in front of their home slot */
+    size_t hole = slot;
+    for (size_t next = nextSlot(slot); mNodes[next].mIndex != EMPTY_INDEX; next = nextSlot(next)) {
+        size_t home = homeSlot(mNodes[next].mHash);
+        size_t distFromHome = (next + SLOT_COUNT - home) % SLOT_COUNT;
+        size_t distFromHole = (next + SLOT_COUNT - hole) % SLOT_COUNT;
+        if (distFromHome >= distFromHole) {
+            mNodes[hole] = mNodes[next];
+            hole = next;
         }
     }
-    // if the above failed, create a new block and add entry to it
-    HashListBlock* newBlock = new (std::nothrow) HashListBlock;
-
-    if (!newBlock) return ESP_ERR_NO_MEM;
-
-    mBlockList.push_back(newBlock);
-    newBlock->mNodes[0] = HashListNode(hash_24, index);
-    newBlock->mCount++;
-
-    return ESP_OK;
+    mNodes[hole] = HashListNode();
+    --mSize;
 }
 
 void HashList::erase(size_t index, bool itemShouldExist)
 {
-    for (auto it = mBlockList.begin(); it != mBlockList.end();) {
-        bool haveEntries = false;
-        bool foundIndex = false;
-        for (size_t i = 0; i < it->mCount; ++i) {
-            if (it->mNodes[i].mIndex == index) {
-                it->mNodes[i].mIndex = 0xff;
-                foundIndex = true;
-                /* found the item and removed it */
-            }
-            if (it->mNodes[i].mIndex != 0xff) {
-                haveEntries = true;
-            }
-            if (haveEntries && foundIndex) {
-                /* item was found, and HashListBlock still has some items */
-                return;
-            }
-        }
-        /* no items left in HashListBlock, can remove */
-        if (!haveEntries) {
-            auto tmp = it;
-            ++it;
-            mBlockList.erase(tmp);
-            delete static_cast<HashListBlock*>(tmp);
-        } else {
-            ++it;
-        }
-        if (foundIndex) {
-            /* item was found and empty HashListBlock was removed */
+    /* Callers only know the entry index, not the hash. Erasing an entry also
+     * means writing to flash, so scanning the whole table is cheap in comparison. */
+    for (size_t slot = 0; slot < SLOT_COUNT; ++slot) {
+        if (mNodes[slot].mIndex == index) {
+            eraseSlot(slot);
             return;
         }
     }
@@ -106,17 +81,15 @@ void HashList::erase(size_t index, bool itemShouldExist)
 size_t HashList::find(size_t start, const Item& item)
 {
     const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
-    for (auto it = mBlockList.begin(); it != mBlockList.end(); ++it) {
-        for (size_t index = 0; index < it->mCount; ++index) {
-            HashListNode& e = it->mNodes[index];
-            if (e.mIndex >= start &&
-                    e.mHash == hash_24 &&
-                    e.mIndex != 0xff) {
-                return e.mIndex;
-            }
+    size_t result = SIZE_MAX;
+    for (size_t slot = homeSlot(hash_24); mNodes[slot].mIndex != EMPTY_INDEX; slot = nextSlot(slot)) {
+        const HashListNode& e = mNodes[slot];
+        // nodes of one probe sequence are not ordered, so look for the lowest matching index
+        if (e.mHash == hash_24 && e.mIndex >= start && e.mIndex < result) {
+            result = e.mIndex;
         }
     }
-    return SIZE_MAX;
+    return result;
 }
 
 
@@ -17,22 +17,36 @@
 
 #include "nvs.h"
 #include "nvs_types.hpp"
-#include "intrusive_list.h"
 
 namespace nvs
 {
 
+/**
+ * Open addressing hash table which maps item hashes to entry indices within one page.
+ *
+ * The table has a fixed number of slots and is embedded in the Page object, so it doesn't
+ * allocate memory on the heap. Linear probing is used, and erased nodes are removed by
+ * shifting the rest of the probe sequence back, so the table never fills up with deleted
+ * markers.
+ */
 class HashList
 {
 public:
     HashList();
-    ~HashList();
 
     esp_err_t insert(const Item& item, size_t index);
     void erase(const size_t index, bool itemShouldExist=true);
     size_t find(size_t start, const Item& item);
     void clear();
 
+    size_t size() const
+    {
+        return mSize;
+    }
+
+    // Page::ENTRY_COUNT fits at a load of at most 79%, which keeps probe sequences short
+    static const size_t SLOT_COUNT = 160;
+
 private:
     HashList(const HashList& other);
     const HashList& operator= (const HashList& rhs);
@@ -41,7 +55,7 @@ protected:
 
     struct HashListNode {
         HashListNode() :
-            mIndex(0xff), mHash(0)
+            mIndex(EMPTY_INDEX), mHash(0)
         {
         }
 
@@ -54,18 +68,22 @@ protected:
         uint32_t mHash  : 24;
     };
 
-    struct HashListBlock : public intrusive_list_node<HashList::HashListBlock> {
-        HashListBlock();
+    static const uint32_t EMPTY_INDEX = 0xff;
 
-        static const size_t BYTE_SIZE = 128;
-        static const size_t ENTRY_COUNT = (BYTE_SIZE - sizeof(intrusive_list_node<HashListBlock>) - sizeof(size_t)) / 4;
+    static size_t homeSlot(uint32_t hash)
+    {
+        return hash % SLOT_COUNT;
+    }
 
-        size_t mCount = 0;
-        HashListNode mNodes[ENTRY_COUNT];
-    };
+    static size_t nextSlot(size_t slot)
+    {
+        return (slot + 1 == SLOT_COUNT) ? 0 : slot + 1;
+    }
+
+    void eraseSlot(size_t slot);
 
-    typedef intrusive_list<HashListBlock> TBlockList;
-    TBlockList mBlockList;
+    HashListNode mNodes[SLOT_COUNT];
+    size_t mSize = 0;
 }; // class HashList
 
 } // namespace nvs
@@ -0,0 +1,133 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs_item_index.hpp"
+
+namespace nvs
+{
+
+ItemIndex::ItemIndex()
+{
+}
+
+ItemIndex::~ItemIndex()
+{
+    clear();
+}
+
+esp_err_t ItemIndex::init(size_t bucketCount)
+{
+    clear();
+
+    // round up to a power of two, so that bucket can be selected using a mask
+    size_t count = 16;
+    while (count < bucketCount && count < 0x1000000) {
+        count <<= 1;
+    }
+
+    mBuckets = new (std::nothrow) Node*[count];
+    if (!mBuckets) {
+        return ESP_ERR_NO_MEM;
+    }
+    std::fill_n(mBuckets, count, nullptr);
+    mBucketMask = count - 1;
+    return ESP_OK;
+}
+
+void ItemIndex::clear()
+{
+    delete[] mBuckets;
+    mBuckets = nullptr;
+    mBucketMask = 0;
+    mSize = 0;
+    mFreeNodes = nullptr;
+    mBlockList.clearAndFreeNodes();
+}
+
+ItemIndex::Node* ItemIndex::allocNode()
+{
+    if (!mFreeNodes) {
+        NodeBlock* block = new (std::nothrow) NodeBlock;
+        if (!block) {
+            return nullptr;
+        }
+        mBlockList.push_back(block);
+        for (size_t i = 0; i < NodeBlock::NODE_COUNT; ++i) {
+            block->mNodes[i].mNext = mFreeNodes;
+            mFreeNodes = &block->mNodes[i];
+        }
+    }
+    Node* node = mFreeNodes;
+    mFreeNodes = node->mNext;
+    return node;
+}
+
+esp_err_t ItemIndex::insert(const Item& item, Page* page)
+{
+    assert(isValid());
+    Node* node = allocNode();
+    if (!node) {
+        return ESP_ERR_NO_MEM;
+    }
+    const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
+    node->mPage = page;
+    node->mHash = hash_24;
+    node->mType = static_cast<uint8_t>(item.datatype);
+    node->mNext = mBuckets[hash_24 & mBucketMask];
+    mBuckets[hash_24 & mBucketMask] = node;
+    ++mSize;
+    return ESP_OK;
+}
+
+void ItemIndex::erase(const Item& item, Page* page)
+{
+    assert(isValid());
+    const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
+    const uint8_t type = static_cast<uint8_t>(item.datatype);
+    for (Node** link = &mBuckets[hash_24 & mBucketMask]; *link; link = &(*link)->mNext) {
+        Node* node = *link;
+        if (node->mHash == hash_24 && node->mType == type && node->mPage == page) {
+            /* Only one node is removed: if the same page holds several items with
+             * this hash (e.g. old and new version of a blob index), the others stay */
+            *link = node->mNext;
+            node->mNext = mFreeNodes;
+            mFreeNodes = node;
+            --mSize;
+            return;
+        }
+    }
+}
+
+void ItemIndex::movePage(const Page* from, Page* to)
+{
+    assert(isValid());
+    for (size_t i = 0; i <= mBucketMask; ++i) {
+        for (Node* node = mBuckets[i]; node; node = node->mNext) {
+            if (node->mPage == from) {
+                node->mPage = to;
+            }
+        }
+    }
+}
+
+bool ItemIndex::contains(const Item& item, const Page* page) const
+{
+    bool found = false;
+    forEachPage(item, [&](const Page* candidate) {
+        found = found || (candidate == page);
+    });
+    return found;
+}
+
+} // namespace nvs
@@ -0,0 +1,100 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef nvs_item_index_hpp
+#define nvs_item_index_hpp
+
+#include "nvs.h"
+#include "nvs_types.hpp"
+#include "intrusive_list.h"
+
+namespace nvs
+{
+
+class Page;
+
+/**
+ * Storage-wide index which maps <namespace, key, chunk index, type> of every item to the page holding it.
+ *
+ * The index only records the 24-bit item hash and the type, so it may return pages which don't actually hold
+ * the item (hash collisions, items lost to CRC errors). Callers must confirm the result with Page::findItem.
+ * However, every item which is present in flash must have a node here, so a lookup which yields no page
+ * means that the item doesn't exist.
+ */
+class ItemIndex
+{
+public:
+    ItemIndex();
+    ~ItemIndex();
+
+    esp_err_t init(size_t bucketCount);
+    bool isValid() const
+    {
+        return mBuckets != nullptr;
+    }
+    void clear();
+
+    esp_err_t insert(const Item& item, Page* page);
+    void erase(const Item& item, Page* page);
+    void movePage(const Page* from, Page* to);
+    bool contains(const Item& item, const Page* page) const;
+
+    template<typename TFunc>
+    void forEachPage(const Item& item, TFunc func) const
+    {
+        const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
+        const uint8_t type = static_cast<uint8_t>(item.datatype);
+        for (Node* node = mBuckets[hash_24 & mBucketMask]; node; node = node->mNext) {
+            if (node->mHash == hash_24 && node->mType == type) {
+                func(node->mPage);
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        return mSize;
+    }
+
+private:
+    ItemIndex(const ItemIndex& other);
+    const ItemIndex& operator= (const ItemIndex& rhs);
+
+protected:
+
+    struct Node {
+        Page* mPage;
+        uint32_t mHash : 24;
+        uint32_t mType : 8;
+        Node* mNext;
+    };
+
+    struct NodeBlock : public intrusive_list_node<NodeBlock> {
+        static const size_t NODE_COUNT = 32;
+
+        Node mNodes[NODE_COUNT];
+    };
+
+    Node* allocNode();
+
+    Node** mBuckets = nullptr;
+    size_t mBucketMask = 0;
+    size_t mSize = 0;
+    Node* mFreeNodes = nullptr;
+    intrusive_list<NodeBlock> mBlockList;
+}; // class ItemIndex
+
+} // namespace nvs
+
+#endif /* nvs_item_index_hpp */
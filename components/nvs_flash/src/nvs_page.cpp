@@ -32,13 +32,15 @@ uint32_t Page::Header::calculateCrc32()
                     offsetof(Header, mCrc32) - offsetof(Header, mSeqNumber));
 }
 
-esp_err_t Page::load(Partition *partition, uint32_t sectorNumber)
+esp_err_t Page::load(Partition *partition, uint32_t sectorNumber, Mutex* deferredLoadMutex)
 {
     if (partition == nullptr) {
         return ESP_ERR_INVALID_ARG;
     }
 
     mPartition = partition;
+    mLoadMutex = deferredLoadMutex;
+    mEntriesLoaded = true;
     mBaseAddress = sectorNumber * SEC_SIZE;
     mUsedEntryCount = 0;
     mErasedEntryCount = 0;
@@ -91,7 +93,7 @@ esp_err_t Page::load(Partition *partition, uint32_t sectorNumber)
     case PageState::FULL:
     case PageState::ACTIVE:
     case PageState::FREEING:
-        mLoadEntryTable();
+        mLoadEntryTable(deferredLoadMutex != nullptr);
         break;
 
     default:
@@ -128,12 +130,13 @@ esp_err_t Page::writeEntry(const Item& item)
     return ESP_OK;
 }
 
-esp_err_t Page::writeEntryData(const uint8_t* data, size_t size)
+esp_err_t Page::writeEntrySpan(const Item& header, const uint8_t* data, size_t dataSize)
 {
-    assert(size % ENTRY_SIZE == 0);
     assert(mNextFreeEntry != INVALID_ENTRY);
-    assert(mFirstUsedEntry != INVALID_ENTRY);
-    const uint16_t count = size / ENTRY_SIZE;
+    const size_t count = header.span;
+    const size_t full = dataSize / ENTRY_SIZE * ENTRY_SIZE;
+    const size_t tail = dataSize - full;
+    assert(count == 1 + (dataSize + ENTRY_SIZE - 1) / ENTRY_SIZE);
 
     const uint8_t* buf = data;
 
@@ -146,16 +149,31 @@ esp_err_t Page::writeEntryData(const uint8_t* data, size_t size)
      * TODO: figure out how to make this platform-specific check nicer (probably by introducing
      * a platform-specific flash layer).
      */
-    if ((uint32_t) data < 0x3ff00000) {
-        buf = (uint8_t*) malloc(size);
+    if (full > 0 && (uint32_t) data < 0x3ff00000) {
+        buf = (uint8_t*) malloc(full);
         if (!buf) {
             return ESP_ERR_NO_MEM;
         }
-        memcpy((void*)buf, data, size);
+        memcpy((void*)buf, data, full);
     }
 #endif //ESP_PLATFORM
 
-    auto rc = mPartition->write(getEntryAddress(mNextFreeEntry), buf, size);
+    /* Header, data and the padded tail entry are handed to the partition as one write,
+     * so that e.g. an encrypted partition encrypts and programs the whole span at once. */
+    Item tailEntry;
+    Partition::WriteBuffer buffers[3];
+    size_t bufferCount = 0;
+    buffers[bufferCount++] = {&header, sizeof(Item)};
+    if (full > 0) {
+        buffers[bufferCount++] = {buf, full};
+    }
+    if (tail > 0) {
+        std::fill_n(tailEntry.rawData, sizeof(tailEntry.rawData), 0xff);
+        memcpy(tailEntry.rawData, data + full, tail);
+        buffers[bufferCount++] = {&tailEntry, sizeof(Item)};
+    }
+
+    auto rc = mPartition->write_gather(getEntryAddress(mNextFreeEntry), buffers, bufferCount);
 
 #ifdef ESP_PLATFORM
     if (buf != data) {
@@ -170,6 +188,9 @@ esp_err_t Page::writeEntryData(const uint8_t* data, size_t size)
     if (err != ESP_OK) {
         return err;
     }
+    if (mFirstUsedEntry == INVALID_ENTRY) {
+        mFirstUsedEntry = mNextFreeEntry;
+    }
     mUsedEntryCount += count;
     mNextFreeEntry += count;
     return ESP_OK;
@@ -243,34 +264,15 @@ esp_err_t Page::writeItem(uint8_t nsIndex, ItemType datatype, const char* key, c
         item.varLength.dataSize = dataSize;
         item.varLength.reserved = 0xffff;
         item.crc32 = item.calculateCrc32();
-        err = writeEntry(item);
+        err = writeEntrySpan(item, src, dataSize);
         if (err != ESP_OK) {
             return err;
         }
-
-        size_t left = dataSize / ENTRY_SIZE * ENTRY_SIZE;
-        if (left > 0) {
-            err = writeEntryData(static_cast<const uint8_t*>(data), left);
-            if (err != ESP_OK) {
-                return err;
-            }
-        }
-
-        size_t tail = dataSize - left;
-        if (tail > 0) {
-            std::fill_n(item.rawData, ENTRY_SIZE, 0xff);
-            memcpy(item.rawData, static_cast<const uint8_t*>(data) + left, tail);
-            err = writeEntry(item);
-            if (err != ESP_OK) {
-                return err;
-            }
-        }
-
     }
     return ESP_OK;
 }
 
-esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx, VerOffset chunkStart)
+esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx, VerOffset chunkStart, bool repair)
 {
     size_t index = 0;
     Item item;
@@ -279,7 +281,7 @@ esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, vo
         return ESP_ERR_NVS_INVALID_STATE;
     }
 
-    esp_err_t rc = findItem(nsIndex, datatype, key, index, item, chunkIdx, chunkStart);
+    esp_err_t rc = findItem(nsIndex, datatype, key, index, item, chunkIdx, chunkStart, repair);
     if (rc != ESP_OK) {
         return rc;
     }
@@ -312,9 +314,11 @@ esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, vo
         dst += willCopy;
     }
     if (Item::calculateCrc32(reinterpret_cast<uint8_t*>(data), item.varLength.dataSize) != item.varLength.dataCrc32) {
-        rc = eraseEntryAndSpan(index);
-        if (rc != ESP_OK) {
-            return rc;
+        if (repair) {
+            rc = eraseEntryAndSpan(index);
+            if (rc != ESP_OK) {
+                return rc;
+            }
         }
         return ESP_ERR_NVS_NOT_FOUND;
     }
@@ -391,6 +395,114 @@ esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, ui
     return findItem(nsIndex, datatype, key, index, item, chunkIdx, chunkStart);
 }
 
+esp_err_t Page::writeEntries(const Item* entries, size_t count)
+{
+    esp_err_t err;
+
+    if (mState == PageState::INVALID) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    if (mState == PageState::UNINITIALIZED) {
+        err = initialize();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    if (mState == PageState::FULL || mNextFreeEntry == INVALID_ENTRY || mNextFreeEntry + count > ENTRY_COUNT) {
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    for (size_t i = 0; i < count; i += entries[i].span) {
+        assert(entries[i].span > 0 && i + entries[i].span <= count);
+        err = mHashList.insert(entries[i], mNextFreeEntry + i);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    err = mPartition->write(getEntryAddress(mNextFreeEntry), entries, count * ENTRY_SIZE);
+    if (err != ESP_OK) {
+        mState = PageState::INVALID;
+        return err;
+    }
+
+    err = alterEntryRangeState(mNextFreeEntry, mNextFreeEntry + count, EntryState::WRITTEN);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (mFirstUsedEntry == INVALID_ENTRY) {
+        mFirstUsedEntry = mNextFreeEntry;
+    }
+    mUsedEntryCount += count;
+    mNextFreeEntry += count;
+    return ESP_OK;
+}
+
+esp_err_t Page::eraseEntries(const size_t* indices, size_t count)
+{
+    const size_t wordCount = mEntryTable.byteSize() / sizeof(uint32_t);
+    static_assert(TEntryTable::byteSize() / sizeof(uint32_t) <= 32, "dirty words don't fit into the mask");
+    uint32_t dirtyWords = 0;
+
+    for (size_t n = 0; n < count; ++n) {
+        const size_t index = indices[n];
+        if (mEntryTable.get(index) != EntryState::WRITTEN) {
+            continue;
+        }
+
+        Item item;
+        auto rc = readEntry(index, item);
+        if (rc != ESP_OK) {
+            return rc;
+        }
+
+        size_t span = 1;
+        if (item.calculateCrc32() != item.crc32) {
+            mHashList.erase(index, false);
+        } else {
+            // entries of a page which isn't loaded yet may be missing from the hash list
+            mHashList.erase(index, mEntriesLoaded);
+            span = item.span;
+        }
+
+        for (size_t i = index; i < index + span; ++i) {
+            if (mEntryTable.get(i) == EntryState::WRITTEN) {
+                --mUsedEntryCount;
+            }
+            ++mErasedEntryCount;
+            mEntryTable.set(i, EntryState::ERASED);
+            dirtyWords |= 1u << mEntryTable.getWordIndex(i);
+        }
+
+        if (index + span > mNextFreeEntry) {
+            mNextFreeEntry = index + span;
+        }
+    }
+
+    // same order as alterEntryRangeState, header entries are marked last
+    for (size_t i = wordCount; i-- > 0;) {
+        if ((dirtyWords & (1u << i)) == 0) {
+            continue;
+        }
+        uint32_t word = mEntryTable.data()[i];
+        auto rc = mPartition->write_raw(mBaseAddress + ENTRY_TABLE_OFFSET + static_cast<uint32_t>(i) * 4,
+                &word, sizeof(word));
+        if (rc != ESP_OK) {
+            mState = PageState::INVALID;
+            return rc;
+        }
+    }
+
+    if (mFirstUsedEntry != INVALID_ENTRY && mEntryTable.get(mFirstUsedEntry) != EntryState::WRITTEN) {
+        updateFirstUsedEntry(mFirstUsedEntry, 1);
+    }
+
+    return ESP_OK;
+}
+
 esp_err_t Page::eraseEntryAndSpan(size_t index)
 {
     auto state = mEntryTable.get(index);
@@ -463,12 +575,70 @@ void Page::updateFirstUsedEntry(size_t index, size_t span)
     }
 }
 
+esp_err_t Page::copyItem(size_t index, Page& other, size_t& span)
+{
+    Item entry;
+    auto err = readEntry(index, entry);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    span = entry.span;
+    assert(index + span <= ENTRY_COUNT);
+
+    if (other.mState == PageState::FULL || other.mNextFreeEntry == INVALID_ENTRY
+            || other.mNextFreeEntry + span > ENTRY_COUNT) {
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    err = other.mHashList.insert(entry, other.mNextFreeEntry);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = other.writeEntry(entry);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (size_t i = index + 1; i < index + span; ++i) {
+        readEntry(i, entry);
+        err = other.writeEntry(entry);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t Page::moveItem(size_t index, Page& other)
+{
+    if (mEntryTable.get(index) != EntryState::WRITTEN) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    size_t span;
+    auto err = copyItem(index, other, span);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // if power is lost before the original is erased, it is found as a duplicate of the last item when loading
+    return eraseEntryAndSpan(index);
+}
+
 esp_err_t Page::copyItems(Page& other)
 {
     if (mFirstUsedEntry == INVALID_ENTRY) {
         return ESP_ERR_NVS_NOT_FOUND;
     }
 
+    // broken items are erased while loading, so that they are not copied
+    auto err = ensureLoaded(true);
+    if (err != ESP_OK) {
+        return err;
+    }
+
     if (other.mState == PageState::UNINITIALIZED) {
         auto err = other.initialize();
         if (err != ESP_OK) {
@@ -476,7 +646,6 @@ esp_err_t Page::copyItems(Page& other)
         }
     }
 
-    Item entry;
     size_t readEntryIndex = mFirstUsedEntry;
 
     while (readEntryIndex < ENTRY_COUNT) {
@@ -486,39 +655,18 @@ esp_err_t Page::copyItems(Page& other)
             readEntryIndex++;
             continue;
         }
-        auto err = readEntry(readEntryIndex, entry);
-        if (err != ESP_OK) {
-            return err;
-        }
-
-        err = other.mHashList.insert(entry, other.mNextFreeEntry);
-        if (err != ESP_OK) {
-            return err;
-        }
-
-        err = other.writeEntry(entry);
+        size_t span;
+        err = copyItem(readEntryIndex, other, span);
         if (err != ESP_OK) {
             return err;
         }
-        size_t span = entry.span;
-        size_t end = readEntryIndex + span;
-
-        assert(end <= ENTRY_COUNT);
-
-        for (size_t i = readEntryIndex + 1; i < end; ++i) {
-            readEntry(i, entry);
-            err = other.writeEntry(entry);
-            if (err != ESP_OK) {
-                return err;
-            }
-        }
-        readEntryIndex = end;
+        readEntryIndex += span;
 
     }
     return ESP_OK;
 }
 
-esp_err_t Page::mLoadEntryTable()
+esp_err_t Page::mLoadEntryTable(bool deferFullPage)
 {
     // for states where we actually care about data in the page, read entry state table
     if (mState == PageState::ACTIVE ||
@@ -668,55 +816,101 @@ esp_err_t Page::mLoadEntryTable()
         }
     } else if (mState == PageState::FULL || mState == PageState::FREEING) {
         // We have already filled mHashList for page in active state.
-        // Do the same for the case when page is in full or freeing state.
-        Item item;
-        for (size_t i = mFirstUsedEntry; i < ENTRY_COUNT; ++i) {
-            if (mEntryTable.get(i) != EntryState::WRITTEN) {
-                continue;
-            }
+        // Do the same for the case when page is in full or freeing state,
+        // unless this can wait until the page is accessed.
+        if (deferFullPage && mState == PageState::FULL) {
+            mEntriesLoaded = false;
+        } else {
+            return loadEntries(true);
+        }
+    }
 
-            auto err = readEntry(i, item);
-            if (err != ESP_OK) {
+    return ESP_OK;
+}
+
+esp_err_t Page::loadEntries(bool repair)
+{
+    Item item;
+    for (size_t i = mFirstUsedEntry; i < ENTRY_COUNT; ++i) {
+        if (mEntryTable.get(i) != EntryState::WRITTEN) {
+            continue;
+        }
+
+        auto err = readEntry(i, item);
+        if (err != ESP_OK) {
+            if (repair) {
                 mState = PageState::INVALID;
-                return err;
             }
+            return err;
+        }
 
-            if (item.crc32 != item.calculateCrc32()) {
-                err = eraseEntryAndSpan(i);
-                if (err != ESP_OK) {
-                    mState = PageState::INVALID;
-                    return err;
-                }
+        if (item.crc32 != item.calculateCrc32()) {
+            if (!repair) {
                 continue;
             }
-
-            assert(item.span > 0);
-
-            err = mHashList.insert(item, i);
+            err = eraseEntryAndSpan(i);
             if (err != ESP_OK) {
                 mState = PageState::INVALID;
                 return err;
             }
+            continue;
+        }
 
-            size_t span = item.span;
+        assert(item.span > 0);
 
-            if (isVariableLengthType(item.datatype)) {
-                for (size_t j = i + 1; j < i + span; ++j) {
-                    if (mEntryTable.get(j) != EntryState::WRITTEN) {
-                        eraseEntryAndSpan(i);
-                        break;
-                    }
-                }
+        err = mHashList.insert(item, i);
+        if (err != ESP_OK) {
+            if (repair) {
+                mState = PageState::INVALID;
             }
+            return err;
+        }
 
-            i += span - 1;
+        size_t span = item.span;
+
+        if (isVariableLengthType(item.datatype) && !isSpanWritten(i, span)) {
+            if (repair) {
+                eraseEntryAndSpan(i);
+            } else {
+                // leave the entries alone, but make sure the item can't be found
+                mHashList.erase(i);
+            }
         }
 
+        i += span - 1;
     }
 
     return ESP_OK;
 }
 
+esp_err_t Page::ensureLoaded(bool repair)
+{
+    if (mEntriesLoaded) {
+        return ESP_OK;
+    }
+
+    MutexLock lock(*mLoadMutex);
+    if (mEntriesLoaded) {
+        return ESP_OK;
+    }
+    auto err = loadEntries(repair);
+    if (err != ESP_OK) {
+        return err;
+    }
+    mEntriesLoaded = true;
+    return ESP_OK;
+}
+
+bool Page::isSpanWritten(size_t index, size_t span) const
+{
+    for (size_t j = index + 1; j < index + span; ++j) {
+        if (j >= ENTRY_COUNT || mEntryTable.get(j) != EntryState::WRITTEN) {
+            return false;
+        }
+    }
+    return true;
+}
+
 
 esp_err_t Page::initialize()
 {
@@ -801,7 +995,7 @@ esp_err_t Page::readEntry(size_t index, Item& dst) const
     return ESP_OK;
 }
 
-esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, size_t &itemIndex, Item& item, uint8_t chunkIdx, VerOffset chunkStart)
+esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, size_t &itemIndex, Item& item, uint8_t chunkIdx, VerOffset chunkStart, bool repair)
 {
     if (mState == PageState::CORRUPT || mState == PageState::INVALID || mState == PageState::UNINITIALIZED) {
         return ESP_ERR_NVS_NOT_FOUND;
@@ -823,6 +1017,10 @@ esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, si
     }
 
     if (nsIndex != NS_ANY && datatype != ItemType::ANY && key != NULL) {
+        auto err = ensureLoaded(repair);
+        if (err != ESP_OK) {
+            return err;
+        }
         size_t cachedIndex = mHashList.find(start, Item(nsIndex, datatype, 0, key, chunkIdx));
         if (cachedIndex < ENTRY_COUNT) {
             start = cachedIndex;
@@ -840,12 +1038,18 @@ esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, si
 
         auto rc = readEntry(i, item);
         if (rc != ESP_OK) {
-            mState = PageState::INVALID;
+            if (repair) {
+                mState = PageState::INVALID;
+            }
             return rc;
         }
 
         auto crc32 = item.calculateCrc32();
         if (item.crc32 != crc32) {
+            if (!repair) {
+                // skip the entry, it will be erased by the next lookup which is allowed to modify the page
+                continue;
+            }
             rc = eraseEntryAndSpan(i);
             if (rc != ESP_OK) {
                 mState = PageState::INVALID;
@@ -856,6 +1060,18 @@ esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, si
 
         if (isVariableLengthType(item.datatype)) {
             next = i + item.span;
+
+            // a page which isn't loaded yet may still contain partially written items
+            if (!mEntriesLoaded && !isSpanWritten(i, item.span)) {
+                if (repair) {
+                    rc = eraseEntryAndSpan(i);
+                    if (rc != ESP_OK) {
+                        mState = PageState::INVALID;
+                        return rc;
+                    }
+                }
+                continue;
+            }
         }
 
         if (nsIndex != NS_ANY && item.nsIndex != nsIndex) {
@@ -942,6 +1158,7 @@ esp_err_t Page::erase()
     mNextFreeEntry = INVALID_ENTRY;
     mState = PageState::UNINITIALIZED;
     mHashList.clear();
+    mEntriesLoaded = true;
     return ESP_OK;
 }
 
@@ -972,6 +1189,16 @@ size_t Page::getVarDataTailroom() const
     return ((mNextFreeEntry < (ENTRY_COUNT-1)) ? ((ENTRY_COUNT - mNextFreeEntry - 1) * ENTRY_SIZE): 0);
 }
 
+size_t Page::getFreeEntryCount() const
+{
+    if (mState == PageState::UNINITIALIZED) {
+        return ENTRY_COUNT;
+    } else if (mState != PageState::ACTIVE || mNextFreeEntry >= ENTRY_COUNT) {
+        return 0;
+    }
+    return ENTRY_COUNT - mNextFreeEntry;
+}
+
 const char* Page::pageStateToName(PageState ps)
 {
     switch (ps) {
@@ -20,11 +20,13 @@
 #include <type_traits>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
 #include "esp_spi_flash.h"
 #include "compressed_enum_table.hpp"
 #include "intrusive_list.h"
 #include "nvs_item_hash_list.hpp"
 #include "partition.hpp"
+#include "nvs_platform.hpp"
 
 namespace nvs
 {
@@ -85,7 +87,15 @@ public:
         return mState;
     }
 
-    esp_err_t load(Partition *partition, uint32_t sectorNumber);
+    /* If deferredLoadMutex is given and the page is full, only the page header and the entry state table are read.
+     * Checking the entries and filling the hash list is done on the first lookup by key, under deferredLoadMutex,
+     * so that concurrent readers may trigger it. */
+    esp_err_t load(Partition *partition, uint32_t sectorNumber, Mutex* deferredLoadMutex = nullptr);
+
+    bool isLoaded() const
+    {
+        return mEntriesLoaded;
+    }
 
     esp_err_t getSeqNumber(uint32_t& seqNumber) const;
 
@@ -95,7 +105,9 @@ public:
 
     esp_err_t writeItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY);
 
-    esp_err_t readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
+    /* Entries found to be corrupted are erased on the way, unless 'repair' is false.
+     * Lookups done by readers holding the storage lock in shared mode must pass false, as they may not modify the page. */
+    esp_err_t readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY, bool repair = true);
 
     esp_err_t cmpItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
@@ -103,7 +115,14 @@ public:
 
     esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
-    esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, size_t &itemIndex, Item& item, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
+    esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, size_t &itemIndex, Item& item, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY, bool repair = true);
+
+    /* Appends complete items (header entries, each followed by its data entries) using a single
+     * flash write for the entries and a single update of the entry state table. */
+    esp_err_t writeEntries(const Item* entries, size_t count);
+
+    /* Erases the items starting at the given entries. Each modified word of the entry state table is written once. */
+    esp_err_t eraseEntries(const size_t* indices, size_t count);
 
     template<typename T>
     esp_err_t writeItem(uint8_t nsIndex, const char* key, const T& value)
@@ -140,12 +159,18 @@ public:
     }
     size_t getVarDataTailroom() const ;
 
+    size_t getFreeEntryCount() const;
+
     esp_err_t markFull();
 
     esp_err_t markFreeing();
 
     esp_err_t copyItems(Page& other);
 
+    /* Appends the item which starts at the given entry to 'other' and erases it here, the same way
+     * an updated value replaces the old one. 'other' has to be the active page. */
+    esp_err_t moveItem(size_t index, Page& other);
+
     esp_err_t erase();
 
     void debugDump() const;
@@ -178,7 +203,13 @@ protected:
         INVALID = 0x4 // entry is in inconsistent state (write started but ESB_WRITTEN has not been set yet)
     };
 
-    esp_err_t mLoadEntryTable();
+    esp_err_t mLoadEntryTable(bool deferFullPage);
+
+    esp_err_t loadEntries(bool repair);
+
+    esp_err_t ensureLoaded(bool repair);
+
+    bool isSpanWritten(size_t index, size_t span) const;
 
     esp_err_t initialize();
 
@@ -192,10 +223,12 @@ protected:
 
     esp_err_t writeEntry(const Item& item);
 
-    esp_err_t writeEntryData(const uint8_t* data, size_t size);
+    esp_err_t writeEntrySpan(const Item& header, const uint8_t* data, size_t dataSize);
 
     esp_err_t eraseEntryAndSpan(size_t index);
 
+    esp_err_t copyItem(size_t index, Page& other, size_t& span);
+
     void updateFirstUsedEntry(size_t index, size_t span);
 
     static constexpr size_t getAlignmentForType(ItemType type)
@@ -228,6 +261,9 @@ protected:
 
     Partition *mPartition;
 
+    Mutex* mLoadMutex = nullptr;
+    std::atomic<bool> mEntriesLoaded{true};
+
     static const uint32_t HEADER_OFFSET = 0;
     static const uint32_t ENTRY_TABLE_OFFSET = HEADER_OFFSET + 32;
     static const uint32_t ENTRY_DATA_OFFSET = ENTRY_TABLE_OFFSET + 32;
@@ -235,6 +271,7 @@ protected:
     static_assert(sizeof(Header) == 32, "header size must be 32 bytes");
     static_assert(ENTRY_TABLE_OFFSET % 32 == 0, "entry table offset should be aligned");
     static_assert(ENTRY_DATA_OFFSET % 32 == 0, "entry data offset should be aligned");
+    static_assert(HashList::SLOT_COUNT > ENTRY_COUNT, "hash list should be able to hold all entries of the page");
 
 }; // class Page
 
@@ -15,14 +15,24 @@
 
 namespace nvs
 {
-esp_err_t PageManager::load(Partition *partition, uint32_t baseSector, uint32_t sectorCount)
+esp_err_t PageManager::load(Partition *partition, uint32_t baseSector, uint32_t sectorCount, bool deferPageLoading)
 {
     if (partition == nullptr) {
         return ESP_ERR_INVALID_ARG;
     }
 
+    Mutex* loadMutex = nullptr;
+    if (deferPageLoading) {
+        auto err = mLoadMutex.init();
+        if (err != ESP_OK) {
+            return err;
+        }
+        loadMutex = &mLoadMutex;
+    }
+
     mBaseSector = baseSector;
     mPageCount = sectorCount;
+    mPendingDuplicatePage = nullptr;
     mPageList.clear();
     mFreePageList.clear();
     mPages.reset(new (nothrow) Page[sectorCount]);
@@ -30,7 +40,7 @@ esp_err_t PageManager::load(Partition *partition, uint32_t baseSector, uint32_t
     if (!mPages) return ESP_ERR_NO_MEM;
 
     for (uint32_t i = 0; i < sectorCount; ++i) {
-        auto err = mPages[i].load(partition, baseSector + i);
+        auto err = mPages[i].load(partition, baseSector + i, loadMutex);
         if (err != ESP_OK) {
             return err;
         }
@@ -70,7 +80,11 @@ esp_err_t PageManager::load(Partition *partition, uint32_t baseSector, uint32_t
         lastItemIndex = itemIndex;
     }
 
-    if (lastItemIndex != SIZE_MAX) {
+    if (lastItemIndex != SIZE_MAX && deferPageLoading) {
+        // looking up the key on each page would load all of them, leave it to the caller
+        mPendingDuplicateItem = item;
+        mPendingDuplicatePage = &lastPage;
+    } else if (lastItemIndex != SIZE_MAX) {
         auto last = PageManager::TPageListIterator(&lastPage);
         TPageListIterator it;
 
@@ -99,6 +113,9 @@ esp_err_t PageManager::load(Partition *partition, uint32_t baseSector, uint32_t
         if (it->state() == Page::PageState::FREEING) {
             Page* newPage = &mPageList.back();
             if (newPage->state() == Page::PageState::ACTIVE) {
+                if (newPage == mPendingDuplicatePage) {
+                    mPendingDuplicatePage = nullptr;
+                }
                 auto err = newPage->erase();
                 if (err != ESP_OK) {
                     return err;
@@ -137,7 +154,7 @@ esp_err_t PageManager::load(Partition *partition, uint32_t baseSector, uint32_t
     return ESP_OK;
 }
 
-esp_err_t PageManager::requestNewPage()
+esp_err_t PageManager::requestNewPage(Page** freedPage)
 {
     if (mFreePageList.empty()) {
         return ESP_ERR_NVS_INVALID_STATE;
@@ -164,6 +181,59 @@ esp_err_t PageManager::requestNewPage()
         return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
     }
 
+    return freePage(maxUnusedItemsPageIt, freedPage);
+}
+
+Page* PageManager::findPageToCompact(size_t minErasedEntries)
+{
+    // with two free pages, the next request for a new page doesn't have to free one
+    if (mFreePageList.size() != 1) {
+        return nullptr;
+    }
+
+    Page& activePage = back();
+    if (activePage.state() != Page::PageState::ACTIVE) {
+        return nullptr;
+    }
+
+    Page* maxErasedItemsPage = nullptr;
+    size_t maxErasedItems = 0;
+    for (auto it = begin(); it != end(); ++it) {
+        auto erased = it->getErasedEntryCount();
+        if (&*it != &activePage && erased > maxErasedItems) {
+            maxErasedItemsPage = it;
+            maxErasedItems = erased;
+        }
+    }
+
+    if (maxErasedItems == 0 || maxErasedItems < minErasedEntries) {
+        return nullptr;
+    }
+
+    // the remaining items go to the active page, the free page is kept for requestNewPage
+    if (maxErasedItemsPage->getUsedEntryCount() > activePage.getFreeEntryCount()) {
+        return nullptr;
+    }
+
+    return maxErasedItemsPage;
+}
+
+esp_err_t PageManager::releasePage(Page* page)
+{
+    assert(page != &back() && page->getUsedEntryCount() == 0);
+
+    auto err = page->erase();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    mPageList.erase(page);
+    mFreePageList.push_back(page);
+    return ESP_OK;
+}
+
+esp_err_t PageManager::freePage(TPageListIterator pageIt, Page** freedPage)
+{
     esp_err_t err = activatePage();
     if (err != ESP_OK) {
         return err;
@@ -171,7 +241,7 @@ esp_err_t PageManager::requestNewPage()
 
     Page* newPage = &mPageList.back();
 
-    Page* erasedPage = maxUnusedItemsPageIt;
+    Page* erasedPage = pageIt;
 
 #ifndef NDEBUG
     size_t usedEntries = erasedPage->getUsedEntryCount();
@@ -194,9 +264,14 @@ esp_err_t PageManager::requestNewPage()
     assert(usedEntries == newPage->getUsedEntryCount());
 #endif
 
-    mPageList.erase(maxUnusedItemsPageIt);
+    mPageList.erase(pageIt);
     mFreePageList.push_back(erasedPage);
 
+    // items of erasedPage now live in newPage, let the caller know so that it can update its references
+    if (freedPage) {
+        *freedPage = erasedPage;
+    }
+
     return ESP_OK;
 }
 
@@ -31,7 +31,8 @@ public:
 
     PageManager() {}
 
-    esp_err_t load(Partition *partition, uint32_t baseSector, uint32_t sectorCount);
+    /* With deferPageLoading, full pages are only loaded partially, see Page::load */
+    esp_err_t load(Partition *partition, uint32_t baseSector, uint32_t sectorCount, bool deferPageLoading = false);
 
     TPageListIterator begin()
     {
@@ -52,10 +53,28 @@ public:
         return mPageCount;
     }
 
-    esp_err_t requestNewPage();
+    esp_err_t requestNewPage(Page** freedPage = nullptr);
+
+    /* Returns the page to compact ahead of time, or nullptr if there is nothing to do. Once only one free page is
+     * left, requestNewPage would have to compact the page with the most erased entries. If that page has at least
+     * minErasedEntries erased entries and its remaining items fit into the active page, the caller may move them
+     * there one by one (Page::moveItem) and call releasePage once the page is empty. */
+    Page* findPageToCompact(size_t minErasedEntries);
+
+    /* Erases a page without items and puts it back on the list of free pages. */
+    esp_err_t releasePage(Page* page);
 
     esp_err_t fillStats(nvs_stats_t& nvsStats);
 
+    /* Returns the page holding the last written item, if load() deferred the search for an older copy of that item.
+     * Such a copy is left behind if power went off during an update. The caller has to erase it from one
+     * of the pages in front of the returned one, the same way as load() would have done. */
+    Page* getPendingDuplicate(Item& item)
+    {
+        item = mPendingDuplicateItem;
+        return mPendingDuplicatePage;
+    }
+
     uint32_t getBaseSector()
     {
         return mBaseSector;
@@ -66,12 +85,17 @@ protected:
 
     esp_err_t activatePage();
 
+    esp_err_t freePage(TPageListIterator pageIt, Page** freedPage);
+
     TPageList mPageList;
     TPageList mFreePageList;
     std::unique_ptr<Page[]> mPages;
     uint32_t mBaseSector;
     uint32_t mPageCount;
     uint32_t mSeqNumber;
+    Mutex mLoadMutex;
+    Item mPendingDuplicateItem;
+    Page* mPendingDuplicatePage = nullptr;
 }; // class PageManager
 
 
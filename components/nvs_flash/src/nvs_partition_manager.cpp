@@ -21,6 +21,18 @@
 
 namespace nvs {
 
+#ifdef CONFIG_NVS_ITEM_INDEX
+static const bool USE_ITEM_INDEX = true;
+#else
+static const bool USE_ITEM_INDEX = false;
+#endif // CONFIG_NVS_ITEM_INDEX
+
+#ifdef CONFIG_NVS_DEFER_PAGE_LOADING
+static const bool DEFER_PAGE_LOADING = true;
+#else
+static const bool DEFER_PAGE_LOADING = false;
+#endif // CONFIG_NVS_DEFER_PAGE_LOADING
+
 NVSPartitionManager* NVSPartitionManager::instance = nullptr;
 
 NVSPartitionManager* NVSPartitionManager::get_instance()
@@ -78,7 +90,7 @@ esp_err_t NVSPartitionManager::init_custom(Partition *partition, uint32_t baseSe
     Storage* new_storage = nullptr;
     Storage* storage = lookup_storage_from_name(partition->get_partition_name());
     if (storage == nullptr) {
-        new_storage = new (std::nothrow) Storage(partition);
+        new_storage = new (std::nothrow) Storage(partition, USE_ITEM_INDEX, DEFER_PAGE_LOADING);
 
         if (new_storage == nullptr) {
             return ESP_ERR_NO_MEM;
@@ -96,7 +108,14 @@ esp_err_t NVSPartitionManager::init_custom(Partition *partition, uint32_t baseSe
         }
     }
 
-    esp_err_t err = storage->init(baseSector, sectorCount);
+    esp_err_t err;
+    if (new_storage != nullptr) {
+        err = storage->init(baseSector, sectorCount);
+    } else {
+        ExclusiveLock storageLock(storage->getLock());
+        err = storage->init(baseSector, sectorCount);
+    }
+
     if (new_storage != nullptr) {
         if (err == ESP_OK) {
             nvs_storage_list.push_back(new_storage);
@@ -164,8 +183,14 @@ esp_err_t NVSPartitionManager::deinit_partition(const char *partition_label)
         }
     }
 
-    /* Finally delete the storage and its partition */
+    /* Nothing can find the storage any more. Operations which still use it have locked it with the global lock
+     * held, as the caller does now, so once it can be locked here no other task is using or waiting for it. */
     nvs_storage_list.erase(storage);
+    {
+        ExclusiveLock storageLock(storage->getLock());
+    }
+
+    /* Finally delete the storage and its partition */
     delete storage;
 
     for (auto it = nvs_partition_list.begin(); it != nvs_partition_list.end(); ++it) {
@@ -197,7 +222,15 @@ esp_err_t NVSPartitionManager::open_handle(const char *part_name,
         return ESP_ERR_NVS_PART_NOT_FOUND;
     }
 
-    esp_err_t err = sHandle->createOrOpenNamespace(ns_name, open_mode == NVS_READWRITE, nsIndex);
+    esp_err_t err;
+    if (open_mode == NVS_READWRITE) {
+        // may add the namespace
+        ExclusiveLock storageLock(sHandle->getLock());
+        err = sHandle->createOrOpenNamespace(ns_name, true, nsIndex);
+    } else {
+        SharedLock storageLock(sHandle->getLock());
+        err = sHandle->createOrOpenNamespace(ns_name, false, nsIndex);
+    }
     if (err != ESP_OK) {
         return err;
     }
@@ -229,6 +262,23 @@ size_t NVSPartitionManager::open_handles_size()
     return nvs_handles.size();
 }
 
+size_t NVSPartitionManager::storage_count()
+{
+    return nvs_storage_list.size();
+}
+
+Storage* NVSPartitionManager::storage_at(size_t index)
+{
+    auto it = nvs_storage_list.begin();
+    for (; index > 0 && it != nvs_storage_list.end(); --index) {
+        ++it;
+    }
+    if (it == nvs_storage_list.end()) {
+        return nullptr;
+    }
+    return it;
+}
+
 Storage* NVSPartitionManager::lookup_storage_from_name(const char* name)
 {
     auto it = find_if(begin(nvs_storage_list), end(nvs_storage_list), [=](Storage& e) -> bool {
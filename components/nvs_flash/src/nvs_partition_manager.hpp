@@ -35,6 +35,10 @@ public:
     esp_err_t secure_init_partition(const char *part_name, nvs_sec_cfg_t* cfg);
 #endif
 
+    /**
+     * Invalidates the handles of the partition and deletes its storage, once operations which are still using it
+     * have finished. Has to be called with nvs::Lock held.
+     */
     esp_err_t deinit_partition(const char *partition_label);
 
     Storage* lookup_storage_from_name(const char* name);
@@ -45,6 +49,13 @@ public:
 
     size_t open_handles_size();
 
+    size_t storage_count();
+
+    /**
+     * Returns the storage of the index-th initialized partition, or nullptr. Has to be called with nvs::Lock held.
+     */
+    Storage* storage_at(size_t index);
+
 protected:
     NVSPartitionManager() { }
 
@@ -14,6 +14,7 @@
 #ifndef nvs_platform_h
 #define nvs_platform_h
 
+#include "esp_err.h"
 
 #ifdef ESP_PLATFORM
 #include "freertos/FreeRTOS.h"
@@ -61,21 +62,405 @@ public:
 
     static SemaphoreHandle_t mSemaphore;
 };
+
+/**
+ * Plain mutex, used where a RWLock held in shared mode doesn't give enough protection.
+ */
+class Mutex
+{
+public:
+    Mutex() : mSemaphore(nullptr) { }
+
+    ~Mutex()
+    {
+        uninit();
+    }
+
+    esp_err_t init()
+    {
+        if (mSemaphore) {
+            return ESP_OK;
+        }
+        mSemaphore = xSemaphoreCreateMutex();
+        if (!mSemaphore) {
+            return ESP_ERR_NO_MEM;
+        }
+        return ESP_OK;
+    }
+
+    void uninit()
+    {
+        if (mSemaphore) {
+            vSemaphoreDelete(mSemaphore);
+        }
+        mSemaphore = nullptr;
+    }
+
+    void lock()
+    {
+        xSemaphoreTake(mSemaphore, portMAX_DELAY);
+    }
+
+    void unlock()
+    {
+        xSemaphoreGive(mSemaphore);
+    }
+
+protected:
+    SemaphoreHandle_t mSemaphore;
+};
+
+/**
+ * Reader/writer lock protecting a single Storage.
+ *
+ * Any number of readers may hold the lock at the same time, a writer holds it exclusively.
+ * The first reader takes mWriteSemaphore on behalf of all readers and the last one gives it back,
+ * so a binary semaphore (which may be given by another task) is used for it.
+ *
+ * Writers are preferred: a writer holds the mTurnstile mutex from the moment it starts waiting until it
+ * unlocks, and every reader passes through mTurnstile before it joins the other readers. So once a writer
+ * waits, no new readers get in, and the writer gets the lock as soon as the current readers are done.
+ * As mTurnstile is a mutex, a task which waits for a writer raises the writer's priority, like the
+ * global nvs::Lock does. Consequently, a task which already holds the lock in shared mode must not
+ * take it again, as a writer may be waiting in between.
+ */
+class RWLock
+{
+public:
+    RWLock() : mTurnstile(nullptr), mMutex(nullptr), mWriteSemaphore(nullptr), mReaderCount(0) { }
+
+    ~RWLock()
+    {
+        uninit();
+    }
+
+    esp_err_t init()
+    {
+        if (mMutex) {
+            return ESP_OK;
+        }
+        mTurnstile = xSemaphoreCreateMutex();
+        mMutex = xSemaphoreCreateMutex();
+        mWriteSemaphore = xSemaphoreCreateBinary();
+        if (!mTurnstile || !mMutex || !mWriteSemaphore) {
+            uninit();
+            return ESP_ERR_NO_MEM;
+        }
+        xSemaphoreGive(mWriteSemaphore);
+        return ESP_OK;
+    }
+
+    void uninit()
+    {
+        if (mTurnstile) {
+            vSemaphoreDelete(mTurnstile);
+        }
+        if (mMutex) {
+            vSemaphoreDelete(mMutex);
+        }
+        if (mWriteSemaphore) {
+            vSemaphoreDelete(mWriteSemaphore);
+        }
+        mTurnstile = nullptr;
+        mMutex = nullptr;
+        mWriteSemaphore = nullptr;
+    }
+
+    void lockShared()
+    {
+        // wait for a writer which is waiting or holds the lock
+        xSemaphoreTake(mTurnstile, portMAX_DELAY);
+        xSemaphoreGive(mTurnstile);
+
+        xSemaphoreTake(mMutex, portMAX_DELAY);
+        if (++mReaderCount == 1) {
+            xSemaphoreTake(mWriteSemaphore, portMAX_DELAY);
+        }
+        xSemaphoreGive(mMutex);
+    }
+
+    void unlockShared()
+    {
+        xSemaphoreTake(mMutex, portMAX_DELAY);
+        if (--mReaderCount == 0) {
+            xSemaphoreGive(mWriteSemaphore);
+        }
+        xSemaphoreGive(mMutex);
+    }
+
+    void lock()
+    {
+        xSemaphoreTake(mTurnstile, portMAX_DELAY);
+        xSemaphoreTake(mWriteSemaphore, portMAX_DELAY);
+    }
+
+    bool tryLock()
+    {
+        if (xSemaphoreTake(mTurnstile, 0) != pdTRUE) {
+            return false;
+        }
+        if (xSemaphoreTake(mWriteSemaphore, 0) != pdTRUE) {
+            xSemaphoreGive(mTurnstile);
+            return false;
+        }
+        return true;
+    }
+
+    void unlock()
+    {
+        xSemaphoreGive(mWriteSemaphore);
+        xSemaphoreGive(mTurnstile);
+    }
+
+protected:
+    SemaphoreHandle_t mTurnstile;
+    SemaphoreHandle_t mMutex;
+    SemaphoreHandle_t mWriteSemaphore;
+    size_t mReaderCount;
+};
 } // namespace nvs
 
 #else // ESP_PLATFORM
+#include <pthread.h>
+
 namespace nvs
 {
 class Lock
 {
 public:
-    Lock() { }
-    ~Lock() { }
+    Lock()
+    {
+        pthread_mutex_lock(&mutex());
+    }
+
+    ~Lock()
+    {
+        pthread_mutex_unlock(&mutex());
+    }
+
     static void init() {}
     static void uninit() {}
+
+protected:
+    static pthread_mutex_t& mutex()
+    {
+        static pthread_mutex_t sMutex = PTHREAD_MUTEX_INITIALIZER;
+        return sMutex;
+    }
+};
+
+class Mutex
+{
+public:
+    Mutex() : mInitialized(false) { }
+
+    ~Mutex()
+    {
+        uninit();
+    }
+
+    esp_err_t init()
+    {
+        if (mInitialized) {
+            return ESP_OK;
+        }
+        if (pthread_mutex_init(&mMutex, nullptr) != 0) {
+            return ESP_ERR_NO_MEM;
+        }
+        mInitialized = true;
+        return ESP_OK;
+    }
+
+    void uninit()
+    {
+        if (mInitialized) {
+            pthread_mutex_destroy(&mMutex);
+        }
+        mInitialized = false;
+    }
+
+    void lock()
+    {
+        pthread_mutex_lock(&mMutex);
+    }
+
+    void unlock()
+    {
+        pthread_mutex_unlock(&mMutex);
+    }
+
+protected:
+    pthread_mutex_t mMutex;
+    bool mInitialized;
+};
+
+class RWLock
+{
+public:
+    RWLock() : mInitialized(false) { }
+
+    ~RWLock()
+    {
+        uninit();
+    }
+
+    esp_err_t init()
+    {
+        if (mInitialized) {
+            return ESP_OK;
+        }
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+        // like the target implementation, block new readers while a writer waits
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        int res = pthread_rwlock_init(&mLock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+        if (res != 0) {
+            return ESP_ERR_NO_MEM;
+        }
+        mInitialized = true;
+        return ESP_OK;
+    }
+
+    void uninit()
+    {
+        if (mInitialized) {
+            pthread_rwlock_destroy(&mLock);
+        }
+        mInitialized = false;
+    }
+
+    void lockShared()
+    {
+        pthread_rwlock_rdlock(&mLock);
+    }
+
+    void unlockShared()
+    {
+        pthread_rwlock_unlock(&mLock);
+    }
+
+    void lock()
+    {
+        pthread_rwlock_wrlock(&mLock);
+    }
+
+    bool tryLock()
+    {
+        return pthread_rwlock_trywrlock(&mLock) == 0;
+    }
+
+    void unlock()
+    {
+        pthread_rwlock_unlock(&mLock);
+    }
+
+protected:
+    pthread_rwlock_t mLock;
+    bool mInitialized;
 };
 } // namespace nvs
 #endif // ESP_PLATFORM
 
+namespace nvs
+{
+
+/**
+ * Holds a RWLock in shared mode until the object is destroyed.
+ * Used for operations which don't modify the storage.
+ *
+ * The lock is taken by the constructor, or by acquire() if the object is default constructed.
+ * The latter allows taking the lock in a narrower scope, e.g. while the global Lock is held,
+ * and keeping it after that scope is left.
+ */
+class SharedLock
+{
+public:
+    SharedLock() : mLock(nullptr) { }
+
+    SharedLock(RWLock& lock) : mLock(nullptr)
+    {
+        acquire(lock);
+    }
+
+    ~SharedLock()
+    {
+        if (mLock) {
+            mLock->unlockShared();
+        }
+    }
+
+    void acquire(RWLock& lock)
+    {
+        lock.lockShared();
+        mLock = &lock;
+    }
+
+protected:
+    RWLock* mLock;
+
+private:
+    SharedLock(const SharedLock&);
+    SharedLock& operator=(const SharedLock&);
+};
+
+/**
+ * Holds a RWLock exclusively until the object is destroyed, see SharedLock.
+ */
+class ExclusiveLock
+{
+public:
+    ExclusiveLock() : mLock(nullptr) { }
+
+    ExclusiveLock(RWLock& lock) : mLock(nullptr)
+    {
+        acquire(lock);
+    }
+
+    ~ExclusiveLock()
+    {
+        if (mLock) {
+            mLock->unlock();
+        }
+    }
+
+    void acquire(RWLock& lock)
+    {
+        lock.lock();
+        mLock = &lock;
+    }
+
+protected:
+    RWLock* mLock;
+
+private:
+    ExclusiveLock(const ExclusiveLock&);
+    ExclusiveLock& operator=(const ExclusiveLock&);
+};
+
+/**
+ * Holds a Mutex for the lifetime of the object.
+ */
+class MutexLock
+{
+public:
+    MutexLock(Mutex& mutex) : mMutex(mutex)
+    {
+        mMutex.lock();
+    }
+
+    ~MutexLock()
+    {
+        mMutex.unlock();
+    }
+
+protected:
+    Mutex& mMutex;
+};
+
+} // namespace nvs
+
 
 #endif /* nvs_platform_h */
@@ -31,110 +31,157 @@ void Storage::clearNamespaces()
     mNamespaces.clearAndFreeNodes();
 }
 
-esp_err_t Storage::populateBlobIndices(TBlobIndexList& blobIdxList)
+esp_err_t Storage::loadItemLists(TBlobIndexList& blobIdxList, TBlobDataList& blobDataList)
 {
+    // In deferred page loading mode, PageManager leaves the search for an older copy of
+    // the last written item to us, so that all items are only read once.
+    Item lastItem;
+    Page* lastItemPage = mPageManager.getPendingDuplicate(lastItem);
+    bool beforeLastItemPage = lastItemPage != nullptr;
+    Page* oldBlobPage = nullptr;
+
     for (auto it = mPageManager.begin(); it != mPageManager.end(); ++it) {
         Page& p = *it;
         size_t itemIndex = 0;
         Item item;
 
+        if (&p == lastItemPage) {
+            beforeLastItemPage = false;
+        }
+
         /* If the power went off just after writing a blob index, the duplicate detection
          * logic in pagemanager will remove the earlier index. So we should never find a
          * duplicate index at this point */
 
-        while (p.findItem(Page::NS_ANY, ItemType::BLOB_IDX, nullptr, itemIndex, item) == ESP_OK) {
-            BlobIndexNode* entry = new (std::nothrow) BlobIndexNode;
+        while (p.findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK) {
+            const size_t currentIndex = itemIndex;
+            itemIndex += item.span;
 
-            if (!entry) return ESP_ERR_NO_MEM;
+            if (beforeLastItemPage && item.nsIndex == lastItem.nsIndex
+                    && strncmp(item.key, lastItem.key, Item::MAX_KEY_LENGTH) == 0) {
+                if (p.eraseItem(lastItem.nsIndex, lastItem.datatype, lastItem.key, lastItem.chunkIndex) == ESP_OK) {
+                    beforeLastItemPage = false;
+                    lastItemPage = nullptr;
+                    // the erased copy isn't necessarily the current item
+                    size_t checkIndex = currentIndex;
+                    Item checkItem;
+                    if (p.findItem(Page::NS_ANY, ItemType::ANY, nullptr, checkIndex, checkItem) != ESP_OK
+                            || checkIndex != currentIndex) {
+                        continue;
+                    }
+                } else if (item.datatype == ItemType::BLOB && !oldBlobPage) {
+                    oldBlobPage = &p;
+                }
+            }
 
-            item.getKey(entry->key, sizeof(entry->key));
-            entry->nsIndex = item.nsIndex;
-            entry->chunkStart = item.blobIndex.chunkStart;
-            entry->chunkCount = item.blobIndex.chunkCount;
+            if (item.nsIndex == Page::NS_INDEX && item.datatype == ItemType::U8) {
+                NamespaceEntry* entry = new (std::nothrow) NamespaceEntry;
 
-            blobIdxList.push_back(entry);
-            itemIndex += item.span;
+                if (!entry) return ESP_ERR_NO_MEM;
+
+                item.getKey(entry->mName, sizeof(entry->mName));
+                item.getValue(entry->mIndex);
+                mNamespaces.push_back(entry);
+                mNamespaceUsage.set(entry->mIndex, true);
+            } else if (item.datatype == ItemType::BLOB_IDX) {
+                BlobIndexNode* entry = new (std::nothrow) BlobIndexNode;
+
+                if (!entry) return ESP_ERR_NO_MEM;
+
+                item.getKey(entry->key, sizeof(entry->key));
+                entry->nsIndex = item.nsIndex;
+                entry->chunkStart = item.blobIndex.chunkStart;
+                entry->chunkCount = item.blobIndex.chunkCount;
+
+                blobIdxList.push_back(entry);
+            } else if (item.datatype == ItemType::BLOB_DATA) {
+                BlobDataNode* entry = new (std::nothrow) BlobDataNode;
+
+                if (!entry) return ESP_ERR_NO_MEM;
+
+                item.getKey(entry->key, sizeof(entry->key));
+                entry->nsIndex = item.nsIndex;
+                entry->chunkIndex = item.chunkIndex;
+                entry->page = &p;
+
+                blobDataList.push_back(entry);
+            }
         }
     }
 
+    if (lastItemPage && lastItem.datatype == ItemType::BLOB_IDX && oldBlobPage) {
+        /* Rare case in which the blob was stored using old format, but power went just after writing
+         * blob index during modification. Delete the old version blob*/
+        oldBlobPage->eraseItem(lastItem.nsIndex, ItemType::BLOB, lastItem.key, lastItem.chunkIndex);
+    }
+
     return ESP_OK;
 }
 
-void Storage::eraseOrphanDataBlobs(TBlobIndexList& blobIdxList)
+void Storage::eraseOrphanDataBlobs(TBlobIndexList& blobIdxList, TBlobDataList& blobDataList)
 {
-    for (auto it = mPageManager.begin(); it != mPageManager.end(); ++it) {
-        Page& p = *it;
-        size_t itemIndex = 0;
-        Item item;
-        /* Chunks with same <ns,key> and with chunkIndex in the following ranges
-         * belong to same family.
-         * 1) VER_0_OFFSET <= chunkIndex < VER_1_OFFSET-1 => Version0 chunks
-         * 2) VER_1_OFFSET <= chunkIndex < VER_ANY => Version1 chunks
-         */
-        while (p.findItem(Page::NS_ANY, ItemType::BLOB_DATA, nullptr, itemIndex, item) == ESP_OK) {
-
-            auto iter = std::find_if(blobIdxList.begin(),
-                    blobIdxList.end(),
-                    [=] (const BlobIndexNode& e) -> bool
-                    {return (strncmp(item.key, e.key, sizeof(e.key) - 1) == 0)
-                            && (item.nsIndex == e.nsIndex)
-                            && (item.chunkIndex >=  static_cast<uint8_t> (e.chunkStart))
-                            && (item.chunkIndex < static_cast<uint8_t> (e.chunkStart) + e.chunkCount);});
-            if (iter == std::end(blobIdxList)) {
-                p.eraseItem(item.nsIndex, item.datatype, item.key, item.chunkIndex);
-            }
-            itemIndex += item.span;
+    /* Chunks with same <ns,key> and with chunkIndex in the following ranges
+     * belong to same family.
+     * 1) VER_0_OFFSET <= chunkIndex < VER_1_OFFSET-1 => Version0 chunks
+     * 2) VER_1_OFFSET <= chunkIndex < VER_ANY => Version1 chunks
+     */
+    for (auto it = blobDataList.begin(); it != blobDataList.end(); ++it) {
+        const BlobDataNode& data = *it;
+        auto iter = std::find_if(blobIdxList.begin(),
+                blobIdxList.end(),
+                [=] (const BlobIndexNode& e) -> bool
+                {return (strncmp(data.key, e.key, sizeof(e.key) - 1) == 0)
+                        && (data.nsIndex == e.nsIndex)
+                        && (data.chunkIndex >=  static_cast<uint8_t> (e.chunkStart))
+                        && (data.chunkIndex < static_cast<uint8_t> (e.chunkStart) + e.chunkCount);});
+        if (iter == std::end(blobIdxList)) {
+            data.page->eraseItem(data.nsIndex, ItemType::BLOB_DATA, data.key, data.chunkIndex);
         }
     }
 }
 
 esp_err_t Storage::init(uint32_t baseSector, uint32_t sectorCount)
 {
-    auto err = mPageManager.load(mPartition, baseSector, sectorCount);
+    auto err = mLock.init();
     if (err != ESP_OK) {
-        mState = StorageState::INVALID;
         return err;
     }
 
-    // load namespaces list
-    clearNamespaces();
-    std::fill_n(mNamespaceUsage.data(), mNamespaceUsage.byteSize() / 4, 0);
-    for (auto it = mPageManager.begin(); it != mPageManager.end(); ++it) {
-        Page& p = *it;
-        size_t itemIndex = 0;
-        Item item;
-        while (p.findItem(Page::NS_INDEX, ItemType::U8, nullptr, itemIndex, item) == ESP_OK) {
-            NamespaceEntry* entry = new (std::nothrow) NamespaceEntry;
-
-            if (!entry) {
-                mState = StorageState::INVALID;
-                return ESP_ERR_NO_MEM;
-            }
+    mItemIndex.clear();
 
-            item.getKey(entry->mName, sizeof(entry->mName));
-            item.getValue(entry->mIndex);
-            mNamespaces.push_back(entry);
-            mNamespaceUsage.set(entry->mIndex, true);
-            itemIndex += item.span;
-        }
+    err = mPageManager.load(mPartition, baseSector, sectorCount, mDeferPageLoading);
+    if (err != ESP_OK) {
+        mState = StorageState::INVALID;
+        return err;
     }
-    mNamespaceUsage.set(0, true);
-    mNamespaceUsage.set(255, true);
-    mState = StorageState::ACTIVE;
 
-    // Populate list of multi-page index entries.
+    // load namespaces list and multi-page blob entries
+    clearNamespaces();
+    std::fill_n(mNamespaceUsage.data(), mNamespaceUsage.byteSize() / 4, 0);
     TBlobIndexList blobIdxList;
-    err = populateBlobIndices(blobIdxList);
+    TBlobDataList blobDataList;
+    err = loadItemLists(blobIdxList, blobDataList);
     if (err != ESP_OK) {
+        blobIdxList.clearAndFreeNodes();
+        blobDataList.clearAndFreeNodes();
         mState = StorageState::INVALID;
         return ESP_ERR_NO_MEM;
     }
+    mNamespaceUsage.set(0, true);
+    mNamespaceUsage.set(255, true);
+    mState = StorageState::ACTIVE;
 
     // Remove the entries for which there is no parent multi-page index.
-    eraseOrphanDataBlobs(blobIdxList);
+    eraseOrphanDataBlobs(blobIdxList, blobDataList);
 
-    // Purge the blob index list
+    // Purge the blob lists
     blobIdxList.clearAndFreeNodes();
+    blobDataList.clearAndFreeNodes();
+
+    if (mUseItemIndex) {
+        // if there isn't enough memory for the index, lookups fall back to scanning all pages
+        buildItemIndex();
+    }
 
 #ifndef ESP_PLATFORM
     debugCheck();
@@ -147,11 +194,124 @@ bool Storage::isValid() const
     return mState == StorageState::ACTIVE;
 }
 
-esp_err_t Storage::findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx, VerOffset chunkStart)
+esp_err_t Storage::buildItemIndex()
 {
+    auto err = mItemIndex.init(mPageManager.getPageCount() * ITEM_INDEX_BUCKETS_PER_PAGE);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (auto it = mPageManager.begin(); it != mPageManager.end(); ++it) {
+        size_t itemIndex = 0;
+        Item item;
+        while (it->findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK) {
+            err = mItemIndex.insert(item, it);
+            if (err != ESP_OK) {
+                mItemIndex.clear();
+                return err;
+            }
+            itemIndex += item.span;
+        }
+    }
+    return ESP_OK;
+}
+
+void Storage::indexItem(Page* page, const Item& item)
+{
+    if (mItemIndex.isValid() && mItemIndex.insert(item, page) != ESP_OK) {
+        // an incomplete index can't be trusted, fall back to scanning all pages
+        mItemIndex.clear();
+    }
+}
+
+void Storage::unindexItem(Page* page, const Item& item)
+{
+    if (mItemIndex.isValid()) {
+        mItemIndex.erase(item, page);
+    }
+}
+
+esp_err_t Storage::requestNewPage()
+{
+    Page* freedPage = nullptr;
+    auto err = mPageManager.requestNewPage(&freedPage);
+    if (err == ESP_OK && freedPage != nullptr && mItemIndex.isValid()) {
+        mItemIndex.movePage(freedPage, &getCurrentPage());
+    }
+    return err;
+}
+
+esp_err_t Storage::collectGarbage(size_t minErasedEntries)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    Page* page = mPageManager.findPageToCompact(minErasedEntries);
+    if (page == nullptr) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    size_t itemIndex = 0;
+    Item item;
+    auto err = page->findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item);
+    if (err == ESP_ERR_NVS_NOT_FOUND && page->getUsedEntryCount() == 0) {
+        return mPageManager.releasePage(page);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    Page& activePage = getCurrentPage();
+    err = page->moveItem(itemIndex, activePage);
+    if (err != ESP_OK) {
+        // the item may have been copied without being erased
+        mItemIndex.clear();
+        return err;
+    }
+    unindexItem(page, item);
+    indexItem(&activePage, item);
+    return ESP_OK;
+}
+
+esp_err_t Storage::findIndexedItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx, VerOffset chunkStart, bool repair)
+{
+    /* The index may name more than one page. Pick the oldest one which really holds
+     * the item, same as the page by page search would do. */
+    Page* foundPage = nullptr;
+    uint32_t foundSeqNumber = UINT32_MAX;
+    mItemIndex.forEachPage(Item(nsIndex, datatype, 0, key, chunkIdx), [&](Page* candidate) {
+        uint32_t seqNumber;
+        if (candidate == foundPage
+                || candidate->getSeqNumber(seqNumber) != ESP_OK
+                || seqNumber >= foundSeqNumber) {
+            return;
+        }
+        size_t itemIndex = 0;
+        Item candidateItem;
+        if (candidate->findItem(nsIndex, datatype, key, itemIndex, candidateItem, chunkIdx, chunkStart, repair) == ESP_OK) {
+            foundPage = candidate;
+            foundSeqNumber = seqNumber;
+            item = candidateItem;
+        }
+    });
+
+    if (foundPage == nullptr) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    page = foundPage;
+    return ESP_OK;
+}
+
+esp_err_t Storage::findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx, VerOffset chunkStart, bool repair)
+{
+    if (mItemIndex.isValid() && nsIndex != Page::NS_ANY && datatype != ItemType::ANY && key != nullptr) {
+        return findIndexedItem(nsIndex, datatype, key, page, item, chunkIdx, chunkStart, repair);
+    }
+
     for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
         size_t itemIndex = 0;
-        auto err = it->findItem(nsIndex, datatype, key, itemIndex, item, chunkIdx, chunkStart);
+        auto err = it->findItem(nsIndex, datatype, key, itemIndex, item, chunkIdx, chunkStart, repair);
         if (err == ESP_OK) {
             page = it;
             return ESP_OK;
@@ -191,7 +351,7 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
                     return err;
                 }
             }
-            err = mPageManager.requestNewPage();
+            err = requestNewPage();
             if (err != ESP_OK) {
                 return err;
             } else if(getCurrentPage().getVarDataTailroom() == tailroom) {
@@ -210,13 +370,15 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
         chunkSize = (remainingSize > tailroom)? tailroom : remainingSize;
         remainingSize -= chunkSize;
 
+        const uint8_t chunkIdx = static_cast<uint8_t> (chunkStart) + chunkCount;
         err = page.writeItem(nsIndex, ItemType::BLOB_DATA, key,
-                static_cast<const uint8_t*> (data) + offset, chunkSize, static_cast<uint8_t> (chunkStart) + chunkCount);
+                static_cast<const uint8_t*> (data) + offset, chunkSize, chunkIdx);
         chunkCount++;
         assert(err != ESP_ERR_NVS_PAGE_FULL);
         if (err != ESP_OK) {
             break;
         } else {
+            indexItem(&page, Item(nsIndex, ItemType::BLOB_DATA, 0, key, chunkIdx));
             UsedPageNode* node = new (std::nothrow) UsedPageNode();
             if (!node) {
                 err = ESP_ERR_NO_MEM;
@@ -231,7 +393,7 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
                         break;
                     }
                 }
-                err = mPageManager.requestNewPage();
+                err = requestNewPage();
                 if (err != ESP_OK) {
                     break;
                 }
@@ -248,6 +410,9 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
 
             err = getCurrentPage().writeItem(nsIndex, ItemType::BLOB_IDX, key, item.data, sizeof(item.data));
             assert(err != ESP_ERR_NVS_PAGE_FULL);
+            if (err == ESP_OK) {
+                indexItem(&getCurrentPage(), Item(nsIndex, ItemType::BLOB_IDX, 0, key));
+            }
             break;
         }
     } while (1);
@@ -256,7 +421,10 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
         /* Anything failed, then we should erase all the written chunks*/
         int ii=0;
         for (auto it = std::begin(usedPages); it != std::end(usedPages); it++) {
-            it->mPage->eraseItem(nsIndex, ItemType::BLOB_DATA, key, ii++);
+            if (it->mPage->eraseItem(nsIndex, ItemType::BLOB_DATA, key, ii) == ESP_OK) {
+                unindexItem(it->mPage, Item(nsIndex, ItemType::BLOB_DATA, 0, key, ii));
+            }
+            ii++;
         }
     }
     usedPages.clearAndFreeNodes();
@@ -344,21 +512,22 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
             return ESP_OK;
         }
 
-        Page& page = getCurrentPage();
-        err = page.writeItem(nsIndex, datatype, key, data, dataSize);
+        Page* page = &getCurrentPage();
+        err = page->writeItem(nsIndex, datatype, key, data, dataSize);
         if (err == ESP_ERR_NVS_PAGE_FULL) {
-            if (page.state() != Page::PageState::FULL) {
-                err = page.markFull();
+            if (page->state() != Page::PageState::FULL) {
+                err = page->markFull();
                 if (err != ESP_OK) {
                     return err;
                 }
             }
-            err = mPageManager.requestNewPage();
+            err = requestNewPage();
             if (err != ESP_OK) {
                 return err;
             }
 
-            err = getCurrentPage().writeItem(nsIndex, datatype, key, data, dataSize);
+            page = &getCurrentPage();
+            err = page->writeItem(nsIndex, datatype, key, data, dataSize);
             if (err == ESP_ERR_NVS_PAGE_FULL) {
                 return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
             }
@@ -368,6 +537,7 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
         } else if (err != ESP_OK) {
             return err;
         }
+        indexItem(page, Item(nsIndex, datatype, 0, key));
     }
 
     if (findPage) {
@@ -382,10 +552,184 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
         if (err != ESP_OK) {
             return err;
         }
+        unindexItem(findPage, item);
+    }
+#ifndef ESP_PLATFORM
+    debugCheck();
+#endif
+    return ESP_OK;
+}
+
+esp_err_t Storage::writeItems(uint8_t nsIndex, ItemBatch& batch)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    esp_err_t err;
+    for (auto it = batch.begin(); it != batch.end(); ++it) {
+        if (it->datatype == ItemType::BLOB) {
+            err = writeItem(nsIndex, ItemType::BLOB, it->key, it->data, it->dataSize);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+
+    BatchPageWrite* pageWrite = new (std::nothrow) BatchPageWrite;
+    if (!pageWrite) {
+        return ESP_ERR_NO_MEM;
+    }
+    pageWrite->entryCount = 0;
+    pageWrite->updateCount = 0;
+
+    err = ESP_OK;
+    for (auto it = batch.begin(); it != batch.end() && err == ESP_OK; ++it) {
+        if (it->datatype == ItemType::BLOB) {
+            continue;
+        }
+
+        size_t entryCount = 1;
+        if (isVariableLengthType(it->datatype)) {
+            entryCount += (it->dataSize + Page::ENTRY_SIZE - 1) / Page::ENTRY_SIZE;
+        }
+
+        bool pageRequested = false;
+        while (true) {
+            // look up the previous value again after switching pages, it may have been moved
+            Page* oldPage = nullptr;
+            Item item;
+            err = findItem(nsIndex, it->datatype, it->key, oldPage, item);
+            if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+                break;
+            }
+            err = ESP_OK;
+
+            // same as in writeItem, don't write values which haven't changed
+            if (oldPage != nullptr && oldPage->cmpItem(nsIndex, it->datatype, it->key, it->data, it->dataSize) == ESP_OK) {
+                break;
+            }
+
+            Page& page = getCurrentPage();
+            if (pageWrite->entryCount + entryCount > page.getFreeEntryCount()) {
+                if (pageWrite->entryCount == 0 && pageRequested) {
+                    err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+                    break;
+                }
+                err = writeBatchPage(nsIndex, *pageWrite);
+                if (err != ESP_OK) {
+                    break;
+                }
+                if (page.state() != Page::PageState::FULL) {
+                    err = page.markFull();
+                    if (err != ESP_OK) {
+                        break;
+                    }
+                }
+                err = requestNewPage();
+                if (err != ESP_OK) {
+                    break;
+                }
+                pageRequested = true;
+                continue;
+            }
+
+            BatchPageWrite::Update& update = pageWrite->updates[pageWrite->updateCount++];
+            update.entry = it;
+            update.oldPage = oldPage;
+            update.oldIndex = 0;
+            if (oldPage != nullptr) {
+                err = oldPage->findItem(nsIndex, it->datatype, it->key, update.oldIndex, item);
+                if (err != ESP_OK) {
+                    break;
+                }
+            }
+
+            Item* header = &pageWrite->entries[pageWrite->entryCount];
+            *header = Item(nsIndex, it->datatype, entryCount, it->key);
+            if (!isVariableLengthType(it->datatype)) {
+                memcpy(header->data, it->data, it->dataSize);
+            } else {
+                header->varLength.dataCrc32 = Item::calculateCrc32(it->data, it->dataSize);
+                header->varLength.dataSize = it->dataSize;
+                header->varLength.reserved = 0xffff;
+                for (size_t i = 1; i < entryCount; ++i) {
+                    size_t offset = (i - 1) * Page::ENTRY_SIZE;
+                    size_t size = it->dataSize - offset;
+                    if (size > Page::ENTRY_SIZE) {
+                        size = Page::ENTRY_SIZE;
+                    }
+                    std::fill_n(header[i].rawData, Page::ENTRY_SIZE, 0xff);
+                    memcpy(header[i].rawData, it->data + offset, size);
+                }
+            }
+            header->crc32 = header->calculateCrc32();
+            pageWrite->entryCount += entryCount;
+            break;
+        }
+    }
+
+    if (err == ESP_OK) {
+        err = writeBatchPage(nsIndex, *pageWrite);
     }
+    delete pageWrite;
+
 #ifndef ESP_PLATFORM
     debugCheck();
 #endif
+    return err;
+}
+
+esp_err_t Storage::writeBatchPage(uint8_t nsIndex, BatchPageWrite& pageWrite)
+{
+    if (pageWrite.entryCount == 0) {
+        return ESP_OK;
+    }
+
+    Page& page = getCurrentPage();
+    auto err = page.writeEntries(pageWrite.entries, pageWrite.entryCount);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    for (size_t i = 0; i < pageWrite.updateCount; ++i) {
+        ItemBatch::Entry* entry = pageWrite.updates[i].entry;
+        indexItem(&page, Item(nsIndex, entry->datatype, 0, entry->key));
+    }
+
+    /* New values are in place, now erase the previous ones, collecting all of them which live on the same page */
+    for (size_t i = 0; i < pageWrite.updateCount; ++i) {
+        Page* oldPage = pageWrite.updates[i].oldPage;
+        if (oldPage == nullptr) {
+            continue;
+        }
+
+        size_t eraseCount = 0;
+        for (size_t j = i; j < pageWrite.updateCount; ++j) {
+            if (pageWrite.updates[j].oldPage == oldPage) {
+                pageWrite.eraseIndices[eraseCount++] = pageWrite.updates[j].oldIndex;
+            }
+        }
+
+        err = oldPage->eraseEntries(pageWrite.eraseIndices, eraseCount);
+        if (err == ESP_ERR_FLASH_OP_FAIL) {
+            return ESP_ERR_NVS_REMOVE_FAILED;
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        for (size_t j = i; j < pageWrite.updateCount; ++j) {
+            if (pageWrite.updates[j].oldPage == oldPage) {
+                ItemBatch::Entry* entry = pageWrite.updates[j].entry;
+                unindexItem(oldPage, Item(nsIndex, entry->datatype, 0, entry->key));
+                pageWrite.updates[j].oldPage = nullptr;
+            }
+        }
+    }
+
+    pageWrite.entryCount = 0;
+    pageWrite.updateCount = 0;
     return ESP_OK;
 }
 
@@ -442,7 +786,7 @@ esp_err_t Storage::readMultiPageBlob(uint8_t nsIndex, const char* key, void* dat
     Page* findPage = nullptr;
 
     /* First read the blob index */
-    auto err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item);
+    auto err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item, Page::CHUNK_ANY, VerOffset::VER_ANY, false);
     if (err != ESP_OK) {
         return err;
     }
@@ -456,14 +800,14 @@ esp_err_t Storage::readMultiPageBlob(uint8_t nsIndex, const char* key, void* dat
 
     /* Now read corresponding chunks */
     for (uint8_t chunkNum = 0; chunkNum < chunkCount; chunkNum++) {
-        err = findItem(nsIndex, ItemType::BLOB_DATA, key, findPage, item, static_cast<uint8_t> (chunkStart) + chunkNum);
+        err = findItem(nsIndex, ItemType::BLOB_DATA, key, findPage, item, static_cast<uint8_t> (chunkStart) + chunkNum, VerOffset::VER_ANY, false);
         if (err != ESP_OK) {
             if (err == ESP_ERR_NVS_NOT_FOUND) {
                 break;
             }
             return err;
         }
-        err = findPage->readItem(nsIndex, ItemType::BLOB_DATA, key, static_cast<uint8_t*>(data) + offset, item.varLength.dataSize, static_cast<uint8_t> (chunkStart) + chunkNum);
+        err = findPage->readItem(nsIndex, ItemType::BLOB_DATA, key, static_cast<uint8_t*>(data) + offset, item.varLength.dataSize, static_cast<uint8_t> (chunkStart) + chunkNum, VerOffset::VER_ANY, false);
         if (err != ESP_OK) {
             return err;
         }
@@ -473,9 +817,8 @@ esp_err_t Storage::readMultiPageBlob(uint8_t nsIndex, const char* key, void* dat
     if (err == ESP_OK) {
         assert(offset == dataSize);
     }
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        eraseMultiPageBlob(nsIndex, key); // cleanup if a chunk is not found
-    }
+    /* If a chunk is not found, the index is left in place as readers may not modify the storage.
+     * It is cleaned up when the blob is written or erased next time. */
     return err;
 }
 
@@ -536,12 +879,86 @@ esp_err_t Storage::readItem(uint8_t nsIndex, ItemType datatype, const char* key,
         } // else check if the blob is stored with earlier version format without index
     }
 
-    auto err = findItem(nsIndex, datatype, key, findPage, item);
+    auto err = findItem(nsIndex, datatype, key, findPage, item, Page::CHUNK_ANY, VerOffset::VER_ANY, false);
     if (err != ESP_OK) {
         return err;
     }
-    return findPage->readItem(nsIndex, datatype, key, data, dataSize);
+    return findPage->readItem(nsIndex, datatype, key, data, dataSize, Page::CHUNK_ANY, VerOffset::VER_ANY, false);
+
+}
+
+esp_err_t Storage::readBlobStream(uint8_t nsIndex, const char* key, nvs_blob_read_cb_t callback, void* ctx)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    Item item;
+    Page* findPage = nullptr;
+    uint8_t chunkCount = 1;
+    uint8_t chunkStart = Page::CHUNK_ANY;
+    ItemType chunkType = ItemType::BLOB_DATA;
+    size_t dataSize;
+
+    auto err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item, Page::CHUNK_ANY, VerOffset::VER_ANY, false);
+    if (err == ESP_OK) {
+        chunkCount = item.blobIndex.chunkCount;
+        chunkStart = static_cast<uint8_t>(item.blobIndex.chunkStart);
+        dataSize = item.blobIndex.dataSize;
+    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
+        // the blob may be stored with earlier version format without index, as a single item
+        err = findItem(nsIndex, ItemType::BLOB, key, findPage, item, Page::CHUNK_ANY, VerOffset::VER_ANY, false);
+        if (err != ESP_OK) {
+            return err;
+        }
+        chunkType = ItemType::BLOB;
+        dataSize = item.varLength.dataSize;
+    } else {
+        return err;
+    }
 
+    if (dataSize == 0) {
+        return ESP_OK;
+    }
+
+    // a chunk never takes more than one page
+    size_t bufferSize = dataSize;
+    if (bufferSize > Page::CHUNK_MAX_SIZE) {
+        bufferSize = Page::CHUNK_MAX_SIZE;
+    }
+    uint8_t* buffer = new (std::nothrow) uint8_t[bufferSize];
+    if (!buffer) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    size_t offset = 0;
+    for (uint8_t chunkNum = 0; chunkNum < chunkCount; chunkNum++) {
+        uint8_t chunkIdx = (chunkType == ItemType::BLOB) ? Page::CHUNK_ANY : chunkStart + chunkNum;
+        err = findItem(nsIndex, chunkType, key, findPage, item, chunkIdx, VerOffset::VER_ANY, false);
+        if (err != ESP_OK) {
+            break;
+        }
+        size_t chunkSize = item.varLength.dataSize;
+        if (chunkSize > bufferSize || offset + chunkSize > dataSize) {
+            err = ESP_ERR_NVS_INVALID_LENGTH;
+            break;
+        }
+        err = findPage->readItem(nsIndex, chunkType, key, buffer, chunkSize, chunkIdx, VerOffset::VER_ANY, false);
+        if (err != ESP_OK) {
+            break;
+        }
+        err = callback(buffer, chunkSize, ctx);
+        if (err != ESP_OK) {
+            break;
+        }
+        offset += chunkSize;
+    }
+
+    delete[] buffer;
+    if (err == ESP_OK && offset != dataSize) {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    return err;
 }
 
 esp_err_t Storage::eraseMultiPageBlob(uint8_t nsIndex, const char* key, VerOffset chunkStart)
@@ -561,6 +978,7 @@ esp_err_t Storage::eraseMultiPageBlob(uint8_t nsIndex, const char* key, VerOffse
     if (err != ESP_OK) {
         return err;
     }
+    unindexItem(findPage, item);
 
     uint8_t chunkCount = item.blobIndex.chunkCount;
 
@@ -583,6 +1001,7 @@ esp_err_t Storage::eraseMultiPageBlob(uint8_t nsIndex, const char* key, VerOffse
         if (err != ESP_OK) {
             return err;
         }
+        unindexItem(findPage, item);
 
     }
 
@@ -610,7 +1029,12 @@ esp_err_t Storage::eraseItem(uint8_t nsIndex, ItemType datatype, const char* key
         return eraseMultiPageBlob(nsIndex, key);
     }
 
-    return findPage->eraseItem(nsIndex, datatype, key);
+    err = findPage->eraseItem(nsIndex, datatype, key);
+    if (err != ESP_OK) {
+        return err;
+    }
+    unindexItem(findPage, item);
+    return ESP_OK;
 }
 
 esp_err_t Storage::eraseNamespace(uint8_t nsIndex)
@@ -630,6 +1054,11 @@ esp_err_t Storage::eraseNamespace(uint8_t nsIndex)
             }
         }
     }
+
+    if (mItemIndex.isValid()) {
+        // Page::eraseItem doesn't report which items were erased, so simply rebuild the index
+        buildItemIndex();
+    }
     return ESP_OK;
 
 }
@@ -642,12 +1071,12 @@ esp_err_t Storage::getItemDataSize(uint8_t nsIndex, ItemType datatype, const cha
 
     Item item;
     Page* findPage = nullptr;
-    auto err = findItem(nsIndex, datatype, key, findPage, item);
+    auto err = findItem(nsIndex, datatype, key, findPage, item, Page::CHUNK_ANY, VerOffset::VER_ANY, false);
     if (err != ESP_OK) {
         if (datatype != ItemType::BLOB) {
             return err;
         }
-        err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item);
+        err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item, Page::CHUNK_ANY, VerOffset::VER_ANY, false);
         if (err != ESP_OK) {
             return err;
         }
@@ -685,6 +1114,7 @@ void Storage::debugCheck()
                 assert(0);
             }
             keys.insert(std::make_pair(keystr, static_cast<Page*>(p)));
+            assert(!mItemIndex.isValid() || mItemIndex.contains(item, p));
             itemIndex += item.span;
             usedCount += item.span;
         }
@@ -711,7 +1141,7 @@ esp_err_t Storage::calcEntriesInNamespace(uint8_t nsIndex, size_t& usedEntries)
         size_t itemIndex = 0;
         Item item;
         while (true) {
-            auto err = it->findItem(nsIndex, ItemType::ANY, nullptr, itemIndex, item);
+            auto err = it->findItem(nsIndex, ItemType::ANY, nullptr, itemIndex, item, Page::CHUNK_ANY, VerOffset::VER_ANY, false);
             if (err == ESP_ERR_NVS_NOT_FOUND) {
                 break;
             }
@@ -775,7 +1205,7 @@ bool Storage::nextEntry(nvs_opaque_iterator_t* it)
 
     for (auto page = it->page; page != mPageManager.end(); ++page) {
         do {
-            err = page->findItem(it->nsIndex, (ItemType)it->type, nullptr, it->entryIndex, item);
+            err = page->findItem(it->nsIndex, (ItemType)it->type, nullptr, it->entryIndex, item, Page::CHUNK_ANY, VerOffset::VER_ANY, false);
             it->entryIndex += item.span;
             if(err == ESP_OK && isIterableItem(item) && !isMultipageBlob(item)) {
                 fillEntryInfo(item, it->entry_info);
@@ -20,6 +20,9 @@
 #include "nvs_types.hpp"
 #include "nvs_page.hpp"
 #include "nvs_pagemanager.hpp"
+#include "nvs_item_index.hpp"
+#include "nvs_item_batch.hpp"
+#include "nvs_platform.hpp"
 #include "partition.hpp"
 
 //extern void dumpBytes(const uint8_t* data, size_t count);
@@ -58,10 +61,39 @@ class Storage : public intrusive_list_node<Storage>
 
     typedef intrusive_list<BlobIndexNode> TBlobIndexList;
 
+    struct BlobDataNode: public intrusive_list_node<BlobDataNode> {
+        public:
+            char key[Item::MAX_KEY_LENGTH + 1];
+            uint8_t nsIndex;
+            uint8_t chunkIndex;
+            Page* page;
+    };
+
+    typedef intrusive_list<BlobDataNode> TBlobDataList;
+
+    // Roughly a quarter of Page::ENTRY_COUNT, so that item index chains stay short even when pages are full
+    static const size_t ITEM_INDEX_BUCKETS_PER_PAGE = 32;
+
+    // Part of a batch which is written to one page, see writeItems
+    struct BatchPageWrite {
+        struct Update {
+            ItemBatch::Entry* entry;
+            Page* oldPage;      // page holding the previous value, if any
+            size_t oldIndex;
+        };
+
+        Item entries[Page::ENTRY_COUNT];
+        Update updates[Page::ENTRY_COUNT];
+        size_t eraseIndices[Page::ENTRY_COUNT];
+        size_t entryCount;
+        size_t updateCount;
+    };
+
 public:
     ~Storage();
 
-    Storage(Partition *partition) : mPartition(partition) {
+    Storage(Partition *partition, bool useItemIndex = false, bool deferPageLoading = false)
+        : mPartition(partition), mUseItemIndex(useItemIndex), mDeferPageLoading(deferPageLoading) {
         if (partition == nullptr) {
             abort();
         }
@@ -71,16 +103,45 @@ public:
 
     bool isValid() const;
 
+    bool hasItemIndex() const
+    {
+        return mItemIndex.isValid();
+    }
+
     esp_err_t createOrOpenNamespace(const char* nsName, bool canCreate, uint8_t& nsIndex);
 
+    /**
+     * Lock which callers must hold while using this storage: exclusively for functions
+     * which modify it, in shared mode for readItem, getItemDataSize, calcEntriesInNamespace,
+     * fillStats, findEntry and nextEntry. These never modify the pages, so they may run in parallel.
+     */
+    RWLock& getLock()
+    {
+        return mLock;
+    }
+
     esp_err_t writeItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize);
 
     esp_err_t readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize);
 
+    /**
+     * Reads a blob one chunk at a time into a buffer of the size of a chunk and passes each chunk to the callback.
+     * Doesn't modify the storage, see readItem.
+     */
+    esp_err_t readBlobStream(uint8_t nsIndex, const char* key, nvs_blob_read_cb_t callback, void* ctx);
+
     esp_err_t getItemDataSize(uint8_t nsIndex, ItemType datatype, const char* key, size_t& dataSize);
 
     esp_err_t eraseItem(uint8_t nsIndex, ItemType datatype, const char* key);
 
+    /**
+     * Writes all values of the batch. Values which fit into one page are packed together, so that each page
+     * receives a single flash write for their entries, and the previous values are erased once per page.
+     * Blobs are written one by one, like writeItem does.
+     * If an error is returned, some of the values may have been written already.
+     */
+    esp_err_t writeItems(uint8_t nsIndex, ItemBatch& batch);
+
     template<typename T>
     esp_err_t writeItem(uint8_t nsIndex, const char* key, const T& value)
     {
@@ -131,6 +192,16 @@ public:
 
     esp_err_t calcEntriesInNamespace(uint8_t nsIndex, size_t& usedEntries);
 
+    /**
+     * Incremental garbage collection, meant to be called when the system is idle.
+     *
+     * Once only one free page is left, the page with the most erased entries (at least minErasedEntries) is
+     * compacted ahead of time, so that the following writes don't have to do it: each call moves one of its items
+     * to the active page, and the call after the last one erases the page. Returns ESP_ERR_NVS_NOT_FOUND if there
+     * is nothing to do.
+     */
+    esp_err_t collectGarbage(size_t minErasedEntries);
+
     bool findEntry(nvs_opaque_iterator_t*, const char* name);
 
     bool nextEntry(nvs_opaque_iterator_t* it);
@@ -144,13 +215,25 @@ protected:
 
     void clearNamespaces();
 
-    esp_err_t populateBlobIndices(TBlobIndexList&);
+    esp_err_t loadItemLists(TBlobIndexList&, TBlobDataList&);
 
-    void eraseOrphanDataBlobs(TBlobIndexList&);
+    void eraseOrphanDataBlobs(TBlobIndexList&, TBlobDataList&);
 
     void fillEntryInfo(Item &item, nvs_entry_info_t &info);
 
-    esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx = Page::CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
+    esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx = Page::CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY, bool repair = true);
+
+    esp_err_t findIndexedItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx, VerOffset chunkStart, bool repair);
+
+    esp_err_t buildItemIndex();
+
+    void indexItem(Page* page, const Item& item);
+
+    void unindexItem(Page* page, const Item& item);
+
+    esp_err_t requestNewPage();
+
+    esp_err_t writeBatchPage(uint8_t nsIndex, BatchPageWrite& pageWrite);
 
 protected:
     Partition *mPartition;
@@ -159,6 +242,10 @@ protected:
     TNamespaces mNamespaces;
     CompressedEnumTable<bool, 1, 256> mNamespaceUsage;
     StorageState mState = StorageState::INVALID;
+    bool mUseItemIndex;
+    bool mDeferPageLoading;
+    ItemIndex mItemIndex;
+    RWLock mLock;
 };
 
 } // namespace nvs
@@ -15,6 +15,7 @@
 #ifndef PARTITION_HPP_
 #define PARTITION_HPP_
 
+#include <cstddef>
 #include "esp_err.h"
 
 namespace nvs {
@@ -41,6 +42,33 @@ public:
 
     virtual esp_err_t write(size_t dst_offset, const void* src, size_t size) = 0;
 
+    /**
+     * One of the source buffers of write_gather().
+     */
+    struct WriteBuffer {
+        const void* src;
+        size_t size;
+    };
+
+    /**
+     * Write the concatenation of several buffers to consecutive addresses starting at dst_offset.
+     *
+     * The size of each buffer must satisfy the same constraints as for write(). The default
+     * implementation writes the buffers one by one, partitions which can do better with
+     * one large write (e.g. encrypted partitions) override it.
+     */
+    virtual esp_err_t write_gather(size_t dst_offset, const WriteBuffer* buffers, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            esp_err_t err = write(dst_offset, buffers[i].src, buffers[i].size);
+            if (err != ESP_OK) {
+                return err;
+            }
+            dst_offset += buffers[i].size;
+        }
+        return ESP_OK;
+    }
+
     virtual esp_err_t erase_range(size_t dst_offset, size_t size) = 0;
 
     /**
@@ -18,6 +18,7 @@
 #include <cassert>
 #include <algorithm>
 #include <random>
+#include <atomic>
 #include "esp_spi_flash.h"
 #include "catch.hpp"
 
@@ -232,12 +233,13 @@ protected:
     std::vector<uint32_t> mData;
     std::vector<uint32_t> mEraseCnt;
 
-    mutable size_t mReadOps = 0;
-    mutable size_t mWriteOps = 0;
-    mutable size_t mReadBytes = 0;
-    mutable size_t mWriteBytes = 0;
-    mutable size_t mEraseOps = 0;
-    mutable size_t mTotalTime = 0;
+    // read() may be called concurrently by readers sharing a storage lock
+    mutable std::atomic<size_t> mReadOps{0};
+    mutable std::atomic<size_t> mWriteOps{0};
+    mutable std::atomic<size_t> mReadBytes{0};
+    mutable std::atomic<size_t> mWriteBytes{0};
+    mutable std::atomic<size_t> mEraseOps{0};
+    mutable std::atomic<size_t> mTotalTime{0};
     size_t mLowerSectorBound = 0;
     size_t mUpperSectorBound = 0;
     
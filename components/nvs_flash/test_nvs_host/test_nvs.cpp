@@ -27,6 +27,13 @@
 #include <sys/wait.h>
 #include <string.h>
 #include <string>
+#include <map>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <mutex>
 
 #include "test_fixtures.hpp"
 
@@ -290,45 +297,95 @@ TEST_CASE("Page handles invalid CRC of variable length items", "[nvs][cur]")
     }
 }
 
-class HashListTestHelper : public HashList
-{
-    public:
-        size_t getBlockCount()
-        {
-            return mBlockList.size();
-        }
-};
-
 TEST_CASE("HashList is cleaned up as soon as items are erased", "[nvs]")
 {
-    HashListTestHelper hashlist;
+    HashList hashlist;
     // Add items
     const size_t count = 128;
     for (size_t i = 0; i < count; ++i) {
         char key[16];
         snprintf(key, sizeof(key), "i%ld", (long int)i);
         Item item(1, ItemType::U32, 1, key);
-        hashlist.insert(item, i);
+        TEST_ESP_OK(hashlist.insert(item, i));
     }
-    INFO("Added " << count << " items, " << hashlist.getBlockCount() << " blocks");
+    INFO("Added " << count << " items");
+    CHECK(hashlist.size() == count);
+    // the table is embedded, 4 bytes per slot
+    CHECK(sizeof(HashList) == HashList::SLOT_COUNT * 4 + sizeof(size_t));
     // Remove them in reverse order
     for (size_t i = count; i > 0; --i) {
         hashlist.erase(i - 1, true);
     }
-    CHECK(hashlist.getBlockCount() == 0);
+    CHECK(hashlist.size() == 0);
     // Add again
     for (size_t i = 0; i < count; ++i) {
         char key[16];
         snprintf(key, sizeof(key), "i%ld", (long int)i);
         Item item(1, ItemType::U32, 1, key);
-        hashlist.insert(item, i);
+        TEST_ESP_OK(hashlist.insert(item, i));
     }
-    INFO("Added " << count << " items, " << hashlist.getBlockCount() << " blocks");
+    INFO("Added " << count << " items");
     // Remove them in the same order
     for (size_t i = 0; i < count; ++i) {
         hashlist.erase(i, true);
     }
-    CHECK(hashlist.getBlockCount() == 0);
+    CHECK(hashlist.size() == 0);
+    for (size_t i = 0; i < count; ++i) {
+        char key[16];
+        snprintf(key, sizeof(key), "i%ld", (long int)i);
+        CHECK(hashlist.find(0, Item(1, ItemType::U32, 1, key)) == SIZE_MAX);
+    }
+}
+
+TEST_CASE("HashList finds remaining items after random erasures", "[nvs]")
+{
+    std::mt19937 gen(12);
+    HashList hashlist;
+    bool present[Page::ENTRY_COUNT] = {};
+    char key[16];
+    for (size_t round = 0; round < 2000; ++round) {
+        size_t index = gen() % Page::ENTRY_COUNT;
+        if (present[index]) {
+            hashlist.erase(index, true);
+        } else {
+            snprintf(key, sizeof(key), "k%d", static_cast<int>(index));
+            TEST_ESP_OK(hashlist.insert(Item(1, ItemType::U8, 1, key), index));
+        }
+        present[index] = !present[index];
+
+        if (round % 100 == 0) {
+            for (size_t i = 0; i < Page::ENTRY_COUNT; ++i) {
+                snprintf(key, sizeof(key), "k%d", static_cast<int>(i));
+                size_t found = hashlist.find(0, Item(1, ItemType::U8, 1, key));
+                CHECK(found == (present[i] ? i : SIZE_MAX));
+            }
+        }
+    }
+}
+
+TEST_CASE("HashList lookup benchmark", "[nvs]")
+{
+    HashList hashlist;
+    char key[16];
+    std::vector<Item> items;
+    for (size_t i = 0; i < Page::ENTRY_COUNT; ++i) {
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+        items.push_back(Item(1, ItemType::U32, 1, key));
+        TEST_ESP_OK(hashlist.insert(items.back(), i));
+    }
+
+    const size_t ROUNDS = 1000;
+    size_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < ROUNDS; ++round) {
+        for (size_t i = 0; i < Page::ENTRY_COUNT; ++i) {
+            found += (hashlist.find(0, items[i]) == i);
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    CHECK(found == ROUNDS * Page::ENTRY_COUNT);
+    s_perf << "HashList with " << Page::ENTRY_COUNT << " items: " << sizeof(HashList) << " bytes, "
+           << elapsed.count() / (ROUNDS * Page::ENTRY_COUNT) << " ns per lookup" << std::endl;
 }
 
 TEST_CASE("can init PageManager in empty flash", "[nvs]")
@@ -1606,8 +1663,9 @@ TEST_CASE("recovery after failure to write data", "[nvs]")
     PartitionEmulationFixture f(0, 3);
     const char str[] = "value 0123456789abcdef012345678value 0123456789abcdef012345678";
 
-    // make flash write fail exactly in Page::writeEntryData
-    f.emu.failAfter(17);
+    // make flash write fail in the middle of the item data, after the header and the first word
+    // of the last data entry have been written
+    f.emu.failAfter(25);
     {
         Storage storage(&f.part);
         TEST_ESP_OK(storage.init(0, 3));
@@ -1960,7 +2018,7 @@ TEST_CASE("Recovery from power-off when the entry being erased is not on active
     TEST_ESP_OK( nvs_open("test", NVS_READWRITE, &handle) );
 
     f.emu.clearStats();
-    f.emu.failAfter(Page::CHUNK_MAX_SIZE/4 + 75);
+    f.emu.failAfter(Page::CHUNK_MAX_SIZE/4 + 71);
     TEST_ESP_OK( nvs_set_blob(handle, "1a", blob, blob_size) );
     TEST_ESP_OK( nvs_set_blob(handle, "1b", blob, blob_size) );
 
@@ -3487,6 +3545,809 @@ TEST_CASE("check and read data from partition generated via manufacturing utilit
 }
 #endif
 
+TEST_CASE("storage item index gives the same results as page by page search", "[nvs]")
+{
+    std::mt19937 gen(42);
+    PartitionEmulationFixture f(0, 16);
+    f.emu.setBounds(2, 16);
+    Storage storage(&f.part, true);
+    TEST_ESP_OK(storage.init(2, 14));
+    REQUIRE(storage.hasItemIndex());
+
+    const size_t nKeys = 16;
+    std::map<std::string, int32_t> ints;
+    std::map<std::string, std::string> blobs;
+    char key[16];
+    for (size_t i = 0; i < 3000; ++i) {
+        const size_t k = gen() % nKeys;
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(k));
+        switch (gen() % 5) {
+        case 0:
+        case 1: {
+            int32_t value = static_cast<int32_t>(gen());
+            if (blobs.count(key)) {
+                TEST_ESP_OK(storage.eraseItem(1, ItemType::BLOB, key));
+                blobs.erase(key);
+            }
+            TEST_ESP_OK(storage.writeItem(1, key, value));
+            ints[key] = value;
+            break;
+        }
+        case 2: {
+            // some blobs are big enough to span several pages
+            std::string value((gen() % 8 == 0) ? Page::CHUNK_MAX_SIZE + 100 : 50, static_cast<char>(gen()));
+            if (ints.count(key)) {
+                TEST_ESP_OK(storage.eraseItem(1, key));
+                ints.erase(key);
+            }
+            TEST_ESP_OK(storage.writeItem(1, ItemType::BLOB, key, value.data(), value.size()));
+            blobs[key] = value;
+            break;
+        }
+        case 3:
+            if (ints.count(key) || blobs.count(key)) {
+                TEST_ESP_OK(storage.eraseItem(1, key));
+                ints.erase(key);
+                blobs.erase(key);
+            } else {
+                TEST_ESP_ERR(storage.eraseItem(1, key), ESP_ERR_NVS_NOT_FOUND);
+            }
+            break;
+        default: {
+            int32_t value;
+            if (ints.count(key)) {
+                TEST_ESP_OK(storage.readItem(1, key, value));
+                CHECK(value == ints[key]);
+            } else {
+                TEST_ESP_ERR(storage.readItem(1, key, value), ESP_ERR_NVS_NOT_FOUND);
+            }
+            break;
+        }
+        }
+    }
+    REQUIRE(storage.hasItemIndex());
+
+    // storage without index reads back exactly what the indexed one has written
+    Storage reference(&f.part);
+    TEST_ESP_OK(reference.init(2, 14));
+    for (size_t k = 0; k < nKeys; ++k) {
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(k));
+        int32_t value;
+        size_t size;
+        if (ints.count(key)) {
+            TEST_ESP_OK(reference.readItem(1, key, value));
+            CHECK(value == ints[key]);
+        } else {
+            TEST_ESP_ERR(reference.readItem(1, key, value), ESP_ERR_NVS_NOT_FOUND);
+        }
+        if (blobs.count(key)) {
+            std::string value(blobs[key].size(), 0);
+            TEST_ESP_OK(storage.getItemDataSize(1, ItemType::BLOB, key, size));
+            CHECK(size == value.size());
+            TEST_ESP_OK(reference.readItem(1, ItemType::BLOB, key, &value[0], value.size()));
+            CHECK(value == blobs[key]);
+        } else {
+            TEST_ESP_ERR(storage.getItemDataSize(1, ItemType::BLOB, key, size), ESP_ERR_NVS_NOT_FOUND);
+        }
+    }
+}
+
+TEST_CASE("storage item index speeds up lookups in large partitions", "[nvs]")
+{
+    const size_t KEY_COUNT = 10000;
+    const uint32_t SECTOR_COUNT = (KEY_COUNT + Page::ENTRY_COUNT - 1) / Page::ENTRY_COUNT + 1;
+    PartitionEmulationFixture f(0, SECTOR_COUNT);
+
+    // fill the pages directly, writing through Storage would run debugCheck after each item
+    char key[16];
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        if (i % Page::ENTRY_COUNT == 0) {
+            Page page;
+            TEST_ESP_OK(page.load(&f.part, i / Page::ENTRY_COUNT));
+            TEST_ESP_OK(page.setSeqNumber(i / Page::ENTRY_COUNT));
+            for (size_t j = i; j < std::min(KEY_COUNT, i + Page::ENTRY_COUNT); ++j) {
+                snprintf(key, sizeof(key), "key%05d", static_cast<int>(j));
+                TEST_ESP_OK(page.writeItem(1, key, static_cast<uint32_t>(j)));
+            }
+        }
+    }
+
+    for (bool useIndex : {false, true}) {
+        Storage storage(&f.part, useIndex);
+        TEST_ESP_OK(storage.init(0, SECTOR_COUNT));
+        CHECK(storage.hasItemIndex() == useIndex);
+
+        f.emu.clearStats();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < KEY_COUNT; ++i) {
+            snprintf(key, sizeof(key), "key%05d", static_cast<int>(i));
+            uint32_t value;
+            REQUIRE(storage.readItem(1, key, value) == ESP_OK);
+            REQUIRE(value == i);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        s_perf << "Time to read " << KEY_COUNT << " keys from " << SECTOR_COUNT << " sectors "
+               << (useIndex ? "with" : "without") << " item index: " << elapsed.count() << " us ("
+               << f.emu.getReadOps() << " reads)" << std::endl;
+    }
+}
+
+TEST_CASE("RWLock doesn't let new readers in while a writer waits", "[nvs]")
+{
+    RWLock lock;
+    TEST_ESP_OK(lock.init());
+    std::mutex orderMutex;
+    std::string order;
+    auto record = [&](char c) {
+        std::lock_guard<std::mutex> guard(orderMutex);
+        order += c;
+    };
+
+    lock.lockShared();
+    std::thread writer([&]() {
+        lock.lock();
+        record('w');
+        lock.unlock();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::thread reader([&]() {
+        lock.lockShared();
+        record('r');
+        lock.unlockShared();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    {
+        std::lock_guard<std::mutex> guard(orderMutex);
+        CHECK(order.empty());
+    }
+    lock.unlockShared();
+    writer.join();
+    reader.join();
+    CHECK(order == "wr");
+}
+
+TEST_CASE("concurrent readers and writers on two partitions", "[nvs]")
+{
+    const uint32_t SECTOR_COUNT = 8;
+    const size_t KEY_COUNT = 32;
+    const size_t READER_COUNT = 4;
+    const size_t ITERATIONS = 2000;
+    PartitionEmulationFixture calib(0, SECTOR_COUNT, "calib");
+    PartitionEmulationFixture config(0, SECTOR_COUNT, "config");
+
+    TEST_ESP_OK(NVSPartitionManager::get_instance()->init_custom(&calib.part, 0, SECTOR_COUNT));
+    TEST_ESP_OK(NVSPartitionManager::get_instance()->init_custom(&config.part, 0, SECTOR_COUNT));
+
+    /* Values carry the index of their key in the upper half, so that readers can tell
+     * whether they got a consistent value. Strings consist of a single repeated character. */
+    char key[16];
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open_from_partition("calib", "ns", NVS_READWRITE, &handle));
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+        TEST_ESP_OK(nvs_set_u32(handle, key, static_cast<uint32_t>(i << 16)));
+    }
+    TEST_ESP_OK(nvs_set_str(handle, "str", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"));
+    nvs_close(handle);
+
+    std::atomic<int> errors(0);
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+
+    // writer on the partition which is read by the other threads
+    threads.emplace_back([&]() {
+        nvs_handle_t h;
+        char k[16];
+        if (nvs_open_from_partition("calib", "ns", NVS_READWRITE, &h) != ESP_OK) {
+            ++errors;
+            return;
+        }
+        char str[49];
+        for (size_t i = 0; i < ITERATIONS; ++i) {
+            size_t index = i % KEY_COUNT;
+            snprintf(k, sizeof(k), "key%d", static_cast<int>(index));
+            if (nvs_set_u32(h, k, static_cast<uint32_t>((index << 16) | (i & 0xffff))) != ESP_OK) {
+                ++errors;
+            }
+            if (i % 8 == 0) {
+                memset(str, 'a' + (i / 8) % 26, sizeof(str) - 1);
+                str[sizeof(str) - 1] = 0;
+                if (nvs_set_str(h, "str", str) != ESP_OK) {
+                    ++errors;
+                }
+            }
+        }
+        nvs_close(h);
+    });
+
+    // writer on an unrelated partition
+    threads.emplace_back([&]() {
+        nvs_handle_t h;
+        if (nvs_open_from_partition("config", "ns", NVS_READWRITE, &h) != ESP_OK) {
+            ++errors;
+            return;
+        }
+        for (size_t i = 0; i < ITERATIONS; ++i) {
+            if (nvs_set_u32(h, "counter", static_cast<uint32_t>(i)) != ESP_OK) {
+                ++errors;
+            }
+        }
+        uint32_t value;
+        if (nvs_get_u32(h, "counter", &value) != ESP_OK || value != ITERATIONS - 1) {
+            ++mismatches;
+        }
+        nvs_close(h);
+    });
+
+    for (size_t r = 0; r < READER_COUNT; ++r) {
+        threads.emplace_back([&, r]() {
+            nvs_handle_t h;
+            char k[16];
+            if (nvs_open_from_partition("calib", "ns", NVS_READONLY, &h) != ESP_OK) {
+                ++errors;
+                return;
+            }
+            for (size_t i = 0; i < ITERATIONS; ++i) {
+                size_t index = (i + r) % KEY_COUNT;
+                snprintf(k, sizeof(k), "key%d", static_cast<int>(index));
+                uint32_t value;
+                if (nvs_get_u32(h, k, &value) != ESP_OK) {
+                    ++errors;
+                } else if (value >> 16 != index) {
+                    ++mismatches;
+                }
+
+                char str[64];
+                size_t len = sizeof(str);
+                if (nvs_get_str(h, "str", str, &len) != ESP_OK) {
+                    ++errors;
+                } else if (len != 49 || strspn(str, std::string(1, str[0]).c_str()) != 48) {
+                    ++mismatches;
+                }
+            }
+            nvs_close(h);
+        });
+    }
+
+    // reader using the C++ API
+    threads.emplace_back([&]() {
+        esp_err_t err;
+        std::unique_ptr<nvs::NVSHandle> h = nvs::open_nvs_handle_from_partition("calib", "ns", NVS_READONLY, &err);
+        if (err != ESP_OK) {
+            ++errors;
+            return;
+        }
+        for (size_t i = 0; i < ITERATIONS; ++i) {
+            uint32_t value;
+            if (h->get_item("key0", value) != ESP_OK) {
+                ++errors;
+            } else if (value >> 16 != 0) {
+                ++mismatches;
+            }
+        }
+    });
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    CHECK(errors == 0);
+    CHECK(mismatches == 0);
+
+    TEST_ESP_OK(nvs_open_from_partition("calib", "ns", NVS_READONLY, &handle));
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+        uint32_t value;
+        TEST_ESP_OK(nvs_get_u32(handle, key, &value));
+        CHECK(value >> 16 == i);
+    }
+    nvs_close(handle);
+
+    TEST_ESP_OK(nvs_flash_deinit_partition("calib"));
+    TEST_ESP_OK(nvs_flash_deinit_partition("config"));
+}
+
+TEST_CASE("storage batch write spanning several pages survives reload", "[nvs]")
+{
+    const uint32_t SECTOR_COUNT = 8;
+    const size_t KEY_COUNT = 300;
+    PartitionEmulationFixture f(0, SECTOR_COUNT);
+    char key[16];
+    {
+        Storage storage(&f.part);
+        TEST_ESP_OK(storage.init(0, SECTOR_COUNT));
+        for (size_t i = 0; i < KEY_COUNT; i += 3) {
+            snprintf(key, sizeof(key), "key%03d", static_cast<int>(i));
+            TEST_ESP_OK(storage.writeItem(1, key, static_cast<uint32_t>(i)));
+        }
+
+        ItemBatch batch;
+        for (size_t i = 0; i < KEY_COUNT; ++i) {
+            snprintf(key, sizeof(key), "key%03d", static_cast<int>(i));
+            uint32_t value = static_cast<uint32_t>(i + 1000);
+            TEST_ESP_OK(batch.add(itemTypeOf(value), key, &value, sizeof(value)));
+        }
+        snprintf(key, sizeof(key), "str");
+        TEST_ESP_OK(batch.add(ItemType::SZ, key, "a string longer than one entry", 31));
+        TEST_ESP_OK(storage.writeItems(1, batch));
+    }
+
+    Storage storage(&f.part);
+    TEST_ESP_OK(storage.init(0, SECTOR_COUNT));
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        snprintf(key, sizeof(key), "key%03d", static_cast<int>(i));
+        uint32_t value;
+        TEST_ESP_OK(storage.readItem(1, key, value));
+        CHECK(value == i + 1000);
+    }
+    char str[32];
+    TEST_ESP_OK(storage.readItem(1, ItemType::SZ, "str", str, sizeof(str)));
+    CHECK(string(str) == "a string longer than one entry");
+    size_t usedEntries = 0;
+    TEST_ESP_OK(storage.calcEntriesInNamespace(1, usedEntries));
+    CHECK(usedEntries == KEY_COUNT + 2);
+}
+
+TEST_CASE("batched writes use fewer flash operations than single writes", "[nvs]")
+{
+    const uint32_t SECTOR_COUNT = 8;
+    const size_t KEY_COUNT = 40;
+    char key[16];
+    char str[24];
+
+    for (bool batched : {false, true}) {
+        PartitionEmulationFixture f(0, SECTOR_COUNT);
+        TEST_ESP_OK(NVSPartitionManager::get_instance()->init_custom(&f.part, 0, SECTOR_COUNT));
+        shared_ptr<NVSHandle> handle = open_nvs_handle("boot", NVS_READWRITE);
+        REQUIRE(handle);
+
+        f.emu.clearStats();
+        auto start = std::chrono::steady_clock::now();
+        if (batched) {
+            TEST_ESP_OK(handle->begin_batch());
+        }
+        for (size_t i = 0; i < KEY_COUNT; ++i) {
+            snprintf(key, sizeof(key), "key%02d", static_cast<int>(i));
+            if (i % 4 == 0) {
+                snprintf(str, sizeof(str), "value of key %02d", static_cast<int>(i));
+                TEST_ESP_OK(handle->set_string(key, str));
+            } else {
+                TEST_ESP_OK(handle->set_item(key, static_cast<uint32_t>(i)));
+            }
+        }
+        if (batched) {
+            TEST_ESP_OK(handle->commit_batch());
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        s_perf << "Time to write " << KEY_COUNT << " keys " << (batched ? "in one batch" : "one by one") << ": "
+               << elapsed.count() << " us (" << f.emu.getWriteOps() << " writes, "
+               << f.emu.getWriteBytes() << " bytes)" << std::endl;
+        const size_t writeOps = f.emu.getWriteOps();
+        if (batched) {
+            CHECK(writeOps < KEY_COUNT);
+        }
+
+        for (size_t i = 0; i < KEY_COUNT; i += 4) {
+            snprintf(key, sizeof(key), "key%02d", static_cast<int>(i));
+            TEST_ESP_OK(handle->get_string(key, str, sizeof(str)));
+        }
+        uint32_t value;
+        TEST_ESP_OK(handle->get_item("key39", value));
+        CHECK(value == 39);
+
+        handle.reset();
+        TEST_ESP_OK(NVSPartitionManager::get_instance()->deinit_partition(NVS_DEFAULT_PART_NAME));
+    }
+}
+
+TEST_CASE("deferred page loading reads full pages on first access", "[nvs]")
+{
+    const size_t KEY_COUNT = 2000;
+    const uint32_t SECTOR_COUNT = (KEY_COUNT + Page::ENTRY_COUNT - 1) / Page::ENTRY_COUNT + 2;
+    PartitionEmulationFixture f(0, SECTOR_COUNT);
+
+    char key[16];
+    {
+        Storage storage(&f.part);
+        TEST_ESP_OK(storage.init(0, SECTOR_COUNT));
+        for (size_t i = 0; i < KEY_COUNT; ++i) {
+            snprintf(key, sizeof(key), "key%05d", static_cast<int>(i));
+            TEST_ESP_OK(storage.writeItem(1, key, static_cast<uint32_t>(i)));
+        }
+    }
+
+    for (bool defer : {false, true}) {
+        Storage storage(&f.part, false, defer);
+        f.emu.clearStats();
+        TEST_ESP_OK(storage.init(0, SECTOR_COUNT));
+        s_perf << "Time to init storage with " << KEY_COUNT << " keys in " << SECTOR_COUNT << " sectors "
+               << (defer ? "with" : "without") << " deferred page loading: " << f.emu.getTotalTime() << " us ("
+               << f.emu.getReadOps() << " reads, " << f.emu.getReadBytes() << " bytes)" << std::endl;
+        const size_t initReadOps = f.emu.getReadOps();
+
+        f.emu.clearStats();
+        uint32_t value;
+        TEST_ESP_OK(storage.readItem(1, "key00000", value));
+        CHECK(value == 0);
+        s_perf << "Time to read first key " << (defer ? "with" : "without") << " deferred page loading: "
+               << f.emu.getTotalTime() << " us" << std::endl;
+
+        for (size_t i = 0; i < KEY_COUNT; ++i) {
+            snprintf(key, sizeof(key), "key%05d", static_cast<int>(i));
+            REQUIRE(storage.readItem(1, key, value) == ESP_OK);
+            REQUIRE(value == i);
+        }
+        static size_t eagerInitReadOps;
+        if (defer) {
+            CHECK(initReadOps < eagerInitReadOps);
+        } else {
+            eagerInitReadOps = initReadOps;
+        }
+    }
+
+    // updates move items around, pages which are freed have to be loaded first
+    {
+        Storage storage(&f.part, false, true);
+        TEST_ESP_OK(storage.init(0, SECTOR_COUNT));
+        for (size_t i = 0; i < KEY_COUNT; i += 7) {
+            snprintf(key, sizeof(key), "key%05d", static_cast<int>(i));
+            TEST_ESP_OK(storage.writeItem(1, key, static_cast<uint32_t>(i + 1)));
+        }
+    }
+    Storage storage(&f.part);
+    TEST_ESP_OK(storage.init(0, SECTOR_COUNT));
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        snprintf(key, sizeof(key), "key%05d", static_cast<int>(i));
+        uint32_t value;
+        REQUIRE(storage.readItem(1, key, value) == ESP_OK);
+        REQUIRE(value == ((i % 7 == 0) ? i + 1 : i));
+    }
+}
+
+TEST_CASE("deferred page loading skips partially written items", "[nvs]")
+{
+    PartitionEmulationFixture f(0, 3);
+    {
+        Page page;
+        TEST_ESP_OK(page.load(&f.part, 0));
+        TEST_ESP_OK(page.setSeqNumber(0));
+        TEST_ESP_OK(page.writeItem(1, ItemType::SZ, "broken", "a string which takes three entries", 35));
+        TEST_ESP_OK(page.writeItem(1, "valid", static_cast<uint32_t>(42)));
+        TEST_ESP_OK(page.markFull());
+    }
+    // mark the last data entry of the string as empty again, as if writing it was interrupted
+    std::vector<uint32_t> sector(SPI_FLASH_SEC_SIZE / 4);
+    REQUIRE(f.emu.read(sector.data(), 0, SPI_FLASH_SEC_SIZE));
+    sector[8] |= 0x3 << 4;
+    REQUIRE(f.emu.erase(0));
+    REQUIRE(f.emu.write(0, sector.data(), SPI_FLASH_SEC_SIZE));
+
+    Page page;
+    Mutex mutex;
+    TEST_ESP_OK(mutex.init());
+    TEST_ESP_OK(page.load(&f.part, 0, &mutex));
+    CHECK(page.state() == Page::PageState::FULL);
+    CHECK_FALSE(page.isLoaded());
+
+    size_t itemIndex = 0;
+    Item item;
+    TEST_ESP_ERR(page.findItem(Page::NS_ANY, ItemType::SZ, nullptr, itemIndex, item, Page::CHUNK_ANY, VerOffset::VER_ANY, false), ESP_ERR_NVS_NOT_FOUND);
+    CHECK_FALSE(page.isLoaded());
+
+    uint32_t value;
+    TEST_ESP_OK(page.readItem(1, "valid", value));
+    CHECK(value == 42);
+    CHECK(page.isLoaded());
+    char buf[40];
+    TEST_ESP_ERR(page.readItem(1, ItemType::SZ, "broken", buf, sizeof(buf)), ESP_ERR_NVS_NOT_FOUND);
+    CHECK(page.getUsedEntryCount() == 1);
+}
+
+struct BlobStreamReader {
+    std::vector<uint8_t> data;
+    size_t calls = 0;
+    size_t largestPart = 0;
+    size_t stopAfter = SIZE_MAX;
+
+    static esp_err_t callback(const void* part, size_t length, void* ctx)
+    {
+        auto reader = static_cast<BlobStreamReader*>(ctx);
+        if (reader->calls == reader->stopAfter) {
+            return ESP_FAIL;
+        }
+        ++reader->calls;
+        reader->largestPart = std::max(reader->largestPart, length);
+        reader->data.insert(reader->data.end(), static_cast<const uint8_t*>(part), static_cast<const uint8_t*>(part) + length);
+        return ESP_OK;
+    }
+};
+
+TEST_CASE("nvs_blob_read_stream passes a blob to the callback chunk by chunk", "[nvs]")
+{
+    const size_t BLOB_SIZE = 100 * 1024;
+    const uint32_t SECTOR_COUNT = 40;
+    PartitionEmulationFixture f(0, SECTOR_COUNT);
+    TEST_ESP_OK(NVSPartitionManager::get_instance()->init_custom(&f.part, 0, SECTOR_COUNT));
+
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("certs", NVS_READWRITE, &handle));
+
+    std::vector<uint8_t> blob(BLOB_SIZE);
+    std::mt19937 gen(42);
+    std::generate(blob.begin(), blob.end(), [&]() { return static_cast<uint8_t>(gen()); });
+    TEST_ESP_OK(nvs_set_blob(handle, "ca", blob.data(), blob.size()));
+    TEST_ESP_OK(nvs_set_blob(handle, "empty", nullptr, 0));
+
+    BlobStreamReader reader;
+    TEST_ESP_OK(nvs_blob_read_stream(handle, "ca", BlobStreamReader::callback, &reader));
+    CHECK(reader.data == blob);
+    CHECK(reader.calls > 1);
+    CHECK(reader.largestPart <= static_cast<size_t>(Page::CHUNK_MAX_SIZE));
+
+    BlobStreamReader emptyReader;
+    TEST_ESP_OK(nvs_blob_read_stream(handle, "empty", BlobStreamReader::callback, &emptyReader));
+    CHECK(emptyReader.calls == 0);
+
+    BlobStreamReader stoppedReader;
+    stoppedReader.stopAfter = 2;
+    TEST_ESP_ERR(nvs_blob_read_stream(handle, "ca", BlobStreamReader::callback, &stoppedReader), ESP_FAIL);
+    CHECK(stoppedReader.calls == 2);
+
+    TEST_ESP_ERR(nvs_blob_read_stream(handle, "missing", BlobStreamReader::callback, &reader), ESP_ERR_NVS_NOT_FOUND);
+    TEST_ESP_ERR(nvs_blob_read_stream(handle, "ca", nullptr, &reader), ESP_ERR_INVALID_ARG);
+
+    nvs_close(handle);
+    TEST_ESP_ERR(nvs_blob_read_stream(handle, "ca", BlobStreamReader::callback, &reader), ESP_ERR_NVS_INVALID_HANDLE);
+    TEST_ESP_OK(nvs_flash_deinit_partition(f.part.get_partition_name()));
+}
+
+TEST_CASE("nvs_blob_read_stream reads blobs in old format", "[nvs]")
+{
+    PartitionEmulationFixture f(0, 3);
+    const uint8_t hexdata_old[] = {0x11, 0x12, 0x13, 0xbb, 0xcc, 0xee};
+    {
+        Page p;
+        TEST_ESP_OK(p.load(&f.part, 0));
+        TEST_ESP_OK(p.setSeqNumber(0));
+        TEST_ESP_OK(p.writeItem(Page::NS_INDEX, "namespace1", static_cast<uint8_t>(1)));
+        TEST_ESP_OK(p.writeItem(1, ItemType::BLOB, "singlepage", hexdata_old, sizeof(hexdata_old)));
+    }
+    TEST_ESP_OK(NVSPartitionManager::get_instance()->init_custom(&f.part, 0, 3));
+
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("namespace1", NVS_READONLY, &handle));
+    BlobStreamReader reader;
+    TEST_ESP_OK(nvs_blob_read_stream(handle, "singlepage", BlobStreamReader::callback, &reader));
+    CHECK(reader.data == std::vector<uint8_t>(hexdata_old, hexdata_old + sizeof(hexdata_old)));
+    CHECK(reader.calls == 1);
+
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(f.part.get_partition_name()));
+}
+
+TEST_CASE("background garbage collection bounds write latency", "[nvs]")
+{
+    const uint32_t SECTOR_COUNT = 5;
+    const size_t WRITE_COUNT = 100000;
+    const size_t KEY_COUNT = 20;
+    size_t maxLatency[2];
+    size_t eraseOps[2];
+
+    TEST_ESP_ERR(nvs_flash_collect_garbage("nonexistent"), ESP_ERR_NVS_NOT_INITIALIZED);
+
+    for (bool gc : {false, true}) {
+        PartitionEmulationFixture f(0, SECTOR_COUNT, "gc");
+        TEST_ESP_OK(NVSPartitionManager::get_instance()->init_custom(&f.part, 0, SECTOR_COUNT));
+        nvs_handle_t handle;
+        TEST_ESP_OK(nvs_open_from_partition("gc", "test", NVS_READWRITE, &handle));
+
+        std::vector<size_t> latencies;
+        latencies.reserve(WRITE_COUNT);
+        size_t gcTime = 0;
+        char key[16];
+        for (size_t i = 0; i < WRITE_COUNT; ++i) {
+            snprintf(key, sizeof(key), "key%02d", static_cast<int>(i % KEY_COUNT));
+            size_t before = f.emu.getTotalTime();
+            REQUIRE(nvs_set_u32(handle, key, static_cast<uint32_t>(i)) == ESP_OK);
+            latencies.push_back(f.emu.getTotalTime() - before);
+            if (gc) {
+                // the system is idle between two writes
+                before = f.emu.getTotalTime();
+                REQUIRE(nvs_flash_collect_garbage("gc") == ESP_OK);
+                gcTime += f.emu.getTotalTime() - before;
+            }
+        }
+
+        for (size_t k = 0; k < KEY_COUNT; ++k) {
+            uint32_t value;
+            snprintf(key, sizeof(key), "key%02d", static_cast<int>(k));
+            TEST_ESP_OK(nvs_get_u32(handle, key, &value));
+            CHECK(value == WRITE_COUNT - KEY_COUNT + k);
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        maxLatency[gc] = latencies.back();
+        eraseOps[gc] = f.emu.getEraseOps();
+        s_perf << "Latency of " << WRITE_COUNT << " writes " << (gc ? "with" : "without") << " background GC: "
+               << "p50 " << latencies[WRITE_COUNT / 2] << " us, "
+               << "p99 " << latencies[WRITE_COUNT * 99 / 100] << " us, "
+               << "p99.9 " << latencies[WRITE_COUNT * 999 / 1000] << " us, "
+               << "max " << latencies.back() << " us, " << f.emu.getEraseOps() << " erases";
+        if (gc) {
+            s_perf << " (" << gcTime << " us spent in GC)";
+        }
+        s_perf << std::endl;
+
+        nvs_close(handle);
+        TEST_ESP_OK(nvs_flash_deinit_partition("gc"));
+    }
+
+    CHECK(maxLatency[1] * 10 < maxLatency[0]);
+    // compaction moves values to the active page, it doesn't retire it early
+    CHECK(eraseOps[1] <= eraseOps[0] + 1);
+}
+
+TEST_CASE("garbage collection doesn't wait for a partition which is in use", "[nvs]")
+{
+    const uint32_t SECTOR_COUNT = 5;
+    PartitionEmulationFixture f(0, SECTOR_COUNT, "gc");
+    TEST_ESP_OK(NVSPartitionManager::get_instance()->init_custom(&f.part, 0, SECTOR_COUNT));
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open_from_partition("gc", "test", NVS_READWRITE, &handle));
+    const uint8_t blob[64] = {};
+    TEST_ESP_OK(nvs_set_blob(handle, "blob", blob, sizeof(blob)));
+    TEST_ESP_OK(nvs_set_u32(handle, "value", 42));
+
+    struct Context {
+        nvs_handle_t handle;
+        esp_err_t gcResult;
+        uint32_t value;
+    } ctx = { handle, ESP_FAIL, 0 };
+
+    // the callback runs with the storage locked, compaction started by another task meanwhile
+    // must not wait for it
+    auto callback = [](const void* part, size_t length, void* arg) -> esp_err_t {
+        auto ctx = static_cast<Context*>(arg);
+        std::thread gc([=]() {
+            ctx->gcResult = nvs_flash_collect_garbage("gc");
+        });
+        gc.join();
+        return ESP_OK;
+    };
+    TEST_ESP_OK(nvs_blob_read_stream(handle, "blob", callback, &ctx));
+    TEST_ESP_OK(ctx.gcResult);
+    TEST_ESP_OK(nvs_get_u32(handle, "value", &ctx.value));
+    CHECK(ctx.value == 42);
+
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition("gc"));
+}
+
+TEST_CASE("handle and partition are freed only after operations using them have finished", "[nvs]")
+{
+    const uint32_t SECTOR_COUNT = 5;
+    PartitionEmulationFixture f(0, SECTOR_COUNT, "close");
+    TEST_ESP_OK(NVSPartitionManager::get_instance()->init_custom(&f.part, 0, SECTOR_COUNT));
+    const uint8_t blob[64] = {};
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open_from_partition("close", "test", NVS_READWRITE, &handle));
+    TEST_ESP_OK(nvs_set_blob(handle, "blob", blob, sizeof(blob)));
+
+    struct Context {
+        std::function<esp_err_t()> release;
+        esp_err_t releaseResult;
+        std::thread thread;
+        std::atomic<bool> released;
+        bool releasedDuringRead;
+    };
+
+    // the callback runs while the operation holds the storage lock, releasing the handle or the partition
+    // from another task meanwhile must wait until the operation has finished
+    auto callback = [](const void* part, size_t length, void* arg) -> esp_err_t {
+        auto ctx = static_cast<Context*>(arg);
+        ctx->thread = std::thread([=]() {
+            ctx->releaseResult = ctx->release();
+            ctx->released = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ctx->releasedDuringRead = ctx->released;
+        return ESP_OK;
+    };
+
+    uint32_t value;
+    SECTION("nvs_close") {
+        Context ctx;
+        ctx.release = [=]() {
+            nvs_close(handle);
+            return ESP_OK;
+        };
+        ctx.released = false;
+        TEST_ESP_OK(nvs_blob_read_stream(handle, "blob", callback, &ctx));
+        ctx.thread.join();
+        CHECK_FALSE(ctx.releasedDuringRead);
+        TEST_ESP_ERR(nvs_get_u32(handle, "value", &value), ESP_ERR_NVS_INVALID_HANDLE);
+        TEST_ESP_OK(nvs_flash_deinit_partition("close"));
+    }
+    SECTION("nvs_flash_deinit_partition") {
+        Context ctx;
+        ctx.release = []() {
+            return nvs_flash_deinit_partition("close");
+        };
+        ctx.released = false;
+        TEST_ESP_OK(nvs_blob_read_stream(handle, "blob", callback, &ctx));
+        ctx.thread.join();
+        CHECK_FALSE(ctx.releasedDuringRead);
+        TEST_ESP_OK(ctx.releaseResult);
+        TEST_ESP_ERR(nvs_get_u32(handle, "value", &value), ESP_ERR_NVS_INVALID_HANDLE);
+    }
+}
+
+/* Writes every buffer of a gathered write separately, like encrypted partitions did before
+ * page writes were combined */
+class SeparateWritesEncryptedPartition : public NVSEncryptedPartition {
+public:
+    SeparateWritesEncryptedPartition(const esp_partition_t *partition) : NVSEncryptedPartition(partition) { }
+
+    esp_err_t write_gather(size_t dst_offset, const WriteBuffer* buffers, size_t count) override
+    {
+        return Partition::write_gather(dst_offset, buffers, count);
+    }
+};
+
+TEST_CASE("encrypted partition writes variable length items with one flash write", "[nvs]")
+{
+    const size_t WRITE_COUNT = 200;
+    const size_t BLOB_SIZE = 100;
+    const uint32_t SECTOR_COUNT = 8;
+
+    nvs_sec_cfg_t xts_cfg;
+    for (int count = 0; count < NVS_KEY_SIZE; count++) {
+        xts_cfg.eky[count] = 0x11;
+        xts_cfg.tky[count] = 0x22;
+    }
+
+    uint8_t blob[BLOB_SIZE];
+    uint8_t readBlob[BLOB_SIZE];
+    char key[16];
+
+    for (bool combined : {false, true}) {
+        EncryptedPartitionFixture f(&xts_cfg, 0, SECTOR_COUNT);
+        SeparateWritesEncryptedPartition separatePart(&f.esp_partition);
+        TEST_ESP_OK(separatePart.init(&xts_cfg));
+        Partition* part = combined ? static_cast<Partition*>(&f.part) : &separatePart;
+
+        Storage storage(part);
+        TEST_ESP_OK(storage.init(0, SECTOR_COUNT));
+
+        f.emu.clearStats();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < WRITE_COUNT; ++i) {
+            std::fill_n(blob, BLOB_SIZE, static_cast<uint8_t>(i));
+            snprintf(key, sizeof(key), "key%02d", static_cast<int>(i % 20));
+            TEST_ESP_OK(storage.writeItem(1, ItemType::SZ, key, blob, BLOB_SIZE));
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        s_perf << "Time to write " << WRITE_COUNT << " encrypted " << BLOB_SIZE << " byte items "
+               << (combined ? "with" : "without") << " write combining: " << elapsed.count() << " us, "
+               << f.emu.getTotalTime() << " us in flash (" << f.emu.getWriteOps() << " writes)" << std::endl;
+        if (combined) {
+            /* one write for the span and one for the entry state bitmap, plus old copies
+             * being erased and pages being freed */
+            CHECK(f.emu.getWriteOps() < WRITE_COUNT * 4);
+        }
+
+        /* whatever the partition object did, the image must be readable by a plain encrypted partition */
+        Storage reader(&f.part);
+        TEST_ESP_OK(reader.init(0, SECTOR_COUNT));
+        for (size_t i = WRITE_COUNT - 20; i < WRITE_COUNT; ++i) {
+            std::fill_n(blob, BLOB_SIZE, static_cast<uint8_t>(i));
+            snprintf(key, sizeof(key), "key%02d", static_cast<int>(i % 20));
+            TEST_ESP_OK(reader.readItem(1, ItemType::SZ, key, readBlob, BLOB_SIZE));
+            CHECK(memcmp(blob, readBlob, BLOB_SIZE) == 0);
+        }
+    }
+}
+
 /* Add new tests above */
 /* This test has to be the final one */
 
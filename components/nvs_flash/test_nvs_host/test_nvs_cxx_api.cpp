@@ -191,3 +191,99 @@ TEST_CASE("NVSHandleSimple CXX api read/write blob", "[nvs cxx]")
 
     nvs::NVSPartitionManager::get_instance()->deinit_partition("nvs");
 }
+
+TEST_CASE("NVSHandleSimple CXX api batch write", "[nvs cxx]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 3;
+    PartitionEmulationFixture f(0, 10);
+    const char blob [6] = {15, 16, 17, 18, 19};
+    char read_blob[6] = {0};
+    char read_buffer[16];
+    esp_err_t result;
+    shared_ptr<nvs::NVSHandle> handle;
+
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(&f.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN)
+            == ESP_OK);
+
+    handle = nvs::open_nvs_handle("test_ns", NVS_READWRITE, &result);
+    CHECK(result == ESP_OK);
+    REQUIRE(handle);
+
+    CHECK(handle->set_item("overwrite", 1) == ESP_OK);
+    CHECK(handle->set_item("same", 2) == ESP_OK);
+
+    CHECK(handle->commit_batch() == ESP_ERR_NVS_INVALID_STATE);
+    CHECK(handle->begin_batch() == ESP_OK);
+    CHECK(handle->begin_batch() == ESP_ERR_NVS_INVALID_STATE);
+    CHECK(handle->set_item("overwrite", 10) == ESP_OK);
+    CHECK(handle->set_item("overwrite", 11) == ESP_OK);
+    CHECK(handle->set_item("same", 2) == ESP_OK);
+    CHECK(handle->set_item("u16", static_cast<uint16_t>(0x1234)) == ESP_OK);
+    CHECK(handle->set_string("str", "test string") == ESP_OK);
+    CHECK(handle->set_blob("blob", blob, sizeof(blob)) == ESP_OK);
+    CHECK(handle->erase_item("same") == ESP_ERR_NVS_INVALID_STATE);
+    CHECK(handle->erase_all() == ESP_ERR_NVS_INVALID_STATE);
+
+    // nothing is visible before commit
+    int value = 0;
+    CHECK(handle->get_item("overwrite", value) == ESP_OK);
+    CHECK(value == 1);
+    CHECK(handle->get_string("str", read_buffer, sizeof(read_buffer)) == ESP_ERR_NVS_NOT_FOUND);
+
+    CHECK(handle->commit_batch() == ESP_OK);
+    CHECK(handle->commit_batch() == ESP_ERR_NVS_INVALID_STATE);
+
+    CHECK(handle->get_item("overwrite", value) == ESP_OK);
+    CHECK(value == 11);
+    CHECK(handle->get_item("same", value) == ESP_OK);
+    CHECK(value == 2);
+    uint16_t u16 = 0;
+    CHECK(handle->get_item("u16", u16) == ESP_OK);
+    CHECK(u16 == 0x1234);
+    CHECK(handle->get_string("str", read_buffer, sizeof(read_buffer)) == ESP_OK);
+    CHECK(string(read_buffer) == "test string");
+    CHECK(handle->get_blob("blob", read_blob, sizeof(read_blob)) == ESP_OK);
+    CHECK(vector<char>(blob, blob + sizeof(blob)) == vector<char>(read_blob, read_blob + sizeof(read_blob)));
+
+    size_t used = 0;
+    CHECK(handle->get_used_entry_count(used) == ESP_OK);
+
+    // aborted batch leaves storage untouched
+    CHECK(handle->begin_batch() == ESP_OK);
+    CHECK(handle->set_item("overwrite", 12) == ESP_OK);
+    CHECK(handle->set_item("aborted", 13) == ESP_OK);
+    handle->abort_batch();
+    CHECK(handle->get_item("overwrite", value) == ESP_OK);
+    CHECK(value == 11);
+    CHECK(handle->get_item("aborted", value) == ESP_ERR_NVS_NOT_FOUND);
+    size_t usedAfterAbort = 0;
+    CHECK(handle->get_used_entry_count(usedAfterAbort) == ESP_OK);
+    CHECK(usedAfterAbort == used);
+
+    handle.reset();
+    nvs::NVSPartitionManager::get_instance()->deinit_partition("nvs");
+}
+
+TEST_CASE("NVSHandleSimple CXX api batch write read only", "[nvs cxx]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 3;
+    PartitionEmulationFixture f(0, 10);
+    esp_err_t result;
+    shared_ptr<nvs::NVSHandle> handle;
+
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(&f.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN)
+            == ESP_OK);
+
+    handle = nvs::open_nvs_handle("test_ns", NVS_READWRITE, &result);
+    REQUIRE(handle);
+    handle.reset();
+
+    handle = nvs::open_nvs_handle("test_ns", NVS_READONLY, &result);
+    REQUIRE(handle);
+    CHECK(handle->begin_batch() == ESP_ERR_NVS_READ_ONLY);
+
+    handle.reset();
+    nvs::NVSPartitionManager::get_instance()->deinit_partition("nvs");
+}
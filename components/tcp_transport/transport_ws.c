@@ -205,13 +205,56 @@ static int ws_connect(esp_transport_handle_t t, const char *host, int port, int
     return 0;
 }
 
+/*
+ * Word used to XOR the payload with the mask key a word at a time,
+ * it may alias the bytes of the payload buffer.
+ */
+typedef uint32_t __attribute__((__may_alias__)) ws_mask_word_t;
+
+/*
+ * XOR the payload with the mask key, which masks and unmasks it alike.
+ * `offset` is the position of the payload in the frame, for payloads read in several parts.
+ */
+static void ws_mask_payload(char *buffer, int len, const char *mask_key, int offset)
+{
+    // Byte by byte up to the first aligned word
+    while (len > 0 && ((uintptr_t)buffer % sizeof(ws_mask_word_t)) != 0) {
+        *buffer++ ^= mask_key[offset++ % 4];
+        len--;
+    }
+
+    // Whole words, with the mask key rotated to start at the offset of the first one
+    int word_count = len / sizeof(ws_mask_word_t);
+    if (word_count > 0) {
+        char rotated_key[4];
+        for (int i = 0; i < 4; i++) {
+            rotated_key[i] = mask_key[(offset + i) % 4];
+        }
+        ws_mask_word_t mask_word;
+        memcpy(&mask_word, rotated_key, sizeof(mask_word));
+
+        ws_mask_word_t *words = (ws_mask_word_t *)buffer;
+        for (int i = 0; i < word_count; i++) {
+            words[i] ^= mask_word;
+        }
+        buffer += word_count * sizeof(ws_mask_word_t);
+        len -= word_count * sizeof(ws_mask_word_t);
+    }
+
+    // The remaining bytes, whole words leave the position in the mask key unchanged
+    while (len > 0) {
+        *buffer++ ^= mask_key[offset++ % 4];
+        len--;
+    }
+}
+
 static int _ws_write(esp_transport_handle_t t, int opcode, int mask_flag, const char *b, int len, int timeout_ms)
 {
     transport_ws_t *ws = esp_transport_get_context_data(t);
     char *buffer = (char *)b;
     char ws_header[MAX_WEBSOCKET_HEADER_SIZE];
     char *mask;
-    int header_len = 0, i;
+    int header_len = 0;
 
     int poll_write;
     if ((poll_write = esp_transport_poll_write(ws->parent, timeout_ms)) <= 0) {
@@ -244,9 +287,7 @@ static int _ws_write(esp_transport_handle_t t, int opcode, int mask_flag, const
         getrandom(ws_header + header_len, 4, 0);
         header_len += 4;
 
-        for (i = 0; i < len; ++i) {
-            buffer[i] = (buffer[i] ^ mask[i % 4]);
-        }
+        ws_mask_payload(buffer, len, mask, 0);
     }
 
     if (esp_transport_write(ws->parent, ws_header, header_len, timeout_ms) != header_len) {
@@ -262,9 +303,7 @@ static int _ws_write(esp_transport_handle_t t, int opcode, int mask_flag, const
     // does not create its own copy of data to be sent
     if (mask_flag) {
         mask = &ws_header[header_len-4];
-        for (i = 0; i < len; ++i) {
-            buffer[i] = (buffer[i] ^ mask[i % 4]);
-        }
+        ws_mask_payload(buffer, len, mask, 0);
     }
     return ret;
 }
@@ -313,13 +352,12 @@ static int ws_read_payload(esp_transport_handle_t t, char *buffer, int len, int
         ESP_LOGE(TAG, "Error read data");
         return rlen;
     }
+    // The payload may be read in several parts, continue in the mask key where the last part ended
+    int offset = ws->frame_state.payload_len - ws->frame_state.bytes_remaining;
     ws->frame_state.bytes_remaining -= rlen;
 
-    if (ws->frame_state.mask_key) {
-        for (int i = 0; i < bytes_to_read; i++) {
-            buffer[i] = (buffer[i] ^ ws->frame_state.mask_key[i % 4]);
-        }
-    }
+    // The mask key is all zeros for unmasked frames
+    ws_mask_payload(buffer, rlen, ws->frame_state.mask_key, offset);
     return rlen;
 }
 
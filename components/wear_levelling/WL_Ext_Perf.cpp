@@ -13,6 +13,7 @@
 
 #include "WL_Ext_Perf.h"
 #include <stdlib.h>
+#include <string.h>
 #include "esp_log.h"
 
 static const char *TAG = "wl_ext_perf";
@@ -26,11 +27,20 @@ static const char *TAG = "wl_ext_perf";
 WL_Ext_Perf::WL_Ext_Perf(): WL_Flash()
 {
     this->sector_buffer = NULL;
+    this->cache_size = 0;
+    this->cache_clock = 0;
+    this->cache = NULL;
 }
 
 WL_Ext_Perf::~WL_Ext_Perf()
 {
     free(this->sector_buffer);
+    if (this->cache != NULL) {
+        for (uint32_t i = 0; i < this->cache_size; i++) {
+            free(this->cache[i].data);
+        }
+        free(this->cache);
+    }
 }
 
 esp_err_t WL_Ext_Perf::config(WL_Config_s *cfg, Flash_Access *flash_drv)
@@ -50,6 +60,20 @@ esp_err_t WL_Ext_Perf::config(WL_Config_s *cfg, Flash_Access *flash_drv)
         return ESP_ERR_INVALID_ARG;
     }
 
+    if (config->cache_size > 0) {
+        this->cache = (cache_entry_t *)calloc(config->cache_size, sizeof(cache_entry_t));
+        if (this->cache == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        this->cache_size = config->cache_size;
+        for (uint32_t i = 0; i < this->cache_size; i++) {
+            this->cache[i].data = (uint32_t *)malloc(cfg->sector_size);
+            if (this->cache[i].data == NULL) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+
     return WL_Flash::config(cfg, flash_drv);
 }
 
@@ -78,6 +102,10 @@ esp_err_t WL_Ext_Perf::erase_sector_fit(uint32_t start_sector, uint32_t count)
     // This method works with one flash device sector and able to erase "count" of fatfs sectors from this sector
     esp_err_t result = ESP_OK;
 
+    if (this->cache_size > 0) {
+        return this->cache_erase_sector_fit(start_sector, count);
+    }
+
     uint32_t pre_check_start = start_sector % this->size_factor;
 
 
@@ -156,6 +184,11 @@ esp_err_t WL_Ext_Perf::erase_range(size_t start_address, size_t size)
         rest_check_count = rest_check_count / this->size_factor;
         size_t start_sector = rest_check_start / this->flash_sector_size;
         for (size_t i = 0; i < rest_check_count; i++) {
+            // the complete sector is erased, so a cached copy has nothing worth writing back
+            cache_entry_t *entry = this->cache_find(start_sector + i);
+            if (entry != NULL) {
+                entry->valid = false;
+            }
             result = WL_Flash::erase_sector(start_sector + i);
             WL_EXT_RESULT_CHECK(result);
         }
@@ -166,3 +199,156 @@ esp_err_t WL_Ext_Perf::erase_range(size_t start_address, size_t size)
     }
     return ESP_OK;
 }
+
+esp_err_t WL_Ext_Perf::write_back_sector(uint32_t sector, const uint32_t *data)
+{
+    esp_err_t result = WL_Flash::erase_sector(sector);
+    WL_EXT_RESULT_CHECK(result);
+    result = WL_Flash::write(sector * this->flash_sector_size, data, this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+    return ESP_OK;
+}
+
+WL_Ext_Perf::cache_entry_t *WL_Ext_Perf::cache_find(uint32_t sector)
+{
+    for (uint32_t i = 0; i < this->cache_size; i++) {
+        if (this->cache[i].valid && (this->cache[i].sector == sector)) {
+            this->cache[i].last_used = ++this->cache_clock;
+            return &this->cache[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t WL_Ext_Perf::cache_load(uint32_t sector, cache_entry_t **out_entry)
+{
+    esp_err_t result = ESP_OK;
+    cache_entry_t *entry = this->cache_find(sector);
+    if (entry == NULL) {
+        // Take a free entry or the least recently used one
+        entry = &this->cache[0];
+        for (uint32_t i = 0; i < this->cache_size && entry->valid; i++) {
+            if (!this->cache[i].valid || (this->cache[i].last_used < entry->last_used)) {
+                entry = &this->cache[i];
+            }
+        }
+        result = this->cache_write_back(entry);
+        WL_EXT_RESULT_CHECK(result);
+        entry->valid = false;
+        result = WL_Flash::read(sector * this->flash_sector_size, entry->data, this->flash_sector_size);
+        WL_EXT_RESULT_CHECK(result);
+        ESP_LOGV(TAG, "%s sector = 0x%08x", __func__, sector);
+        entry->sector = sector;
+        entry->valid = true;
+        entry->dirty = false;
+        entry->last_used = ++this->cache_clock;
+    }
+    *out_entry = entry;
+    return result;
+}
+
+esp_err_t WL_Ext_Perf::cache_write_back(cache_entry_t *entry)
+{
+    if (!entry->valid || !entry->dirty) {
+        return ESP_OK;
+    }
+    ESP_LOGV(TAG, "%s sector = 0x%08x", __func__, entry->sector);
+    esp_err_t result = this->write_back_sector(entry->sector, entry->data);
+    WL_EXT_RESULT_CHECK(result);
+    entry->dirty = false;
+    return ESP_OK;
+}
+
+esp_err_t WL_Ext_Perf::cache_erase_sector_fit(uint32_t start_sector, uint32_t count)
+{
+    cache_entry_t *entry;
+    esp_err_t result = this->cache_load(start_sector / this->size_factor, &entry);
+    WL_EXT_RESULT_CHECK(result);
+    memset((uint8_t *)entry->data + (start_sector % this->size_factor) * this->fat_sector_size, 0xff, count * this->fat_sector_size);
+    entry->dirty = true;
+    return ESP_OK;
+}
+
+esp_err_t WL_Ext_Perf::write(size_t dest_addr, const void *src, size_t size)
+{
+    if (this->cache_size == 0) {
+        return WL_Flash::write(dest_addr, src, size);
+    }
+    // Parts of cached sectors are programmed into the RAM copy, the rest goes directly to flash
+    esp_err_t result = ESP_OK;
+    const uint8_t *buff = (const uint8_t *)src;
+    size_t end = dest_addr + size;
+    size_t uncached_start = dest_addr;
+    for (size_t addr = dest_addr; addr < end;) {
+        size_t sector_end = (addr / this->flash_sector_size + 1) * this->flash_sector_size;
+        size_t part_size = (end < sector_end ? end : sector_end) - addr;
+        cache_entry_t *entry = this->cache_find(addr / this->flash_sector_size);
+        if (entry != NULL) {
+            if (addr > uncached_start) {
+                result = WL_Flash::write(uncached_start, &buff[uncached_start - dest_addr], addr - uncached_start);
+                WL_EXT_RESULT_CHECK(result);
+            }
+            // like flash programming, a write can only clear bits
+            uint8_t *cached = (uint8_t *)entry->data + addr % this->flash_sector_size;
+            for (size_t i = 0; i < part_size; i++) {
+                cached[i] &= buff[addr - dest_addr + i];
+            }
+            entry->dirty = true;
+            uncached_start = addr + part_size;
+        }
+        addr += part_size;
+    }
+    if (end > uncached_start) {
+        result = WL_Flash::write(uncached_start, &buff[uncached_start - dest_addr], end - uncached_start);
+        WL_EXT_RESULT_CHECK(result);
+    }
+    return result;
+}
+
+esp_err_t WL_Ext_Perf::read(size_t src_addr, void *dest, size_t size)
+{
+    if (this->cache_size == 0) {
+        return WL_Flash::read(src_addr, dest, size);
+    }
+    // Parts of cached sectors are taken from RAM, the rest is read from flash
+    esp_err_t result = ESP_OK;
+    uint8_t *buff = (uint8_t *)dest;
+    size_t end = src_addr + size;
+    size_t uncached_start = src_addr;
+    for (size_t addr = src_addr; addr < end;) {
+        size_t sector_end = (addr / this->flash_sector_size + 1) * this->flash_sector_size;
+        size_t part_size = (end < sector_end ? end : sector_end) - addr;
+        cache_entry_t *entry = this->cache_find(addr / this->flash_sector_size);
+        if (entry != NULL) {
+            if (addr > uncached_start) {
+                result = WL_Flash::read(uncached_start, &buff[uncached_start - src_addr], addr - uncached_start);
+                WL_EXT_RESULT_CHECK(result);
+            }
+            memcpy(&buff[addr - src_addr], (uint8_t *)entry->data + addr % this->flash_sector_size, part_size);
+            uncached_start = addr + part_size;
+        }
+        addr += part_size;
+    }
+    if (end > uncached_start) {
+        result = WL_Flash::read(uncached_start, &buff[uncached_start - src_addr], end - uncached_start);
+        WL_EXT_RESULT_CHECK(result);
+    }
+    return result;
+}
+
+esp_err_t WL_Ext_Perf::flush_cache()
+{
+    esp_err_t result = ESP_OK;
+    for (uint32_t i = 0; i < this->cache_size; i++) {
+        result = this->cache_write_back(&this->cache[i]);
+        WL_EXT_RESULT_CHECK(result);
+    }
+    return result;
+}
+
+esp_err_t WL_Ext_Perf::flush()
+{
+    esp_err_t result = this->flush_cache();
+    WL_EXT_RESULT_CHECK(result);
+    return WL_Flash::flush();
+}
@@ -117,6 +117,10 @@ esp_err_t WL_Ext_Safe::erase_sector_fit(uint32_t start_sector, uint32_t count)
 {
     esp_err_t result = ESP_OK;
 
+    if (this->cache_size > 0) {
+        return this->cache_erase_sector_fit(start_sector, count);
+    }
+
     uint32_t local_addr_base = start_sector / this->size_factor;
     uint32_t pre_check_start = start_sector % this->size_factor;
     ESP_LOGV(TAG, "%s start_sector=0x%08x, count = %i", __func__, start_sector, count);
@@ -159,3 +163,35 @@ esp_err_t WL_Ext_Safe::erase_sector_fit(uint32_t start_sector, uint32_t count)
 
     return ESP_OK;
 }
+
+esp_err_t WL_Ext_Safe::write_back_sector(uint32_t sector, const uint32_t *data)
+{
+    esp_err_t result = ESP_OK;
+    ESP_LOGV(TAG, "%s sector=0x%08x", __func__, sector);
+
+    // Same transaction as in erase_sector_fit, but the dump holds the complete new content
+    // of the sector, so nothing of it is excluded (count = 0) if recover() has to restore it
+    result = WL_Flash::erase_sector(this->dump_addr / this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+    result = WL_Flash::write(this->dump_addr, data, this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+
+    WL_Ext_Safe_State state;
+    state.erase_begin = WL_EXT_SAFE_OK;
+    state.local_addr_base = sector;
+    state.local_addr_shift = 0;
+    state.count = 0;
+
+    result = WL_Flash::erase_sector(this->state_addr / this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+    result = WL_Flash::write(this->state_addr + 0, &state, sizeof(WL_Ext_Safe_State));
+    WL_EXT_RESULT_CHECK(result);
+
+    result = WL_Ext_Perf::write_back_sector(sector, data);
+    WL_EXT_RESULT_CHECK(result);
+
+    result = WL_Flash::erase_sector(this->state_addr / this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+
+    return ESP_OK;
+}
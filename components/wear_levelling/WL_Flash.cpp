@@ -574,43 +574,62 @@ esp_err_t WL_Flash::erase_range(size_t start_address, size_t size)
     return result;
 }
 
-esp_err_t WL_Flash::write(size_t dest_addr, const void *src, size_t size)
+// Max. number of physically contiguous runs passed to the driver in one call.
+// A request shorter than the partition is split at most at the dummy page and at the end of the memory.
+#define WL_FLASH_VEC_MAX 4
+
+esp_err_t WL_Flash::transfer(size_t addr, uint8_t *buff, size_t size, bool write)
 {
     esp_err_t result = ESP_OK;
+    flash_access_vec_t vec[WL_FLASH_VEC_MAX];
+    size_t vec_count = 0;
+    // Logical pages are mapped one by one, but neighbouring pages which are also neighbours
+    // in flash are merged, so that the driver is called once per contiguous run
+    for (size_t offset = 0; offset < size; offset += this->cfg.page_size) {
+        size_t part_size = size - offset;
+        if (part_size > this->cfg.page_size) {
+            part_size = this->cfg.page_size;
+        }
+        size_t real_addr = this->cfg.start_addr + this->calcAddr(addr + offset);
+        if ((vec_count > 0) && (vec[vec_count - 1].addr + vec[vec_count - 1].size == real_addr)) {
+            vec[vec_count - 1].size += part_size;
+            continue;
+        }
+        if (vec_count == WL_FLASH_VEC_MAX) {
+            result = write ? this->flash_drv->writev(vec, vec_count) : this->flash_drv->readv(vec, vec_count);
+            WL_RESULT_CHECK(result);
+            vec_count = 0;
+        }
+        vec[vec_count].addr = real_addr;
+        vec[vec_count].buff = &buff[offset];
+        vec[vec_count].size = part_size;
+        vec_count++;
+    }
+    if (vec_count > 0) {
+        ESP_LOGV(TAG, "%s - real_addr= 0x%08x, runs= %i, size= 0x%08x", __func__, (uint32_t) vec[0].addr, (int) vec_count, (uint32_t) size);
+        result = write ? this->flash_drv->writev(vec, vec_count) : this->flash_drv->readv(vec, vec_count);
+        WL_RESULT_CHECK(result);
+    }
+    return result;
+}
+
+esp_err_t WL_Flash::write(size_t dest_addr, const void *src, size_t size)
+{
     if (!this->initialized) {
         return ESP_ERR_INVALID_STATE;
     }
     ESP_LOGD(TAG, "%s - dest_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) dest_addr, (uint32_t) size);
-    uint32_t count = (size - 1) / this->cfg.page_size;
-    for (size_t i = 0; i < count; i++) {
-        size_t virt_addr = this->calcAddr(dest_addr + i * this->cfg.page_size);
-        result = this->flash_drv->write(this->cfg.start_addr + virt_addr, &((uint8_t *)src)[i * this->cfg.page_size], this->cfg.page_size);
-        WL_RESULT_CHECK(result);
-    }
-    size_t virt_addr_last = this->calcAddr(dest_addr + count * this->cfg.page_size);
-    result = this->flash_drv->write(this->cfg.start_addr + virt_addr_last, &((uint8_t *)src)[count * this->cfg.page_size], size - count * this->cfg.page_size);
-    WL_RESULT_CHECK(result);
-    return result;
+    // the buffer is only read from when writing
+    return this->transfer(dest_addr, (uint8_t *)src, size, true);
 }
 
 esp_err_t WL_Flash::read(size_t src_addr, void *dest, size_t size)
 {
-    esp_err_t result = ESP_OK;
     if (!this->initialized) {
         return ESP_ERR_INVALID_STATE;
     }
     ESP_LOGD(TAG, "%s - src_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) src_addr, (uint32_t) size);
-    uint32_t count = (size - 1) / this->cfg.page_size;
-    for (size_t i = 0; i < count; i++) {
-        size_t virt_addr = this->calcAddr(src_addr + i * this->cfg.page_size);
-        ESP_LOGV(TAG, "%s - real_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) (this->cfg.start_addr + virt_addr), (uint32_t) size);
-        result = this->flash_drv->read(this->cfg.start_addr + virt_addr, &((uint8_t *)dest)[i * this->cfg.page_size], this->cfg.page_size);
-        WL_RESULT_CHECK(result);
-    }
-    size_t virt_addr_last = this->calcAddr(src_addr + count * this->cfg.page_size);
-    result = this->flash_drv->read(this->cfg.start_addr + virt_addr_last, &((uint8_t *)dest)[count * this->cfg.page_size], size - count * this->cfg.page_size);
-    WL_RESULT_CHECK(result);
-    return result;
+    return this->transfer(src_addr, (uint8_t *)dest, size, false);
 }
 
 Flash_Access *WL_Flash::get_drv()
@@ -630,3 +649,8 @@ esp_err_t WL_Flash::flush()
     ESP_LOGD(TAG, "%s - result= 0x%08x, move_count= 0x%08x", __func__, result, this->state.move_count);
     return result;
 }
+
+esp_err_t WL_Flash::flush_cache()
+{
+    return ESP_OK;
+}
@@ -94,6 +94,22 @@ esp_err_t wl_erase_range(wl_handle_t handle, size_t start_addr, size_t size);
 */
 esp_err_t wl_write(wl_handle_t handle, size_t dest_addr, const void *src, size_t size);
 
+/**
+* @brief Write sectors cached in RAM back to flash
+*
+* With CONFIG_WL_SECTOR_CACHE_SIZE greater than zero, erases and writes of
+* sectors smaller than the flash sector are collected in RAM and the flash
+* sector is only rewritten when it is evicted from the cache, on wl_flush
+* or on wl_unmount. Data which has not been flushed is lost on power failure.
+*
+* @param handle WL handle that are related to the partition
+*
+* @return
+*       - ESP_OK, if all cached data was written successfully (or no cache is used);
+*       - or one of error codes from lower-level flash driver.
+*/
+esp_err_t wl_flush(wl_handle_t handle);
+
 /**
 * @brief Read data from the WL storage
 *
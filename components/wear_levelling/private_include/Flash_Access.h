@@ -14,8 +14,20 @@
 
 #ifndef _Flash_Access_H_
 #define _Flash_Access_H_
+#include <stdint.h>
+#include <stddef.h>
 #include "esp_err.h"
 
+/**
+* @brief One contiguous part of a vectored read or write: size bytes at device address addr
+*        are transferred to or from buff. Writes never modify buff.
+*/
+typedef struct {
+    size_t addr;
+    uint8_t *buff;
+    size_t size;
+} flash_access_vec_t;
+
 /**
 * @brief Universal flash access interface class
 *
@@ -31,6 +43,31 @@ public:
     virtual esp_err_t write(size_t dest_addr, const void *src, size_t size) = 0;
     virtual esp_err_t read(size_t src_addr, void *dest, size_t size) = 0;
 
+    /**
+    * @brief Vectored versions of write() and read(). The default implementations issue one
+    *        write()/read() per element; drivers which can do better may override them.
+    */
+    virtual esp_err_t writev(const flash_access_vec_t *vec, size_t count)
+    {
+        for (size_t i = 0; i < count; i++) {
+            esp_err_t result = this->write(vec[i].addr, vec[i].buff, vec[i].size);
+            if (result != ESP_OK) {
+                return result;
+            }
+        }
+        return ESP_OK;
+    };
+    virtual esp_err_t readv(const flash_access_vec_t *vec, size_t count)
+    {
+        for (size_t i = 0; i < count; i++) {
+            esp_err_t result = this->read(vec[i].addr, vec[i].buff, vec[i].size);
+            if (result != ESP_OK) {
+                return result;
+            }
+        }
+        return ESP_OK;
+    };
+
     virtual size_t sector_size() = 0;
 
     virtual esp_err_t flush()
@@ -33,13 +33,40 @@ public:
     esp_err_t erase_sector(size_t sector) override;
     esp_err_t erase_range(size_t start_address, size_t size) override;
 
+    esp_err_t write(size_t dest_addr, const void *src, size_t size) override;
+    esp_err_t read(size_t src_addr, void *dest, size_t size) override;
+
+    esp_err_t flush() override;
+    esp_err_t flush_cache() override;
+
 protected:
     uint32_t flash_sector_size;
     uint32_t fat_sector_size;
     uint32_t size_factor;
     uint32_t *sector_buffer;
 
+    // Flash sector held in RAM. Partial erases and writes are applied to the copy,
+    // the flash sector is only erased and rewritten when the entry is written back.
+    typedef struct {
+        uint32_t sector;    // flash sector number, in flash_sector_size units
+        uint32_t last_used; // value of cache_clock at the last access, for LRU eviction
+        bool valid;
+        bool dirty;
+        uint32_t *data;
+    } cache_entry_t;
+
+    uint32_t cache_size;
+    uint32_t cache_clock;
+    cache_entry_t *cache;
+
     virtual esp_err_t erase_sector_fit(uint32_t start_sector, uint32_t count);
+    // Replace content of the complete flash sector with data
+    virtual esp_err_t write_back_sector(uint32_t sector, const uint32_t *data);
+
+    cache_entry_t *cache_find(uint32_t sector);
+    esp_err_t cache_load(uint32_t sector, cache_entry_t **out_entry);
+    esp_err_t cache_write_back(cache_entry_t *entry);
+    esp_err_t cache_erase_sector_fit(uint32_t start_sector, uint32_t count);
 
 };
 
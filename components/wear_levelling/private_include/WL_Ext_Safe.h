@@ -31,6 +31,7 @@ public:
 
 protected:
     esp_err_t erase_sector_fit(uint32_t start_sector, uint32_t count) override;
+    esp_err_t write_back_sector(uint32_t sector, const uint32_t *data) override;
 
     // Dump Sector
     uint32_t dump_addr; // dump buffer address
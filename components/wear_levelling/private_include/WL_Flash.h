@@ -43,6 +43,8 @@ public :
     esp_err_t read(size_t src_addr, void *dest, size_t size) override;
 
     esp_err_t flush() override;
+    // Write back data kept in RAM by derived classes, WL_Flash itself keeps none
+    virtual esp_err_t flush_cache();
 
     Flash_Access *get_drv();
     wl_config_t *get_cfg();
@@ -71,6 +73,7 @@ protected:
     esp_err_t updateWL();
     esp_err_t recoverPos();
     size_t calcAddr(size_t addr);
+    esp_err_t transfer(size_t addr, uint8_t *buff, size_t size, bool write);
 
     esp_err_t updateVersion();
     esp_err_t updateV1_V2();
@@ -1,11 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <chrono>
 
 #include "esp_spi_flash.h"
 #include "esp_partition.h"
 #include "wear_levelling.h"
 #include "WL_Flash.h"
+#include "WL_Ext_Perf.h"
+#include "WL_Ext_Safe.h"
+#include "Partition.h"
 #include "SpiFlash.h"
 
 #include "catch.hpp"
@@ -207,4 +211,192 @@ TEST_CASE("power down test", "[wear_levelling]")
     // Unmount
     result = wl_unmount(wl_handle);
     REQUIRE(result == ESP_OK);
-}
\ No newline at end of file
+}
+
+// Counts the calls which reach the flash driver
+class CountingPartition : public Partition
+{
+public:
+    CountingPartition(const esp_partition_t *partition) : Partition(partition) { }
+
+    esp_err_t write(size_t dest_addr, const void *src, size_t size) override
+    {
+        write_count++;
+        return Partition::write(dest_addr, src, size);
+    }
+
+    esp_err_t read(size_t src_addr, void *dest, size_t size) override
+    {
+        read_count++;
+        return Partition::read(src_addr, dest, size);
+    }
+
+    size_t write_count = 0;
+    size_t read_count = 0;
+};
+
+TEST_CASE("sequential access is done with one driver call per contiguous run", "[wear_levelling]")
+{
+    _spi_flash_init(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    CountingPartition part(partition);
+
+    wl_config_t cfg;
+    cfg.full_mem_size = partition->size;
+    cfg.start_addr = 0;
+    cfg.version = 2;
+    cfg.sector_size = SPI_FLASH_SEC_SIZE;
+    cfg.page_size = SPI_FLASH_SEC_SIZE;
+    cfg.updaterate = 16;
+    cfg.temp_buff_size = 32;
+    cfg.wr_size = 16;
+
+    WL_Flash wl_flash;
+    REQUIRE(wl_flash.config(&cfg, &part) == ESP_OK);
+    REQUIRE(wl_flash.init() == ESP_OK);
+
+    const size_t size = wl_flash.chip_size();
+    const size_t page_size = cfg.page_size;
+    uint8_t *data = (uint8_t *) malloc(size);
+    uint8_t *read = (uint8_t *) malloc(size);
+    for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+        ((uint32_t *) data)[i] = i;
+    }
+
+    // Move the dummy page away from the end, so that the logical range is split in flash
+    for (size_t i = 0; i < size / page_size / 2; i++) {
+        REQUIRE(wl_flash.erase_sector(0) == ESP_OK);
+        REQUIRE(wl_flash.flush() == ESP_OK);
+    }
+    REQUIRE(wl_flash.erase_range(0, size) == ESP_OK);
+
+    part.write_count = 0;
+    REQUIRE(wl_flash.write(0, data, size) == ESP_OK);
+    printf("write of %i bytes: %i driver calls\n", (int) size, (int) part.write_count);
+    // at most split at the dummy page and at the end of the memory
+    CHECK(part.write_count <= 3);
+
+    for (int pass = 0; pass < 2; pass++) {
+        const bool by_page = (pass == 0);
+        memset(read, 0, size);
+        part.read_count = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int repeat = 0; repeat < 10; repeat++) {
+            if (by_page) {
+                for (size_t offset = 0; offset < size; offset += page_size) {
+                    REQUIRE(wl_flash.read(offset, read + offset, page_size) == ESP_OK);
+                }
+            } else {
+                REQUIRE(wl_flash.read(0, read, size) == ESP_OK);
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        printf("read 10 x %i bytes %s: %i driver calls, %lli us (%.1f MB/s)\n", (int) size,
+               by_page ? "page by page" : "in one request", (int) part.read_count, (long long) elapsed.count(),
+               elapsed.count() ? 10.0 * size / elapsed.count() : 0.0);
+        REQUIRE(memcmp(data, read, size) == 0);
+        if (!by_page) {
+            CHECK(part.read_count <= 10 * 3);
+        }
+    }
+
+    free(data);
+    free(read);
+}
+
+// Rewrites one 512 byte sector the way FATFS does it through diskio_wl: erase, then write
+static void update_fat_sector(WL_Flash *wl_flash, uint8_t *image, uint32_t sector, uint8_t value, size_t offset, size_t size)
+{
+    const size_t fat_sector_size = 512;
+    memset(image + sector * fat_sector_size + offset, value, size);
+    REQUIRE(wl_flash->erase_range(sector * fat_sector_size, fat_sector_size) == ESP_OK);
+    REQUIRE(wl_flash->write(sector * fat_sector_size, image + sector * fat_sector_size, fat_sector_size) == ESP_OK);
+}
+
+TEST_CASE("sector cache absorbs repeated updates of 512 byte sectors", "[wear_levelling]")
+{
+    _spi_flash_init(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    const size_t fat_sector_size = 512;
+    const uint32_t fat_table_sector = 1;
+    const uint32_t dir_sector = 2;
+    const uint32_t first_data_sector = 16;
+    const int file_count = 8;
+    const int chunks_per_file = 4;
+
+    for (int safe = 0; safe < 2; safe++) {
+        uint32_t erase_cycles[2];
+        for (int cached = 0; cached < 2; cached++) {
+            Partition part(partition);
+            wl_ext_cfg_t cfg;
+            cfg.full_mem_size = partition->size;
+            cfg.start_addr = 0;
+            cfg.version = 2;
+            cfg.sector_size = SPI_FLASH_SEC_SIZE;
+            cfg.page_size = SPI_FLASH_SEC_SIZE;
+            cfg.updaterate = 16;
+            cfg.temp_buff_size = 32;
+            cfg.wr_size = 16;
+            cfg.fat_sector_size = fat_sector_size;
+            cfg.cache_size = cached ? 4 : 0;
+
+            WL_Flash *wl_flash = safe ? new WL_Ext_Safe() : new WL_Ext_Perf();
+            REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+            REQUIRE(wl_flash->init() == ESP_OK);
+
+            const size_t image_size = (first_data_sector + file_count * chunks_per_file) * fat_sector_size;
+            uint8_t *image = (uint8_t *) malloc(image_size);
+            uint8_t *read = (uint8_t *) malloc(image_size);
+            // start with programmed sectors, so that every write back needs a real erase
+            memset(image, 0x5a, image_size);
+            REQUIRE(wl_flash->erase_range(0, image_size) == ESP_OK);
+            REQUIRE(wl_flash->write(0, image, image_size) == ESP_OK);
+
+            spiflash.reset_erase_cycles();
+            spiflash.reset_total_erase_cycles();
+
+            // create and append: every chunk of data also updates the FAT table and the directory entry
+            uint32_t data_sector = first_data_sector;
+            for (int file = 0; file < file_count; file++) {
+                update_fat_sector(wl_flash, image, dir_sector, file, file * 32, 32);
+                update_fat_sector(wl_flash, image, fat_table_sector, file, file * 16, 2);
+                for (int chunk = 0; chunk < chunks_per_file; chunk++) {
+                    update_fat_sector(wl_flash, image, data_sector++, file * 16 + chunk, 0, fat_sector_size);
+                    update_fat_sector(wl_flash, image, fat_table_sector, file, file * 16 + chunk * 2, 2);
+                    update_fat_sector(wl_flash, image, dir_sector, file, file * 32 + 28, 4);
+                }
+            }
+            // delete every other file
+            for (int file = 0; file < file_count; file += 2) {
+                update_fat_sector(wl_flash, image, dir_sector, 0xe5, file * 32, 1);
+                update_fat_sector(wl_flash, image, fat_table_sector, 0, file * 16, chunks_per_file * 2);
+            }
+
+            // cached data must be visible before it is written back
+            REQUIRE(wl_flash->read(0, read, image_size) == ESP_OK);
+            REQUIRE(memcmp(image, read, image_size) == 0);
+
+            REQUIRE(wl_flash->flush_cache() == ESP_OK);
+            erase_cycles[cached] = spiflash.get_total_erase_cycles();
+            printf("%s, %s sector cache: %i erase cycles\n", safe ? "safe mode" : "performance mode",
+                   cached ? "with" : "without", (int) erase_cycles[cached]);
+            REQUIRE(wl_flash->flush() == ESP_OK);
+            delete wl_flash;
+
+            // after flush, everything must be in flash
+            cfg.cache_size = 0;
+            wl_flash = safe ? new WL_Ext_Safe() : new WL_Ext_Perf();
+            REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+            REQUIRE(wl_flash->init() == ESP_OK);
+            REQUIRE(wl_flash->read(0, read, image_size) == ESP_OK);
+            REQUIRE(memcmp(image, read, image_size) == 0);
+            delete wl_flash;
+
+            free(image);
+            free(read);
+        }
+        CHECK(erase_cycles[1] * 4 < erase_cycles[0]);
+    }
+}
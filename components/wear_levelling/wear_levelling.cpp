@@ -48,6 +48,14 @@
 #define WL_CURRENT_VERSION  2
 #endif //WL_CURRENT_VERSION
 
+#ifndef WL_DEFAULT_CACHE_SIZE
+#ifdef CONFIG_WL_SECTOR_CACHE_SIZE
+#define WL_DEFAULT_CACHE_SIZE   CONFIG_WL_SECTOR_CACHE_SIZE
+#else
+#define WL_DEFAULT_CACHE_SIZE   0
+#endif //CONFIG_WL_SECTOR_CACHE_SIZE
+#endif //WL_DEFAULT_CACHE_SIZE
+
 typedef struct {
     WL_Flash *instance;
     _lock_t lock;
@@ -88,6 +96,7 @@ esp_err_t wl_mount(const esp_partition_t *partition, wl_handle_t *out_handle)
     cfg.wr_size = WL_DEFAULT_WRITE_SIZE;
     // FAT sector size by default will be 512
     cfg.fat_sector_size = CONFIG_WL_SECTOR_SIZE;
+    cfg.cache_size = WL_DEFAULT_CACHE_SIZE;
 
     if (*out_handle == WL_INVALID_HANDLE) {
         ESP_LOGE(TAG, "MAX_WL_HANDLES=%d instances already allocated", MAX_WL_HANDLES);
@@ -213,6 +222,18 @@ esp_err_t wl_write(wl_handle_t handle, size_t dest_addr, const void *src, size_t
     return result;
 }
 
+esp_err_t wl_flush(wl_handle_t handle)
+{
+    esp_err_t result = check_handle(handle, __func__);
+    if (result != ESP_OK) {
+        return result;
+    }
+    _lock_acquire(&s_instances[handle].lock);
+    result = s_instances[handle].instance->flush_cache();
+    _lock_release(&s_instances[handle].lock);
+    return result;
+}
+
 esp_err_t wl_read(wl_handle_t handle, size_t src_addr, void *dest, size_t size)
 {
     esp_err_t result = check_handle(handle, __func__);
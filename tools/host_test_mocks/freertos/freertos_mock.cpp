@@ -0,0 +1,319 @@
+// Copyright 2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* FreeRTOS tasks, queues, semaphores and critical sections for the host tests, implemented with host threads.
+ * All functions are weak, a test which needs different behaviour defines its own. */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+using namespace std;
+
+#define WEAK __attribute__((weak))
+
+struct host_task {
+    TaskFunction_t function;
+    void *arg;
+    mutex lock;
+    condition_variable notified;
+    uint32_t notifications;
+};
+
+struct host_queue {
+    size_t length;
+    size_t item_size;
+    deque<vector<uint8_t>> items;
+    mutex lock;
+    condition_variable changed;
+};
+
+/* Mutexes are semaphores with a count of one. The holder is only tracked for the recursive functions. */
+struct host_semaphore {
+    UBaseType_t max_count;
+    UBaseType_t count;
+    thread::id holder;
+    UBaseType_t recursion;
+    mutex lock;
+    condition_variable changed;
+};
+
+static recursive_mutex s_critical_section;
+static host_task s_main_task;
+static thread_local host_task *s_current_task;
+static const chrono::steady_clock::time_point s_start = chrono::steady_clock::now();
+
+/* Wait until ready() holds, for at most 'ticks_to_wait' */
+template<typename Pred>
+static bool wait_until(unique_lock<mutex> &lock, condition_variable &cond, TickType_t ticks_to_wait, Pred ready)
+{
+    if (ticks_to_wait == portMAX_DELAY) {
+        cond.wait(lock, ready);
+        return true;
+    }
+    return cond.wait_for(lock, chrono::milliseconds(ticks_to_wait), ready);
+}
+
+extern "C" {
+
+WEAK void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    s_critical_section.lock();
+}
+
+WEAK void vPortExitCritical(portMUX_TYPE *mux)
+{
+    s_critical_section.unlock();
+}
+
+WEAK void vPortCPUInitializeMutex(portMUX_TYPE *mux)
+{
+}
+
+WEAK BaseType_t xPortGetCoreID(void)
+{
+    return 0;
+}
+
+WEAK BaseType_t xPortInIsrContext(void)
+{
+    return pdFALSE;
+}
+
+WEAK uint32_t xthal_get_ccount(void)
+{
+    return 0;
+}
+
+WEAK BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *arg,
+                                        UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    host_task *t = new host_task();
+    t->function = task;
+    t->arg = arg;
+    /* Like FreeRTOS, set the handle before the task can run */
+    if (created_task) {
+        *created_task = t;
+    }
+    thread([t]() {
+        s_current_task = t;
+        t->function(t->arg);
+        delete t;
+    }).detach();
+    return pdPASS;
+}
+
+WEAK BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *arg,
+                            UBaseType_t priority, TaskHandle_t *created_task)
+{
+    return xTaskCreatePinnedToCore(task, name, stack_depth, arg, priority, created_task, tskNO_AFFINITY);
+}
+
+WEAK void vTaskDelete(TaskHandle_t task)
+{
+    /* Only self delete is supported, the thread ends when the task function returns */
+}
+
+WEAK void vTaskSuspend(TaskHandle_t task)
+{
+    /* Threads can't be suspended, tasks which suspend themselves are left to block instead */
+}
+
+WEAK void vTaskDelay(TickType_t ticks)
+{
+    this_thread::sleep_for(chrono::milliseconds(ticks));
+}
+
+WEAK TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    /* Threads which weren't created as tasks, like the one running the tests, share one handle */
+    return s_current_task ? s_current_task : &s_main_task;
+}
+
+WEAK TickType_t xTaskGetTickCount(void)
+{
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - s_start).count();
+}
+
+WEAK BaseType_t xTaskGetSchedulerState(void)
+{
+    return taskSCHEDULER_RUNNING;
+}
+
+WEAK BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    host_task *t = static_cast<host_task *>(task);
+    lock_guard<mutex> lock(t->lock);
+    t->notifications++;
+    t->notified.notify_all();
+    return pdPASS;
+}
+
+WEAK uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    host_task *t = static_cast<host_task *>(xTaskGetCurrentTaskHandle());
+    unique_lock<mutex> lock(t->lock);
+    if (!wait_until(lock, t->notified, ticks_to_wait, [t]() { return t->notifications > 0; })) {
+        return 0;
+    }
+    uint32_t value = t->notifications;
+    t->notifications = clear_on_exit ? 0 : value - 1;
+    return value;
+}
+
+WEAK QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    host_queue *q = new host_queue();
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+WEAK void vQueueDelete(QueueHandle_t queue)
+{
+    delete static_cast<host_queue *>(queue);
+}
+
+WEAK BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    host_queue *q = static_cast<host_queue *>(queue);
+    unique_lock<mutex> lock(q->lock);
+    if (!wait_until(lock, q->changed, ticks_to_wait, [q]() { return !q->items.empty(); })) {
+        return pdFALSE;
+    }
+    memcpy(buffer, q->items.front().data(), q->item_size);
+    q->items.pop_front();
+    q->changed.notify_all();
+    return pdTRUE;
+}
+
+WEAK BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    host_queue *q = static_cast<host_queue *>(queue);
+    unique_lock<mutex> lock(q->lock);
+    if (!wait_until(lock, q->changed, ticks_to_wait, [q]() { return q->items.size() < q->length; })) {
+        return pdFALSE;
+    }
+    const uint8_t *p = static_cast<const uint8_t *>(item);
+    q->items.emplace_back(p, p + q->item_size);
+    q->changed.notify_all();
+    return pdTRUE;
+}
+
+WEAK BaseType_t xQueueSendToBackFromISR(QueueHandle_t queue, const void *item, BaseType_t *higher_priority_task_woken)
+{
+    if (higher_priority_task_woken) {
+        *higher_priority_task_woken = pdFALSE;
+    }
+    return xQueueSendToBack(queue, item, 0);
+}
+
+WEAK SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    host_semaphore *s = new host_semaphore();
+    s->max_count = max_count;
+    s->count = initial_count;
+    return s;
+}
+
+WEAK SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+WEAK SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+WEAK void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    delete static_cast<host_semaphore *>(semaphore);
+}
+
+WEAK BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    host_semaphore *s = static_cast<host_semaphore *>(semaphore);
+    unique_lock<mutex> lock(s->lock);
+    if (!wait_until(lock, s->changed, ticks_to_wait, [s]() { return s->count > 0; })) {
+        return pdFALSE;
+    }
+    s->count--;
+    return pdTRUE;
+}
+
+WEAK BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    host_semaphore *s = static_cast<host_semaphore *>(semaphore);
+    lock_guard<mutex> lock(s->lock);
+    if (s->count == s->max_count) {
+        return pdFALSE;
+    }
+    s->count++;
+    s->changed.notify_one();
+    return pdTRUE;
+}
+
+WEAK BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higher_priority_task_woken)
+{
+    if (higher_priority_task_woken) {
+        *higher_priority_task_woken = pdFALSE;
+    }
+    return xSemaphoreGive(semaphore);
+}
+
+WEAK BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    host_semaphore *s = static_cast<host_semaphore *>(semaphore);
+    {
+        lock_guard<mutex> lock(s->lock);
+        if (s->recursion > 0 && s->holder == this_thread::get_id()) {
+            s->recursion++;
+            return pdTRUE;
+        }
+    }
+    if (xSemaphoreTake(semaphore, ticks_to_wait) != pdTRUE) {
+        return pdFALSE;
+    }
+    lock_guard<mutex> lock(s->lock);
+    s->holder = this_thread::get_id();
+    s->recursion = 1;
+    return pdTRUE;
+}
+
+WEAK BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore)
+{
+    host_semaphore *s = static_cast<host_semaphore *>(semaphore);
+    {
+        lock_guard<mutex> lock(s->lock);
+        if (s->recursion == 0 || s->holder != this_thread::get_id()) {
+            return pdFALSE;
+        }
+        if (--s->recursion > 0) {
+            return pdTRUE;
+        }
+        s->holder = thread::id();
+    }
+    return xSemaphoreGive(semaphore);
+}
+
+} // extern "C"
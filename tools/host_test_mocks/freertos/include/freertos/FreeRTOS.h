@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/queue.h>  // included by the FreeRTOS port headers on the target
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* FreeRTOS for the Makefile based host tests, implemented with host threads by freertos_mock.cpp.
+
+   One tick is one millisecond. Critical sections of all spinlocks share one recursive mutex. Every function is weak,
+   so a test can replace some of them, for example to run a task function itself instead of in a thread.
+*/
+
+#define configUSE_16_BIT_TICKS 0
+#define portNUM_PROCESSORS 2
+#define portMAX_DELAY 0xffffffffUL
+#define portTICK_RATE_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+
+typedef struct {
+    int unused;
+} StaticQueue_t;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL_SAFE(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_SAFE(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL_NESTED() (vPortEnterCritical(NULL), 0)
+#define portEXIT_CRITICAL_NESTED(state) do { (void)(state); vPortExitCritical(NULL); } while(0)
+#define portYIELD_FROM_ISR() do { } while(0)
+
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+void vPortCPUInitializeMutex(portMUX_TYPE *mux);
+BaseType_t xPortGetCoreID(void);
+BaseType_t xPortInIsrContext(void);
+
+/* From the Xtensa HAL, which the port headers include on the target */
+uint32_t xthal_get_ccount(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,38 @@
+# Build rules shared by the Makefile based host tests which use the FreeRTOS mock.
+#
+# The including Makefile sets TEST_PROGRAM, SOURCE_FILES and INCLUDE_FLAGS, and may add to CPPFLAGS, CFLAGS, CXXFLAGS
+# and LDFLAGS. Its own stubs directory comes first in INCLUDE_FLAGS, so it can replace any of the mock headers.
+
+HOST_TEST_MOCKS := $(abspath $(dir $(lastword $(MAKEFILE_LIST))))
+
+all: $(TEST_PROGRAM)
+
+ifneq ($(filter clean,$(MAKECMDGOALS)),)
+.NOTPARALLEL:  # prevent make clean racing the other targets
+endif
+
+INCLUDE_FLAGS += -I$(HOST_TEST_MOCKS)/freertos/include
+
+CPPFLAGS += $(INCLUDE_FLAGS) -g -m32
+CFLAGS += -Wall -Werror
+CXXFLAGS += -std=c++11 -Wall -Werror
+LDFLAGS += -lstdc++ -lpthread -m32
+
+OBJ_FILES = $(filter %.o, $(SOURCE_FILES:.cpp=.o) $(SOURCE_FILES:.c=.o))
+
+# Built in the test directory, as each test builds it with its own flags
+MOCK_OBJ_FILES = freertos_mock.o
+
+freertos_mock.o: $(HOST_TEST_MOCKS)/freertos/freertos_mock.cpp
+	$(CXX) $(CPPFLAGS) $(CXXFLAGS) -c -o $@ $<
+
+$(TEST_PROGRAM): $(OBJ_FILES) $(MOCK_OBJ_FILES)
+	g++ $(LDFLAGS) -o $(TEST_PROGRAM) $(OBJ_FILES) $(MOCK_OBJ_FILES)
+
+test: $(TEST_PROGRAM)
+	./$(TEST_PROGRAM)
+
+clean:
+	rm -f $(OBJ_FILES) $(MOCK_OBJ_FILES) $(TEST_PROGRAM)
+
+.PHONY: clean all test